@@ -1,8 +1,30 @@
 #pragma once
+#include <atomic>
+#include <cstdint>
 #include <vector>
 #include "chat_message.h"
 #include "database_config.h"
 
+// Counters of a backend's connection pool (MySQL), exported on /metrics
+struct DatabasePoolStats {
+    std::atomic<uint64_t> acquisitions{0};  // connections handed out
+    std::atomic<uint64_t> wait_micros{0};   // total time callers waited for one
+    std::atomic<int64_t> in_use{0};         // connections currently borrowed
+    std::atomic<int64_t> open{0};           // connections open (idle + in use)
+    std::atomic<uint64_t> health_checks{0}; // pings before reusing an idle or failed connection
+    std::atomic<uint64_t> reconnects{0};    // connections replaced after a failed ping
+};
+
+// Keyset cursor for one channel's history. Pages never use OFFSET: before/after are ids
+// taken from the edge of the previous page, so each page is one index range scan of
+// `limit` rows however deep into the history it is.
+struct HistoryCursor {
+    long long before = 0; // only ids < before, 0 = no upper bound
+    long long after = 0;  // only ids > after; when set the page starts right after it,
+                          // otherwise it ends at the newest match
+    int limit = 50;
+};
+
 class Database {
 public:
     virtual ~Database() = default;
@@ -10,17 +32,40 @@ public:
     // Initialize the database connection
     virtual bool init(const DatabaseConfig& config) = 0;
     
-    // Add a new message
-    virtual bool addMessage(const ChatMessage& msg) = 0;
+    // Add a new message; on success msg.id is set to the assigned id
+    virtual bool addMessage(ChatMessage& msg) = 0;
     
+    // Store messages whose ids are already assigned, in one transaction (all or nothing)
+    virtual bool addMessages(const std::vector<ChatMessage>& msgs) = 0;
+
     // Get message history (limit count, optionally filter for a user)
     virtual std::vector<ChatMessage> getHistory(int limit, const std::string& username = "") = 0;
     
-    // Get messages after a specific ID (optionally filter for a user)
-    virtual std::vector<ChatMessage> getMessagesAfter(long long last_id, const std::string& username = "") = 0;
+    // Get messages after a specific ID (optionally filter for a user, limit <= 0 means no limit)
+    virtual std::vector<ChatMessage> getMessagesAfter(long long last_id, const std::string& username = "", int limit = 0) = 0;
     
-    // Get total message count
+    // One page of a room's public messages, oldest first
+    virtual std::vector<ChatMessage> getRoomHistory(const std::string& room_id, const HistoryCursor& cursor) = 0;
+
+    // One page of the private conversation between user_a and user_b, oldest first
+    virtual std::vector<ChatMessage> getConversationHistory(const std::string& user_a, const std::string& user_b,
+                                                            const HistoryCursor& cursor) = 0;
+
+    // Get the most recent messages of every kind (public and private), oldest first
+    virtual std::vector<ChatMessage> getRecentMessages(int limit) = 0;
+
+    // Up to limit messages of every kind with id > after_id, oldest first (index rebuilds)
+    virtual std::vector<ChatMessage> scanMessages(long long after_id, int limit) = 0;
+
+    // The messages with these ids that exist, oldest first
+    virtual std::vector<ChatMessage> getMessagesByIds(const std::vector<long long>& ids) = 0;
+
+    // Message counts, kept up to date by the write path (never a table scan)
     virtual long long getMessageCount() = 0;
+    // Public messages in a room ("" = global channel)
+    virtual long long getRoomMessageCount(const std::string& room_id) = 0;
+    // Messages sent by a user
+    virtual long long getUserMessageCount(const std::string& username) = 0;
 
     // User Management
     virtual bool addUser(const std::string& username, const std::string& password) = 0;
@@ -28,4 +73,7 @@ public:
     virtual bool userExists(const std::string& username) = 0;
     virtual long long getUserId(const std::string& username) = 0;
     virtual std::vector<std::pair<std::string, long long>> getAllUsers() = 0;
+
+    // Periodic housekeeping (segment rolling, compaction), called from a background timer
+    virtual void maintain() {}
 };
@@ -2,15 +2,50 @@
 #include <string>
 
 struct DatabaseConfig {
-    std::string type = "sqlite"; // sqlite, mysql
+    std::string type = "sqlite"; // sqlite, mysql, log
     std::string path = "chatroom.db"; // for sqlite
     std::string host = "127.0.0.1";
     int port = 3306;
     std::string user = "root";
     std::string password = "";
     std::string db_name = "chatroom";
+    std::string socket = ""; // MySQL unix socket; used instead of host/port when set
     
     // Pooling config
     int initial_size = 2;
     int max_size = 10;
+    int health_check_idle_seconds = 30; // ping pooled connections idle at least this long
+
+    // Recent messages kept in memory per room / private conversation / global channel, 0 = off
+    int message_cache_size = 1000;
+
+    // Message inserts go through a write-behind writer thread. When addMessage returns:
+    //   "memory"  - the message has an id and is visible, but may not be stored yet
+    //   "batched" - its batch has been committed (SQLite: synchronous=NORMAL)
+    //   "fsync"   - its batch has been committed and synced to disk (synchronous=FULL)
+    std::string durability = "fsync";
+    int write_batch_interval_ms = 5; // how long the writer gathers a batch
+    int write_batch_max = 500;       // messages per transaction
+
+    // Threads running DatabaseManager::async work, started on first use
+    int async_threads = 4;
+
+    // In-memory full-text index over message content, rebuilt from the database at init
+    bool search_index = true;
+
+    // SQLite tuning; ":memory:" databases always use a single connection
+    bool sqlite_wal = true;                  // WAL journal, required for the reader pool
+    std::string sqlite_synchronous;          // OFF|NORMAL|FULL|EXTRA, empty = from durability
+    int sqlite_readers = 4;                  // read-only connections, 0 = read on the writer
+    long long sqlite_mmap_bytes = 268435456; // memory-mapped I/O per connection, 0 = off
+    bool sqlite_statement_cache = true;      // keep prepared statements instead of re-preparing
+
+    // Append-only log store (type "log")
+    std::string log_dir = "chatroom_log";
+    long long log_segment_bytes = 67108864; // preallocated size of a segment file
+    int log_index_interval = 64;            // records per sparse index entry
+    int log_roll_seconds = 3600;            // seal the active segment once it is this old, 0 = every maintain()
+
+    // How often Database::maintain() runs, 0 = never
+    int maintenance_interval_seconds = 60;
 };
@@ -2,27 +2,125 @@
 #include <vector>
 #include <mutex>
 #include <memory>
+#include <functional>
+#include <map>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <future>
+#include <thread>
+#include <type_traits>
 #include "database.h"
 #include "database_config.h"
+#include "message_cache.h"
+#include "message_writer.h"
+#include "search_index.h"
 
+// Queries go straight to the backend, which does its own locking (SQLite reader pool,
+// MySQL connection pool), so concurrent callers run concurrently. Only message appends
+// share a short critical section that assigns ids in order.
 class DatabaseManager {
 public:
+    // Called after a message has been stored (msg.id is set)
+    using MessageListener = std::function<void(const ChatMessage& msg)>;
+    // Called after a user has registered
+    using UserListener = std::function<void(const std::string& username, long long user_id)>;
+
+    // Runs a completion where the caller wants it, e.g. on an EventLoop via queueInLoop
+    using Executor = std::function<void(std::function<void()>)>;
+
+    struct SearchResult {
+        ChatMessage message;
+        double score;
+    };
+
+    struct AsyncStats {
+        std::atomic<uint64_t> tasks{0};   // queries run on the query threads
+        std::atomic<int64_t> pending{0}; // async calls whose result or completion is still outstanding
+    };
+
+    // While a scope is alive, instance() asserts (debug builds) on the current thread.
+    // HttpServer opens one around handlers it runs inline on an IO loop, where a blocking
+    // query would stall every connection owned by that loop.
+    class NoAccessScope {
+    public:
+        NoAccessScope();
+        ~NoAccessScope();
+        NoAccessScope(const NoAccessScope&) = delete;
+        NoAccessScope& operator=(const NoAccessScope&) = delete;
+        static bool active();
+    };
+
     static DatabaseManager& instance();
 
     // Initialize database
     bool init(const DatabaseConfig& config);
 
-    // Add a new message
-    bool addMessage(const ChatMessage& msg);
+    // Add a new message; on success msg.id is set and message listeners are notified.
+    // The id is assigned in memory and the row is stored by the write-behind writer;
+    // when this returns depends on DatabaseConfig::durability. Unless durability is
+    // "memory", the cache and listeners get the message only after its transaction has
+    // committed, and a message that could not be stored (false) is never published.
+    bool addMessage(ChatMessage& msg);
+
+    // addMessage without blocking the caller: msg.id is set when this returns; done(ok) is
+    // handed to executor once the row meets the configured durability (immediately for
+    // "memory"), after listeners have run. Returns false, without calling done, if the
+    // manager is not initialized.
+    bool addMessageAsync(ChatMessage& msg, Executor executor, std::function<void(bool ok)> done);
 
-    // Get message history (limit count)
+    // Runs fn(DatabaseManager&) on one of the query threads (DatabaseConfig::async_threads).
+    // The future carries its result or exception.
+    template <typename Fn>
+    auto async(Fn fn) -> std::future<std::invoke_result_t<Fn&, DatabaseManager&>>;
+
+    // Runs fn(DatabaseManager&) on a query thread, then hands its result to done through
+    // executor, so neither an IO loop nor a business thread waits on the query. fn must not
+    // throw; if it does, the error is logged and done is not called.
+    template <typename Fn, typename Done>
+    void async(Fn fn, Executor executor, Done done);
+
+    const AsyncStats& asyncStats() const { return async_stats_; }
+
+    // Subscribe to stored messages. Listeners run while the store lock is held, on the
+    // writer thread after the commit (on the appending thread for durability "memory"),
+    // so they observe messages in id order and must not call back into DatabaseManager.
+    // Returns a handle for removeMessageListener.
+    int addMessageListener(MessageListener listener);
+    void removeMessageListener(int handle);
+
+    // Subscribe to registrations, same rules as message listeners. Returns a handle for
+    // removeUserListener.
+    int addUserListener(UserListener listener);
+    void removeUserListener(int handle);
+
+    // Get message history (limit count). Served from the recent-message cache when it
+    // holds the complete answer.
     std::vector<ChatMessage> getHistory(int limit, const std::string& username = "");
 
-    // Get messages after a specific ID
-    std::vector<ChatMessage> getMessagesAfter(long long last_id, const std::string& username = "");
+    // Get messages after a specific ID (limit <= 0 means no limit). Cursors inside the
+    // cache window are answered from memory; older ranges go to the database.
+    std::vector<ChatMessage> getMessagesAfter(long long last_id, const std::string& username = "", int limit = 0);
+
+    // Keyset-paginated history of one room / one private conversation, oldest first
+    std::vector<ChatMessage> getRoomHistory(const std::string& room_id, const HistoryCursor& cursor);
+    std::vector<ChatMessage> getConversationHistory(const std::string& user_a, const std::string& user_b,
+                                                    const HistoryCursor& cursor);
 
-    // Get total message count
+    // Full-text search, best match first; empty when DatabaseConfig::search_index is off.
+    // Hits not yet written by the write-behind writer are left out.
+    std::vector<SearchResult> search(const SearchIndex::Query& query);
+
+    const MessageCache::Stats& messageCacheStats() const { return cache_.stats(); }
+    const SearchIndex::Stats& searchStats() const { return search_.stats(); }
+    const MessageWriter::Stats& messageWriterStats() const { return writer_stats_; }
+    const DatabasePoolStats& poolStats() const { return pool_stats_; }
+
+    // Stored message counts; maintained counters, cheap enough for any request path
     long long getMessageCount();
+    long long getRoomMessageCount(const std::string& room_id);
+    long long getUserMessageCount(const std::string& username);
 
     // User Management
     bool addUser(const std::string& username, const std::string& password);
@@ -30,6 +128,9 @@ public:
     bool userExists(const std::string& username);
     long long getUserId(const std::string& username);
     std::vector<std::pair<std::string, long long>> getAllUsers();
+
+    // Backend housekeeping; blocking, so run it through async()
+    void maintain();
     
 private:
     DatabaseManager();
@@ -39,6 +140,79 @@ private:
     DatabaseManager(const DatabaseManager&) = delete;
     DatabaseManager& operator=(const DatabaseManager&) = delete;
 
-    std::unique_ptr<Database> db_;
-    std::mutex mutex_;
+    // Current backend; callers take a snapshot so init() can swap it under running queries
+    std::shared_ptr<Database> database() const { return db_.load(std::memory_order_acquire); }
+
+    // Hand a message to the cache, the search index and listeners; caller holds mutex_
+    void publishLocked(const ChatMessage& msg);
+
+    // Queue a task for the query threads, starting them on first use
+    void post(std::function<void()> task);
+    void runQueries();
+
+    std::atomic<std::shared_ptr<Database>> db_;
+    std::mutex mutex_; // serializes init and appends (id assignment, cache, listeners)
+
+    std::map<int, MessageListener> listeners_; // guarded by mutex_
+    std::map<int, UserListener> user_listeners_; // guarded by mutex_
+    int next_listener_ = 0;
+
+    MessageCache cache_; // written under mutex_ in id order, read without it
+    SearchIndex search_; // likewise
+    bool search_enabled_ = false; // guarded by mutex_
+
+    // Stats outlive writers so counters survive re-init
+    MessageWriter::Stats writer_stats_;
+    DatabasePoolStats pool_stats_;
+    std::shared_ptr<MessageWriter> writer_; // guarded by mutex_
+    bool wait_for_writer_ = true;            // durability is not "memory"
+    long long next_id_ = 1;                  // guarded by mutex_
+
+    std::mutex query_mutex_;
+    std::condition_variable query_cv_;
+    std::deque<std::function<void()>> query_queue_; // guarded by query_mutex_
+    std::vector<std::thread> query_threads_;        // guarded by query_mutex_
+    int async_threads_ = 4;                         // guarded by query_mutex_
+    bool stopping_ = false;                         // guarded by query_mutex_
+    AsyncStats async_stats_;
 };
+
+template <typename Fn>
+auto DatabaseManager::async(Fn fn) -> std::future<std::invoke_result_t<Fn&, DatabaseManager&>> {
+    using Result = std::invoke_result_t<Fn&, DatabaseManager&>;
+    auto task = std::make_shared<std::packaged_task<Result()>>([this, fn = std::move(fn)]() mutable {
+        return fn(*this);
+    });
+    std::future<Result> future = task->get_future();
+    async_stats_.pending.fetch_add(1, std::memory_order_relaxed);
+    post([this, task]() {
+        (*task)();
+        async_stats_.pending.fetch_sub(1, std::memory_order_relaxed);
+    });
+    return future;
+}
+
+template <typename Fn, typename Done>
+void DatabaseManager::async(Fn fn, Executor executor, Done done) {
+    using Result = std::invoke_result_t<Fn&, DatabaseManager&>;
+    async_stats_.pending.fetch_add(1, std::memory_order_relaxed);
+    post([this, fn = std::move(fn), executor = std::move(executor), done = std::move(done)]() mutable {
+        try {
+            if constexpr (std::is_void_v<Result>) {
+                fn(*this);
+                executor([this, done = std::move(done)]() mutable {
+                    done();
+                    async_stats_.pending.fetch_sub(1, std::memory_order_relaxed);
+                });
+            } else {
+                executor([this, done = std::move(done), result = fn(*this)]() mutable {
+                    done(std::move(result));
+                    async_stats_.pending.fetch_sub(1, std::memory_order_relaxed);
+                });
+            }
+        } catch (...) {
+            async_stats_.pending.fetch_sub(1, std::memory_order_relaxed);
+            throw;
+        }
+    });
+}
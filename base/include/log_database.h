@@ -0,0 +1,109 @@
+#pragma once
+#include "database.h"
+#include "message_counters.h"
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Append-only message store for write-heavy deployments (DatabaseConfig::type "log").
+//
+// Messages are appended to segment files under log_dir, each named after a lower bound
+// of the first id it holds. A record is [u32 payload length][u32 CRC-32 of payload]
+// [payload], the payload being the id followed by the five text fields, all varint
+// length-prefixed. Segments are preallocated to log_segment_bytes and read through a
+// shared mmap; an in-memory sparse index (one entry per log_index_interval records) maps
+// ids to offsets, so a cursor lookup is a binary search plus a short forward scan.
+//
+// init() rebuilds the indexes by walking the record lengths of older segments and
+// CRC-checks the newest two (a write batch that rolled may have torn the one before the
+// tail as well). Reading stops at the first torn or corrupt record; the tail segment is
+// also truncated there. maintain()
+// seals an active segment older than log_roll_seconds and merges runs of small sealed
+// segments into one.
+//
+// There are no secondary indexes: history filtered by user, room or conversation is a
+// scan from the cursor. Users live in a small append-only side file (users.log) that is
+// loaded into memory at init. Message counts are tallied by one decoding pass over the
+// log at init and kept up to date by append(); the log itself is their durable record.
+class LogDatabase : public Database {
+public:
+    LogDatabase();
+    ~LogDatabase() override;
+
+    bool init(const DatabaseConfig& config) override;
+    bool addMessage(ChatMessage& msg) override;
+    bool addMessages(const std::vector<ChatMessage>& msgs) override;
+    std::vector<ChatMessage> getHistory(int limit, const std::string& username = "") override;
+    std::vector<ChatMessage> getMessagesAfter(long long last_id, const std::string& username = "", int limit = 0) override;
+    std::vector<ChatMessage> getRoomHistory(const std::string& room_id, const HistoryCursor& cursor) override;
+    std::vector<ChatMessage> getConversationHistory(const std::string& user_a, const std::string& user_b,
+                                                    const HistoryCursor& cursor) override;
+    std::vector<ChatMessage> getRecentMessages(int limit) override;
+    std::vector<ChatMessage> scanMessages(long long after_id, int limit) override;
+    std::vector<ChatMessage> getMessagesByIds(const std::vector<long long>& ids) override;
+    long long getMessageCount() override;
+    long long getRoomMessageCount(const std::string& room_id) override;
+    long long getUserMessageCount(const std::string& username) override;
+
+    bool addUser(const std::string& username, const std::string& password) override;
+    bool validateUser(const std::string& username, const std::string& password) override;
+    bool userExists(const std::string& username) override;
+    long long getUserId(const std::string& username) override;
+    std::vector<std::pair<std::string, long long>> getAllUsers() override;
+
+    // Rolls an old active segment and compacts sealed ones
+    void maintain() override;
+
+    std::size_t segmentCount() const;
+
+private:
+    struct Segment; // file + mapping + sparse index
+
+    struct User {
+        long long id;
+        std::string password;
+    };
+
+    bool recover();
+    bool loadUsers();
+    std::shared_ptr<Segment> createSegment(long long first_id, std::size_t capacity);
+    // Writes and publishes msgs (ids ascending, above last_id_); caller holds write_mutex_
+    bool append(const std::vector<ChatMessage>& msgs);
+    // Seals the active segment and starts a new one; caller holds write_mutex_
+    bool roll(long long first_id, std::size_t min_capacity);
+    void compact();
+
+    // Visit messages with id > after_id in ascending order until visit returns false
+    template <typename Visit>
+    void scanForward(long long after_id, Visit&& visit) const;
+    // Visit messages with id < before_id in descending order until visit returns false
+    template <typename Visit>
+    void scanBackward(long long before_id, Visit&& visit) const;
+
+    std::string dir_;
+    std::size_t segment_bytes_ = 0;
+    long long index_interval_ = 1;
+    std::chrono::seconds roll_interval_{0};
+    bool sync_ = true; // fdatasync before acknowledging (durability "fsync")
+    bool initialized_;
+
+    // Segments in id order, the last one active. Appends hold write_mutex_ while writing
+    // and take mutex_ exclusively only to publish; readers hold it shared.
+    std::vector<std::shared_ptr<Segment>> segments_;
+    mutable std::shared_mutex mutex_;
+    std::mutex write_mutex_;
+    std::mutex maintenance_mutex_;
+    long long last_id_ = 0; // newest published id, guarded by mutex_
+    MessageCounters counters_; // tallied from the log at init, then by each append
+
+    std::unordered_map<std::string, User> users_; // guarded by users_mutex_
+    mutable std::shared_mutex users_mutex_;
+    int users_fd_ = -1;
+    long long next_user_id_ = 1;
+};
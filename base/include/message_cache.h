@@ -0,0 +1,67 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "chat_message.h"
+
+// Write-through cache of the most recent messages, one ring per channel: the global
+// channel, each room and each private conversation. A busy room therefore cannot push
+// a quiet room's (or a DM's) recent messages out of memory.
+//
+// Lookups reproduce the visibility rules of Database::getMessagesAfter/getHistory
+// (public messages from every channel, plus private conversations the user is part of)
+// and answer only when the result is provably complete: every ring remembers the id of
+// the newest message it evicted, and the cache as a whole remembers how far back its
+// warm-up load reached. Otherwise the caller falls back to SQL.
+//
+// Thread safety: append() and reset() take an exclusive lock, lookups a shared one.
+// Appends must arrive in id order (DatabaseManager calls append under its store lock).
+class MessageCache {
+public:
+    struct Stats {
+        std::atomic<uint64_t> hits{0};
+        std::atomic<uint64_t> misses{0};
+        std::atomic<uint64_t> evictions{0};
+    };
+
+    // window: messages kept per channel, 0 disables the cache.
+    // recent: the newest messages of every kind, oldest first (warm-up).
+    // complete: recent holds every stored message, so nothing older is missing.
+    void reset(std::size_t window, const std::vector<ChatMessage>& recent, bool complete);
+
+    void append(const ChatMessage& msg);
+
+    // Same result as Database::getMessagesAfter; false when the cache cannot prove completeness
+    bool messagesAfter(long long last_id, const std::string& username, int limit, std::vector<ChatMessage>& out) const;
+
+    // Same result as Database::getHistory; false when the cache cannot prove completeness
+    bool history(int limit, const std::string& username, std::vector<ChatMessage>& out) const;
+
+    std::size_t window() const;
+    const Stats& stats() const { return stats_; }
+
+private:
+    struct Ring {
+        std::deque<ChatMessage> messages; // ascending id
+        long long evicted_id = 0;         // newest id pushed out of this ring
+    };
+
+    void appendLocked(const ChatMessage& msg);
+    // Rings a user may read, and the id at or below which any of them may be missing messages
+    long long collect(const std::string& username, std::vector<const Ring*>& rings) const;
+
+    static std::string conversationKey(const std::string& a, const std::string& b);
+
+    mutable std::shared_mutex mutex_;
+    std::size_t window_ = 0;
+    long long warm_floor_ = 0; // messages with id <= this were never loaded
+    std::unordered_map<std::string, Ring> public_rings_;  // room id ("" = global)
+    std::unordered_map<std::string, Ring> private_rings_; // conversationKey
+    std::unordered_map<std::string, std::vector<std::string>> conversations_; // user -> conversation keys
+    mutable Stats stats_;
+};
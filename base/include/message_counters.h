@@ -0,0 +1,51 @@
+#pragma once
+#include <atomic>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "chat_message.h"
+
+// Message totals overall, per room (public messages by room_id, "" = global channel) and
+// per sender, mirrored in memory by a store so that counting never scans the messages table.
+//
+// SQL backends persist the same numbers in a message_stats table, updated in the
+// transaction that inserts the messages; they load() it at init and apply() each batch's
+// Delta once it has committed. Readers therefore see a count only after the rows exist.
+//
+// Thread safety: load() and apply() take an exclusive lock, lookups a shared one.
+class MessageCounters {
+public:
+    // One message_stats row
+    struct Row {
+        std::string scope; // "total", "room" or "user"
+        std::string name;  // room id or username, "" for the total
+        long long count;
+    };
+
+    // Increments contributed by one batch of messages
+    struct Delta {
+        long long total = 0;
+        std::unordered_map<std::string, long long> rooms;
+        std::unordered_map<std::string, long long> users;
+
+        void add(const ChatMessage& msg);
+        // As message_stats rows to add to
+        std::vector<Row> rows() const;
+    };
+
+    static Delta tally(const std::vector<ChatMessage>& msgs);
+
+    void load(const std::vector<Row>& rows);
+    void apply(const Delta& delta);
+
+    long long total() const { return total_.load(); }
+    long long room(const std::string& room_id) const;
+    long long user(const std::string& username) const;
+
+private:
+    std::atomic<long long> total_{0};
+    mutable std::shared_mutex mutex_;
+    std::unordered_map<std::string, long long> rooms_;
+    std::unordered_map<std::string, long long> users_;
+};
@@ -0,0 +1,83 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "chat_message.h"
+
+class Database;
+
+// Write-behind stage for message inserts. Messages arrive with their ids already
+// assigned; a dedicated thread gathers them for up to `interval` (or until `max_batch`
+// are queued) and stores each batch with Database::addMessages, one transaction per
+// max_batch messages. Callers that need durability wait on the ticket of the transaction
+// their message joined, so concurrent senders share one commit (group commit).
+class MessageWriter {
+public:
+    // Called on the writer thread with each transaction's messages once it has committed,
+    // before the senders waiting on it are released
+    using CommitCallback = std::function<void(const std::vector<ChatMessage>& msgs)>;
+
+    struct Stats {
+        std::atomic<uint64_t> batches{0};  // transactions committed
+        std::atomic<uint64_t> messages{0}; // messages stored
+        std::atomic<uint64_t> failures{0}; // batches given up on after retries
+        std::atomic<uint64_t> queued{0};   // messages waiting for the writer
+    };
+
+    // Completion of one transaction; shared by every message that joined it
+    struct Ticket {
+        bool done = false; // guarded by the writer's mutex
+        bool ok = false;
+        std::vector<std::function<void(bool)>> callbacks; // run on the writer thread once done
+    };
+
+    // stats must outlive the writer; on_commit may be empty
+    MessageWriter(std::shared_ptr<Database> db, std::chrono::milliseconds interval, std::size_t max_batch,
+                  Stats& stats, CommitCallback on_commit = nullptr);
+    // Stores everything still queued before returning
+    ~MessageWriter();
+
+    MessageWriter(const MessageWriter&) = delete;
+    MessageWriter& operator=(const MessageWriter&) = delete;
+
+    // Queue a message (id set by the caller). Must be called in id order.
+    std::shared_ptr<const Ticket> submit(const ChatMessage& msg);
+
+    // Same, but instead of waiting on a ticket the writer thread calls on_stored(ok) after
+    // the transaction commits. on_stored must be quick and must not submit to this writer.
+    void submit(const ChatMessage& msg, std::function<void(bool ok)> on_stored);
+
+    // Block until the ticket's transaction has been committed; false if it could not be stored
+    bool wait(const std::shared_ptr<const Ticket>& ticket);
+
+private:
+    // Appends msg to queue_ and returns the ticket of the transaction it will be stored in
+    std::shared_ptr<Ticket> enqueueLocked(const ChatMessage& msg);
+    void run();
+    bool store(const std::vector<ChatMessage>& batch);
+
+    static constexpr int kMaxAttempts = 3;
+
+    std::shared_ptr<Database> db_;
+    const std::chrono::milliseconds interval_;
+    const std::size_t max_batch_;
+
+    std::mutex mutex_;
+    std::condition_variable work_cv_;
+    std::condition_variable done_cv_;
+    std::vector<ChatMessage> queue_;   // guarded by mutex_
+    // One ticket per max_batch messages of queue_, the last one still filling; guarded by mutex_
+    std::vector<std::shared_ptr<Ticket>> tickets_;
+    bool stop_ = false;
+
+    Stats& stats_;
+    CommitCallback on_commit_;
+    std::thread thread_;
+};
@@ -1,38 +1,76 @@
 #pragma once
 #include "database.h"
+#include "message_counters.h"
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
 #include <mutex>
 #include <mysql/mysql.h>
-#include <queue>
-#include <condition_variable>
 
+// Every query is a server-side prepared statement, cached per pooled connection.
+// Connections are pinged only when they sat idle for health_check_idle_seconds or
+// their last query failed; automatic reconnects are off because they would silently
+// drop the prepared statements.
+// Message counts live in a message_stats table that inserts update in their own
+// transaction; this process mirrors it in memory, so reading a count costs no query.
 class MysqlDatabase : public Database {
 public:
-    MysqlDatabase();
+    // stats: optional external counters (must outlive this object)
+    explicit MysqlDatabase(DatabasePoolStats* stats = nullptr);
     ~MysqlDatabase() override;
 
     bool init(const DatabaseConfig& config) override;
-    bool addMessage(const ChatMessage& msg) override;
+    bool addMessage(ChatMessage& msg) override;
+    bool addMessages(const std::vector<ChatMessage>& msgs) override;
     std::vector<ChatMessage> getHistory(int limit, const std::string& username = "") override;
-    std::vector<ChatMessage> getMessagesAfter(long long last_id, const std::string& username = "") override;
+    std::vector<ChatMessage> getMessagesAfter(long long last_id, const std::string& username = "", int limit = 0) override;
+    std::vector<ChatMessage> getRoomHistory(const std::string& room_id, const HistoryCursor& cursor) override;
+    std::vector<ChatMessage> getConversationHistory(const std::string& user_a, const std::string& user_b,
+                                                    const HistoryCursor& cursor) override;
+    std::vector<ChatMessage> getRecentMessages(int limit) override;
+    std::vector<ChatMessage> scanMessages(long long after_id, int limit) override;
+    std::vector<ChatMessage> getMessagesByIds(const std::vector<long long>& ids) override;
     long long getMessageCount() override;
+    long long getRoomMessageCount(const std::string& room_id) override;
+    long long getUserMessageCount(const std::string& username) override;
 
     bool addUser(const std::string& username, const std::string& password) override;
     bool validateUser(const std::string& username, const std::string& password) override;
     bool userExists(const std::string& username) override;
     long long getUserId(const std::string& username) override;
     std::vector<std::pair<std::string, long long>> getAllUsers() override;
-    
+
+    const DatabasePoolStats& poolStats() const { return *stats_; }
+
 private: friend class ConnectionGuard;
 
 private:
+    struct Connection; // MYSQL handle + prepared statements
+
     DatabaseConfig config_;
-    std::queue<MYSQL*> connection_pool_;
+    std::deque<std::unique_ptr<Connection>> connection_pool_; // idle, most recently used at the back
     std::mutex pool_mutex_;
     std::condition_variable pool_cv_;
     int current_pool_size_;
     bool initialized_;
 
-    MYSQL* getConnection();
-    void releaseConnection(MYSQL* conn);
-    MYSQL* createConnection();
+    DatabasePoolStats own_stats_;
+    DatabasePoolStats* stats_;
+    MessageCounters counters_; // committed contents of message_stats
+
+    std::unique_ptr<Connection> getConnection();
+    // failed: the last statement failed, check the connection before reusing it
+    void releaseConnection(std::unique_ptr<Connection> conn, bool failed);
+    std::unique_ptr<Connection> createConnection();
+    // Brings the schema to the latest version recorded in the schema_version table
+    bool applyMigrations(MYSQL* mysql);
+    // Cached prepared statement for sql, nullptr on error
+    MYSQL_STMT* prepare(Connection& conn, const std::string& sql);
+    // Stores a chunk of messages with one multi-row INSERT
+    bool insertRows(Connection& conn, const ChatMessage* msgs, std::size_t count);
+    // Adds a batch's counts to message_stats inside the caller's transaction
+    bool addStats(Connection& conn, const MessageCounters::Delta& delta);
+    // Replaces counters_ with the contents of message_stats
+    bool loadStats(MYSQL* mysql);
 };
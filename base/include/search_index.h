@@ -0,0 +1,87 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "chat_message.h"
+
+// In-memory inverted index over message content, maintained on the append path.
+//
+// Tokens are lower-cased ASCII words (runs of letters and digits; other non-CJK text is
+// kept byte for byte) and, for CJK text, every character plus every pair of adjacent
+// characters. A query matches when it contains all of its tokens, CJK runs being looked
+// up by their bigrams (a lone CJK character by itself), so a Chinese phrase behaves like
+// a substring search without word segmentation.
+//
+// Each term's posting list is a byte string of (document delta, term frequency) varint
+// pairs over document ordinals, which follow message ids. Results are ranked by BM25,
+// newest first on ties, and only the best `limit` are kept.
+//
+// Thread safety: add() and clear() take an exclusive lock, search() a shared one.
+// Messages must be added in id order (DatabaseManager adds them under its store lock).
+class SearchIndex {
+public:
+    struct Query {
+        std::string text;
+        std::string viewer;              // sees public messages plus their private conversations
+        std::optional<std::string> room; // only public messages of this room ("" = global channel)
+        std::string sender;              // only messages from this user, "" = anyone
+        std::string start;               // timestamp bounds, inclusive; a prefix such as
+        std::string end;                 // "2026-10-18" covers the whole day
+        int limit = 20;
+    };
+
+    struct Hit {
+        long long id;
+        double score;
+    };
+
+    struct Stats {
+        std::atomic<uint64_t> queries{0};
+        std::atomic<uint64_t> documents{0};
+        std::atomic<uint64_t> terms{0};
+        std::atomic<uint64_t> posting_bytes{0};
+    };
+
+    void clear();
+    void add(const ChatMessage& msg);
+
+    // Best matches first
+    std::vector<Hit> search(const Query& query) const;
+
+    const Stats& stats() const { return stats_; }
+
+    // Index terms of text (query = false) or the terms a query must all match (query = true)
+    static std::vector<std::string> tokenize(const std::string& text, bool query = false);
+
+private:
+    struct Doc {
+        long long id;
+        long long time; // timestamp digits as YYYYMMDDhhmmss
+        uint32_t room;
+        uint32_t sender;
+        uint32_t target; // 0 = public
+        uint32_t length; // index terms
+    };
+
+    struct Posting {
+        std::string data;  // (ordinal delta, frequency) varint pairs
+        uint32_t last = 0; // ordinal of the newest document
+        uint32_t docs = 0;
+    };
+
+    uint32_t intern(const std::string& name);
+    // Interned id of name, or UINT32_MAX if it was never seen
+    uint32_t lookup(const std::string& name) const;
+
+    mutable std::shared_mutex mutex_;
+    std::vector<Doc> docs_;
+    std::unordered_map<std::string, Posting> postings_;
+    std::unordered_map<std::string, uint32_t> names_; // users and rooms; "" = 0
+    uint64_t total_length_ = 0;
+    mutable Stats stats_;
+};
@@ -1,30 +1,67 @@
 #pragma once
 #include "database.h"
+#include "message_counters.h"
+#include <condition_variable>
+#include <memory>
 #include <mutex>
+#include <vector>
 
 // Forward declaration
 struct sqlite3;
 
+// Writes go through one connection guarded by mutex_. With WAL enabled (file databases
+// only) reads borrow one of config.sqlite_readers read-only connections instead, so they
+// run alongside the writer and each other; otherwise they share the writer connection.
+// Each connection keeps its prepared statements, keyed by SQL text.
+// Indexes on (room_id, id), (target_user, id) and (username, id) come from versioned
+// migrations applied at init, as does the message_stats table of message counts, which
+// inserts update in the same transaction and which is mirrored in memory.
 class SqliteDatabase : public Database {
 public:
     SqliteDatabase();
     ~SqliteDatabase() override;
 
     bool init(const DatabaseConfig& config) override;
-    bool addMessage(const ChatMessage& msg) override;
+    bool addMessage(ChatMessage& msg) override;
+    bool addMessages(const std::vector<ChatMessage>& msgs) override;
     std::vector<ChatMessage> getHistory(int limit, const std::string& username = "") override;
-    std::vector<ChatMessage> getMessagesAfter(long long last_id, const std::string& username = "") override;
+    std::vector<ChatMessage> getMessagesAfter(long long last_id, const std::string& username = "", int limit = 0) override;
+    std::vector<ChatMessage> getRoomHistory(const std::string& room_id, const HistoryCursor& cursor) override;
+    std::vector<ChatMessage> getConversationHistory(const std::string& user_a, const std::string& user_b,
+                                                    const HistoryCursor& cursor) override;
+    std::vector<ChatMessage> getRecentMessages(int limit) override;
+    std::vector<ChatMessage> scanMessages(long long after_id, int limit) override;
+    std::vector<ChatMessage> getMessagesByIds(const std::vector<long long>& ids) override;
     long long getMessageCount() override;
+    long long getRoomMessageCount(const std::string& room_id) override;
+    long long getUserMessageCount(const std::string& username) override;
 
     bool addUser(const std::string& username, const std::string& password) override;
     bool validateUser(const std::string& username, const std::string& password) override;
     bool userExists(const std::string& username) override;
     long long getUserId(const std::string& username) override;
     std::vector<std::pair<std::string, long long>> getAllUsers() override;
-    
+
+    // Read-only connections in the pool (0 when reads use the writer connection)
+    std::size_t readerCount() const { return readers_.size(); }
+
 private:
-    void createTables();
-    sqlite3* db_;
+    class Connection; // sqlite3 handle + statement cache
+    class Statement;  // prepared statement borrowed from a Connection
+    class ReadLease;  // connection for one read: a pooled reader or the locked writer
+
+    // Brings the schema to the latest version recorded in PRAGMA user_version
+    bool applyMigrations();
+    // Adds a batch's counts to message_stats; caller holds mutex_ inside a transaction
+    bool addStats(const MessageCounters::Delta& delta);
+
+    std::unique_ptr<Connection> writer_; // guarded by mutex_
     std::mutex mutex_;
     bool initialized_;
+    MessageCounters counters_; // committed contents of message_stats
+
+    std::vector<std::unique_ptr<Connection>> readers_;
+    std::vector<Connection*> idle_readers_; // guarded by pool_mutex_
+    std::mutex pool_mutex_;
+    std::condition_variable pool_cv_;
 };
@@ -1,78 +1,342 @@
 #include "database_manager.h"
 #include "sqlite_database.h"
 #include "mysql_database.h"
+#include "log_database.h"
 #include "logger.h"
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <unordered_map>
+
+namespace {
+thread_local int no_access_depth = 0;
+
+constexpr int kSearchRebuildPage = 10000; // messages read per query while rebuilding the index
+}
+
+DatabaseManager::NoAccessScope::NoAccessScope() {
+    ++no_access_depth;
+}
+
+DatabaseManager::NoAccessScope::~NoAccessScope() {
+    --no_access_depth;
+}
+
+bool DatabaseManager::NoAccessScope::active() {
+    return no_access_depth > 0;
+}
 
 DatabaseManager& DatabaseManager::instance() {
+    assert(!NoAccessScope::active() && "DatabaseManager used from an inline (IO thread) handler");
     static DatabaseManager instance;
     return instance;
 }
 
 DatabaseManager::DatabaseManager() {}
-DatabaseManager::~DatabaseManager() {}
+
+DatabaseManager::~DatabaseManager() {
+    {
+        std::lock_guard<std::mutex> lock(query_mutex_);
+        stopping_ = true;
+    }
+    query_cv_.notify_all();
+    for (auto& thread : query_threads_) {
+        thread.join();
+    }
+}
 
 bool DatabaseManager::init(const DatabaseConfig& config) {
+    // Released after the lock: the old writer publishes its last commits under it
+    std::shared_ptr<MessageWriter> retired;
     std::lock_guard<std::mutex> lock(mutex_);
-    
+    // Dropping our reference lets the old writer store its queue once no sender waits on it
+    retired = std::move(writer_);
+    {
+        std::lock_guard<std::mutex> query_lock(query_mutex_);
+        if (query_threads_.empty()) {
+            async_threads_ = std::max(1, config.async_threads);
+        }
+    }
+
+    std::shared_ptr<Database> db;
     if (config.type == "mysql") {
-        db_ = std::make_unique<MysqlDatabase>();
+        db = std::make_shared<MysqlDatabase>(&pool_stats_);
+    } else if (config.type == "log") {
+        db = std::make_shared<LogDatabase>();
     } else {
-        db_ = std::make_unique<SqliteDatabase>();
+        db = std::make_shared<SqliteDatabase>();
+    }
+
+    if (!db->init(config)) {
+        db_.store(nullptr, std::memory_order_release);
+        cache_.reset(0, {}, true);
+        search_.clear();
+        search_enabled_ = false;
+        return false;
+    }
+    std::size_t window = static_cast<std::size_t>(std::max(0, config.message_cache_size));
+    // Also yields the newest id, from which ids are handed out in memory
+    std::vector<ChatMessage> recent = db->getRecentMessages(static_cast<int>(std::max<std::size_t>(window, 1)));
+    next_id_ = recent.empty() ? 1 : recent.back().id + 1;
+    cache_.reset(window, recent, recent.size() < window);
+
+    search_.clear();
+    search_enabled_ = config.search_index;
+    if (search_enabled_) {
+        auto started = std::chrono::steady_clock::now();
+        long long after_id = 0;
+        for (;;) {
+            std::vector<ChatMessage> page = db->scanMessages(after_id, kSearchRebuildPage);
+            for (const auto& msg : page) {
+                search_.add(msg);
+            }
+            if (page.size() < static_cast<std::size_t>(kSearchRebuildPage)) break;
+            after_id = page.back().id;
+        }
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started);
+        LOG_INFO("Search index built: {} messages, {} terms, {} posting bytes in {} ms", search_.stats().documents.load(),
+                 search_.stats().terms.load(), search_.stats().posting_bytes.load(), elapsed.count());
+    }
+
+    wait_for_writer_ = config.durability != "memory";
+    // With a durable setting a message is published only once its transaction has committed,
+    // so a message whose sender is told it failed was never seen by anyone
+    MessageWriter::CommitCallback on_commit;
+    if (wait_for_writer_) {
+        on_commit = [this](const std::vector<ChatMessage>& msgs) {
+            std::lock_guard<std::mutex> publish_lock(mutex_);
+            for (const auto& msg : msgs) {
+                publishLocked(msg);
+            }
+        };
+    }
+    writer_ = std::make_shared<MessageWriter>(db, std::chrono::milliseconds(std::max(0, config.write_batch_interval_ms)),
+                                              static_cast<std::size_t>(std::max(1, config.write_batch_max)),
+                                              writer_stats_, std::move(on_commit));
+    // Queries still running on the previous backend keep it alive through their snapshot
+    db_.store(std::move(db), std::memory_order_release);
+    return true;
+}
+
+bool DatabaseManager::addMessage(ChatMessage& msg) {
+    std::shared_ptr<MessageWriter> writer;
+    std::shared_ptr<const MessageWriter::Ticket> ticket;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!writer_) return false;
+        msg.id = next_id_++;
+        ticket = writer_->submit(msg);
+        if (!wait_for_writer_) {
+            publishLocked(msg);
+            return true;
+        }
+        writer = writer_;
+    }
+    // Senders arriving while this batch gathers or commits share its transaction
+    return writer->wait(ticket);
+}
+
+bool DatabaseManager::addMessageAsync(ChatMessage& msg, Executor executor, std::function<void(bool ok)> done) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!writer_) return false;
+        msg.id = next_id_++;
+        async_stats_.pending.fetch_add(1, std::memory_order_relaxed);
+        if (wait_for_writer_) {
+            writer_->submit(msg, [this, executor, done](bool ok) {
+                executor([this, done, ok]() {
+                    done(ok);
+                    async_stats_.pending.fetch_sub(1, std::memory_order_relaxed);
+                });
+            });
+            return true;
+        }
+        writer_->submit(msg);
+        publishLocked(msg);
+    }
+    executor([this, done = std::move(done)]() {
+        done(true);
+        async_stats_.pending.fetch_sub(1, std::memory_order_relaxed);
+    });
+    return true;
+}
+
+void DatabaseManager::publishLocked(const ChatMessage& msg) {
+    cache_.append(msg);
+    if (search_enabled_) search_.add(msg);
+    for (const auto& entry : listeners_) {
+        entry.second(msg);
+    }
+}
+
+void DatabaseManager::post(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(query_mutex_);
+        if (query_threads_.empty()) {
+            for (int i = 0; i < async_threads_; ++i) {
+                query_threads_.emplace_back([this]() { runQueries(); });
+            }
+        }
+        query_queue_.push_back(std::move(task));
+    }
+    query_cv_.notify_one();
+}
+
+void DatabaseManager::runQueries() {
+    std::unique_lock<std::mutex> lock(query_mutex_);
+    while (true) {
+        query_cv_.wait(lock, [this]() { return stopping_ || !query_queue_.empty(); });
+        if (stopping_) {
+            break; // completions would target event loops that are already gone
+        }
+        std::function<void()> task = std::move(query_queue_.front());
+        query_queue_.pop_front();
+        lock.unlock();
+        try {
+            task();
+        } catch (const std::exception& e) {
+            LOG_ERROR("Async database call failed: {}", e.what());
+        }
+        async_stats_.tasks.fetch_add(1, std::memory_order_relaxed);
+        lock.lock();
     }
-    
-    return db_->init(config);
 }
 
-bool DatabaseManager::addMessage(const ChatMessage& msg) {
+int DatabaseManager::addMessageListener(MessageListener listener) {
     std::lock_guard<std::mutex> lock(mutex_);
-    if (!db_) return false;
-    return db_->addMessage(msg);
+    int handle = ++next_listener_;
+    listeners_[handle] = std::move(listener);
+    return handle;
 }
 
-std::vector<ChatMessage> DatabaseManager::getHistory(int limit, const std::string& username) {
+void DatabaseManager::removeMessageListener(int handle) {
     std::lock_guard<std::mutex> lock(mutex_);
-    if (!db_) return {};
-    return db_->getHistory(limit, username);
+    listeners_.erase(handle);
 }
 
-std::vector<ChatMessage> DatabaseManager::getMessagesAfter(long long last_id, const std::string& username) {
+int DatabaseManager::addUserListener(UserListener listener) {
     std::lock_guard<std::mutex> lock(mutex_);
-    if (!db_) return {};
-    return db_->getMessagesAfter(last_id, username);
+    int handle = ++next_listener_;
+    user_listeners_[handle] = std::move(listener);
+    return handle;
 }
 
-long long DatabaseManager::getMessageCount() {
+void DatabaseManager::removeUserListener(int handle) {
     std::lock_guard<std::mutex> lock(mutex_);
-    if (!db_) return 0;
-    return db_->getMessageCount();
+    user_listeners_.erase(handle);
+}
+
+std::vector<ChatMessage> DatabaseManager::getHistory(int limit, const std::string& username) {
+    std::vector<ChatMessage> cached;
+    if (cache_.history(limit, username, cached)) return cached;
+    auto db = database();
+    if (!db) return {};
+    return db->getHistory(limit, username);
+}
+
+std::vector<ChatMessage> DatabaseManager::getMessagesAfter(long long last_id, const std::string& username, int limit) {
+    std::vector<ChatMessage> cached;
+    if (cache_.messagesAfter(last_id, username, limit, cached)) return cached;
+    auto db = database();
+    if (!db) return {};
+    return db->getMessagesAfter(last_id, username, limit);
+}
+
+std::vector<DatabaseManager::SearchResult> DatabaseManager::search(const SearchIndex::Query& query) {
+    std::vector<SearchIndex::Hit> hits = search_.search(query);
+    if (hits.empty()) return {};
+    auto db = database();
+    if (!db) return {};
+
+    std::vector<long long> ids;
+    ids.reserve(hits.size());
+    for (const auto& hit : hits) {
+        ids.push_back(hit.id);
+    }
+    std::unordered_map<long long, ChatMessage> rows;
+    for (auto& msg : db->getMessagesByIds(ids)) {
+        long long id = msg.id;
+        rows.emplace(id, std::move(msg));
+    }
+    std::vector<SearchResult> results;
+    results.reserve(hits.size());
+    for (const auto& hit : hits) {
+        auto it = rows.find(hit.id);
+        if (it != rows.end()) {
+            results.push_back({std::move(it->second), hit.score});
+        }
+    }
+    return results;
+}
+
+std::vector<ChatMessage> DatabaseManager::getRoomHistory(const std::string& room_id, const HistoryCursor& cursor) {
+    auto db = database();
+    if (!db) return {};
+    return db->getRoomHistory(room_id, cursor);
+}
+
+std::vector<ChatMessage> DatabaseManager::getConversationHistory(const std::string& user_a, const std::string& user_b,
+                                                                 const HistoryCursor& cursor) {
+    auto db = database();
+    if (!db) return {};
+    return db->getConversationHistory(user_a, user_b, cursor);
+}
+
+long long DatabaseManager::getMessageCount() {
+    auto db = database();
+    if (!db) return 0;
+    return db->getMessageCount();
+}
+
+long long DatabaseManager::getRoomMessageCount(const std::string& room_id) {
+    auto db = database();
+    if (!db) return 0;
+    return db->getRoomMessageCount(room_id);
+}
+
+long long DatabaseManager::getUserMessageCount(const std::string& username) {
+    auto db = database();
+    if (!db) return 0;
+    return db->getUserMessageCount(username);
+}
+
+void DatabaseManager::maintain() {
+    auto db = database();
+    if (db) db->maintain();
 }
 
 bool DatabaseManager::addUser(const std::string& username, const std::string& password) {
+    auto db = database();
+    if (!db || !db->addUser(username, password)) return false;
+
+    long long user_id = db->getUserId(username);
     std::lock_guard<std::mutex> lock(mutex_);
-    if (!db_) return false;
-    return db_->addUser(username, password);
+    for (const auto& entry : user_listeners_) {
+        entry.second(username, user_id);
+    }
+    return true;
 }
 
 bool DatabaseManager::validateUser(const std::string& username, const std::string& password) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    if (!db_) return false;
-    return db_->validateUser(username, password);
+    auto db = database();
+    if (!db) return false;
+    return db->validateUser(username, password);
 }
 
 bool DatabaseManager::userExists(const std::string& username) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    if (!db_) return false;
-    return db_->userExists(username);
+    auto db = database();
+    if (!db) return false;
+    return db->userExists(username);
 }
 
 long long DatabaseManager::getUserId(const std::string& username) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    if (!db_) return -1;
-    return db_->getUserId(username);
+    auto db = database();
+    if (!db) return -1;
+    return db->getUserId(username);
 }
 
 std::vector<std::pair<std::string, long long>> DatabaseManager::getAllUsers() {
-    std::lock_guard<std::mutex> lock(mutex_);
-    if (!db_) return {};
-    return db_->getAllUsers();
+    auto db = database();
+    if (!db) return {};
+    return db->getAllUsers();
 }
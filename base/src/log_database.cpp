@@ -0,0 +1,854 @@
+#include "log_database.h"
+#include "logger.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr std::size_t kHeaderBytes = 8; // u32 payload length + u32 CRC-32 of the payload
+constexpr const char* kSegmentSuffix = ".seg";
+constexpr const char* kUsersFile = "users.log";
+
+constexpr std::array<uint32_t, 256> makeCrcTable() {
+    std::array<uint32_t, 256> table{};
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; ++k) {
+            c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        }
+        table[i] = c;
+    }
+    return table;
+}
+
+constexpr std::array<uint32_t, 256> kCrcTable = makeCrcTable();
+
+uint32_t crc32(const char* data, std::size_t n) {
+    uint32_t c = 0xFFFFFFFFu;
+    for (std::size_t i = 0; i < n; ++i) {
+        c = kCrcTable[(c ^ static_cast<uint8_t>(data[i])) & 0xFF] ^ (c >> 8);
+    }
+    return c ^ 0xFFFFFFFFu;
+}
+
+void put32(std::string& out, uint32_t v) {
+    for (int i = 0; i < 4; ++i) {
+        out.push_back(static_cast<char>((v >> (8 * i)) & 0xFF));
+    }
+}
+
+uint32_t get32(const char* p) {
+    uint32_t v = 0;
+    for (int i = 0; i < 4; ++i) {
+        v |= static_cast<uint32_t>(static_cast<uint8_t>(p[i])) << (8 * i);
+    }
+    return v;
+}
+
+void putVarint(std::string& out, uint64_t v) {
+    while (v >= 0x80) {
+        out.push_back(static_cast<char>(v | 0x80));
+        v >>= 7;
+    }
+    out.push_back(static_cast<char>(v));
+}
+
+bool getVarint(const char*& p, const char* end, uint64_t& v) {
+    v = 0;
+    for (int shift = 0; shift < 64 && p < end; shift += 7) {
+        uint8_t byte = static_cast<uint8_t>(*p++);
+        v |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+void putString(std::string& out, const std::string& s) {
+    putVarint(out, s.size());
+    out.append(s);
+}
+
+bool getString(const char*& p, const char* end, std::string& s) {
+    uint64_t len;
+    if (!getVarint(p, end, len) || len > static_cast<uint64_t>(end - p)) return false;
+    s.assign(p, len);
+    p += len;
+    return true;
+}
+
+// Appends a framed record holding payload
+void frame(const std::string& payload, std::string& out) {
+    put32(out, static_cast<uint32_t>(payload.size()));
+    put32(out, crc32(payload.data(), payload.size()));
+    out.append(payload);
+}
+
+void encodeMessage(const ChatMessage& msg, std::string& payload, std::string& out) {
+    payload.clear();
+    putVarint(payload, static_cast<uint64_t>(msg.id));
+    putString(payload, msg.username);
+    putString(payload, msg.content);
+    putString(payload, msg.timestamp);
+    putString(payload, msg.target_user);
+    putString(payload, msg.room_id);
+    frame(payload, out);
+}
+
+// Size of the record at p (header included), or 0 when there is none: end of the data,
+// zero fill, a length running past `available` or, with verify, a CRC mismatch
+std::size_t recordSize(const char* p, std::size_t available, bool verify) {
+    if (available < kHeaderBytes) return 0;
+    uint32_t len = get32(p);
+    if (len == 0 || len > available - kHeaderBytes) return 0;
+    if (verify && crc32(p + kHeaderBytes, len) != get32(p + 4)) return 0;
+    return kHeaderBytes + len;
+}
+
+// Leading varint of a record's payload (the message or user id), -1 if malformed
+long long recordId(const char* p) {
+    const char* q = p + kHeaderBytes;
+    uint64_t id;
+    if (!getVarint(q, q + get32(p), id) || id > static_cast<uint64_t>(LLONG_MAX)) return -1;
+    return static_cast<long long>(id);
+}
+
+bool decodeMessage(const char* p, ChatMessage& msg) {
+    const char* q = p + kHeaderBytes;
+    const char* end = q + get32(p);
+    uint64_t id;
+    if (!getVarint(q, end, id)) return false;
+    msg.id = static_cast<long long>(id);
+    return getString(q, end, msg.username) && getString(q, end, msg.content) &&
+           getString(q, end, msg.timestamp) && getString(q, end, msg.target_user) &&
+           getString(q, end, msg.room_id);
+}
+
+bool visibleTo(const ChatMessage& msg, const std::string& username) {
+    if (msg.target_user.empty()) return true;
+    return !username.empty() && (msg.target_user == username || msg.username == username);
+}
+
+bool writeAll(int fd, const char* data, std::size_t n, off_t offset) {
+    while (n > 0) {
+        ssize_t written = ::pwrite(fd, data, n, offset);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += written;
+        offset += written;
+        n -= static_cast<std::size_t>(written);
+    }
+    return true;
+}
+
+// Makes a rename or a newly created file in dir durable
+void syncDir(const std::string& dir) {
+    int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+    if (fd >= 0) {
+        ::fsync(fd);
+        ::close(fd);
+    }
+}
+
+std::string segmentPath(const std::string& dir, long long first_id) {
+    char name[32];
+    std::snprintf(name, sizeof(name), "%020lld%s", first_id, kSegmentSuffix);
+    return (fs::path(dir) / name).string();
+}
+
+} // namespace
+
+struct LogDatabase::Segment {
+    std::string path;
+    int fd = -1;
+    const char* data = nullptr; // shared read-only mapping of `capacity` bytes
+    std::size_t capacity = 0;
+    std::size_t size = 0;       // bytes of published records
+    long long first_id = 0;     // 0 while empty
+    long long last_id = 0;
+    long long records = 0;
+    std::vector<std::pair<long long, std::size_t>> index; // sparse (id, offset), ascending
+    bool sealed = false;
+    std::chrono::steady_clock::time_point opened = std::chrono::steady_clock::now();
+
+    ~Segment() {
+        unmap();
+        if (fd >= 0) ::close(fd);
+    }
+
+    void unmap() {
+        if (data) ::munmap(const_cast<char*>(data), capacity);
+        data = nullptr;
+        capacity = 0;
+    }
+
+    // Maps the first `bytes` of the file, preallocating (zero-filled) space up to there
+    bool map(std::size_t bytes) {
+        unmap();
+        if (bytes == 0) return true;
+        struct stat st;
+        if (::fstat(fd, &st) != 0) return false;
+        if (static_cast<std::size_t>(st.st_size) < bytes) {
+            int rc = ::posix_fallocate(fd, 0, static_cast<off_t>(bytes));
+            if (rc != 0 && ::ftruncate(fd, static_cast<off_t>(bytes)) != 0) {
+                LOG_ERROR("Can't extend log segment {}: {}", path, std::strerror(rc));
+                return false;
+            }
+        }
+        void* addr = ::mmap(nullptr, bytes, PROT_READ, MAP_SHARED, fd, 0);
+        if (addr == MAP_FAILED) {
+            LOG_ERROR("Can't map log segment {}: {}", path, std::strerror(errno));
+            return false;
+        }
+        data = static_cast<const char*>(addr);
+        capacity = bytes;
+        return true;
+    }
+
+    // Offset of the indexed record at or before the first id > after_id
+    std::size_t seek(long long after_id) const {
+        auto it = std::upper_bound(index.begin(), index.end(), after_id,
+                                   [](long long id, const auto& entry) { return id < entry.first; });
+        return it == index.begin() ? 0 : std::prev(it)->second;
+    }
+};
+
+LogDatabase::LogDatabase() : initialized_(false) {}
+
+LogDatabase::~LogDatabase() {
+    if (users_fd_ >= 0) ::close(users_fd_);
+}
+
+bool LogDatabase::init(const DatabaseConfig& config) {
+    std::lock_guard<std::mutex> write_lock(write_mutex_);
+    if (initialized_) return true;
+
+    dir_ = config.log_dir.empty() ? "chatroom_log" : config.log_dir;
+    segment_bytes_ = static_cast<std::size_t>(std::max(4096LL, config.log_segment_bytes));
+    index_interval_ = std::max(1, config.log_index_interval);
+    roll_interval_ = std::chrono::seconds(std::max(0, config.log_roll_seconds));
+    sync_ = config.durability == "fsync";
+
+    std::error_code ec;
+    fs::create_directories(dir_, ec);
+    if (ec) {
+        LOG_ERROR("Can't create log directory {}: {}", dir_, ec.message());
+        return false;
+    }
+    if (!recover() || !loadUsers()) {
+        segments_.clear();
+        return false;
+    }
+
+    MessageCounters::Delta counts;
+    scanForward(0, [&counts](const ChatMessage& msg) {
+        counts.add(msg);
+        return true;
+    });
+    counters_.apply(counts);
+
+    initialized_ = true;
+    LOG_INFO("Log Database initialized at {} ({} segments, {} messages, last id {})", dir_, segments_.size(),
+             counters_.total(), last_id_);
+    return true;
+}
+
+bool LogDatabase::recover() {
+    std::vector<std::pair<long long, std::string>> files;
+    for (const auto& entry : fs::directory_iterator(dir_)) {
+        const std::string name = entry.path().filename().string();
+        if (name.size() > 4 && name.compare(name.size() - 4, 4, ".tmp") == 0) {
+            // Merge output of a compaction that never got renamed into place
+            fs::remove(entry.path());
+            continue;
+        }
+        if (entry.path().extension() != kSegmentSuffix) continue;
+        try {
+            files.emplace_back(std::stoll(entry.path().stem().string()), entry.path().string());
+        } catch (...) {
+            LOG_WARN("Ignoring unexpected file {} in log directory", name);
+        }
+    }
+    std::sort(files.begin(), files.end());
+
+    for (std::size_t i = 0; i < files.size(); ++i) {
+        const bool tail = i + 1 == files.size();
+        // A write batch that rolled may have torn the segment before the tail as well
+        const bool verify = i + 2 >= files.size();
+        auto seg = std::make_shared<Segment>();
+        seg->path = files[i].second;
+        seg->fd = ::open(seg->path.c_str(), O_RDWR | O_CLOEXEC);
+        struct stat st;
+        if (seg->fd < 0 || ::fstat(seg->fd, &st) != 0) {
+            LOG_ERROR("Can't open log segment {}: {}", seg->path, std::strerror(errno));
+            return false;
+        }
+        std::size_t file_size = static_cast<std::size_t>(st.st_size);
+        if (!seg->map(tail ? std::max(segment_bytes_, file_size) : file_size)) {
+            return false;
+        }
+
+        // Older segments are walked by record length alone
+        std::size_t offset = 0;
+        std::size_t n;
+        while ((n = recordSize(seg->data + offset, file_size - offset, verify)) > 0) {
+            long long id = recordId(seg->data + offset);
+            if (id <= last_id_) break;
+            if (seg->records % index_interval_ == 0) {
+                seg->index.emplace_back(id, offset);
+            }
+            if (seg->records == 0) seg->first_id = id;
+            seg->last_id = id;
+            ++seg->records;
+            last_id_ = id;
+            offset += n;
+        }
+        seg->size = offset;
+
+        if (seg->records == 0 && !tail) {
+            // Empty, or overlapped by the merged segment of an interrupted compaction
+            LOG_WARN("Removing redundant log segment {}", seg->path);
+            fs::remove(seg->path);
+            continue;
+        }
+        if (tail && offset < file_size &&
+            std::any_of(seg->data + offset, seg->data + file_size, [](char c) { return c != 0; })) {
+            LOG_WARN("Log segment {}: discarding torn tail after {} records ({} bytes)", seg->path, seg->records,
+                     offset);
+            std::size_t capacity = seg->capacity;
+            seg->unmap();
+            if (::ftruncate(seg->fd, static_cast<off_t>(offset)) != 0 || !seg->map(capacity)) {
+                return false;
+            }
+        }
+        seg->sealed = !tail;
+        segments_.push_back(std::move(seg));
+    }
+
+    if (segments_.empty()) {
+        auto seg = createSegment(last_id_ + 1, segment_bytes_);
+        if (!seg) return false;
+        segments_.push_back(std::move(seg));
+    }
+    return true;
+}
+
+bool LogDatabase::loadUsers() {
+    std::string path = (fs::path(dir_) / kUsersFile).string();
+    users_fd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (users_fd_ < 0) {
+        LOG_ERROR("Can't open {}: {}", path, std::strerror(errno));
+        return false;
+    }
+    std::string contents;
+    char buf[65536];
+    ssize_t n;
+    while ((n = ::pread(users_fd_, buf, sizeof(buf), static_cast<off_t>(contents.size()))) > 0) {
+        contents.append(buf, static_cast<std::size_t>(n));
+    }
+
+    std::size_t offset = 0;
+    std::size_t size;
+    while ((size = recordSize(contents.data() + offset, contents.size() - offset, true)) > 0) {
+        const char* p = contents.data() + offset + kHeaderBytes;
+        const char* end = p + (size - kHeaderBytes);
+        uint64_t id;
+        std::string username;
+        User user;
+        if (!getVarint(p, end, id) || !getString(p, end, username) || !getString(p, end, user.password)) break;
+        user.id = static_cast<long long>(id);
+        next_user_id_ = std::max(next_user_id_, user.id + 1);
+        users_.emplace(std::move(username), std::move(user));
+        offset += size;
+    }
+    if (offset < contents.size()) {
+        LOG_WARN("{}: discarding torn tail after {} users", path, users_.size());
+        if (::ftruncate(users_fd_, static_cast<off_t>(offset)) != 0) return false;
+    }
+    return true;
+}
+
+std::shared_ptr<LogDatabase::Segment> LogDatabase::createSegment(long long first_id, std::size_t capacity) {
+    auto seg = std::make_shared<Segment>();
+    seg->path = segmentPath(dir_, first_id);
+    seg->fd = ::open(seg->path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (seg->fd < 0) {
+        LOG_ERROR("Can't create log segment {}: {}", seg->path, std::strerror(errno));
+        return nullptr;
+    }
+    if (!seg->map(capacity)) return nullptr;
+    syncDir(dir_);
+    return seg;
+}
+
+bool LogDatabase::roll(long long first_id, std::size_t min_capacity) {
+    auto seg = createSegment(first_id, std::max(segment_bytes_, min_capacity));
+    if (!seg) return false;
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    segments_.back()->sealed = true;
+    segments_.push_back(std::move(seg));
+    return true;
+}
+
+bool LogDatabase::append(const std::vector<ChatMessage>& msgs) {
+    // Written past each segment's published size, then published in one step
+    struct Pending {
+        Segment* seg;
+        std::size_t size;
+        long long first_id;
+        long long last_id;
+        long long records;
+        std::vector<std::pair<long long, std::size_t>> index;
+    };
+    std::vector<Pending> pending;
+    auto start = [&pending](Segment* seg) {
+        pending.push_back({seg, seg->size, seg->first_id, seg->last_id, seg->records, {}});
+    };
+    auto revert = [&pending]() {
+        // Zero what was written so recovery cannot resurrect unacknowledged records
+        for (const auto& p : pending) {
+            if (p.size > p.seg->size) {
+                std::string zeros(p.size - p.seg->size, '\0');
+                writeAll(p.seg->fd, zeros.data(), zeros.size(), static_cast<off_t>(p.seg->size));
+            }
+        }
+    };
+
+    start(segments_.back().get());
+    std::string payload;
+    std::string record;
+    for (const auto& msg : msgs) {
+        record.clear();
+        encodeMessage(msg, payload, record);
+        if (pending.back().size + record.size() > pending.back().seg->capacity) {
+            bool ok;
+            if (pending.back().records == 0) {
+                // Nothing to seal: an empty active segment only has to grow for an oversized record
+                std::unique_lock<std::shared_mutex> lock(mutex_);
+                ok = pending.back().seg->map(record.size());
+            } else {
+                ok = roll(msg.id, record.size());
+                if (ok) start(segments_.back().get());
+            }
+            if (!ok) {
+                revert();
+                return false;
+            }
+        }
+        Pending& cur = pending.back();
+        if (!writeAll(cur.seg->fd, record.data(), record.size(), static_cast<off_t>(cur.size))) {
+            LOG_ERROR("Writing log segment {} failed: {}", cur.seg->path, std::strerror(errno));
+            revert();
+            return false;
+        }
+        if (cur.records % index_interval_ == 0) {
+            cur.index.emplace_back(msg.id, cur.size);
+        }
+        if (cur.records == 0) cur.first_id = msg.id;
+        cur.last_id = msg.id;
+        ++cur.records;
+        cur.size += record.size();
+    }
+
+    if (sync_) {
+        for (const auto& p : pending) {
+            if (p.size > p.seg->size && ::fdatasync(p.seg->fd) != 0) {
+                LOG_ERROR("Syncing log segment {} failed: {}", p.seg->path, std::strerror(errno));
+                revert();
+                return false;
+            }
+        }
+    }
+
+    MessageCounters::Delta delta = MessageCounters::tally(msgs);
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    for (auto& p : pending) {
+        p.seg->size = p.size;
+        p.seg->first_id = p.first_id;
+        p.seg->last_id = p.last_id;
+        p.seg->records = p.records;
+        p.seg->index.insert(p.seg->index.end(), p.index.begin(), p.index.end());
+    }
+    last_id_ = msgs.back().id;
+    counters_.apply(delta);
+    return true;
+}
+
+bool LogDatabase::addMessage(ChatMessage& msg) {
+    std::lock_guard<std::mutex> write_lock(write_mutex_);
+    if (!initialized_) return false;
+    ChatMessage stored = msg;
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        stored.id = last_id_ + 1;
+    }
+    if (!append({stored})) return false;
+    msg.id = stored.id;
+    return true;
+}
+
+bool LogDatabase::addMessages(const std::vector<ChatMessage>& msgs) {
+    std::lock_guard<std::mutex> write_lock(write_mutex_);
+    if (!initialized_) return false;
+    if (msgs.empty()) return true;
+
+    // Ids must extend the log in ascending order (a primary key violation in SQL terms)
+    long long prev;
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        prev = last_id_;
+    }
+    for (const auto& msg : msgs) {
+        if (msg.id <= prev) {
+            LOG_ERROR("Log store rejects message id {} (not above {})", msg.id, prev);
+            return false;
+        }
+        prev = msg.id;
+    }
+    return append(msgs);
+}
+
+template <typename Visit>
+void LogDatabase::scanForward(long long after_id, Visit&& visit) const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    ChatMessage msg;
+    for (const auto& seg : segments_) {
+        if (seg->records == 0 || seg->last_id <= after_id) continue;
+        std::size_t offset = seg->seek(after_id);
+        std::size_t n;
+        while (offset < seg->size && (n = recordSize(seg->data + offset, seg->size - offset, false)) > 0) {
+            if (recordId(seg->data + offset) > after_id && decodeMessage(seg->data + offset, msg) && !visit(msg)) {
+                return;
+            }
+            offset += n;
+        }
+    }
+}
+
+template <typename Visit>
+void LogDatabase::scanBackward(long long before_id, Visit&& visit) const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    std::vector<ChatMessage> block;
+    for (auto seg_it = segments_.rbegin(); seg_it != segments_.rend(); ++seg_it) {
+        const Segment& seg = **seg_it;
+        if (seg.records == 0 || seg.first_id >= before_id) continue;
+        // Decode one index block at a time and walk it backwards
+        auto entry = std::upper_bound(seg.index.begin(), seg.index.end(), before_id - 1,
+                                      [](long long id, const auto& e) { return id < e.first; });
+        for (std::size_t b = static_cast<std::size_t>(entry - seg.index.begin()); b-- > 0;) {
+            std::size_t offset = seg.index[b].second;
+            std::size_t end = b + 1 < seg.index.size() ? seg.index[b + 1].second : seg.size;
+            block.clear();
+            std::size_t n;
+            while (offset < end && (n = recordSize(seg.data + offset, end - offset, false)) > 0) {
+                block.emplace_back();
+                if (!decodeMessage(seg.data + offset, block.back())) block.pop_back();
+                offset += n;
+            }
+            for (auto it = block.rbegin(); it != block.rend(); ++it) {
+                if (it->id < before_id && !visit(*it)) return;
+            }
+        }
+    }
+}
+
+std::vector<ChatMessage> LogDatabase::getHistory(int limit, const std::string& username) {
+    std::vector<ChatMessage> history;
+    if (!initialized_ || limit <= 0) return history;
+    scanBackward(LLONG_MAX, [&](const ChatMessage& msg) {
+        if (visibleTo(msg, username)) history.push_back(msg);
+        return static_cast<int>(history.size()) < limit;
+    });
+    std::reverse(history.begin(), history.end());
+    return history;
+}
+
+std::vector<ChatMessage> LogDatabase::getMessagesAfter(long long last_id, const std::string& username, int limit) {
+    std::vector<ChatMessage> history;
+    if (!initialized_) return history;
+    scanForward(last_id, [&](const ChatMessage& msg) {
+        if (visibleTo(msg, username)) history.push_back(msg);
+        return limit <= 0 || static_cast<int>(history.size()) < limit;
+    });
+    return history;
+}
+
+std::vector<ChatMessage> LogDatabase::getRoomHistory(const std::string& room_id, const HistoryCursor& cursor) {
+    std::vector<ChatMessage> history;
+    if (!initialized_ || cursor.limit <= 0) return history;
+    long long before = cursor.before > 0 ? cursor.before : LLONG_MAX;
+    auto collect = [&](const ChatMessage& msg) {
+        if (msg.room_id == room_id && msg.target_user.empty()) history.push_back(msg);
+        return static_cast<int>(history.size()) < cursor.limit;
+    };
+    if (cursor.after > 0) {
+        scanForward(cursor.after, [&](const ChatMessage& msg) { return msg.id < before && collect(msg); });
+    } else {
+        scanBackward(before, collect);
+        std::reverse(history.begin(), history.end());
+    }
+    return history;
+}
+
+std::vector<ChatMessage> LogDatabase::getConversationHistory(const std::string& user_a, const std::string& user_b,
+                                                             const HistoryCursor& cursor) {
+    std::vector<ChatMessage> history;
+    if (!initialized_ || cursor.limit <= 0) return history;
+    long long before = cursor.before > 0 ? cursor.before : LLONG_MAX;
+    auto collect = [&](const ChatMessage& msg) {
+        if ((msg.username == user_a && msg.target_user == user_b) ||
+            (msg.username == user_b && msg.target_user == user_a)) {
+            history.push_back(msg);
+        }
+        return static_cast<int>(history.size()) < cursor.limit;
+    };
+    if (cursor.after > 0) {
+        scanForward(cursor.after, [&](const ChatMessage& msg) { return msg.id < before && collect(msg); });
+    } else {
+        scanBackward(before, collect);
+        std::reverse(history.begin(), history.end());
+    }
+    return history;
+}
+
+std::vector<ChatMessage> LogDatabase::getRecentMessages(int limit) {
+    std::vector<ChatMessage> history;
+    if (!initialized_ || limit <= 0) return history;
+    scanBackward(LLONG_MAX, [&](const ChatMessage& msg) {
+        history.push_back(msg);
+        return static_cast<int>(history.size()) < limit;
+    });
+    std::reverse(history.begin(), history.end());
+    return history;
+}
+
+std::vector<ChatMessage> LogDatabase::scanMessages(long long after_id, int limit) {
+    std::vector<ChatMessage> page;
+    if (!initialized_ || limit <= 0) return page;
+    scanForward(after_id, [&](const ChatMessage& msg) {
+        page.push_back(msg);
+        return static_cast<int>(page.size()) < limit;
+    });
+    return page;
+}
+
+std::vector<ChatMessage> LogDatabase::getMessagesByIds(const std::vector<long long>& ids) {
+    std::vector<ChatMessage> found;
+    if (!initialized_) return found;
+    std::vector<long long> sorted(ids);
+    std::sort(sorted.begin(), sorted.end());
+    sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+    // Each lookup is an index seek plus at most log_index_interval records
+    for (long long id : sorted) {
+        scanForward(id - 1, [&](const ChatMessage& msg) {
+            if (msg.id == id) found.push_back(msg);
+            return false;
+        });
+    }
+    return found;
+}
+
+long long LogDatabase::getMessageCount() {
+    return counters_.total();
+}
+
+long long LogDatabase::getRoomMessageCount(const std::string& room_id) {
+    return counters_.room(room_id);
+}
+
+long long LogDatabase::getUserMessageCount(const std::string& username) {
+    return counters_.user(username);
+}
+
+bool LogDatabase::addUser(const std::string& username, const std::string& password) {
+    std::unique_lock<std::shared_mutex> lock(users_mutex_);
+    if (!initialized_ || users_.count(username)) return false;
+
+    User user{next_user_id_, password};
+    std::string payload;
+    putVarint(payload, static_cast<uint64_t>(user.id));
+    putString(payload, username);
+    putString(payload, password);
+    std::string record;
+    frame(payload, record);
+    struct stat st;
+    if (::fstat(users_fd_, &st) != 0 || !writeAll(users_fd_, record.data(), record.size(), st.st_size) ||
+        (sync_ && ::fdatasync(users_fd_) != 0)) {
+        LOG_ERROR("Writing {} failed: {}", kUsersFile, std::strerror(errno));
+        return false;
+    }
+    ++next_user_id_;
+    users_.emplace(username, std::move(user));
+    return true;
+}
+
+bool LogDatabase::validateUser(const std::string& username, const std::string& password) {
+    std::shared_lock<std::shared_mutex> lock(users_mutex_);
+    auto it = users_.find(username);
+    return it != users_.end() && it->second.password == password;
+}
+
+bool LogDatabase::userExists(const std::string& username) {
+    std::shared_lock<std::shared_mutex> lock(users_mutex_);
+    return users_.count(username) > 0;
+}
+
+long long LogDatabase::getUserId(const std::string& username) {
+    std::shared_lock<std::shared_mutex> lock(users_mutex_);
+    auto it = users_.find(username);
+    return it == users_.end() ? -1 : it->second.id;
+}
+
+std::vector<std::pair<std::string, long long>> LogDatabase::getAllUsers() {
+    std::vector<std::pair<std::string, long long>> users;
+    {
+        std::shared_lock<std::shared_mutex> lock(users_mutex_);
+        users.reserve(users_.size());
+        for (const auto& entry : users_) {
+            users.emplace_back(entry.first, entry.second.id);
+        }
+    }
+    std::sort(users.begin(), users.end());
+    return users;
+}
+
+std::size_t LogDatabase::segmentCount() const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    return segments_.size();
+}
+
+void LogDatabase::maintain() {
+    std::lock_guard<std::mutex> maintenance_lock(maintenance_mutex_);
+    if (!initialized_) return;
+    {
+        // Keeps the part recovery has to CRC-check small on a quiet server
+        std::lock_guard<std::mutex> write_lock(write_mutex_);
+        const Segment& active = *segments_.back();
+        if (active.records > 0 && std::chrono::steady_clock::now() - active.opened >= roll_interval_) {
+            long long next_id;
+            {
+                std::shared_lock<std::shared_mutex> lock(mutex_);
+                next_id = last_id_ + 1;
+            }
+            roll(next_id, 0);
+        }
+    }
+    compact();
+}
+
+void LogDatabase::compact() {
+    struct Snapshot {
+        std::shared_ptr<Segment> seg;
+        std::size_t size;
+        bool sealed;
+        bool oversized; // file still preallocated beyond its records
+    };
+    std::vector<Snapshot> snapshot;
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        for (const auto& seg : segments_) {
+            struct stat st;
+            bool oversized = ::fstat(seg->fd, &st) == 0 && static_cast<std::size_t>(st.st_size) > seg->size;
+            snapshot.push_back({seg, seg->size, seg->sealed, oversized});
+        }
+    }
+
+    std::size_t i = 0;
+    while (i < snapshot.size()) {
+        if (!snapshot[i].sealed) {
+            ++i;
+            continue;
+        }
+        // The longest run of sealed segments that fits in one segment together
+        std::size_t j = i;
+        std::size_t total = 0;
+        while (j < snapshot.size() && snapshot[j].sealed && total + snapshot[j].size <= segment_bytes_) {
+            total += snapshot[j].size;
+            ++j;
+        }
+        if (j == i) {
+            ++i;
+            continue;
+        }
+        if (j - i < 2) {
+            if (snapshot[i].oversized) {
+                // Give back the preallocated space; only the writer appends past size, under write_mutex_
+                std::lock_guard<std::mutex> write_lock(write_mutex_);
+                std::shared_lock<std::shared_mutex> lock(mutex_);
+                const Segment& seg = *snapshot[i].seg;
+                if (seg.sealed && ::ftruncate(seg.fd, static_cast<off_t>(seg.size)) != 0) {
+                    LOG_WARN("Trimming log segment {} failed: {}", seg.path, std::strerror(errno));
+                }
+            }
+            i = j;
+            continue;
+        }
+
+        // Concatenate the run into <first path>.tmp, then swap it in
+        const std::string& target = snapshot[i].seg->path;
+        std::string tmp = target + ".tmp";
+        auto merged = std::make_shared<Segment>();
+        merged->path = target;
+        merged->sealed = true;
+        merged->fd = ::open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        bool ok = merged->fd >= 0;
+        std::size_t offset = 0;
+        for (std::size_t k = i; ok && k < j; ++k) {
+            const Segment& src = *snapshot[k].seg;
+            ok = writeAll(merged->fd, src.data, snapshot[k].size, static_cast<off_t>(offset));
+            std::shared_lock<std::shared_mutex> lock(mutex_);
+            for (const auto& entry : src.index) {
+                merged->index.emplace_back(entry.first, entry.second + offset);
+            }
+            if (src.records > 0) {
+                if (merged->records == 0) merged->first_id = src.first_id;
+                merged->last_id = src.last_id;
+                merged->records += src.records;
+            }
+            offset += snapshot[k].size;
+        }
+        ok = ok && ::fdatasync(merged->fd) == 0 && merged->map(total);
+        merged->size = total;
+
+        if (ok) {
+            // A sealed segment still changes in the write batch that rolled past it
+            std::lock_guard<std::mutex> write_lock(write_mutex_);
+            std::unique_lock<std::shared_mutex> lock(mutex_);
+            auto first = std::find(segments_.begin(), segments_.end(), snapshot[i].seg);
+            ok = first != segments_.end() && static_cast<std::size_t>(segments_.end() - first) >= j - i;
+            for (std::size_t k = i; ok && k < j; ++k) {
+                ok = first[k - i] == snapshot[k].seg && snapshot[k].seg->size == snapshot[k].size;
+            }
+            ok = ok && ::rename(tmp.c_str(), target.c_str()) == 0;
+            if (ok) {
+                *first = merged;
+                segments_.erase(first + 1, first + static_cast<std::ptrdiff_t>(j - i));
+            }
+        }
+        if (!ok) {
+            LOG_WARN("Compacting log segments from {} abandoned", target);
+            ::unlink(tmp.c_str());
+        } else {
+            // A crash before these unlinks leaves segments the merged one overlaps; recovery drops them
+            for (std::size_t k = i + 1; k < j; ++k) {
+                ::unlink(snapshot[k].seg->path.c_str());
+            }
+            syncDir(dir_);
+            LOG_INFO("Compacted {} log segments ({} bytes) into {}", j - i, total, target);
+        }
+        i = j;
+    }
+}
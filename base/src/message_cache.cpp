@@ -0,0 +1,168 @@
+#include "message_cache.h"
+#include <algorithm>
+#include <mutex>
+
+namespace {
+
+bool byId(const ChatMessage* a, const ChatMessage* b) {
+    return a->id < b->id;
+}
+
+} // namespace
+
+std::string MessageCache::conversationKey(const std::string& a, const std::string& b) {
+    // '\n' cannot appear in a valid username
+    return a < b ? a + '\n' + b : b + '\n' + a;
+}
+
+void MessageCache::reset(std::size_t window, const std::vector<ChatMessage>& recent, bool complete) {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    window_ = window;
+    public_rings_.clear();
+    private_rings_.clear();
+    conversations_.clear();
+    warm_floor_ = 0;
+    if (window_ == 0) {
+        return;
+    }
+    if (!complete && !recent.empty()) {
+        warm_floor_ = recent.front().id - 1;
+    }
+    for (const auto& msg : recent) {
+        appendLocked(msg);
+    }
+}
+
+void MessageCache::append(const ChatMessage& msg) {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    if (window_ > 0) {
+        appendLocked(msg);
+    }
+}
+
+void MessageCache::appendLocked(const ChatMessage& msg) {
+    Ring* ring;
+    if (msg.target_user.empty()) {
+        ring = &public_rings_[msg.room_id];
+    } else {
+        std::string key = conversationKey(msg.username, msg.target_user);
+        auto it = private_rings_.find(key);
+        if (it == private_rings_.end()) {
+            it = private_rings_.emplace(key, Ring()).first;
+            conversations_[msg.username].push_back(key);
+            if (msg.target_user != msg.username) {
+                conversations_[msg.target_user].push_back(key);
+            }
+        }
+        ring = &it->second;
+    }
+    ring->messages.push_back(msg);
+    if (ring->messages.size() > window_) {
+        ring->evicted_id = ring->messages.front().id;
+        ring->messages.pop_front();
+        stats_.evictions.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+long long MessageCache::collect(const std::string& username, std::vector<const Ring*>& rings) const {
+    long long floor = warm_floor_;
+    rings.reserve(public_rings_.size());
+    for (const auto& [room, ring] : public_rings_) {
+        rings.push_back(&ring);
+        floor = std::max(floor, ring.evicted_id);
+    }
+    if (!username.empty()) {
+        auto it = conversations_.find(username);
+        if (it != conversations_.end()) {
+            for (const auto& key : it->second) {
+                const Ring& ring = private_rings_.at(key);
+                rings.push_back(&ring);
+                floor = std::max(floor, ring.evicted_id);
+            }
+        }
+    }
+    return floor;
+}
+
+bool MessageCache::messagesAfter(long long last_id, const std::string& username, int limit,
+                                 std::vector<ChatMessage>& out) const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    if (window_ == 0) {
+        return false;
+    }
+    std::vector<const Ring*> rings;
+    long long floor = collect(username, rings);
+    // Anything this query could return that is not in memory has an id <= floor
+    if (last_id < floor) {
+        stats_.misses.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    std::vector<const ChatMessage*> found;
+    for (const Ring* ring : rings) {
+        auto it = std::upper_bound(ring->messages.begin(), ring->messages.end(), last_id,
+                                   [](long long id, const ChatMessage& msg) { return id < msg.id; });
+        for (; it != ring->messages.end(); ++it) {
+            found.push_back(&*it);
+        }
+    }
+    std::size_t count = found.size();
+    if (limit > 0 && static_cast<std::size_t>(limit) < count) {
+        count = static_cast<std::size_t>(limit);
+        std::partial_sort(found.begin(), found.begin() + count, found.end(), byId);
+    } else {
+        std::sort(found.begin(), found.end(), byId);
+    }
+
+    out.clear();
+    out.reserve(count);
+    for (std::size_t i = 0; i < count; ++i) {
+        out.push_back(*found[i]);
+    }
+    stats_.hits.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+bool MessageCache::history(int limit, const std::string& username, std::vector<ChatMessage>& out) const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    if (window_ == 0 || limit <= 0) {
+        return false;
+    }
+    std::vector<const Ring*> rings;
+    long long floor = collect(username, rings);
+
+    // Only the newest `limit` of each ring can make the cut
+    std::vector<const ChatMessage*> found;
+    for (const Ring* ring : rings) {
+        std::size_t skip = ring->messages.size() > static_cast<std::size_t>(limit)
+                               ? ring->messages.size() - static_cast<std::size_t>(limit)
+                               : 0;
+        for (auto it = ring->messages.begin() + skip; it != ring->messages.end(); ++it) {
+            found.push_back(&*it);
+        }
+    }
+    std::size_t count = std::min(found.size(), static_cast<std::size_t>(limit));
+    auto newest_first = [](const ChatMessage* a, const ChatMessage* b) { return a->id > b->id; };
+    std::partial_sort(found.begin(), found.begin() + count, found.end(), newest_first);
+
+    // A short result is complete only if nothing was ever left out; a full one only if
+    // everything missing is older than its oldest message
+    bool complete = count < static_cast<std::size_t>(limit) ? floor == 0 : found[count - 1]->id > floor;
+    if (!complete) {
+        stats_.misses.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    out.clear();
+    out.reserve(count);
+    for (std::size_t i = count; i > 0; --i) {
+        out.push_back(*found[i - 1]);
+    }
+    stats_.hits.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+std::size_t MessageCache::window() const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    return window_;
+}
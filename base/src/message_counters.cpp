@@ -0,0 +1,58 @@
+#include "message_counters.h"
+#include <mutex>
+
+void MessageCounters::Delta::add(const ChatMessage& msg) {
+    ++total;
+    if (msg.target_user.empty()) ++rooms[msg.room_id];
+    ++users[msg.username];
+}
+
+MessageCounters::Delta MessageCounters::tally(const std::vector<ChatMessage>& msgs) {
+    Delta delta;
+    for (const auto& msg : msgs) delta.add(msg);
+    return delta;
+}
+
+std::vector<MessageCounters::Row> MessageCounters::Delta::rows() const {
+    std::vector<Row> out;
+    out.reserve(1 + rooms.size() + users.size());
+    out.push_back({"total", "", total});
+    for (const auto& [room, n] : rooms) out.push_back({"room", room, n});
+    for (const auto& [user, n] : users) out.push_back({"user", user, n});
+    return out;
+}
+
+void MessageCounters::load(const std::vector<Row>& rows) {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    total_ = 0;
+    rooms_.clear();
+    users_.clear();
+    for (const auto& row : rows) {
+        if (row.scope == "total") {
+            total_ = row.count;
+        } else if (row.scope == "room") {
+            rooms_[row.name] = row.count;
+        } else if (row.scope == "user") {
+            users_[row.name] = row.count;
+        }
+    }
+}
+
+void MessageCounters::apply(const Delta& delta) {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    for (const auto& [room, n] : delta.rooms) rooms_[room] += n;
+    for (const auto& [user, n] : delta.users) users_[user] += n;
+    total_ += delta.total;
+}
+
+long long MessageCounters::room(const std::string& room_id) const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    auto it = rooms_.find(room_id);
+    return it == rooms_.end() ? 0 : it->second;
+}
+
+long long MessageCounters::user(const std::string& username) const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    auto it = users_.find(username);
+    return it == users_.end() ? 0 : it->second;
+}
@@ -0,0 +1,141 @@
+#include "message_writer.h"
+#include "database.h"
+#include "logger.h"
+#include <algorithm>
+#include <utility>
+
+MessageWriter::MessageWriter(std::shared_ptr<Database> db, std::chrono::milliseconds interval,
+                             std::size_t max_batch, Stats& stats, CommitCallback on_commit)
+    : db_(std::move(db)),
+      interval_(interval),
+      max_batch_(std::max<std::size_t>(1, max_batch)),
+      stats_(stats),
+      on_commit_(std::move(on_commit)) {
+    tickets_.push_back(std::make_shared<Ticket>());
+    thread_ = std::thread([this]() { run(); });
+}
+
+MessageWriter::~MessageWriter() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    work_cv_.notify_one();
+    thread_.join();
+}
+
+std::shared_ptr<const MessageWriter::Ticket> MessageWriter::submit(const ChatMessage& msg) {
+    std::shared_ptr<const Ticket> ticket;
+    bool wake;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ticket = enqueueLocked(msg);
+        // The first message opens the gathering window; a full batch closes it early
+        wake = queue_.size() == 1 || queue_.size() == max_batch_;
+    }
+    stats_.queued.fetch_add(1, std::memory_order_relaxed);
+    if (wake) {
+        work_cv_.notify_one();
+    }
+    return ticket;
+}
+
+void MessageWriter::submit(const ChatMessage& msg, std::function<void(bool ok)> on_stored) {
+    bool wake;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        enqueueLocked(msg)->callbacks.push_back(std::move(on_stored));
+        wake = queue_.size() == 1 || queue_.size() == max_batch_;
+    }
+    stats_.queued.fetch_add(1, std::memory_order_relaxed);
+    if (wake) {
+        work_cv_.notify_one();
+    }
+}
+
+std::shared_ptr<MessageWriter::Ticket> MessageWriter::enqueueLocked(const ChatMessage& msg) {
+    // Each max_batch messages are stored in their own transaction and get their own ticket
+    if (queue_.size() == max_batch_ * tickets_.size()) {
+        tickets_.push_back(std::make_shared<Ticket>());
+    }
+    queue_.push_back(msg);
+    return tickets_.back();
+}
+
+bool MessageWriter::wait(const std::shared_ptr<const Ticket>& ticket) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_cv_.wait(lock, [&ticket]() { return ticket->done; });
+    return ticket->ok;
+}
+
+void MessageWriter::run() {
+    std::vector<ChatMessage> batch;
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        work_cv_.wait(lock, [this]() { return stop_ || !queue_.empty(); });
+        if (queue_.empty()) {
+            break; // stopping and fully drained
+        }
+        if (!stop_ && queue_.size() < max_batch_ && interval_.count() > 0) {
+            work_cv_.wait_for(lock, interval_, [this]() { return stop_ || queue_.size() >= max_batch_; });
+        }
+
+        batch.clear();
+        batch.swap(queue_);
+        // One ticket per chunk below
+        std::vector<std::shared_ptr<Ticket>> tickets;
+        tickets.swap(tickets_);
+        tickets_.push_back(std::make_shared<Ticket>());
+        lock.unlock();
+
+        std::vector<bool> results;
+        for (std::size_t begin = 0; begin < batch.size(); begin += max_batch_) {
+            std::size_t end = std::min(batch.size(), begin + max_batch_);
+            std::vector<ChatMessage> chunk(std::make_move_iterator(batch.begin() + begin),
+                                           std::make_move_iterator(batch.begin() + end));
+            bool ok = store(chunk);
+            if (ok && on_commit_) {
+                on_commit_(chunk);
+            }
+            results.push_back(ok);
+        }
+        stats_.queued.fetch_sub(batch.size(), std::memory_order_relaxed);
+
+        lock.lock();
+        std::vector<std::function<void(bool)>> callbacks;
+        std::vector<bool> callback_results;
+        for (std::size_t i = 0; i < tickets.size(); ++i) {
+            tickets[i]->ok = results[i];
+            tickets[i]->done = true;
+            for (auto& callback : tickets[i]->callbacks) {
+                callbacks.push_back(std::move(callback));
+                callback_results.push_back(results[i]);
+            }
+            tickets[i]->callbacks.clear();
+        }
+        done_cv_.notify_all();
+        if (!callbacks.empty()) {
+            lock.unlock();
+            for (std::size_t i = 0; i < callbacks.size(); ++i) {
+                callbacks[i](callback_results[i]);
+            }
+            lock.lock();
+        }
+    }
+}
+
+bool MessageWriter::store(const std::vector<ChatMessage>& batch) {
+    for (int attempt = 1; attempt <= kMaxAttempts; ++attempt) {
+        if (db_->addMessages(batch)) {
+            stats_.batches.fetch_add(1, std::memory_order_relaxed);
+            stats_.messages.fetch_add(batch.size(), std::memory_order_relaxed);
+            return true;
+        }
+        LOG_WARN("Storing {} messages failed (attempt {}/{})", batch.size(), attempt, kMaxAttempts);
+        std::this_thread::sleep_for(std::chrono::milliseconds(10 * attempt));
+    }
+    stats_.failures.fetch_add(1, std::memory_order_relaxed);
+    LOG_ERROR("Dropping {} messages (ids {}-{}) after {} failed attempts", batch.size(), batch.front().id,
+              batch.back().id, kMaxAttempts);
+    return false;
+}
@@ -1,6 +1,194 @@
 #include "mysql_database.h"
 #include "logger.h"
-#include <sstream>
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+
+namespace {
+
+// Schema changes on top of the tables created in init(), in order; the schema_version
+// table holds how many have been applied
+const std::vector<std::vector<const char*>> kMigrations = {
+    // 1: keyset-paginated history per room, per private conversation and per sender
+    {"CREATE INDEX idx_messages_room ON messages (room_id, id)",
+     "CREATE INDEX idx_messages_target ON messages (target_user, id)",
+     "CREATE INDEX idx_messages_username ON messages (username, id)"},
+    // 2: message counts maintained by the inserts, seeded from the existing rows
+    {"CREATE TABLE IF NOT EXISTS message_stats ("
+     "scope VARCHAR(8) NOT NULL,"
+     "name VARCHAR(255) CHARACTER SET utf8mb4 COLLATE utf8mb4_bin NOT NULL,"
+     "count BIGINT NOT NULL,"
+     "PRIMARY KEY (scope, name)"
+     ") ENGINE=InnoDB DEFAULT CHARSET=utf8mb4",
+     "INSERT IGNORE INTO message_stats SELECT 'total', '', COUNT(*) FROM messages",
+     "INSERT IGNORE INTO message_stats SELECT 'room', IFNULL(room_id, '') COLLATE utf8mb4_bin AS room, COUNT(*) "
+     "FROM messages WHERE target_user IS NULL OR target_user = '' GROUP BY room",
+     "INSERT IGNORE INTO message_stats SELECT 'user', username COLLATE utf8mb4_bin AS sender, COUNT(*) "
+     "FROM messages GROUP BY sender"},
+};
+
+constexpr unsigned int kErrDupKeyName = 1061; // ER_DUP_KEYNAME: index already exists
+
+using Clock = std::chrono::steady_clock;
+
+// Rows per multi-row INSERT statement; bounds the number of cached insert statements
+constexpr std::size_t kInsertRowsPerStatement = 100;
+
+// MySQL and MariaDB disagree on the flag type (bool vs my_bool)
+using NullFlag = std::remove_pointer_t<decltype(MYSQL_BIND::is_null)>;
+
+// Input parameters of one statement execution; values must outlive execute()
+class Params {
+public:
+    explicit Params(std::size_t count) : binds_(count), lengths_(count), integers_(count) {
+        std::memset(binds_.data(), 0, sizeof(MYSQL_BIND) * count);
+    }
+
+    void text(std::size_t i, const std::string& value) {
+        lengths_[i] = value.size();
+        binds_[i].buffer_type = MYSQL_TYPE_STRING;
+        binds_[i].buffer = const_cast<char*>(value.data());
+        binds_[i].buffer_length = value.size();
+        binds_[i].length = &lengths_[i];
+    }
+
+    // Empty strings are stored as NULL
+    void nullableText(std::size_t i, const std::string& value) {
+        if (value.empty()) {
+            binds_[i].buffer_type = MYSQL_TYPE_NULL;
+        } else {
+            text(i, value);
+        }
+    }
+
+    void integer(std::size_t i, long long value) {
+        integers_[i] = value;
+        binds_[i].buffer_type = MYSQL_TYPE_LONGLONG;
+        binds_[i].buffer = &integers_[i];
+    }
+
+    MYSQL_BIND* data() { return binds_.data(); }
+
+private:
+    std::vector<MYSQL_BIND> binds_;
+    std::vector<unsigned long> lengths_;
+    std::vector<long long> integers_;
+};
+
+// Reads every column of a statement's result set as text (the client library converts
+// numbers). Columns longer than the initial buffer are fetched again at full size.
+class ResultReader {
+public:
+    ResultReader(MYSQL_STMT* stmt, std::size_t columns)
+        : stmt_(stmt), binds_(columns), values_(columns, std::string(kInitialColumnBytes, '\0')),
+          lengths_(columns), nulls_(new NullFlag[columns]()) {
+        std::memset(binds_.data(), 0, sizeof(MYSQL_BIND) * columns);
+        for (std::size_t i = 0; i < columns; ++i) {
+            binds_[i].buffer_type = MYSQL_TYPE_STRING;
+            binds_[i].buffer = values_[i].data();
+            binds_[i].buffer_length = values_[i].size();
+            binds_[i].length = &lengths_[i];
+            binds_[i].is_null = &nulls_[i];
+        }
+        // Buffer the result so the connection is free again as soon as we are done
+        ok_ = mysql_stmt_bind_result(stmt_, binds_.data()) == 0 && mysql_stmt_store_result(stmt_) == 0;
+        if (!ok_) {
+            LOG_ERROR("MySQL result error: {}", mysql_stmt_error(stmt_));
+        }
+    }
+
+    ~ResultReader() { mysql_stmt_free_result(stmt_); }
+
+    ResultReader(const ResultReader&) = delete;
+    ResultReader& operator=(const ResultReader&) = delete;
+
+    // Advances to the next row; false at the end or on error
+    bool next() {
+        if (!ok_) return false;
+        int rc = mysql_stmt_fetch(stmt_);
+        if (rc == MYSQL_NO_DATA) return false;
+        if (rc == 1) {
+            LOG_ERROR("MySQL fetch error: {}", mysql_stmt_error(stmt_));
+            ok_ = false;
+            return false;
+        }
+        // Checked on every row: not every client library reports MYSQL_DATA_TRUNCATED
+        bool rebind = false;
+        for (std::size_t i = 0; i < binds_.size(); ++i) {
+            if (nulls_[i] || lengths_[i] <= values_[i].size()) continue;
+            values_[i].resize(lengths_[i]);
+            binds_[i].buffer = values_[i].data();
+            binds_[i].buffer_length = values_[i].size();
+            mysql_stmt_fetch_column(stmt_, &binds_[i], static_cast<unsigned int>(i), 0);
+            rebind = true;
+        }
+        if (rebind) {
+            mysql_stmt_bind_result(stmt_, binds_.data());
+        }
+        return true;
+    }
+
+    bool ok() const { return ok_; }
+    bool isNull(std::size_t i) const { return nulls_[i]; }
+    std::string text(std::size_t i) const {
+        return nulls_[i] ? std::string() : values_[i].substr(0, lengths_[i]);
+    }
+    long long integer(std::size_t i) const {
+        return nulls_[i] ? 0 : std::stoll(values_[i].substr(0, lengths_[i]));
+    }
+
+    // Row of (id, username, content, timestamp, target_user, room_id)
+    ChatMessage message() const {
+        ChatMessage msg;
+        msg.id = integer(0);
+        msg.username = text(1);
+        msg.content = text(2);
+        msg.timestamp = text(3);
+        msg.target_user = text(4);
+        msg.room_id = text(5);
+        return msg;
+    }
+
+private:
+    static constexpr std::size_t kInitialColumnBytes = 256;
+
+    MYSQL_STMT* stmt_;
+    std::vector<MYSQL_BIND> binds_;
+    std::vector<std::string> values_;
+    std::vector<unsigned long> lengths_;
+    std::unique_ptr<NullFlag[]> nulls_;
+    bool ok_ = false;
+};
+
+std::string insertSql(std::size_t rows) {
+    std::string sql = "INSERT INTO messages (id, username, content, timestamp, target_user, room_id) VALUES ";
+    for (std::size_t i = 0; i < rows; ++i) {
+        sql += i == 0 ? "(?,?,?,?,?,?)" : ",(?,?,?,?,?,?)";
+    }
+    return sql;
+}
+
+} // namespace
+
+struct MysqlDatabase::Connection {
+    MYSQL* mysql = nullptr;
+    std::unordered_map<std::string, MYSQL_STMT*> statements;
+    Clock::time_point last_used = Clock::now();
+    bool suspect = false;
+
+    ~Connection() {
+        for (auto& entry : statements) {
+            mysql_stmt_close(entry.second);
+        }
+        if (mysql) {
+            mysql_close(mysql);
+        }
+    }
+};
 
 class ConnectionGuard {
 public:
@@ -9,62 +197,78 @@ public:
     }
     ~ConnectionGuard() {
         if (conn_) {
-            db_->releaseConnection(conn_);
+            db_->releaseConnection(std::move(conn_), failed_);
+        }
+    }
+    MysqlDatabase::Connection* get() { return conn_.get(); }
+    // Prepares (or reuses) sql and executes it with params; nullptr on error
+    MYSQL_STMT* execute(const std::string& sql, Params* params) {
+        MYSQL_STMT* stmt = db_->prepare(*conn_, sql);
+        if (!stmt) {
+            failed_ = true;
+            return nullptr;
         }
+        if ((params && mysql_stmt_bind_param(stmt, params->data()) != 0) || mysql_stmt_execute(stmt) != 0) {
+            LOG_ERROR("MySQL statement error: {}", mysql_stmt_error(stmt));
+            failed_ = true;
+            return nullptr;
+        }
+        return stmt;
     }
-    MYSQL* get() { return conn_; }
+    void fail() { failed_ = true; }
 
 private:
     MysqlDatabase* db_;
-    MYSQL* conn_;
+    std::unique_ptr<MysqlDatabase::Connection> conn_;
+    bool failed_ = false;
 };
 
-MysqlDatabase::MysqlDatabase() : current_pool_size_(0), initialized_(false) {
+MysqlDatabase::MysqlDatabase(DatabasePoolStats* stats)
+    : current_pool_size_(0), initialized_(false), stats_(stats ? stats : &own_stats_) {
 }
 
 MysqlDatabase::~MysqlDatabase() {
     std::lock_guard<std::mutex> lock(pool_mutex_);
-    while (!connection_pool_.empty()) {
-        MYSQL* conn = connection_pool_.front();
-        connection_pool_.pop();
-        mysql_close(conn);
-    }
+    stats_->open.fetch_sub(static_cast<int64_t>(connection_pool_.size()));
+    connection_pool_.clear();
 }
 
-MYSQL* MysqlDatabase::createConnection() {
-    MYSQL* conn = mysql_init(nullptr);
-    if (!conn) {
+std::unique_ptr<MysqlDatabase::Connection> MysqlDatabase::createConnection() {
+    MYSQL* mysql = mysql_init(nullptr);
+    if (!mysql) {
         LOG_ERROR("MySQL init failed");
         return nullptr;
     }
 
     // Set timeout options
     unsigned int timeout = 5;
-    mysql_options(conn, MYSQL_OPT_CONNECT_TIMEOUT, &timeout);
-    bool reconnect = true;
-    mysql_options(conn, MYSQL_OPT_RECONNECT, &reconnect);
-
-    if (!mysql_real_connect(conn, config_.host.c_str(), config_.user.c_str(), 
-                           config_.password.c_str(), config_.db_name.c_str(), 
-                           config_.port, nullptr, 0)) {
-        LOG_ERROR("MySQL connection failed: {}", mysql_error(conn));
-        mysql_close(conn);
+    mysql_options(mysql, MYSQL_OPT_CONNECT_TIMEOUT, &timeout);
+
+    const char* socket = config_.socket.empty() ? nullptr : config_.socket.c_str();
+    if (!mysql_real_connect(mysql, socket ? "localhost" : config_.host.c_str(), config_.user.c_str(),
+                           config_.password.c_str(), config_.db_name.c_str(),
+                           config_.port, socket, 0)) {
+        LOG_ERROR("MySQL connection failed: {}", mysql_error(mysql));
+        mysql_close(mysql);
         return nullptr;
     }
+    auto conn = std::make_unique<Connection>();
+    conn->mysql = mysql;
+    stats_->open.fetch_add(1);
     return conn;
 }
 
 bool MysqlDatabase::init(const DatabaseConfig& config) {
     std::lock_guard<std::mutex> lock(pool_mutex_);
     if (initialized_) return true;
-    
+
     config_ = config;
-    
+
     // Create initial connections
     for (int i = 0; i < config.initial_size; ++i) {
-        MYSQL* conn = createConnection();
+        auto conn = createConnection();
         if (conn) {
-            connection_pool_.push(conn);
+            connection_pool_.push_back(std::move(conn));
             current_pool_size_++;
         } else {
             LOG_ERROR("Failed to create initial connection {}", i);
@@ -76,8 +280,8 @@ bool MysqlDatabase::init(const DatabaseConfig& config) {
     }
 
     // Use one connection to create table
-    MYSQL* conn = connection_pool_.front();
-    
+    MYSQL* conn = connection_pool_.front()->mysql;
+
     // Create table if not exists
     const char* sql = "CREATE TABLE IF NOT EXISTS messages ("
                       "id BIGINT PRIMARY KEY AUTO_INCREMENT,"
@@ -87,7 +291,7 @@ bool MysqlDatabase::init(const DatabaseConfig& config) {
                       "target_user VARCHAR(255),"
                       "room_id VARCHAR(255)"
                       ") ENGINE=InnoDB DEFAULT CHARSET=utf8mb4;";
-                      
+
     if (mysql_query(conn, sql)) {
         LOG_ERROR("MySQL create table error: {}", mysql_error(conn));
         return false;
@@ -98,7 +302,7 @@ bool MysqlDatabase::init(const DatabaseConfig& config) {
                            "username VARCHAR(255) NOT NULL UNIQUE,"
                            "password VARCHAR(255) NOT NULL"
                            ") ENGINE=InnoDB DEFAULT CHARSET=utf8mb4;";
-    
+
     if (mysql_query(conn, user_sql)) {
         LOG_ERROR("MySQL create users table error: {}", mysql_error(conn));
         return false;
@@ -107,390 +311,580 @@ bool MysqlDatabase::init(const DatabaseConfig& config) {
     // Attempt to add columns if they don't exist (migration for existing DB)
     // We ignore errors because if column exists, it will fail, which is fine.
     const char* alter_sql1 = "ALTER TABLE messages ADD COLUMN target_user VARCHAR(255);";
-    mysql_query(conn, alter_sql1); 
+    mysql_query(conn, alter_sql1);
 
     const char* alter_sql2 = "ALTER TABLE messages ADD COLUMN room_id VARCHAR(255);";
-    mysql_query(conn, alter_sql2); 
+    mysql_query(conn, alter_sql2);
+
+    if (!applyMigrations(conn) || !loadStats(conn)) {
+        return false;
+    }
 
     initialized_ = true;
     LOG_INFO("MySQL Database initialized successfully with {} connections", current_pool_size_);
     return true;
 }
 
-MYSQL* MysqlDatabase::getConnection() {
-    std::unique_lock<std::mutex> lock(pool_mutex_);
-    
-    while (connection_pool_.empty()) {
-        if (current_pool_size_ < config_.max_size) {
-            MYSQL* conn = createConnection();
-            if (conn) {
+bool MysqlDatabase::applyMigrations(MYSQL* mysql) {
+    if (mysql_query(mysql, "CREATE TABLE IF NOT EXISTS schema_version (version INT NOT NULL) ENGINE=InnoDB") ||
+        mysql_query(mysql, "INSERT INTO schema_version (version) SELECT 0 FROM DUAL "
+                           "WHERE NOT EXISTS (SELECT 1 FROM schema_version)") ||
+        mysql_query(mysql, "SELECT version FROM schema_version")) {
+        LOG_ERROR("MySQL schema_version error: {}", mysql_error(mysql));
+        return false;
+    }
+    int version = 0;
+    if (MYSQL_RES* res = mysql_store_result(mysql)) {
+        if (MYSQL_ROW row = mysql_fetch_row(res)) {
+            version = row[0] ? std::atoi(row[0]) : 0;
+        }
+        mysql_free_result(res);
+    }
+
+    const int latest = static_cast<int>(kMigrations.size());
+    if (version > latest) {
+        LOG_WARN("MySQL schema version {} is newer than this build knows ({})", version, latest);
+    }
+    // DDL commits implicitly, so each statement must tolerate having been applied by an
+    // interrupted earlier run
+    for (; version < latest; ++version) {
+        LOG_INFO("Migrating MySQL schema to version {}", version + 1);
+        for (const char* sql : kMigrations[version]) {
+            if (mysql_query(mysql, sql) && mysql_errno(mysql) != kErrDupKeyName) {
+                LOG_ERROR("MySQL migration {} failed ({}): {}", version + 1, sql, mysql_error(mysql));
+                return false;
+            }
+        }
+        std::string update = "UPDATE schema_version SET version = " + std::to_string(version + 1);
+        if (mysql_query(mysql, update.c_str())) {
+            LOG_ERROR("MySQL schema_version update failed: {}", mysql_error(mysql));
+            return false;
+        }
+    }
+    return true;
+}
+
+bool MysqlDatabase::loadStats(MYSQL* mysql) {
+    if (mysql_query(mysql, "SELECT scope, name, count FROM message_stats")) {
+        LOG_ERROR("MySQL message_stats error: {}", mysql_error(mysql));
+        return false;
+    }
+    std::vector<MessageCounters::Row> rows;
+    if (MYSQL_RES* res = mysql_store_result(mysql)) {
+        while (MYSQL_ROW row = mysql_fetch_row(res)) {
+            rows.push_back({row[0] ? row[0] : "", row[1] ? row[1] : "", row[2] ? std::atoll(row[2]) : 0});
+        }
+        mysql_free_result(res);
+    }
+    counters_.load(rows);
+    return true;
+}
+
+std::unique_ptr<MysqlDatabase::Connection> MysqlDatabase::getConnection() {
+    auto start = Clock::now();
+    std::unique_ptr<Connection> conn;
+    {
+        std::unique_lock<std::mutex> lock(pool_mutex_);
+        while (connection_pool_.empty()) {
+            if (current_pool_size_ < config_.max_size) {
+                // Connect outside the lock; the slot is reserved meanwhile
                 current_pool_size_++;
-                return conn;
+                lock.unlock();
+                conn = createConnection();
+                lock.lock();
+                if (conn) break;
+                current_pool_size_--;
+                return nullptr;
             }
-            // Failed to create, wait for others
+            pool_cv_.wait(lock);
         }
-        pool_cv_.wait(lock);
-    }
-    
-    MYSQL* conn = connection_pool_.front();
-    connection_pool_.pop();
-    
-    // Check connection health
-    if (mysql_ping(conn)) {
-        LOG_WARN("MySQL connection lost, attempting reconnect...");
-        mysql_close(conn);
-        conn = createConnection();
         if (!conn) {
-            current_pool_size_--;
-            return nullptr;
+            // Most recently used first: its statements and server-side buffers are warm
+            conn = std::move(connection_pool_.back());
+            connection_pool_.pop_back();
+        }
+    }
+
+    auto idle_limit = std::chrono::seconds(config_.health_check_idle_seconds);
+    if (conn->suspect || Clock::now() - conn->last_used >= idle_limit) {
+        stats_->health_checks.fetch_add(1, std::memory_order_relaxed);
+        if (mysql_ping(conn->mysql)) {
+            LOG_WARN("MySQL connection lost ({}), reconnecting", mysql_error(conn->mysql));
+            stats_->reconnects.fetch_add(1, std::memory_order_relaxed);
+            stats_->open.fetch_sub(1);
+            conn = createConnection();
+            if (!conn) {
+                std::lock_guard<std::mutex> lock(pool_mutex_);
+                current_pool_size_--;
+                pool_cv_.notify_one();
+                return nullptr;
+            }
         }
+        conn->suspect = false;
     }
-    
+
+    stats_->acquisitions.fetch_add(1, std::memory_order_relaxed);
+    stats_->wait_micros.fetch_add(
+        std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count(),
+        std::memory_order_relaxed);
+    stats_->in_use.fetch_add(1);
     return conn;
 }
 
-void MysqlDatabase::releaseConnection(MYSQL* conn) {
+void MysqlDatabase::releaseConnection(std::unique_ptr<Connection> conn, bool failed) {
     if (!conn) return;
-    
+    conn->last_used = Clock::now();
+    conn->suspect = conn->suspect || failed;
+    stats_->in_use.fetch_sub(1);
+
     std::lock_guard<std::mutex> lock(pool_mutex_);
-    connection_pool_.push(conn);
+    connection_pool_.push_back(std::move(conn));
     pool_cv_.notify_one();
 }
 
-bool MysqlDatabase::addMessage(const ChatMessage& msg) {
+MYSQL_STMT* MysqlDatabase::prepare(Connection& conn, const std::string& sql) {
+    auto it = conn.statements.find(sql);
+    if (it != conn.statements.end()) {
+        return it->second;
+    }
+    MYSQL_STMT* stmt = mysql_stmt_init(conn.mysql);
+    if (!stmt) {
+        LOG_ERROR("MySQL statement init failed: {}", mysql_error(conn.mysql));
+        return nullptr;
+    }
+    if (mysql_stmt_prepare(stmt, sql.data(), sql.size()) != 0) {
+        LOG_ERROR("MySQL prepare error: {}", mysql_stmt_error(stmt));
+        mysql_stmt_close(stmt);
+        return nullptr;
+    }
+    conn.statements.emplace(sql, stmt);
+    return stmt;
+}
+
+bool MysqlDatabase::addMessage(ChatMessage& msg) {
+    if (!initialized_) return false;
+
+    ConnectionGuard conn_guard(this);
+    if (!conn_guard.get()) return false;
+
+    // The row and its counts commit together
+    MYSQL* mysql = conn_guard.get()->mysql;
+    bool ok = mysql_autocommit(mysql, false) == 0;
+    long long id = 0;
+    if (ok) {
+        Params params(5);
+        params.text(0, msg.username);
+        params.text(1, msg.content);
+        params.text(2, msg.timestamp);
+        params.nullableText(3, msg.target_user);
+        params.nullableText(4, msg.room_id);
+        MYSQL_STMT* stmt = conn_guard.execute(
+            "INSERT INTO messages (username, content, timestamp, target_user, room_id) VALUES (?, ?, ?, ?, ?)", &params);
+        ok = stmt != nullptr;
+        if (ok) id = static_cast<long long>(mysql_stmt_insert_id(stmt));
+    }
+
+    MessageCounters::Delta delta = MessageCounters::tally({msg});
+    ok = ok && addStats(*conn_guard.get(), delta);
+    if (ok && mysql_commit(mysql) != 0) {
+        LOG_ERROR("MySQL commit error: {}", mysql_error(mysql));
+        ok = false;
+    }
+    if (ok) {
+        msg.id = id;
+        counters_.apply(delta);
+    } else {
+        mysql_rollback(mysql);
+        conn_guard.fail();
+    }
+    mysql_autocommit(mysql, true);
+    return ok;
+}
+
+bool MysqlDatabase::addStats(Connection& conn, const MessageCounters::Delta& delta) {
+    MYSQL_STMT* stmt = prepare(conn, "INSERT INTO message_stats (scope, name, count) VALUES (?, ?, ?) "
+                                     "ON DUPLICATE KEY UPDATE count = count + VALUES(count)");
+    if (!stmt) return false;
+
+    for (const auto& row : delta.rows()) {
+        Params params(3);
+        params.text(0, row.scope);
+        params.text(1, row.name);
+        params.integer(2, row.count);
+        if (mysql_stmt_bind_param(stmt, params.data()) != 0 || mysql_stmt_execute(stmt) != 0) {
+            LOG_ERROR("MySQL message_stats update error: {}", mysql_stmt_error(stmt));
+            return false;
+        }
+    }
+    return true;
+}
+
+bool MysqlDatabase::insertRows(Connection& conn, const ChatMessage* msgs, std::size_t count) {
+    MYSQL_STMT* stmt = prepare(conn, insertSql(count));
+    if (!stmt) return false;
+
+    Params params(count * 6);
+    for (std::size_t i = 0; i < count; ++i) {
+        const ChatMessage& msg = msgs[i];
+        params.integer(i * 6, msg.id);
+        params.text(i * 6 + 1, msg.username);
+        params.text(i * 6 + 2, msg.content);
+        params.text(i * 6 + 3, msg.timestamp);
+        params.nullableText(i * 6 + 4, msg.target_user);
+        params.nullableText(i * 6 + 5, msg.room_id);
+    }
+    if (mysql_stmt_bind_param(stmt, params.data()) != 0 || mysql_stmt_execute(stmt) != 0) {
+        LOG_ERROR("MySQL insert error: {}", mysql_stmt_error(stmt));
+        return false;
+    }
+    return true;
+}
+
+bool MysqlDatabase::addMessages(const std::vector<ChatMessage>& msgs) {
     if (!initialized_) return false;
-    
-    MYSQL* conn = getConnection();
+    if (msgs.empty()) return true;
+
+    ConnectionGuard conn_guard(this);
+    Connection* conn = conn_guard.get();
     if (!conn) return false;
 
-    char* escaped_username = new char[msg.username.length() * 2 + 1];
-    char* escaped_content = new char[msg.content.length() * 2 + 1];
-    char* escaped_timestamp = new char[msg.timestamp.length() * 2 + 1];
-    
-    mysql_real_escape_string(conn, escaped_username, msg.username.c_str(), msg.username.length());
-    mysql_real_escape_string(conn, escaped_content, msg.content.c_str(), msg.content.length());
-    mysql_real_escape_string(conn, escaped_timestamp, msg.timestamp.c_str(), msg.timestamp.length());
-
-    std::string target_val = "NULL";
-    if (!msg.target_user.empty()) {
-        char* escaped_target = new char[msg.target_user.length() * 2 + 1];
-        mysql_real_escape_string(conn, escaped_target, msg.target_user.c_str(), msg.target_user.length());
-        target_val = "'" + std::string(escaped_target) + "'";
-        delete[] escaped_target;
-    }
-
-    std::string room_val = "NULL";
-    if (!msg.room_id.empty()) {
-        char* escaped_room = new char[msg.room_id.length() * 2 + 1];
-        mysql_real_escape_string(conn, escaped_room, msg.room_id.c_str(), msg.room_id.length());
-        room_val = "'" + std::string(escaped_room) + "'";
-        delete[] escaped_room;
-    }
-
-    std::stringstream ss;
-    ss << "INSERT INTO messages (username, content, timestamp, target_user, room_id) VALUES ('"
-       << escaped_username << "', '"
-       << escaped_content << "', '"
-       << escaped_timestamp << "', "
-       << target_val << ", "
-       << room_val << ")";
-    
-    std::string sql = ss.str();
-    
-    delete[] escaped_username;
-    delete[] escaped_content;
-    delete[] escaped_timestamp;
-
-    bool success = true;
-    if (mysql_query(conn, sql.c_str())) {
-        LOG_ERROR("MySQL insert error: {}", mysql_error(conn));
-        success = false;
-    }
-    
-    releaseConnection(conn);
-    return success;
+    // Each chunk is one multi-row INSERT (one round trip); the transaction makes the
+    // whole batch atomic and costs a single log flush
+    bool ok = mysql_autocommit(conn->mysql, false) == 0;
+    for (std::size_t begin = 0; ok && begin < msgs.size(); begin += kInsertRowsPerStatement) {
+        std::size_t count = std::min(kInsertRowsPerStatement, msgs.size() - begin);
+        ok = insertRows(*conn, msgs.data() + begin, count);
+    }
+    MessageCounters::Delta delta = MessageCounters::tally(msgs);
+    ok = ok && addStats(*conn, delta);
+    if (ok && mysql_commit(conn->mysql) != 0) {
+        LOG_ERROR("MySQL commit error: {}", mysql_error(conn->mysql));
+        ok = false;
+    }
+    if (ok) {
+        counters_.apply(delta);
+    } else {
+        mysql_rollback(conn->mysql);
+        conn_guard.fail();
+    }
+    mysql_autocommit(conn->mysql, true);
+    return ok;
 }
 
 std::vector<ChatMessage> MysqlDatabase::getHistory(int limit, const std::string& username) {
     std::vector<ChatMessage> history;
     if (!initialized_) return history;
-    
-    MYSQL* conn = getConnection();
-    if (!conn) return history;
 
-    std::string where_clause;
+    ConnectionGuard conn_guard(this);
+    if (!conn_guard.get()) return history;
+
+    // Use specific columns to ensure order match
+    MYSQL_STMT* stmt;
     if (username.empty()) {
-        where_clause = " WHERE (target_user IS NULL OR target_user = '')";
+        Params params(1);
+        params.integer(0, limit);
+        stmt = conn_guard.execute("SELECT id, username, content, timestamp, target_user, room_id FROM ("
+                                  "SELECT * FROM messages WHERE (target_user IS NULL OR target_user = '') "
+                                  "ORDER BY id DESC LIMIT ?) AS sub ORDER BY id ASC", &params);
     } else {
-        char* escaped_user = new char[username.length() * 2 + 1];
-        mysql_real_escape_string(conn, escaped_user, username.c_str(), username.length());
-        std::string u(escaped_user);
-        delete[] escaped_user;
-        
-        where_clause = " WHERE (target_user IS NULL OR target_user = '' OR target_user = '" + u + "' OR username = '" + u + "')";
-    }
+        Params params(3);
+        params.text(0, username);
+        params.text(1, username);
+        params.integer(2, limit);
+        stmt = conn_guard.execute("SELECT id, username, content, timestamp, target_user, room_id FROM ("
+                                  "SELECT * FROM messages WHERE (target_user IS NULL OR target_user = '' "
+                                  "OR target_user = ? OR username = ?) ORDER BY id DESC LIMIT ?) AS sub ORDER BY id ASC",
+                                  &params);
+    }
+    if (!stmt) return history;
+
+    ResultReader rows(stmt, 6);
+    while (rows.next()) {
+        history.push_back(rows.message());
+    }
+    if (!rows.ok()) conn_guard.fail();
+    return history;
+}
 
-    // Use specific columns to ensure order match
-    std::string sql = "SELECT id, username, content, timestamp, target_user, room_id FROM ("
-                      "SELECT * FROM messages" + where_clause + " ORDER BY id DESC LIMIT " + std::to_string(limit) + ") "
-                      "AS sub ORDER BY id ASC";
+std::vector<ChatMessage> MysqlDatabase::getMessagesAfter(long long last_id, const std::string& username, int limit) {
+    std::vector<ChatMessage> history;
+    if (!initialized_) return history;
 
-    if (mysql_query(conn, sql.c_str())) {
-        LOG_ERROR("MySQL query error: {}", mysql_error(conn));
-        releaseConnection(conn);
-        return history;
-    }
+    ConnectionGuard conn_guard(this);
+    if (!conn_guard.get()) return history;
 
-    MYSQL_RES* res = mysql_store_result(conn);
-    if (!res) {
-        LOG_ERROR("MySQL store result error: {}", mysql_error(conn));
-        releaseConnection(conn);
-        return history;
-    }
+    // No limit is expressed as the largest LIMIT so one statement serves both cases
+    long long row_limit = limit > 0 ? limit : LLONG_MAX;
+    MYSQL_STMT* stmt;
+    if (username.empty()) {
+        Params params(2);
+        params.integer(0, last_id);
+        params.integer(1, row_limit);
+        stmt = conn_guard.execute("SELECT id, username, content, timestamp, target_user, room_id FROM messages "
+                                  "WHERE id > ? AND (target_user IS NULL OR target_user = '') ORDER BY id ASC LIMIT ?",
+                                  &params);
+    } else {
+        Params params(4);
+        params.integer(0, last_id);
+        params.text(1, username);
+        params.text(2, username);
+        params.integer(3, row_limit);
+        stmt = conn_guard.execute("SELECT id, username, content, timestamp, target_user, room_id FROM messages "
+                                  "WHERE id > ? AND (target_user IS NULL OR target_user = '' OR target_user = ? "
+                                  "OR username = ?) ORDER BY id ASC LIMIT ?",
+                                  &params);
+    }
+    if (!stmt) return history;
+
+    ResultReader rows(stmt, 6);
+    while (rows.next()) {
+        history.push_back(rows.message());
+    }
+    if (!rows.ok()) conn_guard.fail();
+    return history;
+}
 
-    MYSQL_ROW row;
-    while ((row = mysql_fetch_row(res))) {
-        ChatMessage msg;
-        msg.id = std::stoll(row[0]);
-        msg.username = row[1] ? row[1] : "";
-        msg.content = row[2] ? row[2] : "";
-        msg.timestamp = row[3] ? row[3] : "";
-        msg.target_user = row[4] ? row[4] : "";
-        msg.room_id = row[5] ? row[5] : "";
-        history.push_back(msg);
-    }
-    
-    mysql_free_result(res);
-    releaseConnection(conn);
+std::vector<ChatMessage> MysqlDatabase::getRoomHistory(const std::string& room_id, const HistoryCursor& cursor) {
+    std::vector<ChatMessage> history;
+    if (!initialized_ || cursor.limit <= 0) return history;
+
+    ConnectionGuard conn_guard(this);
+    if (!conn_guard.get()) return history;
+
+    // Walks idx_messages_room from the cursor in the direction of the page
+    bool forward = cursor.after > 0;
+    Params params(4);
+    params.text(0, room_id);
+    params.integer(1, cursor.after);
+    params.integer(2, cursor.before > 0 ? cursor.before : LLONG_MAX);
+    params.integer(3, cursor.limit);
+    MYSQL_STMT* stmt = conn_guard.execute(
+        forward ? "SELECT id, username, content, timestamp, target_user, room_id FROM messages "
+                  "WHERE room_id = ? AND id > ? AND id < ? AND (target_user IS NULL OR target_user = '') "
+                  "ORDER BY id ASC LIMIT ?"
+                : "SELECT id, username, content, timestamp, target_user, room_id FROM messages "
+                  "WHERE room_id = ? AND id > ? AND id < ? AND (target_user IS NULL OR target_user = '') "
+                  "ORDER BY id DESC LIMIT ?",
+        &params);
+    if (!stmt) return history;
+
+    ResultReader rows(stmt, 6);
+    while (rows.next()) {
+        history.push_back(rows.message());
+    }
+    if (!rows.ok()) conn_guard.fail();
+    if (!forward) std::reverse(history.begin(), history.end());
+    return history;
+}
+
+std::vector<ChatMessage> MysqlDatabase::getConversationHistory(const std::string& user_a, const std::string& user_b,
+                                                               const HistoryCursor& cursor) {
+    std::vector<ChatMessage> history;
+    if (!initialized_ || cursor.limit <= 0) return history;
+
+    ConnectionGuard conn_guard(this);
+    if (!conn_guard.get()) return history;
+
+    // One idx_messages_target range per direction, each capped at the page size
+    bool forward = cursor.after > 0;
+    long long before = cursor.before > 0 ? cursor.before : LLONG_MAX;
+    Params params(11);
+    params.text(0, user_a);
+    params.text(1, user_b);
+    params.integer(2, cursor.after);
+    params.integer(3, before);
+    params.integer(4, cursor.limit);
+    params.text(5, user_b);
+    params.text(6, user_a);
+    params.integer(7, cursor.after);
+    params.integer(8, before);
+    params.integer(9, cursor.limit);
+    params.integer(10, cursor.limit);
+    MYSQL_STMT* stmt = conn_guard.execute(
+        forward ? "(SELECT id, username, content, timestamp, target_user, room_id FROM messages "
+                  "WHERE target_user = ? AND username = ? AND id > ? AND id < ? ORDER BY id ASC LIMIT ?) "
+                  "UNION ALL "
+                  "(SELECT id, username, content, timestamp, target_user, room_id FROM messages "
+                  "WHERE target_user = ? AND username = ? AND id > ? AND id < ? ORDER BY id ASC LIMIT ?) "
+                  "ORDER BY id ASC LIMIT ?"
+                : "(SELECT id, username, content, timestamp, target_user, room_id FROM messages "
+                  "WHERE target_user = ? AND username = ? AND id > ? AND id < ? ORDER BY id DESC LIMIT ?) "
+                  "UNION ALL "
+                  "(SELECT id, username, content, timestamp, target_user, room_id FROM messages "
+                  "WHERE target_user = ? AND username = ? AND id > ? AND id < ? ORDER BY id DESC LIMIT ?) "
+                  "ORDER BY id DESC LIMIT ?",
+        &params);
+    if (!stmt) return history;
+
+    ResultReader rows(stmt, 6);
+    while (rows.next()) {
+        history.push_back(rows.message());
+    }
+    if (!rows.ok()) conn_guard.fail();
+    if (!forward) std::reverse(history.begin(), history.end());
+    // A conversation with oneself matches both directions
+    history.erase(std::unique(history.begin(), history.end(),
+                              [](const ChatMessage& x, const ChatMessage& y) { return x.id == y.id; }),
+                  history.end());
     return history;
 }
 
-std::vector<ChatMessage> MysqlDatabase::getMessagesAfter(long long last_id, const std::string& username) {
+std::vector<ChatMessage> MysqlDatabase::getRecentMessages(int limit) {
     std::vector<ChatMessage> history;
     if (!initialized_) return history;
-    
-    MYSQL* conn = getConnection();
-    if (!conn) return history;
 
-    std::string where_clause;
-    if (username.empty()) {
-        where_clause = " AND (target_user IS NULL OR target_user = '')";
-    } else {
-        char* escaped_user = new char[username.length() * 2 + 1];
-        mysql_real_escape_string(conn, escaped_user, username.c_str(), username.length());
-        std::string u(escaped_user);
-        delete[] escaped_user;
-        
-        where_clause = " AND (target_user IS NULL OR target_user = '' OR target_user = '" + u + "' OR username = '" + u + "')";
-    }
+    ConnectionGuard conn_guard(this);
+    if (!conn_guard.get()) return history;
 
-    std::string sql = "SELECT id, username, content, timestamp, target_user, room_id FROM messages WHERE id > " + 
-                      std::to_string(last_id) + where_clause + " ORDER BY id ASC";
+    Params params(1);
+    params.integer(0, limit);
+    MYSQL_STMT* stmt = conn_guard.execute("SELECT id, username, content, timestamp, target_user, room_id FROM ("
+                                          "SELECT * FROM messages ORDER BY id DESC LIMIT ?) AS sub ORDER BY id ASC",
+                                          &params);
+    if (!stmt) return history;
 
-    if (mysql_query(conn, sql.c_str())) {
-        LOG_ERROR("MySQL query error: {}", mysql_error(conn));
-        releaseConnection(conn);
-        return history;
+    ResultReader rows(stmt, 6);
+    while (rows.next()) {
+        history.push_back(rows.message());
     }
+    if (!rows.ok()) conn_guard.fail();
+    return history;
+}
+
+std::vector<ChatMessage> MysqlDatabase::scanMessages(long long after_id, int limit) {
+    std::vector<ChatMessage> page;
+    if (!initialized_ || limit <= 0) return page;
+
+    ConnectionGuard conn_guard(this);
+    if (!conn_guard.get()) return page;
+
+    Params params(2);
+    params.integer(0, after_id);
+    params.integer(1, limit);
+    MYSQL_STMT* stmt = conn_guard.execute("SELECT id, username, content, timestamp, target_user, room_id FROM messages "
+                                          "WHERE id > ? ORDER BY id ASC LIMIT ?",
+                                          &params);
+    if (!stmt) return page;
+
+    ResultReader rows(stmt, 6);
+    while (rows.next()) {
+        page.push_back(rows.message());
+    }
+    if (!rows.ok()) conn_guard.fail();
+    return page;
+}
 
-    MYSQL_RES* res = mysql_store_result(conn);
-    if (!res) {
-        LOG_ERROR("MySQL store result error: {}", mysql_error(conn));
-        releaseConnection(conn);
-        return history;
+std::vector<ChatMessage> MysqlDatabase::getMessagesByIds(const std::vector<long long>& ids) {
+    std::vector<ChatMessage> found;
+    if (!initialized_ || ids.empty()) return found;
+
+    ConnectionGuard conn_guard(this);
+    if (!conn_guard.get()) return found;
+
+    // One IN list per call; callers ask for a page of ids, so few statement shapes get cached
+    std::string sql = "SELECT id, username, content, timestamp, target_user, room_id FROM messages WHERE id IN (";
+    Params params(ids.size());
+    for (std::size_t i = 0; i < ids.size(); ++i) {
+        sql += i == 0 ? "?" : ",?";
+        params.integer(i, ids[i]);
     }
+    sql += ") ORDER BY id ASC";
+    MYSQL_STMT* stmt = conn_guard.execute(sql, &params);
+    if (!stmt) return found;
 
-    MYSQL_ROW row;
-    while ((row = mysql_fetch_row(res))) {
-        ChatMessage msg;
-        msg.id = std::stoll(row[0]);
-        msg.username = row[1] ? row[1] : "";
-        msg.content = row[2] ? row[2] : "";
-        msg.timestamp = row[3] ? row[3] : "";
-        msg.target_user = row[4] ? row[4] : "";
-        msg.room_id = row[5] ? row[5] : "";
-        history.push_back(msg);
-    }
-    
-    mysql_free_result(res);
-    releaseConnection(conn);
-    return history;
+    ResultReader rows(stmt, 6);
+    while (rows.next()) {
+        found.push_back(rows.message());
+    }
+    if (!rows.ok()) conn_guard.fail();
+    return found;
 }
 
 long long MysqlDatabase::getMessageCount() {
-    if (!initialized_) return 0;
-    
-    MYSQL* conn = getConnection();
-    if (!conn) return 0;
-    
-    if (mysql_query(conn, "SELECT COUNT(*) FROM messages")) {
-        releaseConnection(conn);
-        return 0;
-    }
-    
-    MYSQL_RES* res = mysql_store_result(conn);
-    if (!res) {
-        releaseConnection(conn);
-        return 0;
-    }
-    
-    long long count = 0;
-    MYSQL_ROW row = mysql_fetch_row(res);
-    if (row && row[0]) {
-        count = std::stoll(row[0]);
-    }
-    
-    mysql_free_result(res);
-    releaseConnection(conn);
-    return count;
+    return counters_.total();
+}
+
+long long MysqlDatabase::getRoomMessageCount(const std::string& room_id) {
+    return counters_.room(room_id);
+}
+
+long long MysqlDatabase::getUserMessageCount(const std::string& username) {
+    return counters_.user(username);
 }
 
 bool MysqlDatabase::addUser(const std::string& username, const std::string& password) {
     if (!initialized_) return false;
-    
-    MYSQL* conn = getConnection();
-    if (!conn) return false;
 
-    char* escaped_username = new char[username.length() * 2 + 1];
-    char* escaped_password = new char[password.length() * 2 + 1];
-    
-    mysql_real_escape_string(conn, escaped_username, username.c_str(), username.length());
-    mysql_real_escape_string(conn, escaped_password, password.c_str(), password.length());
-    
-    std::string sql = "INSERT INTO users (username, password) VALUES ('" + 
-                      std::string(escaped_username) + "', '" + 
-                      std::string(escaped_password) + "')";
-                      
-    delete[] escaped_username;
-    delete[] escaped_password;
-    
-    bool success = true;
-    if (mysql_query(conn, sql.c_str())) {
-        LOG_ERROR("MySQL insert user error: {}", mysql_error(conn));
-        success = false;
-    }
-    
-    releaseConnection(conn);
-    return success;
+    ConnectionGuard conn_guard(this);
+    if (!conn_guard.get()) return false;
+
+    Params params(2);
+    params.text(0, username);
+    params.text(1, password);
+    return conn_guard.execute("INSERT INTO users (username, password) VALUES (?, ?)", &params) != nullptr;
 }
 
 bool MysqlDatabase::validateUser(const std::string& username, const std::string& password) {
     if (!initialized_) return false;
-    
-    MYSQL* conn = getConnection();
-    if (!conn) return false;
 
-    char* escaped_username = new char[username.length() * 2 + 1];
-    mysql_real_escape_string(conn, escaped_username, username.c_str(), username.length());
-    
-    std::string sql = "SELECT password FROM users WHERE username = '" + std::string(escaped_username) + "'";
-    delete[] escaped_username;
-    
-    if (mysql_query(conn, sql.c_str())) {
-        LOG_ERROR("MySQL query user error: {}", mysql_error(conn));
-        releaseConnection(conn);
-        return false;
-    }
-    
-    MYSQL_RES* res = mysql_store_result(conn);
-    if (!res) {
-        releaseConnection(conn);
-        return false;
-    }
-    
-    bool valid = false;
-    MYSQL_ROW row = mysql_fetch_row(res);
-    if (row && row[0]) {
-        if (password == std::string(row[0])) {
-            valid = true;
-        }
-    }
-    
-    mysql_free_result(res);
-    releaseConnection(conn);
-    return valid;
+    ConnectionGuard conn_guard(this);
+    if (!conn_guard.get()) return false;
+
+    Params params(1);
+    params.text(0, username);
+    MYSQL_STMT* stmt = conn_guard.execute("SELECT password FROM users WHERE username = ?", &params);
+    if (!stmt) return false;
+
+    ResultReader rows(stmt, 1);
+    return rows.next() && !rows.isNull(0) && rows.text(0) == password;
 }
 
 bool MysqlDatabase::userExists(const std::string& username) {
+    if (!initialized_) return false;
+
     ConnectionGuard conn_guard(this);
-    MYSQL* conn = conn_guard.get();
-    if (!conn) return false;
+    if (!conn_guard.get()) return false;
 
-    std::stringstream ss;
-    char escaped_username[512];
-    mysql_real_escape_string(conn, escaped_username, username.c_str(), username.length());
-    
-    ss << "SELECT COUNT(*) FROM users WHERE username = '" << escaped_username << "'";
-    
-    if (mysql_query(conn, ss.str().c_str())) {
-        return false;
-    }
-    
-    MYSQL_RES* result = mysql_store_result(conn);
-    if (!result) return false;
-    
-    bool exists = false;
-    MYSQL_ROW row = mysql_fetch_row(result);
-    if (row) {
-        exists = std::stoll(row[0]) > 0;
-    }
-    
-    mysql_free_result(result);
-    return exists;
+    Params params(1);
+    params.text(0, username);
+    MYSQL_STMT* stmt = conn_guard.execute("SELECT COUNT(*) FROM users WHERE username = ?", &params);
+    if (!stmt) return false;
+
+    ResultReader rows(stmt, 1);
+    return rows.next() && rows.integer(0) > 0;
 }
 
 long long MysqlDatabase::getUserId(const std::string& username) {
+    if (!initialized_) return -1;
+
     ConnectionGuard conn_guard(this);
-    MYSQL* conn = conn_guard.get();
-    if (!conn) return -1;
-
-    std::stringstream ss;
-    char escaped_username[512];
-    mysql_real_escape_string(conn, escaped_username, username.c_str(), username.length());
-    
-    ss << "SELECT id FROM users WHERE username = '" << escaped_username << "'";
-    
-    if (mysql_query(conn, ss.str().c_str())) {
-        return -1;
-    }
-    
-    MYSQL_RES* result = mysql_store_result(conn);
-    if (!result) return -1;
-    
-    long long id = -1;
-    MYSQL_ROW row = mysql_fetch_row(result);
-    if (row) {
-        id = std::stoll(row[0]);
-    }
-    
-    mysql_free_result(result);
-    return id;
+    if (!conn_guard.get()) return -1;
+
+    Params params(1);
+    params.text(0, username);
+    MYSQL_STMT* stmt = conn_guard.execute("SELECT id FROM users WHERE username = ?", &params);
+    if (!stmt) return -1;
+
+    ResultReader rows(stmt, 1);
+    return rows.next() ? rows.integer(0) : -1;
 }
 
 std::vector<std::pair<std::string, long long>> MysqlDatabase::getAllUsers() {
-    ConnectionGuard conn_guard(this);
-    MYSQL* conn = conn_guard.get();
     std::vector<std::pair<std::string, long long>> users;
-    if (!conn) return users;
+    if (!initialized_) return users;
 
-    std::string sql = "SELECT username, id FROM users ORDER BY username ASC";
-    if (mysql_query(conn, sql.c_str())) {
-        LOG_ERROR("Failed to execute query: {}", mysql_error(conn));
-        return users;
-    }
+    ConnectionGuard conn_guard(this);
+    if (!conn_guard.get()) return users;
 
-    MYSQL_RES* res = mysql_store_result(conn);
-    if (!res) return users;
+    MYSQL_STMT* stmt = conn_guard.execute("SELECT username, id FROM users ORDER BY username ASC", nullptr);
+    if (!stmt) return users;
 
-    MYSQL_ROW row;
-    while ((row = mysql_fetch_row(res))) {
-        if (row[0]) {
-            std::string name = row[0];
-            long long id = row[1] ? std::stoll(row[1]) : 0;
-            users.emplace_back(name, id);
+    ResultReader rows(stmt, 2);
+    while (rows.next()) {
+        if (!rows.isNull(0)) {
+            users.emplace_back(rows.text(0), rows.integer(1));
         }
     }
-
-    mysql_free_result(res);
+    if (!rows.ok()) conn_guard.fail();
     return users;
 }
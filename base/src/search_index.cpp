@@ -0,0 +1,275 @@
+#include "search_index.h"
+#include <algorithm>
+#include <cctype>
+#include <climits>
+#include <cmath>
+#include <mutex>
+
+namespace {
+
+constexpr double kK1 = 1.2; // BM25 term frequency saturation
+constexpr double kB = 0.75; // BM25 length normalization
+constexpr std::size_t kMaxTokenBytes = 64;
+constexpr int kTimeDigits = 14; // YYYYMMDDhhmmss
+
+bool isCjk(uint32_t cp) {
+    return (cp >= 0x3040 && cp <= 0x30FF) ||   // Hiragana, Katakana
+           (cp >= 0x3400 && cp <= 0x4DBF) ||   // CJK Extension A
+           (cp >= 0x4E00 && cp <= 0x9FFF) ||   // CJK Unified Ideographs
+           (cp >= 0xAC00 && cp <= 0xD7AF) ||   // Hangul syllables
+           (cp >= 0xF900 && cp <= 0xFAFF) ||   // CJK Compatibility Ideographs
+           (cp >= 0x20000 && cp <= 0x2FFFF);   // CJK Extensions B and later
+}
+
+bool isSeparator(uint32_t cp) {
+    return (cp >= 0x2000 && cp <= 0x206F) ||   // General punctuation
+           (cp >= 0x3000 && cp <= 0x303F) ||   // CJK symbols and punctuation
+           (cp >= 0xFE30 && cp <= 0xFE4F) ||   // CJK compatibility forms
+           (cp >= 0xFF00 && cp <= 0xFFEF);     // Full-width forms
+}
+
+// Decodes the UTF-8 sequence at text[i], returning its length (0 if malformed)
+std::size_t decodeUtf8(const std::string& text, std::size_t i, uint32_t& cp) {
+    auto byte = [&](std::size_t k) { return static_cast<uint8_t>(text[k]); };
+    uint8_t lead = byte(i);
+    std::size_t len = lead >= 0xF0 && lead < 0xF8 ? 4 : lead >= 0xE0 ? 3 : lead >= 0xC0 ? 2 : 0;
+    if (len == 0 || i + len > text.size()) return 0;
+    cp = lead & (0x7F >> len);
+    for (std::size_t k = 1; k < len; ++k) {
+        if ((byte(i + k) & 0xC0) != 0x80) return 0;
+        cp = (cp << 6) | (byte(i + k) & 0x3F);
+    }
+    return len;
+}
+
+void putVarint(std::string& out, uint32_t v) {
+    while (v >= 0x80) {
+        out.push_back(static_cast<char>(v | 0x80));
+        v >>= 7;
+    }
+    out.push_back(static_cast<char>(v));
+}
+
+uint32_t getVarint(const char*& p) {
+    uint32_t v = 0;
+    for (int shift = 0;; shift += 7) {
+        uint8_t byte = static_cast<uint8_t>(*p++);
+        v |= static_cast<uint32_t>(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return v;
+    }
+}
+
+// The digits of a timestamp as a number, padded to kTimeDigits with `pad`
+long long timeKey(const std::string& timestamp, char pad) {
+    std::string digits;
+    for (char c : timestamp) {
+        if (c >= '0' && c <= '9' && digits.size() < kTimeDigits) digits.push_back(c);
+    }
+    if (digits.empty()) return pad == '0' ? 0 : LLONG_MAX;
+    digits.resize(kTimeDigits, pad);
+    return std::stoll(digits);
+}
+
+} // namespace
+
+std::vector<std::string> SearchIndex::tokenize(const std::string& text, bool query) {
+    std::vector<std::string> tokens;
+    std::string word;
+    std::vector<std::string> run; // consecutive CJK characters
+
+    auto flushWord = [&]() {
+        if (!word.empty()) tokens.push_back(word.substr(0, kMaxTokenBytes));
+        word.clear();
+    };
+    auto flushRun = [&]() {
+        if (!query || run.size() == 1) {
+            tokens.insert(tokens.end(), run.begin(), run.end());
+        }
+        for (std::size_t k = 0; k + 1 < run.size(); ++k) {
+            tokens.push_back(run[k] + run[k + 1]);
+        }
+        run.clear();
+    };
+
+    for (std::size_t i = 0; i < text.size();) {
+        unsigned char c = static_cast<unsigned char>(text[i]);
+        if (c < 0x80) {
+            flushRun();
+            if (std::isalnum(c)) {
+                word.push_back(static_cast<char>(std::tolower(c)));
+            } else {
+                flushWord();
+            }
+            ++i;
+            continue;
+        }
+        uint32_t cp = 0;
+        std::size_t len = decodeUtf8(text, i, cp);
+        if (len == 0) {
+            flushWord();
+            flushRun();
+            ++i;
+        } else if (isCjk(cp)) {
+            flushWord();
+            run.push_back(text.substr(i, len));
+            i += len;
+        } else if (isSeparator(cp)) {
+            flushWord();
+            flushRun();
+            i += len;
+        } else {
+            flushRun();
+            word.append(text, i, len);
+            i += len;
+        }
+    }
+    flushWord();
+    flushRun();
+
+    if (query) {
+        std::sort(tokens.begin(), tokens.end());
+        tokens.erase(std::unique(tokens.begin(), tokens.end()), tokens.end());
+    }
+    return tokens;
+}
+
+void SearchIndex::clear() {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    docs_.clear();
+    postings_.clear();
+    names_.clear();
+    names_.emplace("", 0);
+    total_length_ = 0;
+    stats_.documents = 0;
+    stats_.terms = 0;
+    stats_.posting_bytes = 0;
+}
+
+uint32_t SearchIndex::intern(const std::string& name) {
+    if (names_.empty()) names_.emplace("", 0);
+    return names_.emplace(name, static_cast<uint32_t>(names_.size())).first->second;
+}
+
+uint32_t SearchIndex::lookup(const std::string& name) const {
+    auto it = names_.find(name);
+    return it == names_.end() ? UINT32_MAX : it->second;
+}
+
+void SearchIndex::add(const ChatMessage& msg) {
+    std::vector<std::string> tokens = tokenize(msg.content);
+    // Equal tokens end up adjacent: each run is one term and its frequency
+    std::sort(tokens.begin(), tokens.end());
+
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    uint32_t ord = static_cast<uint32_t>(docs_.size());
+    docs_.push_back({msg.id, timeKey(msg.timestamp, '0'), intern(msg.room_id), intern(msg.username),
+                     intern(msg.target_user), static_cast<uint32_t>(tokens.size())});
+    total_length_ += tokens.size();
+
+    std::size_t bytes = 0;
+    for (std::size_t i = 0; i < tokens.size();) {
+        std::size_t j = i;
+        while (j < tokens.size() && tokens[j] == tokens[i]) ++j;
+        auto [it, inserted] = postings_.try_emplace(tokens[i]);
+        Posting& posting = it->second;
+        std::size_t before = posting.data.size();
+        putVarint(posting.data, ord - posting.last);
+        putVarint(posting.data, static_cast<uint32_t>(j - i));
+        posting.last = ord;
+        ++posting.docs;
+        bytes += posting.data.size() - before + (inserted ? it->first.size() : 0);
+        if (inserted) stats_.terms++;
+        i = j;
+    }
+    stats_.documents++;
+    stats_.posting_bytes += bytes;
+}
+
+std::vector<SearchIndex::Hit> SearchIndex::search(const Query& query) const {
+    stats_.queries++;
+    std::vector<Hit> hits;
+    std::vector<std::string> terms = tokenize(query.text, true);
+    if (terms.empty() || query.limit <= 0) return hits;
+
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    std::vector<const Posting*> lists;
+    for (const auto& term : terms) {
+        auto it = postings_.find(term);
+        if (it == postings_.end()) return hits;
+        lists.push_back(&it->second);
+    }
+    // Rarest first: it bounds the candidates every other list is merged against
+    std::sort(lists.begin(), lists.end(), [](const Posting* a, const Posting* b) { return a->docs < b->docs; });
+
+    uint32_t viewer = query.viewer.empty() ? UINT32_MAX : lookup(query.viewer);
+    uint32_t room = UINT32_MAX;
+    if (query.room) {
+        room = lookup(*query.room);
+        if (room == UINT32_MAX) return hits;
+    }
+    uint32_t sender = UINT32_MAX;
+    if (!query.sender.empty()) {
+        sender = lookup(query.sender);
+        if (sender == UINT32_MAX) return hits;
+    }
+    long long start = query.start.empty() ? 0 : timeKey(query.start, '0');
+    long long end = query.end.empty() ? LLONG_MAX : timeKey(query.end, '9');
+
+    double n = static_cast<double>(docs_.size());
+    double avg_length = std::max(1.0, static_cast<double>(total_length_) / n);
+    auto score = [&](const Posting* list, uint32_t tf, uint32_t length) {
+        double df = list->docs;
+        double idf = std::log(1.0 + (n - df + 0.5) / (df + 0.5));
+        return idf * tf * (kK1 + 1) / (tf + kK1 * (1 - kB + kB * length / avg_length));
+    };
+
+    struct Candidate {
+        uint32_t ord;
+        double score;
+    };
+    std::vector<Candidate> candidates;
+    const char* p = lists[0]->data.data();
+    const char* end_of_list = p + lists[0]->data.size();
+    for (uint32_t ord = 0; p < end_of_list;) {
+        ord += getVarint(p);
+        uint32_t tf = getVarint(p);
+        const Doc& doc = docs_[ord];
+        if (doc.target != 0 && (viewer == UINT32_MAX || (doc.target != viewer && doc.sender != viewer))) continue;
+        if (query.room && (doc.room != room || doc.target != 0)) continue;
+        if (sender != UINT32_MAX && doc.sender != sender) continue;
+        if (doc.time < start || doc.time > end) continue;
+        candidates.push_back({ord, score(lists[0], tf, doc.length)});
+    }
+
+    for (std::size_t k = 1; k < lists.size() && !candidates.empty(); ++k) {
+        const char* q = lists[k]->data.data();
+        const char* q_end = q + lists[k]->data.size();
+        std::size_t kept = 0;
+        uint32_t ord = 0;
+        for (std::size_t c = 0; c < candidates.size() && q < q_end;) {
+            uint32_t next = ord + getVarint(q);
+            uint32_t tf = getVarint(q);
+            ord = next;
+            while (c < candidates.size() && candidates[c].ord < ord) ++c;
+            if (c < candidates.size() && candidates[c].ord == ord) {
+                candidates[kept] = candidates[c];
+                candidates[kept].score += score(lists[k], tf, docs_[ord].length);
+                ++kept;
+                ++c;
+            }
+        }
+        candidates.resize(kept);
+    }
+
+    auto better = [](const Candidate& a, const Candidate& b) {
+        return a.score != b.score ? a.score > b.score : a.ord > b.ord;
+    };
+    std::size_t k = std::min(candidates.size(), static_cast<std::size_t>(query.limit));
+    std::partial_sort(candidates.begin(), candidates.begin() + static_cast<std::ptrdiff_t>(k), candidates.end(),
+                      better);
+    hits.reserve(k);
+    for (std::size_t i = 0; i < k; ++i) {
+        hits.push_back({docs_[candidates[i].ord].id, candidates[i].score});
+    }
+    return hits;
+}
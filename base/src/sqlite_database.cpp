@@ -1,16 +1,198 @@
 #include "sqlite_database.h"
 #include "logger.h"
 #include <sqlite3.h>
-#include <iostream>
+#include <algorithm>
+#include <climits>
+#include <iterator>
+#include <string>
+#include <unordered_map>
+
+namespace {
+
+constexpr int kBusyTimeoutMs = 5000;
+
+// Schema changes on top of the tables created in init(), in order; PRAGMA user_version
+// holds how many have been applied
+const char* const kMigrations[] = {
+    // 1: keyset-paginated history per room, per private conversation and per sender
+    "CREATE INDEX IF NOT EXISTS idx_messages_room ON messages (room_id, id);"
+    "CREATE INDEX IF NOT EXISTS idx_messages_target ON messages (target_user, id);"
+    "CREATE INDEX IF NOT EXISTS idx_messages_username ON messages (username, id);",
+    // 2: message counts maintained by the inserts, seeded from the existing rows
+    "CREATE TABLE IF NOT EXISTS message_stats ("
+    "scope TEXT NOT NULL, name TEXT NOT NULL, count INTEGER NOT NULL, PRIMARY KEY (scope, name)"
+    ") WITHOUT ROWID;"
+    "INSERT INTO message_stats SELECT 'total', '', COUNT(*) FROM messages;"
+    "INSERT INTO message_stats SELECT 'room', IFNULL(room_id, ''), COUNT(*) FROM messages "
+    "WHERE target_user IS NULL OR target_user = '' GROUP BY IFNULL(room_id, '');"
+    "INSERT INTO message_stats SELECT 'user', username, COUNT(*) FROM messages GROUP BY username;",
+};
+
+// Binds username, content, timestamp, target_user, room_id starting at parameter `first`
+void bindMessage(sqlite3_stmt* stmt, const ChatMessage& msg, int first) {
+    sqlite3_bind_text(stmt, first, msg.username.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, first + 1, msg.content.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, first + 2, msg.timestamp.c_str(), -1, SQLITE_STATIC);
 
-SqliteDatabase::SqliteDatabase() : db_(nullptr), initialized_(false) {}
+    if (msg.target_user.empty()) {
+        sqlite3_bind_null(stmt, first + 3);
+    } else {
+        sqlite3_bind_text(stmt, first + 3, msg.target_user.c_str(), -1, SQLITE_STATIC);
+    }
 
-SqliteDatabase::~SqliteDatabase() {
-    if (db_) {
-        sqlite3_close(db_);
+    if (msg.room_id.empty()) {
+        sqlite3_bind_null(stmt, first + 4);
+    } else {
+        sqlite3_bind_text(stmt, first + 4, msg.room_id.c_str(), -1, SQLITE_STATIC);
     }
 }
 
+// Reads a row of (id, username, content, timestamp, target_user, room_id)
+ChatMessage readMessage(sqlite3_stmt* stmt) {
+    ChatMessage msg;
+    msg.id = sqlite3_column_int64(stmt, 0);
+    msg.username = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
+    msg.content = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 2));
+    msg.timestamp = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 3));
+
+    const char* target = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 4));
+    msg.target_user = target ? target : "";
+
+    const char* room = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 5));
+    msg.room_id = room ? room : "";
+    return msg;
+}
+
+// Explicit setting wins; otherwise only the fsync durability mode needs every commit
+// on disk before it is acknowledged
+std::string synchronousLevel(const DatabaseConfig& config) {
+    const std::string& level = config.sqlite_synchronous;
+    if (level == "OFF" || level == "NORMAL" || level == "FULL" || level == "EXTRA") {
+        return level;
+    }
+    if (!level.empty()) {
+        LOG_WARN("Unknown sqlite synchronous level '{}', deriving it from durability", level);
+    }
+    return config.durability == "fsync" ? "FULL" : "NORMAL";
+}
+
+} // namespace
+
+class SqliteDatabase::Connection {
+public:
+    Connection(sqlite3* db, bool cache_statements) : db_(db), cache_statements_(cache_statements) {}
+
+    ~Connection() {
+        for (auto& entry : statements_) {
+            sqlite3_finalize(entry.second);
+        }
+        sqlite3_close(db_);
+    }
+
+    sqlite3* handle() const { return db_; }
+
+    // Ready-to-bind statement for sql, nullptr on error
+    sqlite3_stmt* prepare(const char* sql) {
+        if (cache_statements_) {
+            auto it = statements_.find(sql);
+            if (it != statements_.end()) {
+                return it->second;
+            }
+        }
+        sqlite3_stmt* stmt = nullptr;
+        if (sqlite3_prepare_v2(db_, sql, -1, &stmt, 0) != SQLITE_OK) {
+            LOG_ERROR("Failed to prepare statement: {}", sqlite3_errmsg(db_));
+            return nullptr;
+        }
+        if (cache_statements_) {
+            statements_.emplace(sql, stmt);
+        }
+        return stmt;
+    }
+
+    void release(sqlite3_stmt* stmt) {
+        if (cache_statements_) {
+            sqlite3_reset(stmt);
+            // Bindings point into caller strings that are about to go away
+            sqlite3_clear_bindings(stmt);
+        } else {
+            sqlite3_finalize(stmt);
+        }
+    }
+
+    bool exec(const char* sql) {
+        char* err = nullptr;
+        if (sqlite3_exec(db_, sql, 0, 0, &err) != SQLITE_OK) {
+            LOG_ERROR("SQL error ({}): {}", sql, err ? err : sqlite3_errmsg(db_));
+            sqlite3_free(err);
+            return false;
+        }
+        return true;
+    }
+
+private:
+    sqlite3* db_;
+    bool cache_statements_;
+    std::unordered_map<std::string, sqlite3_stmt*> statements_;
+};
+
+class SqliteDatabase::Statement {
+public:
+    Statement(Connection& conn, const char* sql) : conn_(conn), stmt_(conn.prepare(sql)) {}
+    ~Statement() {
+        if (stmt_) conn_.release(stmt_);
+    }
+
+    Statement(const Statement&) = delete;
+    Statement& operator=(const Statement&) = delete;
+
+    explicit operator bool() const { return stmt_ != nullptr; }
+    sqlite3_stmt* get() const { return stmt_; }
+
+private:
+    Connection& conn_;
+    sqlite3_stmt* stmt_;
+};
+
+class SqliteDatabase::ReadLease {
+public:
+    explicit ReadLease(SqliteDatabase& db) : db_(db) {
+        if (db_.readers_.empty()) {
+            writer_lock_ = std::unique_lock<std::mutex>(db_.mutex_);
+            conn_ = db_.writer_.get();
+            return;
+        }
+        std::unique_lock<std::mutex> lock(db_.pool_mutex_);
+        db_.pool_cv_.wait(lock, [this]() { return !db_.idle_readers_.empty(); });
+        conn_ = db_.idle_readers_.back();
+        db_.idle_readers_.pop_back();
+    }
+
+    ~ReadLease() {
+        if (writer_lock_.owns_lock()) return;
+        {
+            std::lock_guard<std::mutex> lock(db_.pool_mutex_);
+            db_.idle_readers_.push_back(conn_);
+        }
+        db_.pool_cv_.notify_one();
+    }
+
+    ReadLease(const ReadLease&) = delete;
+    ReadLease& operator=(const ReadLease&) = delete;
+
+    // nullptr before init
+    Connection* get() const { return conn_; }
+
+private:
+    SqliteDatabase& db_;
+    std::unique_lock<std::mutex> writer_lock_;
+    Connection* conn_ = nullptr;
+};
+
+SqliteDatabase::SqliteDatabase() : initialized_(false) {}
+
+SqliteDatabase::~SqliteDatabase() = default;
+
 bool SqliteDatabase::init(const DatabaseConfig& config) {
     std::lock_guard<std::mutex> lock(mutex_);
     if (initialized_) return true;
@@ -18,11 +200,15 @@ bool SqliteDatabase::init(const DatabaseConfig& config) {
     std::string db_path = config.path;
     if (db_path.empty()) db_path = "chatroom.db";
 
-    int rc = sqlite3_open(db_path.c_str(), &db_);
+    sqlite3* handle = nullptr;
+    int rc = sqlite3_open(db_path.c_str(), &handle);
     if (rc) {
-        LOG_ERROR("Can't open database: {}", sqlite3_errmsg(db_));
+        LOG_ERROR("Can't open database: {}", sqlite3_errmsg(handle));
+        sqlite3_close(handle);
         return false;
     }
+    writer_ = std::make_unique<Connection>(handle, config.sqlite_statement_cache);
+    sqlite3_busy_timeout(handle, kBusyTimeoutMs);
 
     const char* sql = "CREATE TABLE IF NOT EXISTS messages ("
                       "id INTEGER PRIMARY KEY AUTOINCREMENT,"
@@ -32,12 +218,7 @@ bool SqliteDatabase::init(const DatabaseConfig& config) {
                       "target_user TEXT,"
                       "room_id TEXT"
                       ");";
-
-    char* zErrMsg = 0;
-    rc = sqlite3_exec(db_, sql, 0, 0, &zErrMsg);
-    if (rc != SQLITE_OK) {
-        LOG_ERROR("SQL error (create messages): {}", zErrMsg);
-        sqlite3_free(zErrMsg);
+    if (!writer_->exec(sql)) {
         return false;
     }
 
@@ -46,311 +227,475 @@ bool SqliteDatabase::init(const DatabaseConfig& config) {
                            "username TEXT NOT NULL UNIQUE,"
                            "password TEXT NOT NULL"
                            ");";
-    
-    rc = sqlite3_exec(db_, user_sql, 0, 0, &zErrMsg);
-    if (rc != SQLITE_OK) {
-        LOG_ERROR("SQL error (create users): {}", zErrMsg);
-        sqlite3_free(zErrMsg);
+    if (!writer_->exec(user_sql)) {
         return false;
     }
 
     // Attempt to add columns if they don't exist (migration for existing DB)
     const char* alter_sql1 = "ALTER TABLE messages ADD COLUMN target_user TEXT;";
-    sqlite3_exec(db_, alter_sql1, 0, 0, 0); // Ignore error if exists
+    sqlite3_exec(handle, alter_sql1, 0, 0, 0); // Ignore error if exists
 
     const char* alter_sql2 = "ALTER TABLE messages ADD COLUMN room_id TEXT;";
-    sqlite3_exec(db_, alter_sql2, 0, 0, 0); // Ignore error if exists
+    sqlite3_exec(handle, alter_sql2, 0, 0, 0); // Ignore error if exists
+
+    if (!applyMigrations()) {
+        return false;
+    }
+
+    {
+        std::vector<MessageCounters::Row> rows;
+        Statement stmt(*writer_, "SELECT scope, name, count FROM message_stats;");
+        if (!stmt) return false;
+        while (sqlite3_step(stmt.get()) == SQLITE_ROW) {
+            rows.push_back({reinterpret_cast<const char*>(sqlite3_column_text(stmt.get(), 0)),
+                            reinterpret_cast<const char*>(sqlite3_column_text(stmt.get(), 1)),
+                            sqlite3_column_int64(stmt.get(), 2)});
+        }
+        counters_.load(rows);
+    }
+
+    bool in_memory = db_path == ":memory:";
+    bool wal = false;
+    if (config.sqlite_wal && !in_memory) {
+        // The journal mode is persistent; the pragma reports the mode actually in effect
+        Statement mode(*writer_, "PRAGMA journal_mode = WAL;");
+        if (mode && sqlite3_step(mode.get()) == SQLITE_ROW) {
+            const char* result = reinterpret_cast<const char*>(sqlite3_column_text(mode.get(), 0));
+            wal = result && std::string(result) == "wal";
+        }
+        if (!wal) {
+            LOG_WARN("SQLite database {} could not switch to WAL, reads will share the writer", db_path);
+        }
+    } else if (!in_memory) {
+        // A file left in WAL mode by an earlier run stays there unless switched back
+        writer_->exec("PRAGMA journal_mode = DELETE;");
+    }
+
+    std::string sync_sql = "PRAGMA synchronous = " + synchronousLevel(config) + ";";
+    writer_->exec(sync_sql.c_str());
+    std::string mmap_sql = "PRAGMA mmap_size = " + std::to_string(std::max(0LL, config.sqlite_mmap_bytes)) + ";";
+    if (!in_memory) {
+        writer_->exec(mmap_sql.c_str());
+    }
+
+    // Readers would block on (and stall) the writer under a rollback journal
+    int reader_count = wal ? std::max(0, config.sqlite_readers) : 0;
+    for (int i = 0; i < reader_count; ++i) {
+        sqlite3* reader = nullptr;
+        if (sqlite3_open_v2(db_path.c_str(), &reader, SQLITE_OPEN_READONLY, nullptr) != SQLITE_OK) {
+            LOG_WARN("Can't open SQLite reader connection: {}", sqlite3_errmsg(reader));
+            sqlite3_close(reader);
+            break;
+        }
+        sqlite3_busy_timeout(reader, kBusyTimeoutMs);
+        readers_.push_back(std::make_unique<Connection>(reader, config.sqlite_statement_cache));
+        readers_.back()->exec(mmap_sql.c_str());
+        idle_readers_.push_back(readers_.back().get());
+    }
 
     initialized_ = true;
-    LOG_INFO("SQLite Database initialized successfully at {}", db_path);
+    LOG_INFO("SQLite Database initialized successfully at {} (journal={}, readers={})", db_path,
+             wal ? "wal" : "default", readers_.size());
+    return true;
+}
+
+bool SqliteDatabase::applyMigrations() {
+    int version = 0;
+    {
+        Statement stmt(*writer_, "PRAGMA user_version;");
+        if (stmt && sqlite3_step(stmt.get()) == SQLITE_ROW) {
+            version = sqlite3_column_int(stmt.get(), 0);
+        }
+    }
+    const int latest = static_cast<int>(std::size(kMigrations));
+    if (version > latest) {
+        LOG_WARN("SQLite schema version {} is newer than this build knows ({})", version, latest);
+    }
+    for (; version < latest; ++version) {
+        LOG_INFO("Migrating SQLite schema to version {}", version + 1);
+        std::string sql = std::string("BEGIN;") + kMigrations[version] +
+                          "PRAGMA user_version = " + std::to_string(version + 1) + ";COMMIT;";
+        if (!writer_->exec(sql.c_str())) {
+            sqlite3_exec(writer_->handle(), "ROLLBACK;", 0, 0, 0);
+            return false;
+        }
+    }
+    return true;
+}
+
+bool SqliteDatabase::addStats(const MessageCounters::Delta& delta) {
+    Statement stmt(*writer_, "INSERT INTO message_stats (scope, name, count) VALUES (?, ?, ?) "
+                             "ON CONFLICT (scope, name) DO UPDATE SET count = count + excluded.count;");
+    if (!stmt) return false;
+    for (const auto& row : delta.rows()) {
+        sqlite3_bind_text(stmt.get(), 1, row.scope.c_str(), -1, SQLITE_STATIC);
+        sqlite3_bind_text(stmt.get(), 2, row.name.c_str(), -1, SQLITE_STATIC);
+        sqlite3_bind_int64(stmt.get(), 3, row.count);
+        int rc = sqlite3_step(stmt.get());
+        sqlite3_reset(stmt.get());
+        if (rc != SQLITE_DONE) {
+            LOG_ERROR("Updating message_stats failed: {}", sqlite3_errmsg(writer_->handle()));
+            return false;
+        }
+    }
     return true;
 }
 
-bool SqliteDatabase::addMessage(const ChatMessage& msg) {
+bool SqliteDatabase::addMessage(ChatMessage& msg) {
     std::lock_guard<std::mutex> lock(mutex_);
-    if (!initialized_ || !db_) return false;
-
-    const char* sql = "INSERT INTO messages (username, content, timestamp, target_user, room_id) VALUES (?, ?, ?, ?, ?);";
-    sqlite3_stmt* stmt;
-    
-    int rc = sqlite3_prepare_v2(db_, sql, -1, &stmt, 0);
-    if (rc != SQLITE_OK) {
-        LOG_ERROR("Failed to prepare statement: {}", sqlite3_errmsg(db_));
+    if (!initialized_) return false;
+
+    // The row and its counts commit together
+    if (!writer_->exec("BEGIN;")) {
         return false;
     }
 
-    sqlite3_bind_text(stmt, 1, msg.username.c_str(), -1, SQLITE_STATIC);
-    sqlite3_bind_text(stmt, 2, msg.content.c_str(), -1, SQLITE_STATIC);
-    sqlite3_bind_text(stmt, 3, msg.timestamp.c_str(), -1, SQLITE_STATIC);
-    
-    if (msg.target_user.empty()) {
-        sqlite3_bind_null(stmt, 4);
-    } else {
-        sqlite3_bind_text(stmt, 4, msg.target_user.c_str(), -1, SQLITE_STATIC);
+    bool ok = true;
+    long long id = 0;
+    {
+        Statement stmt(*writer_, "INSERT INTO messages (username, content, timestamp, target_user, room_id) VALUES (?, ?, ?, ?, ?);");
+        ok = static_cast<bool>(stmt);
+        if (ok) {
+            bindMessage(stmt.get(), msg, 1);
+            if (sqlite3_step(stmt.get()) != SQLITE_DONE) {
+                LOG_ERROR("Execution failed: {}", sqlite3_errmsg(writer_->handle()));
+                ok = false;
+            }
+            id = sqlite3_last_insert_rowid(writer_->handle());
+        }
     }
 
-    if (msg.room_id.empty()) {
-        sqlite3_bind_null(stmt, 5);
-    } else {
-        sqlite3_bind_text(stmt, 5, msg.room_id.c_str(), -1, SQLITE_STATIC);
+    MessageCounters::Delta delta = MessageCounters::tally({msg});
+    if (ok && addStats(delta) && writer_->exec("COMMIT;")) {
+        msg.id = id;
+        counters_.apply(delta);
+        return true;
     }
+    sqlite3_exec(writer_->handle(), "ROLLBACK;", 0, 0, 0);
+    return false;
+}
+
+bool SqliteDatabase::addMessages(const std::vector<ChatMessage>& msgs) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!initialized_) return false;
+    if (msgs.empty()) return true;
 
-    rc = sqlite3_step(stmt);
-    if (rc != SQLITE_DONE) {
-        LOG_ERROR("Execution failed: {}", sqlite3_errmsg(db_));
-        sqlite3_finalize(stmt);
+    // One transaction, hence one journal sync, for the whole batch
+    if (!writer_->exec("BEGIN;")) {
         return false;
     }
 
-    sqlite3_finalize(stmt);
-    return true;
+    bool ok = true;
+    {
+        Statement stmt(*writer_, "INSERT INTO messages (id, username, content, timestamp, target_user, room_id) VALUES (?, ?, ?, ?, ?, ?);");
+        ok = static_cast<bool>(stmt);
+        for (std::size_t i = 0; ok && i < msgs.size(); ++i) {
+            sqlite3_bind_int64(stmt.get(), 1, msgs[i].id);
+            bindMessage(stmt.get(), msgs[i], 2);
+            if (sqlite3_step(stmt.get()) != SQLITE_DONE) {
+                LOG_ERROR("Execution failed: {}", sqlite3_errmsg(writer_->handle()));
+                ok = false;
+            }
+            sqlite3_reset(stmt.get());
+        }
+    }
+
+    MessageCounters::Delta delta = MessageCounters::tally(msgs);
+    if (ok && addStats(delta) && writer_->exec("COMMIT;")) {
+        counters_.apply(delta);
+        return true;
+    }
+    sqlite3_exec(writer_->handle(), "ROLLBACK;", 0, 0, 0);
+    return false;
 }
 
 std::vector<ChatMessage> SqliteDatabase::getHistory(int limit, const std::string& username) {
-    std::lock_guard<std::mutex> lock(mutex_);
     std::vector<ChatMessage> history;
-    if (!initialized_ || !db_) return history;
-
-    std::string sql;
-    sqlite3_stmt* stmt;
-    int rc;
+    ReadLease lease(*this);
+    if (!initialized_ || !lease.get()) return history;
 
+    const char* sql;
     if (username.empty()) {
         // Only public messages
         sql = "SELECT id, username, content, timestamp, target_user, room_id FROM ("
               "SELECT * FROM messages WHERE (target_user IS NULL OR target_user = '') ORDER BY id DESC LIMIT ?) "
               "ORDER BY id ASC;";
-        rc = sqlite3_prepare_v2(db_, sql.c_str(), -1, &stmt, 0);
-        if (rc == SQLITE_OK) {
-            sqlite3_bind_int(stmt, 1, limit);
-        }
     } else {
         // Public + Private for user + Sent by user
         sql = "SELECT id, username, content, timestamp, target_user, room_id FROM ("
               "SELECT * FROM messages WHERE (target_user IS NULL OR target_user = '' OR target_user = ? OR username = ?) ORDER BY id DESC LIMIT ?) "
               "ORDER BY id ASC;";
-        rc = sqlite3_prepare_v2(db_, sql.c_str(), -1, &stmt, 0);
-        if (rc == SQLITE_OK) {
-            sqlite3_bind_text(stmt, 1, username.c_str(), -1, SQLITE_STATIC);
-            sqlite3_bind_text(stmt, 2, username.c_str(), -1, SQLITE_STATIC);
-            sqlite3_bind_int(stmt, 3, limit);
-        }
     }
+    Statement stmt(*lease.get(), sql);
+    if (!stmt) return history;
 
-    if (rc != SQLITE_OK) {
-        LOG_ERROR("Failed to prepare statement: {}", sqlite3_errmsg(db_));
-        return history;
+    if (username.empty()) {
+        sqlite3_bind_int(stmt.get(), 1, limit);
+    } else {
+        sqlite3_bind_text(stmt.get(), 1, username.c_str(), -1, SQLITE_STATIC);
+        sqlite3_bind_text(stmt.get(), 2, username.c_str(), -1, SQLITE_STATIC);
+        sqlite3_bind_int(stmt.get(), 3, limit);
     }
 
-    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
-        ChatMessage msg;
-        msg.id = sqlite3_column_int64(stmt, 0);
-        msg.username = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
-        msg.content = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 2));
-        msg.timestamp = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 3));
-        
-        const char* target = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 4));
-        msg.target_user = target ? target : "";
-        
-        const char* room = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 5));
-        msg.room_id = room ? room : "";
-        
-        history.push_back(msg);
+    while (sqlite3_step(stmt.get()) == SQLITE_ROW) {
+        history.push_back(readMessage(stmt.get()));
     }
-
-    sqlite3_finalize(stmt);
     return history;
 }
 
-std::vector<ChatMessage> SqliteDatabase::getMessagesAfter(long long last_id, const std::string& username) {
-    std::lock_guard<std::mutex> lock(mutex_);
+std::vector<ChatMessage> SqliteDatabase::getMessagesAfter(long long last_id, const std::string& username, int limit) {
     std::vector<ChatMessage> history;
-    if (!initialized_ || !db_) return history;
-
-    std::string sql;
-    sqlite3_stmt* stmt;
-    int rc;
+    ReadLease lease(*this);
+    if (!initialized_ || !lease.get()) return history;
 
+    const char* sql;
     if (username.empty()) {
         // Only public messages
         sql = "SELECT id, username, content, timestamp, target_user, room_id FROM messages "
-              "WHERE id > ? AND (target_user IS NULL OR target_user = '') ORDER BY id ASC;";
-        rc = sqlite3_prepare_v2(db_, sql.c_str(), -1, &stmt, 0);
-        if (rc == SQLITE_OK) {
-            sqlite3_bind_int64(stmt, 1, last_id);
-        }
+              "WHERE id > ? AND (target_user IS NULL OR target_user = '') ORDER BY id ASC LIMIT ?;";
     } else {
         // Public + Private for user + Sent by user
         sql = "SELECT id, username, content, timestamp, target_user, room_id FROM messages "
-              "WHERE id > ? AND (target_user IS NULL OR target_user = '' OR target_user = ? OR username = ?) ORDER BY id ASC;";
-        rc = sqlite3_prepare_v2(db_, sql.c_str(), -1, &stmt, 0);
-        if (rc == SQLITE_OK) {
-            sqlite3_bind_int64(stmt, 1, last_id);
-            sqlite3_bind_text(stmt, 2, username.c_str(), -1, SQLITE_STATIC);
-            sqlite3_bind_text(stmt, 3, username.c_str(), -1, SQLITE_STATIC);
-        }
+              "WHERE id > ? AND (target_user IS NULL OR target_user = '' OR target_user = ? OR username = ?) ORDER BY id ASC LIMIT ?;";
     }
+    Statement stmt(*lease.get(), sql);
+    if (!stmt) return history;
 
-    if (rc != SQLITE_OK) {
-        LOG_ERROR("Failed to prepare statement: {}", sqlite3_errmsg(db_));
-        return history;
+    sqlite3_bind_int64(stmt.get(), 1, last_id);
+    // LIMIT -1 means no limit in SQLite
+    if (username.empty()) {
+        sqlite3_bind_int(stmt.get(), 2, limit > 0 ? limit : -1);
+    } else {
+        sqlite3_bind_text(stmt.get(), 2, username.c_str(), -1, SQLITE_STATIC);
+        sqlite3_bind_text(stmt.get(), 3, username.c_str(), -1, SQLITE_STATIC);
+        sqlite3_bind_int(stmt.get(), 4, limit > 0 ? limit : -1);
     }
 
-    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
-        ChatMessage msg;
-        msg.id = sqlite3_column_int64(stmt, 0);
-        msg.username = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
-        msg.content = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 2));
-        msg.timestamp = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 3));
-        
-        const char* target = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 4));
-        msg.target_user = target ? target : "";
-        
-        const char* room = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 5));
-        msg.room_id = room ? room : "";
-        
-        history.push_back(msg);
+    while (sqlite3_step(stmt.get()) == SQLITE_ROW) {
+        history.push_back(readMessage(stmt.get()));
+    }
+    return history;
+}
+
+std::vector<ChatMessage> SqliteDatabase::getRoomHistory(const std::string& room_id, const HistoryCursor& cursor) {
+    std::vector<ChatMessage> history;
+    ReadLease lease(*this);
+    if (!initialized_ || !lease.get() || cursor.limit <= 0) return history;
+
+    // Walks idx_messages_room from the cursor in the direction of the page
+    bool forward = cursor.after > 0;
+    Statement stmt(*lease.get(),
+                   forward ? "SELECT id, username, content, timestamp, target_user, room_id FROM messages "
+                             "WHERE room_id = ? AND id > ? AND id < ? AND (target_user IS NULL OR target_user = '') "
+                             "ORDER BY id ASC LIMIT ?;"
+                           : "SELECT id, username, content, timestamp, target_user, room_id FROM messages "
+                             "WHERE room_id = ? AND id > ? AND id < ? AND (target_user IS NULL OR target_user = '') "
+                             "ORDER BY id DESC LIMIT ?;");
+    if (!stmt) return history;
+
+    sqlite3_bind_text(stmt.get(), 1, room_id.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt.get(), 2, cursor.after);
+    sqlite3_bind_int64(stmt.get(), 3, cursor.before > 0 ? cursor.before : LLONG_MAX);
+    sqlite3_bind_int(stmt.get(), 4, cursor.limit);
+
+    while (sqlite3_step(stmt.get()) == SQLITE_ROW) {
+        history.push_back(readMessage(stmt.get()));
+    }
+    if (!forward) std::reverse(history.begin(), history.end());
+    return history;
+}
+
+std::vector<ChatMessage> SqliteDatabase::getConversationHistory(const std::string& user_a, const std::string& user_b,
+                                                                const HistoryCursor& cursor) {
+    std::vector<ChatMessage> history;
+    ReadLease lease(*this);
+    if (!initialized_ || !lease.get() || cursor.limit <= 0) return history;
+
+    // One idx_messages_target range per direction, each capped at the page size
+    bool forward = cursor.after > 0;
+    Statement stmt(*lease.get(),
+                   forward ? "SELECT * FROM ("
+                             "SELECT * FROM (SELECT id, username, content, timestamp, target_user, room_id FROM messages "
+                             "WHERE target_user = ?1 AND username = ?2 AND id > ?3 AND id < ?4 ORDER BY id ASC LIMIT ?5) "
+                             "UNION ALL "
+                             "SELECT * FROM (SELECT id, username, content, timestamp, target_user, room_id FROM messages "
+                             "WHERE target_user = ?2 AND username = ?1 AND id > ?3 AND id < ?4 ORDER BY id ASC LIMIT ?5)"
+                             ") ORDER BY id ASC LIMIT ?5;"
+                           : "SELECT * FROM ("
+                             "SELECT * FROM (SELECT id, username, content, timestamp, target_user, room_id FROM messages "
+                             "WHERE target_user = ?1 AND username = ?2 AND id > ?3 AND id < ?4 ORDER BY id DESC LIMIT ?5) "
+                             "UNION ALL "
+                             "SELECT * FROM (SELECT id, username, content, timestamp, target_user, room_id FROM messages "
+                             "WHERE target_user = ?2 AND username = ?1 AND id > ?3 AND id < ?4 ORDER BY id DESC LIMIT ?5)"
+                             ") ORDER BY id DESC LIMIT ?5;");
+    if (!stmt) return history;
+
+    sqlite3_bind_text(stmt.get(), 1, user_a.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt.get(), 2, user_b.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt.get(), 3, cursor.after);
+    sqlite3_bind_int64(stmt.get(), 4, cursor.before > 0 ? cursor.before : LLONG_MAX);
+    sqlite3_bind_int(stmt.get(), 5, cursor.limit);
+
+    while (sqlite3_step(stmt.get()) == SQLITE_ROW) {
+        history.push_back(readMessage(stmt.get()));
     }
+    if (!forward) std::reverse(history.begin(), history.end());
+    // A conversation with oneself matches both directions
+    history.erase(std::unique(history.begin(), history.end(),
+                              [](const ChatMessage& x, const ChatMessage& y) { return x.id == y.id; }),
+                  history.end());
+    return history;
+}
+
+std::vector<ChatMessage> SqliteDatabase::getRecentMessages(int limit) {
+    std::vector<ChatMessage> history;
+    ReadLease lease(*this);
+    if (!initialized_ || !lease.get()) return history;
+
+    Statement stmt(*lease.get(), "SELECT id, username, content, timestamp, target_user, room_id FROM ("
+                                 "SELECT * FROM messages ORDER BY id DESC LIMIT ?) ORDER BY id ASC;");
+    if (!stmt) return history;
+    sqlite3_bind_int(stmt.get(), 1, limit);
 
-    sqlite3_finalize(stmt);
+    while (sqlite3_step(stmt.get()) == SQLITE_ROW) {
+        history.push_back(readMessage(stmt.get()));
+    }
     return history;
 }
 
+std::vector<ChatMessage> SqliteDatabase::scanMessages(long long after_id, int limit) {
+    std::vector<ChatMessage> page;
+    ReadLease lease(*this);
+    if (!initialized_ || !lease.get() || limit <= 0) return page;
+
+    Statement stmt(*lease.get(), "SELECT id, username, content, timestamp, target_user, room_id FROM messages "
+                                 "WHERE id > ? ORDER BY id ASC LIMIT ?;");
+    if (!stmt) return page;
+    sqlite3_bind_int64(stmt.get(), 1, after_id);
+    sqlite3_bind_int(stmt.get(), 2, limit);
+
+    while (sqlite3_step(stmt.get()) == SQLITE_ROW) {
+        page.push_back(readMessage(stmt.get()));
+    }
+    return page;
+}
+
+std::vector<ChatMessage> SqliteDatabase::getMessagesByIds(const std::vector<long long>& ids) {
+    std::vector<ChatMessage> found;
+    ReadLease lease(*this);
+    if (!initialized_ || !lease.get() || ids.empty()) return found;
+
+    // Primary key lookups on one cached statement; callers ask for a page of ids at a time
+    Statement stmt(*lease.get(), "SELECT id, username, content, timestamp, target_user, room_id FROM messages "
+                                 "WHERE id = ?;");
+    if (!stmt) return found;
+    std::vector<long long> sorted(ids);
+    std::sort(sorted.begin(), sorted.end());
+    sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+    for (long long id : sorted) {
+        sqlite3_bind_int64(stmt.get(), 1, id);
+        if (sqlite3_step(stmt.get()) == SQLITE_ROW) {
+            found.push_back(readMessage(stmt.get()));
+        }
+        sqlite3_reset(stmt.get());
+    }
+    return found;
+}
+
 long long SqliteDatabase::getMessageCount() {
-    std::lock_guard<std::mutex> lock(mutex_);
-    if (!initialized_ || !db_) return 0;
-    
-    const char* sql = "SELECT COUNT(*) FROM messages;";
-    sqlite3_stmt* stmt;
-    int rc = sqlite3_prepare_v2(db_, sql, -1, &stmt, 0);
-    if (rc != SQLITE_OK) return 0;
-    
-    long long count = 0;
-    if (sqlite3_step(stmt) == SQLITE_ROW) {
-        count = sqlite3_column_int64(stmt, 0);
-    }
-    sqlite3_finalize(stmt);
-    return count;
+    return counters_.total();
+}
+
+long long SqliteDatabase::getRoomMessageCount(const std::string& room_id) {
+    return counters_.room(room_id);
+}
+
+long long SqliteDatabase::getUserMessageCount(const std::string& username) {
+    return counters_.user(username);
 }
 
 bool SqliteDatabase::addUser(const std::string& username, const std::string& password) {
     std::lock_guard<std::mutex> lock(mutex_);
-    if (!initialized_ || !db_) return false;
-
-    const char* sql = "INSERT INTO users (username, password) VALUES (?, ?);";
-    sqlite3_stmt* stmt;
-    
-    int rc = sqlite3_prepare_v2(db_, sql, -1, &stmt, 0);
-    if (rc != SQLITE_OK) {
-        LOG_ERROR("Failed to prepare statement: {}", sqlite3_errmsg(db_));
-        return false;
-    }
+    if (!initialized_) return false;
+
+    Statement stmt(*writer_, "INSERT INTO users (username, password) VALUES (?, ?);");
+    if (!stmt) return false;
+
+    sqlite3_bind_text(stmt.get(), 1, username.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt.get(), 2, password.c_str(), -1, SQLITE_STATIC);
 
-    sqlite3_bind_text(stmt, 1, username.c_str(), -1, SQLITE_STATIC);
-    sqlite3_bind_text(stmt, 2, password.c_str(), -1, SQLITE_STATIC);
-    
-    rc = sqlite3_step(stmt);
-    if (rc != SQLITE_DONE) {
-        LOG_ERROR("Execution failed: {}", sqlite3_errmsg(db_));
-        sqlite3_finalize(stmt);
+    if (sqlite3_step(stmt.get()) != SQLITE_DONE) {
+        LOG_ERROR("Execution failed: {}", sqlite3_errmsg(writer_->handle()));
         return false;
     }
-
-    sqlite3_finalize(stmt);
     return true;
 }
 
 bool SqliteDatabase::validateUser(const std::string& username, const std::string& password) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    if (!initialized_ || !db_) return false;
-
-    const char* sql = "SELECT password FROM users WHERE username = ?;";
-    sqlite3_stmt* stmt;
-    
-    int rc = sqlite3_prepare_v2(db_, sql, -1, &stmt, 0);
-    if (rc != SQLITE_OK) {
-        LOG_ERROR("Failed to prepare statement: {}", sqlite3_errmsg(db_));
-        return false;
-    }
+    ReadLease lease(*this);
+    if (!initialized_ || !lease.get()) return false;
+
+    Statement stmt(*lease.get(), "SELECT password FROM users WHERE username = ?;");
+    if (!stmt) return false;
+
+    sqlite3_bind_text(stmt.get(), 1, username.c_str(), -1, SQLITE_STATIC);
 
-    sqlite3_bind_text(stmt, 1, username.c_str(), -1, SQLITE_STATIC);
-    
     bool valid = false;
-    if (sqlite3_step(stmt) == SQLITE_ROW) {
-        const char* stored_password = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
+    if (sqlite3_step(stmt.get()) == SQLITE_ROW) {
+        const char* stored_password = reinterpret_cast<const char*>(sqlite3_column_text(stmt.get(), 0));
         if (stored_password && password == stored_password) {
             valid = true;
         }
     }
-
-    sqlite3_finalize(stmt);
     return valid;
 }
 
 bool SqliteDatabase::userExists(const std::string& username) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    if (!initialized_ || !db_) return false;
+    ReadLease lease(*this);
+    if (!initialized_ || !lease.get()) return false;
 
-    const char* sql = "SELECT COUNT(*) FROM users WHERE username = ?;";
-    sqlite3_stmt* stmt;
-    
-    int rc = sqlite3_prepare_v2(db_, sql, -1, &stmt, 0);
-    if (rc != SQLITE_OK) return false;
+    Statement stmt(*lease.get(), "SELECT COUNT(*) FROM users WHERE username = ?;");
+    if (!stmt) return false;
 
-    sqlite3_bind_text(stmt, 1, username.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt.get(), 1, username.c_str(), -1, SQLITE_STATIC);
 
     bool exists = false;
-    if (sqlite3_step(stmt) == SQLITE_ROW) {
-        exists = sqlite3_column_int(stmt, 0) > 0;
+    if (sqlite3_step(stmt.get()) == SQLITE_ROW) {
+        exists = sqlite3_column_int(stmt.get(), 0) > 0;
     }
-
-    sqlite3_finalize(stmt);
     return exists;
 }
 
 long long SqliteDatabase::getUserId(const std::string& username) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    if (!initialized_ || !db_) return -1;
+    ReadLease lease(*this);
+    if (!initialized_ || !lease.get()) return -1;
 
-    const char* sql = "SELECT id FROM users WHERE username = ?;";
-    sqlite3_stmt* stmt;
-    
-    int rc = sqlite3_prepare_v2(db_, sql, -1, &stmt, 0);
-    if (rc != SQLITE_OK) return -1;
+    Statement stmt(*lease.get(), "SELECT id FROM users WHERE username = ?;");
+    if (!stmt) return -1;
 
-    sqlite3_bind_text(stmt, 1, username.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt.get(), 1, username.c_str(), -1, SQLITE_STATIC);
 
     long long id = -1;
-    if (sqlite3_step(stmt) == SQLITE_ROW) {
-        id = sqlite3_column_int64(stmt, 0);
+    if (sqlite3_step(stmt.get()) == SQLITE_ROW) {
+        id = sqlite3_column_int64(stmt.get(), 0);
     }
-
-    sqlite3_finalize(stmt);
     return id;
 }
 
 std::vector<std::pair<std::string, long long>> SqliteDatabase::getAllUsers() {
-    std::lock_guard<std::mutex> lock(mutex_);
     std::vector<std::pair<std::string, long long>> users;
-    if (!initialized_ || !db_) return users;
-
-    const char* sql = "SELECT username, id FROM users ORDER BY username ASC;";
-    sqlite3_stmt* stmt;
-    
-    int rc = sqlite3_prepare_v2(db_, sql, -1, &stmt, 0);
-    if (rc != SQLITE_OK) {
-        LOG_ERROR("Failed to prepare statement: {}", sqlite3_errmsg(db_));
-        return users;
-    }
-    
-    while (sqlite3_step(stmt) == SQLITE_ROW) {
-        const char* name = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
-        long long id = sqlite3_column_int64(stmt, 1);
+    ReadLease lease(*this);
+    if (!initialized_ || !lease.get()) return users;
+
+    Statement stmt(*lease.get(), "SELECT username, id FROM users ORDER BY username ASC;");
+    if (!stmt) return users;
+
+    while (sqlite3_step(stmt.get()) == SQLITE_ROW) {
+        const char* name = reinterpret_cast<const char*>(sqlite3_column_text(stmt.get(), 0));
+        long long id = sqlite3_column_int64(stmt.get(), 1);
         if (name) {
             users.emplace_back(name, id);
         }
     }
-    
-    sqlite3_finalize(stmt);
     return users;
 }
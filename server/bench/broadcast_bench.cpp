@@ -0,0 +1,162 @@
+// Room broadcast fan-out: per-recipient TcpConnection::send (the code before the broadcast engine)
+// vs. WebSocketBroadcaster (one shared frame, one task per IO loop).
+// Usage: broadcast_bench [members] [io_loops] [rounds]
+// Build with -DCMAKE_BUILD_TYPE=Release for meaningful numbers.
+#include "http/websocket_broadcaster.h"
+#include "net/event_loop.h"
+#include "net/event_loop_thread.h"
+#include "net/inet_address.h"
+#include "net/tcp_connection.h"
+
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Member {
+    TcpConnectionPtr conn;
+    int peer;
+};
+
+void runAndWait(EventLoop* loop, const std::function<void()>& fn) {
+    std::promise<void> done;
+    loop->runInLoop([&]() {
+        fn();
+        done.set_value();
+    });
+    done.get_future().wait();
+}
+
+// Every task posted before the barrier has run once it returns, since each loop drains its queue in order
+void barrier(const std::vector<EventLoop*>& loops) {
+    for (EventLoop* loop : loops) {
+        runAndWait(loop, []() {});
+    }
+}
+
+void drain(const std::vector<Member>& members) {
+    char buf[4096];
+    for (const auto& member : members) {
+        while (read(member.peer, buf, sizeof(buf)) > 0) {
+        }
+    }
+}
+
+// The pre-engine path: one frame, but send() from a foreign thread copies it into a task per recipient
+void perRecipientSend(const std::vector<Member>& members, const std::string& payload) {
+    std::string frame = WebSocketBroadcaster::encodeFrame(protocols::WebSocketOpcode::TEXT, payload, false);
+    for (const auto& member : members) {
+        member.conn->send(frame);
+    }
+}
+
+void engineBroadcast(WebSocketBroadcaster& broadcaster, const std::vector<Member>& members,
+                     const std::string& payload) {
+    std::vector<WebSocketBroadcaster::Recipient> recipients;
+    recipients.reserve(members.size());
+    for (const auto& member : members) {
+        recipients.push_back({member.conn, nullptr, nullptr});
+    }
+    broadcaster.broadcast(std::move(recipients), protocols::WebSocketOpcode::TEXT, payload, SIZE_MAX, 6);
+}
+
+// Median wall time of one broadcast until every recipient's frame has been handed to the kernel
+double measure(const std::vector<EventLoop*>& loops, const std::vector<Member>& members, int rounds,
+               const std::function<void()>& broadcast) {
+    std::vector<double> samples;
+    for (int i = 0; i < rounds; ++i) {
+        drain(members);
+        auto start = Clock::now();
+        broadcast();
+        barrier(loops);
+        samples.push_back(std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+    }
+    std::sort(samples.begin(), samples.end());
+    return samples[samples.size() / 2];
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+#ifndef __OPTIMIZE__
+    std::printf("note: built without optimization, numbers are not representative\n");
+#endif
+    std::size_t members_wanted = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 10000;
+    int loop_count = argc > 2 ? std::atoi(argv[2]) : 4;
+    int rounds = argc > 3 ? std::atoi(argv[3]) : 20;
+
+    // Each member needs a socketpair; raise the descriptor limit as far as allowed and fit within it
+    rlimit limit;
+    getrlimit(RLIMIT_NOFILE, &limit);
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+    std::size_t fit = limit.rlim_cur > 64 + 8 * static_cast<rlim_t>(loop_count)
+                          ? (limit.rlim_cur - 64 - 8 * loop_count) / 2
+                          : 0;
+    std::size_t member_count = std::min(members_wanted, fit);
+    if (member_count < members_wanted) {
+        std::printf("note: RLIMIT_NOFILE=%llu allows %zu members (wanted %zu)\n",
+                    static_cast<unsigned long long>(limit.rlim_cur), member_count, members_wanted);
+    }
+
+    std::vector<std::unique_ptr<EventLoopThread>> threads;
+    std::vector<EventLoop*> loops;
+    for (int i = 0; i < loop_count; ++i) {
+        threads.push_back(std::make_unique<EventLoopThread>());
+        loops.push_back(threads.back()->startLoop());
+    }
+
+    std::vector<Member> members;
+    members.reserve(member_count);
+    for (std::size_t i = 0; i < member_count; ++i) {
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+            std::perror("socketpair");
+            return 1;
+        }
+        fcntl(fds[1], F_SETFL, O_NONBLOCK);
+        EventLoop* loop = loops[i % loops.size()];
+        auto conn = std::make_shared<TcpConnection>(loop, "member-" + std::to_string(i), fds[0], InetAddress(0),
+                                                    InetAddress(0));
+        runAndWait(loop, [&conn]() { conn->connectEstablished(); });
+        members.push_back({std::move(conn), fds[1]});
+    }
+
+    protocols::WebSocketDeflateStats deflate_stats;
+    WebSocketBroadcaster broadcaster(deflate_stats);
+    const std::string payload =
+        R"({"type":"message","username":"alice","content":"hello everyone in the room","timestamp":"2024-01-01 12:00:00","room_id":"lobby"})";
+
+    double baseline = measure(loops, members, rounds, [&]() { perRecipientSend(members, payload); });
+    double engine = measure(loops, members, rounds, [&]() { engineBroadcast(broadcaster, members, payload); });
+
+    std::printf("%zu members, %d IO loops, %zu-byte payload, median of %d rounds\n", member_count, loop_count,
+                payload.size(), rounds);
+    std::printf("%-20s%14s%14s%14s\n", "", "ms/broadcast", "ns/recipient", "loop tasks");
+    std::printf("%-20s%14.3f%14.1f%14zu\n", "per-recipient send", baseline, baseline * 1e6 / member_count,
+                member_count);
+    std::printf("%-20s%14.3f%14.1f%14zu\n", "broadcaster", engine, engine * 1e6 / member_count,
+                static_cast<std::size_t>(loop_count));
+    std::printf("speedup: %.2fx\n", baseline / engine);
+
+    for (auto& member : members) {
+        TcpConnectionPtr conn = member.conn;
+        runAndWait(conn->getLoop(), [conn]() { conn->connectDestroyed(); });
+        close(member.peer);
+    }
+    return 0;
+}
@@ -0,0 +1,92 @@
+// WebSocket chat message encode/decode cost: JSON (nlohmann DOM, the original protocol) vs. MessagePack.
+// Build with -DCMAKE_BUILD_TYPE=Release for meaningful numbers.
+#include "websocket/chat_wire.h"
+
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <string>
+
+using namespace protocols;
+
+namespace {
+
+// Repeats fn for ~100ms and returns nanoseconds per call
+double measure(const std::function<void()>& fn) {
+    using Clock = std::chrono::steady_clock;
+    const auto budget = std::chrono::milliseconds(100);
+
+    uint64_t calls = 0;
+    auto start = Clock::now();
+    auto elapsed = Clock::duration::zero();
+    std::size_t iters = 1;
+    while (elapsed < budget) {
+        for (std::size_t i = 0; i < iters; ++i) {
+            fn();
+        }
+        calls += iters;
+        iters *= 2;
+        elapsed = Clock::now() - start;
+    }
+    return std::chrono::duration<double, std::nano>(elapsed).count() / static_cast<double>(calls);
+}
+
+struct Sample {
+    const char* name;
+    ChatWireMessage msg;
+};
+
+} // namespace
+
+int main() {
+#ifndef __OPTIMIZE__
+    std::printf("note: built without optimization, numbers are not representative\n");
+#endif
+    Sample samples[5];
+    samples[0].name = "login";
+    samples[0].msg.type = ChatWireType::kLogin;
+    samples[0].msg.username = "alice";
+    samples[0].msg.password = "correct horse";
+
+    samples[1].name = "join_room";
+    samples[1].msg.type = ChatWireType::kJoinRoom;
+    samples[1].msg.room_id = "general";
+
+    samples[2].name = "message";
+    samples[2].msg.type = ChatWireType::kMessage;
+    samples[2].msg.username = "alice";
+    samples[2].msg.room_id = "general";
+    samples[2].msg.timestamp = "2026-10-18 12:00:00";
+    samples[2].msg.content = "Has anyone looked at the deploy dashboard since the last rollout?";
+
+    samples[3].name = "message_4k";
+    samples[3].msg = samples[2].msg;
+    samples[3].msg.content.assign(4096, 'x');
+
+    samples[4].name = "ack";
+    samples[4].msg.type = ChatWireType::kMessageResponse;
+    samples[4].msg.success = true;
+
+    std::printf("%-12s %10s %10s %12s %12s %12s %12s\n", "type", "json B", "msgpack B", "json enc", "mp enc",
+                "json dec", "mp dec");
+    // Summed from every result so the optimizer cannot drop the work
+    std::size_t sink = 0;
+    for (const auto& sample : samples) {
+        std::string json = ChatWireCodec::encodeJson(sample.msg);
+        std::string msgpack = ChatWireCodec::encodeMsgpack(sample.msg);
+        double json_enc = measure([&]() { sink += ChatWireCodec::encodeJson(sample.msg).size(); });
+        double mp_enc = measure([&]() { sink += ChatWireCodec::encodeMsgpack(sample.msg).size(); });
+        double json_dec = measure([&]() {
+            ChatWireMessage out;
+            sink += ChatWireCodec::decodeJson(json, out);
+        });
+        double mp_dec = measure([&]() {
+            ChatWireMessage out;
+            sink += ChatWireCodec::decodeMsgpack(msgpack, out);
+        });
+        std::printf("%-12s %10zu %10zu %9.0f ns %9.0f ns %9.0f ns %9.0f ns\n", sample.name, json.size(),
+                    msgpack.size(), json_enc, mp_enc, json_dec, mp_dec);
+    }
+    std::printf("(checksum %zu)\n", sink);
+    return 0;
+}
@@ -0,0 +1,153 @@
+// SQLite backend throughput: the original single-connection setup (rollback journal, statements
+// prepared per call, reads sharing the writer) vs. the tuned engine (WAL, statement cache, reader pool, mmap).
+// Usage: sqlite_bench [db_path] [messages] [reader_threads]
+// Build with -DCMAKE_BUILD_TYPE=Release for meaningful numbers.
+#include "sqlite_database.h"
+#include "logger.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double seconds(Clock::duration d) {
+    return std::chrono::duration<double>(d).count();
+}
+
+void removeFiles(const std::string& path) {
+    for (const char* suffix : {"", "-wal", "-shm", "-journal"}) {
+        std::remove((path + suffix).c_str());
+    }
+}
+
+ChatMessage makeMessage(long long id) {
+    ChatMessage msg;
+    msg.id = id;
+    msg.username = "user" + std::to_string(id % 50);
+    msg.content = "Has anyone looked at the deploy dashboard since the last rollout? #" + std::to_string(id);
+    msg.timestamp = "2026-10-18 12:00:00";
+    msg.room_id = id % 4 ? "general" : "";
+    return msg;
+}
+
+struct Result {
+    double single_inserts = 0; // messages/s, one autocommit INSERT each
+    double batch_inserts = 0;  // messages/s, 100 per transaction
+    double reads = 0;          // getMessagesAfter/s, one thread
+    double mixed_reads = 0;    // getMessagesAfter/s across all readers while the writer runs
+    double mixed_writes = 0;   // messages/s committed meanwhile
+};
+
+Result run(const DatabaseConfig& config, int messages, int reader_threads) {
+    removeFiles(config.path);
+    SqliteDatabase db;
+    if (!db.init(config)) {
+        std::fprintf(stderr, "init failed for %s\n", config.path.c_str());
+        std::exit(1);
+    }
+    Result r;
+
+    // Single inserts pay one commit (and sync) each, so use a fraction of the messages
+    int singles = std::max(1, messages / 20);
+    auto start = Clock::now();
+    for (int i = 0; i < singles; ++i) {
+        ChatMessage msg = makeMessage(0);
+        db.addMessage(msg);
+    }
+    r.single_inserts = singles / seconds(Clock::now() - start);
+
+    long long next_id = singles + 1;
+    start = Clock::now();
+    for (int done = 0; done < messages; done += 100) {
+        std::vector<ChatMessage> batch;
+        for (int i = 0; i < 100; ++i) {
+            batch.push_back(makeMessage(next_id++));
+        }
+        db.addMessages(batch);
+    }
+    r.batch_inserts = messages / seconds(Clock::now() - start);
+
+    // A reconnecting client's catch-up query: the last 50 messages
+    const long long tail = next_id - 51;
+    int reads = 0;
+    start = Clock::now();
+    while (Clock::now() - start < std::chrono::seconds(1)) {
+        db.getMessagesAfter(tail, reads % 2 ? "user7" : "", 0);
+        ++reads;
+    }
+    r.reads = reads / seconds(Clock::now() - start);
+
+    std::atomic<bool> writing{true};
+    std::atomic<long long> newest{next_id - 1};
+    std::atomic<uint64_t> mixed_reads{0};
+    std::vector<std::thread> readers;
+    for (int t = 0; t < reader_threads; ++t) {
+        readers.emplace_back([&]() {
+            while (writing.load(std::memory_order_relaxed)) {
+                db.getMessagesAfter(newest.load(std::memory_order_relaxed) - 50, "", 0);
+                mixed_reads.fetch_add(1, std::memory_order_relaxed);
+            }
+        });
+    }
+    int written = 0;
+    start = Clock::now();
+    while (Clock::now() - start < std::chrono::seconds(2)) {
+        std::vector<ChatMessage> batch;
+        for (int i = 0; i < 20; ++i) {
+            batch.push_back(makeMessage(next_id++));
+        }
+        db.addMessages(batch);
+        newest.store(next_id - 1, std::memory_order_relaxed);
+        written += 20;
+    }
+    double elapsed = seconds(Clock::now() - start);
+    writing = false;
+    for (auto& reader : readers) {
+        reader.join();
+    }
+    r.mixed_reads = mixed_reads.load() / elapsed;
+    r.mixed_writes = written / elapsed;
+    return r;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+#ifndef __OPTIMIZE__
+    std::printf("note: built without optimization, numbers are not representative\n");
+#endif
+    std::string path = argc > 1 ? argv[1] : "sqlite_bench.db";
+    int messages = argc > 2 ? std::atoi(argv[2]) : 20000;
+    int reader_threads = argc > 3 ? std::atoi(argv[3]) : 4;
+    Logger::instance().setLevel(spdlog::level::warn);
+
+    DatabaseConfig tuned;
+    tuned.path = path;
+    tuned.sqlite_readers = reader_threads;
+
+    DatabaseConfig original = tuned;
+    original.sqlite_wal = false;
+    original.sqlite_readers = 0;
+    original.sqlite_mmap_bytes = 0;
+    original.sqlite_statement_cache = false;
+
+    std::printf("%d messages, %d reader threads, synchronous derived from durability=fsync\n", messages,
+                reader_threads);
+    std::printf("%-10s%14s%14s%14s%14s%14s\n", "engine", "single/s", "batched/s", "reads/s", "mixed rd/s",
+                "mixed wr/s");
+    for (const auto& [name, config] : {std::make_pair("original", original), std::make_pair("tuned", tuned)}) {
+        Result r = run(config, messages, reader_threads);
+        std::printf("%-10s%14.0f%14.0f%14.0f%14.0f%14.0f\n", name, r.single_inserts, r.batch_inserts, r.reads,
+                    r.mixed_reads, r.mixed_writes);
+    }
+    removeFiles(path);
+    return 0;
+}
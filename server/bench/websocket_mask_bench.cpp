@@ -0,0 +1,87 @@
+// WebSocket unmasking throughput: naive per-byte loop vs. the scalar/SSE2/AVX2 kernels.
+// Build with -DCMAKE_BUILD_TYPE=Release for meaningful numbers.
+#include "websocket/websocket_mask.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <vector>
+
+using namespace protocols;
+
+namespace {
+
+// The loop parseFrame used before the vectorized kernels
+void maskNaive(uint8_t* data, std::size_t len, const uint8_t key[4], std::size_t phase) {
+    for (std::size_t i = 0; i < len; ++i) {
+        data[i] ^= key[(phase + i) % 4];
+    }
+}
+
+void maskDispatch(uint8_t* data, std::size_t len, const uint8_t key[4], std::size_t phase) {
+    applyWebSocketMask(data, len, key, phase);
+}
+
+// Repeats fn over the buffer for ~50ms and returns throughput in GB/s
+double measure(WebSocketMaskFn fn, std::vector<uint8_t>& buf, std::size_t len) {
+    using Clock = std::chrono::steady_clock;
+    const uint8_t key[4] = {0x12, 0x34, 0x56, 0x78};
+    const auto budget = std::chrono::milliseconds(50);
+
+    uint64_t bytes = 0;
+    auto start = Clock::now();
+    auto elapsed = Clock::duration::zero();
+    std::size_t iters = 1;
+    while (elapsed < budget) {
+        for (std::size_t i = 0; i < iters; ++i) {
+            // Offset by one byte so payloads are unaligned, as they are behind a frame header
+            fn(buf.data() + 1, len, key, 0);
+        }
+        bytes += static_cast<uint64_t>(iters) * len;
+        iters *= 2;
+        elapsed = Clock::now() - start;
+    }
+    double seconds = std::chrono::duration<double>(elapsed).count();
+    return static_cast<double>(bytes) / seconds / 1e9;
+}
+
+} // namespace
+
+int main() {
+#ifndef __OPTIMIZE__
+    std::printf("note: built without optimization, numbers are not representative\n");
+#endif
+    struct Impl {
+        const char* name;
+        WebSocketMaskFn fn;
+    };
+    std::vector<Impl> impls = {{"naive", maskNaive}, {"scalar", webSocketMaskScalar}};
+#if defined(__x86_64__) || defined(__i386__)
+    impls.push_back({"sse2", webSocketMaskSse2});
+    if (webSocketMaskAvx2Supported()) {
+        impls.push_back({"avx2", webSocketMaskAvx2});
+    }
+#endif
+    impls.push_back({"dispatch", maskDispatch});
+
+    std::printf("dispatch selects: %s\n", webSocketMaskImpl());
+    std::printf("%10s", "size");
+    for (const auto& impl : impls) {
+        std::printf("%12s", impl.name);
+    }
+    std::printf("   (GB/s)\n");
+
+    const std::size_t sizes[] = {16, 64, 256, 1024, 4096, 16384, 65536, 262144, 1048576};
+    std::vector<uint8_t> buf(1048576 + 1);
+    for (std::size_t i = 0; i < buf.size(); ++i) {
+        buf[i] = static_cast<uint8_t>(i);
+    }
+    for (std::size_t size : sizes) {
+        std::printf("%10zu", size);
+        for (const auto& impl : impls) {
+            std::printf("%12.2f", measure(impl.fn, buf, size));
+        }
+        std::printf("\n");
+    }
+    return 0;
+}
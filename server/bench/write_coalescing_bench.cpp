@@ -0,0 +1,138 @@
+// Write syscalls per message with and without per-loop write coalescing.
+// Each round delivers a room message, an ack and a presence event to every member, either from one task
+// on the IO loop (the broadcast engine's pattern) or by calling send() from a foreign thread.
+// Usage: write_coalescing_bench [members] [rounds]
+// Build with -DCMAKE_BUILD_TYPE=Release for meaningful numbers.
+#include "net/event_loop.h"
+#include "net/event_loop_thread.h"
+#include "net/inet_address.h"
+#include "net/io_stats.h"
+#include "net/tcp_connection.h"
+
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Member {
+    TcpConnectionPtr conn;
+    int peer;
+};
+
+void runAndWait(EventLoop* loop, const std::function<void()>& fn) {
+    std::promise<void> done;
+    loop->runInLoop([&]() {
+        fn();
+        done.set_value();
+    });
+    done.get_future().wait();
+}
+
+void drain(const std::vector<Member>& members) {
+    char buf[4096];
+    for (const auto& member : members) {
+        while (read(member.peer, buf, sizeof(buf)) > 0) {
+        }
+    }
+}
+
+struct Result {
+    double sends = 0;
+    double writes = 0;
+    double wakeups = 0;
+    double ms = 0;
+};
+
+Result measure(EventLoop* loop, const std::vector<Member>& members, int rounds, const std::function<void()>& round) {
+    auto& stats = NetIoStats::instance();
+    uint64_t sends = stats.sends.load();
+    uint64_t writes = stats.write_calls.load();
+    uint64_t wakeups = stats.wakeups.load();
+    Clock::duration elapsed{};
+    for (int i = 0; i < rounds; ++i) {
+        drain(members);
+        auto start = Clock::now();
+        round();
+        // Everything posted before this task has run, and its flush happens in the same iteration
+        runAndWait(loop, []() {});
+        elapsed += Clock::now() - start;
+    }
+    Result r;
+    r.sends = static_cast<double>(stats.sends.load() - sends);
+    r.writes = static_cast<double>(stats.write_calls.load() - writes);
+    r.wakeups = static_cast<double>(stats.wakeups.load() - wakeups);
+    r.ms = std::chrono::duration<double, std::milli>(elapsed).count() / rounds;
+    return r;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+#ifndef __OPTIMIZE__
+    std::printf("note: built without optimization, numbers are not representative\n");
+#endif
+    std::size_t member_count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000;
+    int rounds = argc > 2 ? std::atoi(argv[2]) : 50;
+
+    EventLoopThread thread;
+    EventLoop* loop = thread.startLoop();
+
+    const std::string frame(120, 'm');
+    const std::string ack(40, 'a');
+    const std::string presence(60, 'p');
+
+    std::printf("%zu members, 3 messages per member per round, %d rounds\n", member_count, rounds);
+    std::printf("%-12s%-14s%14s%14s%14s\n", "mode", "sender", "writes/msg", "wakeups/msg", "ms/round");
+    for (bool coalescing : {false, true}) {
+        std::vector<Member> members;
+        members.reserve(member_count);
+        for (std::size_t i = 0; i < member_count; ++i) {
+            int fds[2];
+            if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+                std::perror("socketpair");
+                return 1;
+            }
+            fcntl(fds[1], F_SETFL, O_NONBLOCK);
+            auto conn = std::make_shared<TcpConnection>(loop, "member-" + std::to_string(i), fds[0],
+                                                        InetAddress(0), InetAddress(0));
+            conn->setWriteCoalescing(coalescing);
+            runAndWait(loop, [&conn]() { conn->connectEstablished(); });
+            members.push_back({std::move(conn), fds[1]});
+        }
+
+        auto sendAll = [&]() {
+            for (const auto& member : members) {
+                member.conn->send(frame);
+                member.conn->send(ack);
+                member.conn->send(presence);
+            }
+        };
+        Result in_loop = measure(loop, members, rounds, [&]() { loop->runInLoop(sendAll); });
+        Result foreign = measure(loop, members, rounds, sendAll);
+
+        const char* mode = coalescing ? "coalescing" : "direct";
+        for (const auto& [name, r] : {std::make_pair("loop task", in_loop), std::make_pair("other thread", foreign)}) {
+            std::printf("%-12s%-14s%14.3f%14.4f%14.3f\n", mode, name, r.writes / r.sends, r.wakeups / r.sends, r.ms);
+        }
+
+        for (auto& member : members) {
+            TcpConnectionPtr conn = member.conn;
+            runAndWait(loop, [conn]() { conn->connectDestroyed(); });
+            close(conn->fd());
+            close(member.peer);
+        }
+    }
+    return 0;
+}
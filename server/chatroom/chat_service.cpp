@@ -108,8 +108,9 @@ bool ChatService::sendUserMessage(const std::string& username,
     msg.room_id = room_id;
 
     if (DatabaseManager::instance().addMessage(msg)) {
-        metrics_collector_->updateMessageCount(DatabaseManager::instance().getMessageCount());
-        LOG_INFO("Message stored. Total messages: {}", DatabaseManager::instance().getMessageCount());
+        long long total = DatabaseManager::instance().getMessageCount();
+        metrics_collector_->updateMessageCount(total);
+        LOG_INFO("Message stored. Total messages: {}", total);
         return true;
     } else {
         LOG_ERROR("Failed to store message to database");
@@ -11,6 +11,8 @@
 #include <atomic>
 #include <map>
 #include <filesystem>
+#include <algorithm>
+#include <cctype>
 
 static std::atomic<unsigned long long> g_connection_counter{0};
 
@@ -59,11 +61,143 @@ static std::string getQueryParam(const std::string& path, const std::string& key
     return "";
 }
 
+namespace {
+/**
+ * @brief /messages 查询参数
+ */
+struct MessagesQuery {
+    long long since = 0;
+    std::string username;
+    int limit = 0;
+    int wait = 0;   ///< 长轮询等待秒数，0 表示立即返回
+};
+
+/// /history 默认与最大页大小
+constexpr int kHistoryPageDefault = 50;
+constexpr int kHistoryPageMax = 500;
+
+/// /search 默认与最大结果数
+constexpr int kSearchResultsDefault = 20;
+constexpr int kSearchResultsMax = 100;
+
+/// /users 分页时每页最大用户数
+constexpr int kUsersPageMax = 1000;
+
+/**
+ * @brief 解码 URL 查询参数中的 %XX 与 '+'
+ */
+std::string decodeQueryComponent(const std::string& value) {
+    std::string out;
+    out.reserve(value.size());
+    for (std::size_t i = 0; i < value.size(); ++i) {
+        if (value[i] == '+') {
+            out.push_back(' ');
+        } else if (value[i] == '%' && i + 2 < value.size() && std::isxdigit(static_cast<unsigned char>(value[i + 1])) &&
+                   std::isxdigit(static_cast<unsigned char>(value[i + 2]))) {
+            out.push_back(static_cast<char>(std::stoi(value.substr(i + 1, 2), nullptr, 16)));
+            i += 2;
+        } else {
+            out.push_back(value[i]);
+        }
+    }
+    return out;
+}
+
+int parseIntParam(const std::string& path, const std::string& key) {
+    std::string val = getQueryParam(path, key);
+    if (val.empty()) {
+        return 0;
+    }
+    try {
+        return std::stoi(val);
+    } catch (...) {
+        return 0;
+    }
+}
+
+MessagesQuery parseMessagesQuery(const std::string& path) {
+    MessagesQuery query;
+    std::string since_val = getQueryParam(path, "since");
+    if (!since_val.empty()) {
+        try {
+            query.since = std::stoll(since_val);
+        } catch (...) {}
+    }
+    query.username = getQueryParam(path, "username");
+    query.limit = parseIntParam(path, "limit");
+    query.wait = std::clamp(parseIntParam(path, "wait"), 0, ServerConfig::instance().long_poll_max_wait_seconds);
+    return query;
+}
+
+HttpResponse buildMessagesResponse(const std::vector<ChatMessage>& history, long long since) {
+    json resp_json;
+    resp_json["success"] = true;
+    resp_json["messages"] = json::array();
+
+    long long max_id = since;
+    for (const auto& msg : history) {
+        json msg_json;
+        msg_json["username"] = msg.username;
+        msg_json["content"] = msg.content;
+        msg_json["timestamp"] = msg.timestamp;
+        if (!msg.target_user.empty()) msg_json["target_user"] = msg.target_user;
+        if (!msg.room_id.empty()) msg_json["room_id"] = msg.room_id;
+
+        resp_json["messages"].push_back(msg_json);
+        if (msg.id > max_id) max_id = msg.id;
+    }
+
+    resp_json["next_since"] = max_id;
+
+    HttpResponse response;
+    response.body = resp_json.dump();
+    return response;
+}
+
+/**
+ * @brief 把 DatabaseManager 异步调用的回调投递到指定 EventLoop 上执行
+ */
+DatabaseManager::Executor onLoop(EventLoop* loop) {
+    return [loop](std::function<void()> fn) { loop->queueInLoop(std::move(fn)); };
+}
+
+/// SSE 续传时单次从数据库补发的最大消息数，超出部分由客户端重连继续
+constexpr int kEventStreamBacklogLimit = 500;
+
+std::string encodeMessageEvent(const ChatMessage& msg) {
+    json msg_json;
+    msg_json["id"] = msg.id;
+    msg_json["username"] = msg.username;
+    msg_json["content"] = msg.content;
+    msg_json["timestamp"] = msg.timestamp;
+    if (!msg.target_user.empty()) msg_json["target_user"] = msg.target_user;
+    if (!msg.room_id.empty()) msg_json["room_id"] = msg.room_id;
+    return SseHub::encodeEvent("message", msg_json.dump(), msg.id);
+}
+
+bool usesMsgpack(const TcpConnectionPtr& conn) {
+    return HttpServer::webSocketSubprotocol(conn) == protocols::ChatWireCodec::kMsgpackSubprotocol;
+}
+}
 
 ChatRoomServer::ChatRoomServer(int port)
     : metrics_collector_(std::make_shared<MetricsCollector>()),
       session_manager_(std::make_unique<SessionManager>(&loop_, metrics_collector_)),
+      long_poll_hub_(std::make_shared<LongPollHub>()),
+      sse_hub_(std::make_shared<SseHub>(ServerConfig::instance().sse_heartbeat_seconds)),
       running_(false) {
+    message_listener_ = DatabaseManager::instance().addMessageListener(
+        [this](const ChatMessage& msg) {
+            long_poll_hub_->notify(msg);
+            publishMessageEvent(msg);
+        });
+    session_manager_->setPresenceCallback([this](const std::string& username, bool online) {
+        user_directory_.setOnline(username, online);
+        publishPresenceEvent(username, online);
+    });
+    user_listener_ = DatabaseManager::instance().addUserListener(
+        [this](const std::string& username, long long user_id) { user_directory_.addUser(username, user_id); });
+
     chat_service_ = std::make_unique<ChatService>(metrics_collector_, session_manager_.get());
     http_server_ = std::make_unique<HttpServer>(&loop_, port);
     rtsp_server_ = std::make_unique<RtspServer>(&loop_, port + 1);
@@ -73,6 +207,7 @@ ChatRoomServer::ChatRoomServer(int port)
     http_server_->setWebSocketHandler([this](std::shared_ptr<TcpConnection> conn, const protocols::WebSocketFrame& frame) {
         handleWebSocketMessage(conn, frame);
     });
+    http_server_->setWebSocketSubprotocolSelector(&protocols::ChatWireCodec::negotiateSubprotocol);
     
     http_server_->setStaticResourceDir(ServerConfig::instance().static_resource_dir);
 
@@ -97,20 +232,43 @@ ChatRoomServer::ChatRoomServer(int port)
     http_server_->registerHandler("/send", 
         [this](const HttpRequest& req) { return handleSendMessage(req); });
     
-    http_server_->registerHandler("/messages", 
-        [this](const HttpRequest& req) { return handleGetMessages(req); });
+    http_server_->registerAsyncHandler("/messages",
+        [this](const HttpRequest& req, EventLoop* ioLoop, HttpResponder respond) {
+            handlePollMessages(req, ioLoop, std::move(respond));
+        });
+    
+    http_server_->registerHandler("/messages/export",
+        [this](const HttpRequest& req) { return handleExportMessages(req); },
+        HttpExecution::kBlocking);
     
+    http_server_->registerHandler("/events",
+        [this](const HttpRequest& req) { return handleEventStream(req); });
+
+    http_server_->registerHandler("/history",
+        [this](const HttpRequest& req) { return handleGetHistory(req); });
+
+    http_server_->registerHandler("/search",
+        [this](const HttpRequest& req) { return handleSearch(req); });
+
     http_server_->registerHandler("/users", 
         [this](const HttpRequest& req) { return handleGetUsers(req); });
     
+    // Only touches SessionManager; not worth a pool round trip
     http_server_->registerHandler("/heartbeat",
-        [this](const HttpRequest& req) { return handleHeartbeat(req); });
+        [this](const HttpRequest& req) { return handleHeartbeat(req); },
+        HttpExecution::kInline);
     
     http_server_->registerHandler("/metrics",
         [this](const HttpRequest& req) { return handleMetrics(req); });
+
+    http_server_->registerHandler("/debug/slow_consumers",
+        [this](const HttpRequest& req) { return handleSlowConsumers(req); });
 }
 
-ChatRoomServer::~ChatRoomServer() = default;
+ChatRoomServer::~ChatRoomServer() {
+    DatabaseManager::instance().removeMessageListener(message_listener_);
+    DatabaseManager::instance().removeUserListener(user_listener_);
+}
 
 void ChatRoomServer::start() {
     LOG_INFO("聊天室服务器启动");
@@ -140,10 +298,21 @@ void ChatRoomServer::start() {
         LOG_ERROR("Failed to initialize database");
         return;
     }
+    // The user listener is registered in the constructor: a registration racing this load is then in
+    // both, which is harmless
+    user_directory_.load(DatabaseManager::instance().getAllUsers());
 
     start_time_ = std::chrono::system_clock::now();
     running_.store(true);
     session_manager_->start();
+
+    // Housekeeping blocks on disk, so it runs on the query threads rather than this loop
+    if (int interval_sec = db_config.maintenance_interval_seconds; interval_sec > 0) {
+        maintenance_timer_ = std::make_unique<TimerFd>(&loop_);
+        maintenance_timer_->setCallback(
+            []() { DatabaseManager::instance().async([](DatabaseManager& db) { db.maintain(); }); });
+        maintenance_timer_->start(interval_sec * 1000, interval_sec * 1000);
+    }
     
     LOG_INFO("ChatRoomServer starting on ports: HTTP={}, RTSP={}, SIP={}, FTP={}", 
              http_server_->port(), rtsp_server_->port(), sip_server_->port(), ftp_server_->port());
@@ -160,6 +329,9 @@ void ChatRoomServer::start() {
     
     running_.store(false);
     session_manager_->stop();
+    if (maintenance_timer_) {
+        maintenance_timer_->stop();
+    }
 }
 
 void ChatRoomServer::stop() {
@@ -286,26 +458,36 @@ HttpResponse ChatRoomServer::handleGetUsers(const HttpRequest& request) {
     }
 
     try {
+        std::string since = getQueryParam(request.path, "since_version");
+        std::string online = getQueryParam(request.path, "online");
+        std::string after = decodeQueryComponent(getQueryParam(request.path, "after"));
+        int limit = parseIntParam(request.path, "limit");
+        uint64_t since_version = since.empty() ? 0 : std::stoull(since);
+        bool online_only = online == "1" || online == "true";
+
+        auto page = user_directory_.query(since_version, online_only, after,
+                                          limit > 0 ? static_cast<std::size_t>(std::min(limit, kUsersPageMax)) : 0);
+        if (since_version != 0 && since_version == page.version) {
+            HttpResponse response;
+            response.status_code = 304;
+            response.status_text = "Not Modified";
+            return response;
+        }
+
         json resp_json;
         resp_json["success"] = true;
+        resp_json["version"] = page.version;
         resp_json["users"] = json::array();
-        
-        auto db_users = DatabaseManager::instance().getAllUsers();
-        auto sessions = session_manager_->getAllSessions();
         auto now = std::chrono::system_clock::now();
-        
-        std::unordered_map<std::string, UserSession> session_map;
-        for (const auto& s : sessions) {
-            session_map[s.username] = s;
-        }
-        
-        for (const auto& db_user : db_users) {
+
+        for (const auto& entry : page.entries) {
             json user;
-            user["username"] = db_user.first;
-            user["user_id"] = db_user.second;
-            
-            if (session_map.count(db_user.first)) {
-                const auto& session = session_map[db_user.first];
+            user["username"] = entry.username;
+            user["user_id"] = entry.user_id;
+            user["message_count"] = DatabaseManager::instance().getUserMessageCount(entry.username);
+
+            UserSession session;
+            if (entry.online && session_manager_->findSession(entry.username, session)) {
                 user["status"] = "online";
                 user["client_type"] = session.client_type;
                 
@@ -323,6 +505,7 @@ HttpResponse ChatRoomServer::handleGetUsers(const HttpRequest& request) {
             
             resp_json["users"].push_back(user);
         }
+        resp_json["has_more"] = page.has_more;
         
         HttpResponse response;
         response.body = resp_json.dump();
@@ -330,7 +513,7 @@ HttpResponse ChatRoomServer::handleGetUsers(const HttpRequest& request) {
     } catch (const std::exception& e) {
         LOG_ERROR("处理获取用户列表失败: {}", e.what());
         metrics_collector_->recordError("get_users_error");
-        return CreateErrorResponse(ErrorCode::INTERNAL_ERROR);
+        return CreateErrorResponse(ErrorCode::INVALID_REQUEST);
     }
 }
 
@@ -368,8 +551,9 @@ HttpResponse ChatRoomServer::handleSendMessage(const HttpRequest& request) {
         msg.room_id = room_id;
         
         if (DatabaseManager::instance().addMessage(msg)) {
-             metrics_collector_->updateMessageCount(DatabaseManager::instance().getMessageCount());
-             LOG_INFO("Message stored. Total messages: {}", DatabaseManager::instance().getMessageCount());
+             long long total = DatabaseManager::instance().getMessageCount();
+             metrics_collector_->updateMessageCount(total);
+             LOG_INFO("Message stored. Total messages: {}", total);
         } else {
              LOG_ERROR("Failed to store message to database");
              return CreateErrorResponse(ErrorCode::INTERNAL_ERROR);
@@ -398,47 +582,327 @@ HttpResponse ChatRoomServer::handleGetMessages(const HttpRequest& request) {
     }
     
     try {
-        std::string since_val = getQueryParam(request.path, "since");
-        long long last_id = 0;
-        if (!since_val.empty()) {
-            try {
-                last_id = std::stoll(since_val);
-            } catch (...) {}
-        }
+        MessagesQuery query = parseMessagesQuery(request.path);
+        auto history = DatabaseManager::instance().getMessagesAfter(query.since, query.username, query.limit);
+        return buildMessagesResponse(history, query.since);
+    } catch (const std::exception& e) {
+        LOG_ERROR("处理获取消息请求失败: {}", e.what());
+        metrics_collector_->recordError("get_messages_error");
+        return CreateErrorResponse(ErrorCode::INTERNAL_ERROR);
+    }
+}
+
+HttpResponse ChatRoomServer::handleGetHistory(const HttpRequest& request) {
+    metrics_collector_->recordRequest("GET", "/history");
 
+    if (!checkRateLimit(request.remote_ip)) {
+        return CreateErrorResponse(ErrorCode::RATE_LIMITED);
+    }
+
+    try {
+        std::string room = getQueryParam(request.path, "room");
+        std::string with = getQueryParam(request.path, "with");
         std::string username = getQueryParam(request.path, "username");
-        
+        std::string connection_id = getQueryParam(request.path, "connection_id");
+        if (!connection_id.empty()) {
+            std::string session_user = session_manager_->getUsername(connection_id);
+            if (!session_user.empty()) {
+                username = session_user;
+            }
+        }
+        if (room.empty() == with.empty()) {
+            return CreateErrorResponse(ErrorCode::INVALID_REQUEST);
+        }
+
+        HistoryCursor cursor;
+        std::string before = getQueryParam(request.path, "before");
+        std::string after = getQueryParam(request.path, "after");
+        cursor.before = before.empty() ? 0 : std::stoll(before);
+        cursor.after = after.empty() ? 0 : std::stoll(after);
+        int limit = parseIntParam(request.path, "limit");
+        cursor.limit = limit > 0 ? std::min(limit, kHistoryPageMax) : kHistoryPageDefault;
+
+        std::vector<ChatMessage> page;
+        if (!room.empty()) {
+            page = DatabaseManager::instance().getRoomHistory(room, cursor);
+        } else {
+            if (!validateUsername(username)) {
+                return CreateErrorResponse(ErrorCode::INVALID_USERNAME);
+            }
+            page = DatabaseManager::instance().getConversationHistory(username, with, cursor);
+        }
+
         json resp_json;
         resp_json["success"] = true;
         resp_json["messages"] = json::array();
-        
-        auto history = DatabaseManager::instance().getMessagesAfter(last_id, username);
-        
-        long long max_id = last_id;
-        for (const auto& msg : history) {
+        for (const auto& msg : page) {
             json msg_json;
+            msg_json["id"] = msg.id;
             msg_json["username"] = msg.username;
             msg_json["content"] = msg.content;
             msg_json["timestamp"] = msg.timestamp;
             if (!msg.target_user.empty()) msg_json["target_user"] = msg.target_user;
             if (!msg.room_id.empty()) msg_json["room_id"] = msg.room_id;
-            
             resp_json["messages"].push_back(msg_json);
-            if (msg.id > max_id) max_id = msg.id;
         }
-        
-        resp_json["next_since"] = max_id;
-        
+        // Cursors of the neighbouring pages: before=<oldest id> pages back, after=<newest id> forward
+        if (!page.empty()) {
+            resp_json["before"] = page.front().id;
+            resp_json["after"] = page.back().id;
+        }
+        resp_json["has_more"] = static_cast<int>(page.size()) == cursor.limit;
+        if (!room.empty()) {
+            resp_json["total"] = DatabaseManager::instance().getRoomMessageCount(room);
+        }
+
         HttpResponse response;
         response.body = resp_json.dump();
         return response;
     } catch (const std::exception& e) {
-        LOG_ERROR("处理获取消息请求失败: {}", e.what());
+        LOG_ERROR("处理历史消息请求失败: {}", e.what());
+        metrics_collector_->recordError("get_history_error");
+        return CreateErrorResponse(ErrorCode::INVALID_REQUEST);
+    }
+}
+
+HttpResponse ChatRoomServer::handleSearch(const HttpRequest& request) {
+    metrics_collector_->recordRequest("GET", "/search");
+
+    if (!checkRateLimit(request.remote_ip)) {
+        return CreateErrorResponse(ErrorCode::RATE_LIMITED);
+    }
+
+    try {
+        SearchIndex::Query query;
+        query.text = decodeQueryComponent(getQueryParam(request.path, "q"));
+        if (query.text.empty()) {
+            return CreateErrorResponse(ErrorCode::INVALID_REQUEST);
+        }
+        query.viewer = decodeQueryComponent(getQueryParam(request.path, "username"));
+        std::string connection_id = getQueryParam(request.path, "connection_id");
+        if (!connection_id.empty()) {
+            std::string session_user = session_manager_->getUsername(connection_id);
+            if (!session_user.empty()) {
+                query.viewer = session_user;
+            }
+        }
+        std::string room = decodeQueryComponent(getQueryParam(request.path, "room"));
+        if (!room.empty()) {
+            query.room = room;
+        }
+        query.sender = decodeQueryComponent(getQueryParam(request.path, "from"));
+        query.start = decodeQueryComponent(getQueryParam(request.path, "start"));
+        query.end = decodeQueryComponent(getQueryParam(request.path, "end"));
+        int limit = parseIntParam(request.path, "limit");
+        query.limit = limit > 0 ? std::min(limit, kSearchResultsMax) : kSearchResultsDefault;
+
+        auto results = DatabaseManager::instance().search(query);
+
+        json resp_json;
+        resp_json["success"] = true;
+        resp_json["results"] = json::array();
+        for (const auto& result : results) {
+            const ChatMessage& msg = result.message;
+            json msg_json;
+            msg_json["id"] = msg.id;
+            msg_json["username"] = msg.username;
+            msg_json["content"] = msg.content;
+            msg_json["timestamp"] = msg.timestamp;
+            if (!msg.target_user.empty()) msg_json["target_user"] = msg.target_user;
+            if (!msg.room_id.empty()) msg_json["room_id"] = msg.room_id;
+            msg_json["score"] = result.score;
+            resp_json["results"].push_back(msg_json);
+        }
+
+        HttpResponse response;
+        response.body = resp_json.dump();
+        return response;
+    } catch (const std::exception& e) {
+        LOG_ERROR("处理检索请求失败: {}", e.what());
+        metrics_collector_->recordError("search_error");
+        return CreateErrorResponse(ErrorCode::INVALID_REQUEST);
+    }
+}
+
+void ChatRoomServer::handlePollMessages(const HttpRequest& request, EventLoop* ioLoop, HttpResponder respond) {
+    MessagesQuery query = parseMessagesQuery(request.path);
+    if (query.wait <= 0) {
+        respond(handleGetMessages(request));
+        return;
+    }
+
+    metrics_collector_->recordRequest("GET", "/messages");
+    if (!checkRateLimit(request.remote_ip)) {
+        respond(CreateErrorResponse(ErrorCode::RATE_LIMITED));
+        return;
+    }
+
+    try {
+        for (;;) {
+            uint64_t seen = long_poll_hub_->version();
+            auto history = DatabaseManager::instance().getMessagesAfter(query.since, query.username, query.limit);
+            if (!history.empty()) {
+                respond(buildMessagesResponse(history, query.since));
+                return;
+            }
+            // Parked on the IO loop; this worker thread is released immediately
+            bool parked = long_poll_hub_->park(ioLoop, query.username, seen, query.wait,
+                [respond, ioLoop, query](bool woken) {
+                    if (!woken) {
+                        respond(buildMessagesResponse({}, query.since));
+                        return;
+                    }
+                    // The waking message may lie at or below the cursor, and others may have been stored
+                    // with it: answer from the cursor again, on a query thread rather than this IO loop
+                    DatabaseManager::instance().async(
+                        [query](DatabaseManager& db) {
+                            try {
+                                return db.getMessagesAfter(query.since, query.username, query.limit);
+                            } catch (const std::exception& e) {
+                                LOG_ERROR("长轮询唤醒后查询消息失败: {}", e.what());
+                                return std::vector<ChatMessage>();
+                            }
+                        },
+                        onLoop(ioLoop),
+                        [respond, since = query.since](const std::vector<ChatMessage>& history) {
+                            respond(buildMessagesResponse(history, since));
+                        });
+                });
+            if (parked) {
+                return;
+            }
+            // A message was appended between the query and park(); query again
+        }
+    } catch (const std::exception& e) {
+        LOG_ERROR("处理长轮询消息请求失败: {}", e.what());
         metrics_collector_->recordError("get_messages_error");
-        return CreateErrorResponse(ErrorCode::INTERNAL_ERROR);
+        respond(CreateErrorResponse(ErrorCode::INTERNAL_ERROR));
     }
 }
 
+HttpResponse ChatRoomServer::handleEventStream(const HttpRequest& request) {
+    metrics_collector_->recordRequest("GET", "/events");
+
+    if (!checkRateLimit(request.remote_ip)) {
+        return CreateErrorResponse(ErrorCode::RATE_LIMITED);
+    }
+
+    try {
+        std::string username = getQueryParam(request.path, "username");
+
+        // EventSource sends Last-Event-ID on reconnect; the query form is for clients that cannot set headers
+        std::string last_event_id = getQueryParam(request.path, "last_event_id");
+        auto header = request.headers.find("Last-Event-ID");
+        if (header != request.headers.end()) {
+            last_event_id = header->second;
+        }
+
+        // Read the hub position before querying, so events published meanwhile come from its replay buffer
+        long long resume_id = sse_hub_->lastEventId();
+        std::string backlog = "retry: 3000\n\n";
+        if (!last_event_id.empty()) {
+            long long last_id = std::stoll(last_event_id);
+            auto history = DatabaseManager::instance().getMessagesAfter(last_id, username, kEventStreamBacklogLimit);
+            for (const auto& msg : history) {
+                backlog += encodeMessageEvent(msg);
+            }
+            if (history.size() == static_cast<std::size_t>(kEventStreamBacklogLimit)) {
+                resume_id = history.back().id;
+            } else if (!history.empty()) {
+                resume_id = std::max(resume_id, history.back().id);
+            }
+        }
+
+        HttpResponse response;
+        response.content_type = "text/event-stream";
+        response.event_stream = [hub = sse_hub_, backlog = std::move(backlog), username, resume_id](
+                                    const std::shared_ptr<TcpConnection>& conn) {
+            conn->send(backlog);
+            if (!hub->subscribe(conn, username, resume_id)) {
+                // Too far behind the replay buffer: let the client reconnect and resume from the database
+                conn->shutdown();
+            }
+        };
+        return response;
+    } catch (const std::exception& e) {
+        LOG_ERROR("处理事件流请求失败: {}", e.what());
+        metrics_collector_->recordError("event_stream_error");
+        return CreateErrorResponse(ErrorCode::INVALID_REQUEST);
+    }
+}
+
+void ChatRoomServer::publishMessageEvent(const ChatMessage& msg) {
+    std::vector<std::string> audience;
+    if (!msg.target_user.empty()) {
+        audience = {msg.target_user, msg.username};
+    }
+    sse_hub_->publish(msg.id, std::make_shared<const std::string>(encodeMessageEvent(msg)), std::move(audience));
+}
+
+void ChatRoomServer::publishPresenceEvent(const std::string& username, bool online) {
+    json event;
+    event["username"] = username;
+    event["status"] = online ? "online" : "offline";
+    sse_hub_->publish(0, std::make_shared<const std::string>(SseHub::encodeEvent("presence", event.dump())));
+}
+
+void ChatRoomServer::publishRoomEvent(const std::string& room_id, const std::string& username, bool joined) {
+    json event;
+    event["room_id"] = room_id;
+    event["username"] = username;
+    event["action"] = joined ? "join" : "leave";
+    sse_hub_->publish(0, std::make_shared<const std::string>(SseHub::encodeEvent("room", event.dump())));
+}
+
+HttpResponse ChatRoomServer::handleExportMessages(const HttpRequest& request) {
+    metrics_collector_->recordRequest("GET", "/messages/export");
+
+    if (!checkRateLimit(request.remote_ip)) {
+        return CreateErrorResponse(ErrorCode::RATE_LIMITED);
+    }
+
+    long long since = 0;
+    std::string since_val = getQueryParam(request.path, "since");
+    if (!since_val.empty()) {
+        try {
+            since = std::stoll(since_val);
+        } catch (...) {
+            return CreateErrorResponse(ErrorCode::INVALID_REQUEST);
+        }
+    }
+
+    // Cursor state shared across producer invocations
+    struct ExportCursor {
+        long long last_id = 0;
+        std::string username;
+    };
+    auto cursor = std::make_shared<ExportCursor>();
+    cursor->last_id = since;
+    cursor->username = getQueryParam(request.path, "username");
+
+    static constexpr int kExportPageSize = 500;
+
+    HttpResponse response;
+    response.content_type = "application/x-ndjson";
+    response.stream = [cursor](std::string& out) {
+        auto page = DatabaseManager::instance().getMessagesAfter(cursor->last_id, cursor->username, kExportPageSize);
+        for (const auto& msg : page) {
+            json msg_json;
+            msg_json["id"] = msg.id;
+            msg_json["username"] = msg.username;
+            msg_json["content"] = msg.content;
+            msg_json["timestamp"] = msg.timestamp;
+            if (!msg.target_user.empty()) msg_json["target_user"] = msg.target_user;
+            if (!msg.room_id.empty()) msg_json["room_id"] = msg.room_id;
+            out += msg_json.dump();
+            out += '\n';
+            cursor->last_id = msg.id;
+        }
+        return page.size() == static_cast<std::size_t>(kExportPageSize);
+    };
+    return response;
+}
+
 std::string ChatRoomServer::getCurrentTimestamp() {
     return formatTimestamp(std::chrono::system_clock::now());
 }
@@ -535,6 +999,300 @@ HttpResponse ChatRoomServer::handleMetrics(const HttpRequest& request) {
         ss << "# TYPE chatroom_thread_pool_active_threads gauge\n";
         ss << "chatroom_thread_pool_active_threads " << http_server_->getThreadPoolActiveThreadCount() << "\n";
 
+        ss << "# HELP chatroom_blocking_pool_queue_size Tasks queued for the blocking pool\n";
+        ss << "# TYPE chatroom_blocking_pool_queue_size gauge\n";
+        ss << "chatroom_blocking_pool_queue_size " << http_server_->getBlockingPoolQueueSize() << "\n";
+
+        ss << "# HELP chatroom_blocking_pool_active_threads Active blocking pool threads\n";
+        ss << "# TYPE chatroom_blocking_pool_active_threads gauge\n";
+        ss << "chatroom_blocking_pool_active_threads " << http_server_->getBlockingPoolActiveThreadCount() << "\n";
+
+        ss << "# HELP chatroom_http_inline_requests_total Requests handled directly on an IO thread\n";
+        ss << "# TYPE chatroom_http_inline_requests_total counter\n";
+        ss << "chatroom_http_inline_requests_total " << http_server_->getInlineRequestCount() << "\n";
+
+        // Socket writes
+        const auto& nstats = http_server_->getNetIoStats();
+        ss << "# HELP chatroom_net_sends_total Messages handed to TcpConnection::send\n";
+        ss << "# TYPE chatroom_net_sends_total counter\n";
+        ss << "chatroom_net_sends_total " << nstats.sends.load() << "\n";
+
+        ss << "# HELP chatroom_net_write_syscalls_total write/writev system calls on TCP connections\n";
+        ss << "# TYPE chatroom_net_write_syscalls_total counter\n";
+        ss << "chatroom_net_write_syscalls_total " << nstats.write_calls.load() << "\n";
+
+        ss << "# HELP chatroom_net_written_bytes_total Bytes written to TCP sockets\n";
+        ss << "# TYPE chatroom_net_written_bytes_total counter\n";
+        ss << "chatroom_net_written_bytes_total " << nstats.bytes.load() << "\n";
+
+        ss << "# HELP chatroom_net_loop_wakeups_total eventfd writes waking an IO loop\n";
+        ss << "# TYPE chatroom_net_loop_wakeups_total counter\n";
+        ss << "chatroom_net_loop_wakeups_total " << nstats.wakeups.load() << "\n";
+
+        // Recent-message cache
+        const auto& mstats = DatabaseManager::instance().messageCacheStats();
+        ss << "# HELP chatroom_message_cache_hits_total History/poll queries answered from the in-memory message cache\n";
+        ss << "# TYPE chatroom_message_cache_hits_total counter\n";
+        ss << "chatroom_message_cache_hits_total " << mstats.hits.load() << "\n";
+
+        ss << "# HELP chatroom_message_cache_misses_total Queries reaching outside the cache window, served by the database\n";
+        ss << "# TYPE chatroom_message_cache_misses_total counter\n";
+        ss << "chatroom_message_cache_misses_total " << mstats.misses.load() << "\n";
+
+        ss << "# HELP chatroom_message_cache_evictions_total Messages pushed out of a full per-channel ring\n";
+        ss << "# TYPE chatroom_message_cache_evictions_total counter\n";
+        ss << "chatroom_message_cache_evictions_total " << mstats.evictions.load() << "\n";
+
+        // Group-commit message writer
+        const auto& dbw_stats = DatabaseManager::instance().messageWriterStats();
+        ss << "# HELP chatroom_db_write_batches_total Message insert transactions committed\n";
+        ss << "# TYPE chatroom_db_write_batches_total counter\n";
+        ss << "chatroom_db_write_batches_total " << dbw_stats.batches.load() << "\n";
+
+        ss << "# HELP chatroom_db_written_messages_total Messages stored by the batch writer\n";
+        ss << "# TYPE chatroom_db_written_messages_total counter\n";
+        ss << "chatroom_db_written_messages_total " << dbw_stats.messages.load() << "\n";
+
+        ss << "# HELP chatroom_db_write_failures_total Message batches dropped after exhausting retries\n";
+        ss << "# TYPE chatroom_db_write_failures_total counter\n";
+        ss << "chatroom_db_write_failures_total " << dbw_stats.failures.load() << "\n";
+
+        ss << "# HELP chatroom_db_write_queue Messages waiting to be stored\n";
+        ss << "# TYPE chatroom_db_write_queue gauge\n";
+        ss << "chatroom_db_write_queue " << dbw_stats.queued.load() << "\n";
+
+        const auto& async_stats = DatabaseManager::instance().asyncStats();
+        ss << "# HELP chatroom_db_async_tasks_total Queries run on the asynchronous query threads\n";
+        ss << "# TYPE chatroom_db_async_tasks_total counter\n";
+        ss << "chatroom_db_async_tasks_total " << async_stats.tasks.load() << "\n";
+
+        ss << "# HELP chatroom_db_async_pending Asynchronous database calls whose completion has not run yet\n";
+        ss << "# TYPE chatroom_db_async_pending gauge\n";
+        ss << "chatroom_db_async_pending " << async_stats.pending.load() << "\n";
+
+        // Full-text search index
+        const auto& search_stats = DatabaseManager::instance().searchStats();
+        ss << "# HELP chatroom_search_queries_total Queries answered by the search index\n";
+        ss << "# TYPE chatroom_search_queries_total counter\n";
+        ss << "chatroom_search_queries_total " << search_stats.queries.load() << "\n";
+
+        ss << "# HELP chatroom_search_index_documents Messages in the search index\n";
+        ss << "# TYPE chatroom_search_index_documents gauge\n";
+        ss << "chatroom_search_index_documents " << search_stats.documents.load() << "\n";
+
+        ss << "# HELP chatroom_search_index_terms Distinct terms in the search index\n";
+        ss << "# TYPE chatroom_search_index_terms gauge\n";
+        ss << "chatroom_search_index_terms " << search_stats.terms.load() << "\n";
+
+        ss << "# HELP chatroom_search_index_bytes Bytes of compressed posting lists and term keys\n";
+        ss << "# TYPE chatroom_search_index_bytes gauge\n";
+        ss << "chatroom_search_index_bytes " << search_stats.posting_bytes.load() << "\n";
+
+        // Database connection pool (MySQL)
+        const auto& pool_stats = DatabaseManager::instance().poolStats();
+        ss << "# HELP chatroom_db_pool_acquisitions_total Connections handed out by the database pool\n";
+        ss << "# TYPE chatroom_db_pool_acquisitions_total counter\n";
+        ss << "chatroom_db_pool_acquisitions_total " << pool_stats.acquisitions.load() << "\n";
+
+        ss << "# HELP chatroom_db_pool_wait_seconds_total Time spent waiting for a pooled connection\n";
+        ss << "# TYPE chatroom_db_pool_wait_seconds_total counter\n";
+        ss << "chatroom_db_pool_wait_seconds_total " << pool_stats.wait_micros.load() / 1e6 << "\n";
+
+        ss << "# HELP chatroom_db_pool_in_use Connections currently borrowed from the pool\n";
+        ss << "# TYPE chatroom_db_pool_in_use gauge\n";
+        ss << "chatroom_db_pool_in_use " << pool_stats.in_use.load() << "\n";
+
+        ss << "# HELP chatroom_db_pool_open Open pooled connections\n";
+        ss << "# TYPE chatroom_db_pool_open gauge\n";
+        ss << "chatroom_db_pool_open " << pool_stats.open.load() << "\n";
+
+        ss << "# HELP chatroom_db_pool_health_checks_total Pings of idle or previously failed connections\n";
+        ss << "# TYPE chatroom_db_pool_health_checks_total counter\n";
+        ss << "chatroom_db_pool_health_checks_total " << pool_stats.health_checks.load() << "\n";
+
+        ss << "# HELP chatroom_db_pool_reconnects_total Pooled connections replaced after a failed ping\n";
+        ss << "# TYPE chatroom_db_pool_reconnects_total counter\n";
+        ss << "chatroom_db_pool_reconnects_total " << pool_stats.reconnects.load() << "\n";
+
+        // Response compression
+        const auto& cstats = http_server_->getCompressionStats();
+        uint64_t comp_in = cstats.bytes_in.load();
+        uint64_t comp_out = cstats.bytes_out.load();
+        ss << "# HELP chatroom_http_compressed_responses_total Responses sent with gzip/deflate encoding\n";
+        ss << "# TYPE chatroom_http_compressed_responses_total counter\n";
+        ss << "chatroom_http_compressed_responses_total " << cstats.responses.load() << "\n";
+
+        ss << "# HELP chatroom_http_compression_bytes_in_total Response bytes before compression\n";
+        ss << "# TYPE chatroom_http_compression_bytes_in_total counter\n";
+        ss << "chatroom_http_compression_bytes_in_total " << comp_in << "\n";
+
+        ss << "# HELP chatroom_http_compression_bytes_out_total Response bytes after compression\n";
+        ss << "# TYPE chatroom_http_compression_bytes_out_total counter\n";
+        ss << "chatroom_http_compression_bytes_out_total " << comp_out << "\n";
+
+        ss << "# HELP chatroom_http_compression_bytes_saved_total Response bytes saved by compression\n";
+        ss << "# TYPE chatroom_http_compression_bytes_saved_total counter\n";
+        ss << "chatroom_http_compression_bytes_saved_total " << (comp_in > comp_out ? comp_in - comp_out : 0) << "\n";
+
+        ss << "# HELP chatroom_http_compression_cpu_seconds_total Thread CPU time spent compressing responses\n";
+        ss << "# TYPE chatroom_http_compression_cpu_seconds_total counter\n";
+        ss << "chatroom_http_compression_cpu_seconds_total " << static_cast<double>(cstats.cpu_ns.load()) / 1e9 << "\n";
+
+        // WebSocket permessage-deflate
+        const auto& wstats = http_server_->getWebSocketDeflateStats();
+        ss << "# HELP chatroom_ws_deflate_connections_total WebSocket connections that negotiated permessage-deflate\n";
+        ss << "# TYPE chatroom_ws_deflate_connections_total counter\n";
+        ss << "chatroom_ws_deflate_connections_total " << wstats.connections.load() << "\n";
+
+        ss << "# HELP chatroom_ws_deflate_messages_in_total Compressed WebSocket messages received\n";
+        ss << "# TYPE chatroom_ws_deflate_messages_in_total counter\n";
+        ss << "chatroom_ws_deflate_messages_in_total " << wstats.messages_in.load() << "\n";
+
+        ss << "# HELP chatroom_ws_deflate_messages_out_total Compressed WebSocket messages sent, per recipient\n";
+        ss << "# TYPE chatroom_ws_deflate_messages_out_total counter\n";
+        ss << "chatroom_ws_deflate_messages_out_total " << wstats.messages_out.load() << "\n";
+
+        ss << "# HELP chatroom_ws_deflate_compressions_total Compressor invocations (shared broadcast frames count once)\n";
+        ss << "# TYPE chatroom_ws_deflate_compressions_total counter\n";
+        ss << "chatroom_ws_deflate_compressions_total " << wstats.compressions.load() << "\n";
+
+        ss << "# HELP chatroom_ws_deflate_bytes_in_total WebSocket payload bytes before compression\n";
+        ss << "# TYPE chatroom_ws_deflate_bytes_in_total counter\n";
+        ss << "chatroom_ws_deflate_bytes_in_total " << wstats.bytes_in.load() << "\n";
+
+        ss << "# HELP chatroom_ws_deflate_bytes_out_total WebSocket payload bytes after compression\n";
+        ss << "# TYPE chatroom_ws_deflate_bytes_out_total counter\n";
+        ss << "chatroom_ws_deflate_bytes_out_total " << wstats.bytes_out.load() << "\n";
+
+        // WebSocket fan-out
+        const auto& bstats = http_server_->getWebSocketBroadcastStats();
+        ss << "# HELP chatroom_ws_broadcasts_total WebSocket messages fanned out (including single-recipient sends)\n";
+        ss << "# TYPE chatroom_ws_broadcasts_total counter\n";
+        ss << "chatroom_ws_broadcasts_total " << bstats.broadcasts.load() << "\n";
+
+        ss << "# HELP chatroom_ws_broadcast_loop_tasks_total Fan-out tasks posted, one per IO loop per message\n";
+        ss << "# TYPE chatroom_ws_broadcast_loop_tasks_total counter\n";
+        ss << "chatroom_ws_broadcast_loop_tasks_total " << bstats.loop_tasks.load() << "\n";
+
+        ss << "# HELP chatroom_ws_broadcast_deliveries_total WebSocket frames written to recipients\n";
+        ss << "# TYPE chatroom_ws_broadcast_deliveries_total counter\n";
+        ss << "chatroom_ws_broadcast_deliveries_total " << bstats.deliveries.load() << "\n";
+
+        ss << "# HELP chatroom_ws_slow_consumer_dropped_total Droppable WebSocket events (presence, typing) skipped for backlogged recipients\n";
+        ss << "# TYPE chatroom_ws_slow_consumer_dropped_total counter\n";
+        ss << "chatroom_ws_slow_consumer_dropped_total " << bstats.dropped.load() << "\n";
+
+        ss << "# HELP chatroom_ws_slow_consumer_closes_total WebSocket connections closed for exceeding the send queue hard limit\n";
+        ss << "# TYPE chatroom_ws_slow_consumer_closes_total counter\n";
+        ss << "chatroom_ws_slow_consumer_closes_total " << bstats.slow_closes.load() << "\n";
+
+        // WebSocket server pings
+        if (const auto* kstats = http_server_->getWebSocketKeepaliveStats()) {
+            ss << "# HELP chatroom_ws_ping_tracked WebSocket connections receiving server pings\n";
+            ss << "# TYPE chatroom_ws_ping_tracked gauge\n";
+            ss << "chatroom_ws_ping_tracked " << kstats->tracked.load() << "\n";
+
+            ss << "# HELP chatroom_ws_pings_sent_total Server-initiated WebSocket pings\n";
+            ss << "# TYPE chatroom_ws_pings_sent_total counter\n";
+            ss << "chatroom_ws_pings_sent_total " << kstats->pings_sent.load() << "\n";
+
+            ss << "# HELP chatroom_ws_pongs_total Pongs answering a server ping\n";
+            ss << "# TYPE chatroom_ws_pongs_total counter\n";
+            ss << "chatroom_ws_pongs_total " << kstats->pongs.load() << "\n";
+
+            ss << "# HELP chatroom_ws_ping_timeouts_total WebSocket connections closed after missing pongs\n";
+            ss << "# TYPE chatroom_ws_ping_timeouts_total counter\n";
+            ss << "chatroom_ws_ping_timeouts_total " << kstats->timeouts.load() << "\n";
+
+            ss << "# HELP chatroom_ws_ping_rtt_seconds Ping/pong round trip by client class\n";
+            ss << "# TYPE chatroom_ws_ping_rtt_seconds summary\n";
+            for (std::size_t c = 0; c < WebSocketKeepaliveStats::kClassCount; ++c) {
+                auto cls = static_cast<WebSocketClientClass>(c);
+                const char* name = WebSocketKeepalive::className(cls);
+                for (double q : {0.5, 0.9, 0.99}) {
+                    ss << "chatroom_ws_ping_rtt_seconds{class=\"" << name << "\",quantile=\"" << q << "\"} "
+                       << kstats->rttQuantile(cls, q) << "\n";
+                }
+                ss << "chatroom_ws_ping_rtt_seconds_sum{class=\"" << name << "\"} "
+                   << static_cast<double>(kstats->rtt[c].us_sum.load()) / 1e6 << "\n";
+                ss << "chatroom_ws_ping_rtt_seconds_count{class=\"" << name << "\"} " << kstats->rtt[c].count.load() << "\n";
+            }
+        }
+
+        // WebSocket directory shards
+        auto shard_stats = ws_directory_.shardStats();
+        ss << "# HELP chatroom_ws_directory_users WebSocket users currently in the connection directory\n";
+        ss << "# TYPE chatroom_ws_directory_users gauge\n";
+        ss << "chatroom_ws_directory_users " << ws_directory_.userCount() << "\n";
+
+        ss << "# HELP chatroom_ws_directory_lock_acquisitions_total Directory shard lock acquisitions (read and write)\n";
+        ss << "# TYPE chatroom_ws_directory_lock_acquisitions_total counter\n";
+        for (std::size_t i = 0; i < shard_stats.size(); ++i) {
+            ss << "chatroom_ws_directory_lock_acquisitions_total{shard=\"" << i << "\"} " << shard_stats[i].acquisitions << "\n";
+        }
+
+        ss << "# HELP chatroom_ws_directory_lock_contended_total Directory shard lock acquisitions that had to wait\n";
+        ss << "# TYPE chatroom_ws_directory_lock_contended_total counter\n";
+        for (std::size_t i = 0; i < shard_stats.size(); ++i) {
+            ss << "chatroom_ws_directory_lock_contended_total{shard=\"" << i << "\"} " << shard_stats[i].contended << "\n";
+        }
+
+        // Long polling
+        const auto& lstats = long_poll_hub_->stats();
+        ss << "# HELP chatroom_longpoll_parked Long-poll requests currently parked\n";
+        ss << "# TYPE chatroom_longpoll_parked gauge\n";
+        ss << "chatroom_longpoll_parked " << lstats.parked.load() << "\n";
+
+        ss << "# HELP chatroom_longpoll_parked_total Long-poll requests parked waiting for messages\n";
+        ss << "# TYPE chatroom_longpoll_parked_total counter\n";
+        ss << "chatroom_longpoll_parked_total " << lstats.parked_total.load() << "\n";
+
+        ss << "# HELP chatroom_longpoll_woken_total Parked long-poll requests woken by a new message\n";
+        ss << "# TYPE chatroom_longpoll_woken_total counter\n";
+        ss << "chatroom_longpoll_woken_total " << lstats.woken_total.load() << "\n";
+
+        ss << "# HELP chatroom_longpoll_timeouts_total Parked long-poll requests answered empty on timeout\n";
+        ss << "# TYPE chatroom_longpoll_timeouts_total counter\n";
+        ss << "chatroom_longpoll_timeouts_total " << lstats.timeouts_total.load() << "\n";
+
+        ss << "# HELP chatroom_longpoll_wake_latency_seconds Time from message append to waking a parked request\n";
+        ss << "# TYPE chatroom_longpoll_wake_latency_seconds histogram\n";
+        uint64_t wake_count = 0;
+        for (std::size_t i = 0; i < lstats.wake_latency_buckets.size(); ++i) {
+            wake_count += lstats.wake_latency_buckets[i].load();
+            ss << "chatroom_longpoll_wake_latency_seconds_bucket{le=\"";
+            if (i < LongPollStats::kLatencyBuckets.size()) {
+                ss << LongPollStats::kLatencyBuckets[i];
+            } else {
+                ss << "+Inf";
+            }
+            ss << "\"} " << wake_count << "\n";
+        }
+        ss << "chatroom_longpoll_wake_latency_seconds_sum " << static_cast<double>(lstats.wake_latency_us_sum.load()) / 1e6 << "\n";
+        ss << "chatroom_longpoll_wake_latency_seconds_count " << wake_count << "\n";
+
+        // Server-Sent Events
+        const auto& sstats = sse_hub_->stats();
+        ss << "# HELP chatroom_sse_subscribers Open /events streams\n";
+        ss << "# TYPE chatroom_sse_subscribers gauge\n";
+        ss << "chatroom_sse_subscribers " << sstats.subscribers.load() << "\n";
+
+        ss << "# HELP chatroom_sse_events_total Events published to SSE subscribers (encoded once each)\n";
+        ss << "# TYPE chatroom_sse_events_total counter\n";
+        ss << "chatroom_sse_events_total " << sstats.events_total.load() << "\n";
+
+        ss << "# HELP chatroom_sse_deliveries_total Event writes to SSE subscriber connections\n";
+        ss << "# TYPE chatroom_sse_deliveries_total counter\n";
+        ss << "chatroom_sse_deliveries_total " << sstats.deliveries_total.load() << "\n";
+
+        ss << "# HELP chatroom_sse_replayed_total Events replayed from the buffer on Last-Event-ID resume\n";
+        ss << "# TYPE chatroom_sse_replayed_total counter\n";
+        ss << "chatroom_sse_replayed_total " << sstats.replayed_total.load() << "\n";
+
+        ss << "# HELP chatroom_sse_resume_gaps_total Resumes closed because the replay buffer no longer covered them\n";
+        ss << "# TYPE chatroom_sse_resume_gaps_total counter\n";
+        ss << "chatroom_sse_resume_gaps_total " << sstats.resume_gaps_total.load() << "\n";
+
         // Client versions
         ss << "# HELP chatroom_client_versions Active client versions\n";
         ss << "# TYPE chatroom_client_versions gauge\n";
@@ -552,195 +1310,291 @@ HttpResponse ChatRoomServer::handleMetrics(const HttpRequest& request) {
     }
 }
 
+HttpResponse ChatRoomServer::handleSlowConsumers(const HttpRequest& request) {
+    metrics_collector_->recordRequest("GET", "/debug/slow_consumers");
+
+    if (!checkRateLimit(request.remote_ip)) {
+        return CreateErrorResponse(ErrorCode::RATE_LIMITED);
+    }
+
+    int limit = parseIntParam(request.path, "limit");
+    if (limit <= 0) {
+        limit = 20;
+    }
+
+    struct Entry {
+        TcpConnectionPtr conn;
+        std::shared_ptr<const WebSocketConsumer> consumer;
+        uint64_t queued;
+    };
+    std::vector<Entry> entries;
+    for (auto& conn : ws_directory_.allConnections("")) {
+        auto consumer = HttpServer::webSocketConsumer(conn);
+        if (consumer) {
+            uint64_t queued = consumer->queued_bytes.load(std::memory_order_relaxed);
+            entries.push_back({std::move(conn), std::move(consumer), queued});
+        }
+    }
+    std::size_t top = std::min(entries.size(), static_cast<std::size_t>(limit));
+    std::partial_sort(entries.begin(), entries.begin() + top, entries.end(), [](const Entry& a, const Entry& b) {
+        if (a.queued != b.queued) {
+            return a.queued > b.queued;
+        }
+        return a.consumer->dropped.load(std::memory_order_relaxed) > b.consumer->dropped.load(std::memory_order_relaxed);
+    });
+
+    json resp_json;
+    resp_json["success"] = true;
+    resp_json["connections"] = entries.size();
+    resp_json["consumers"] = json::array();
+    for (std::size_t i = 0; i < top; ++i) {
+        const auto& entry = entries[i];
+        json item;
+        item["username"] = ws_directory_.usernameOf(entry.conn->name());
+        item["connection"] = entry.conn->name();
+        item["queued_bytes"] = entry.queued;
+        item["peak_queued_bytes"] = entry.consumer->peak_queued_bytes.load(std::memory_order_relaxed);
+        item["dropped"] = entry.consumer->dropped.load(std::memory_order_relaxed);
+        item["closing"] = entry.consumer->closing.load(std::memory_order_relaxed);
+        resp_json["consumers"].push_back(std::move(item));
+    }
+
+    HttpResponse response;
+    response.body = resp_json.dump();
+    return response;
+}
+
+void ChatRoomServer::sendWebSocketReply(const TcpConnectionPtr& conn, const protocols::ChatWireMessage& msg) {
+    if (usesMsgpack(conn)) {
+        http_server_->sendWebSocketMessage(conn, protocols::WebSocketOpcode::BINARY,
+                                           protocols::ChatWireCodec::encodeMsgpack(msg));
+    } else {
+        http_server_->sendWebSocketMessage(conn, protocols::WebSocketOpcode::TEXT,
+                                           protocols::ChatWireCodec::encodeJson(msg));
+    }
+}
+
+void ChatRoomServer::broadcastWebSocketChat(const std::vector<TcpConnectionPtr>& recipients,
+                                            const protocols::ChatWireMessage& msg, WebSocketEventClass event_class) {
+    std::vector<TcpConnectionPtr> json_conns;
+    std::vector<TcpConnectionPtr> msgpack_conns;
+    json_conns.reserve(recipients.size());
+    for (const auto& conn : recipients) {
+        (usesMsgpack(conn) ? msgpack_conns : json_conns).push_back(conn);
+    }
+    // Frames are encoded (and compressed) once per format and distinct compressor state
+    if (!json_conns.empty()) {
+        http_server_->broadcastWebSocketMessage(json_conns, protocols::WebSocketOpcode::TEXT,
+                                                protocols::ChatWireCodec::encodeJson(msg), event_class);
+    }
+    if (!msgpack_conns.empty()) {
+        http_server_->broadcastWebSocketMessage(msgpack_conns, protocols::WebSocketOpcode::BINARY,
+                                                protocols::ChatWireCodec::encodeMsgpack(msg), event_class);
+    }
+}
+
+std::vector<TcpConnectionPtr> ChatRoomServer::webSocketRecipients(const std::string& sender, const std::string& target,
+                                                                  const std::string& room) const {
+    // Each lookup holds one directory shard's read lock only while copying the recipient list
+    std::vector<TcpConnectionPtr> recipients;
+    if (!target.empty()) {
+        // Private message
+        if (auto target_conn = ws_directory_.connectionOf(target)) {
+            recipients.push_back(std::move(target_conn));
+        }
+    } else if (!room.empty()) {
+        // Room Broadcast
+        recipients = ws_directory_.roomConnections(room, sender);
+    } else {
+        // Global Broadcast (to all except sender)
+        recipients = ws_directory_.allConnections(sender);
+    }
+    return recipients;
+}
+
+void ChatRoomServer::notifyRoomPresence(const std::string& room_id, const std::string& username, bool joined) {
+    protocols::ChatWireMessage presence;
+    presence.type = protocols::ChatWireType::kPresence;
+    presence.username = username;
+    presence.room_id = room_id;
+    presence.action = joined ? "join" : "leave";
+    broadcastWebSocketChat(ws_directory_.roomConnections(room_id, username), presence, WebSocketEventClass::kDroppable);
+}
+
 void ChatRoomServer::handleWebSocketMessage(std::shared_ptr<TcpConnection> conn, const protocols::WebSocketFrame& frame) {
-    if (frame.opcode == protocols::WebSocketOpcode::TEXT) {
-        std::string payload(frame.payload.begin(), frame.payload.end());
-        try {
-            auto j = json::parse(payload);
-            std::string type = j.value("type", "");
-            
-            if (type == "login") {
-                std::string username = j.value("username", "");
-                std::string password = j.value("password", "");
-                
-                if (validateUsername(username)) {
-                    // Verify password
-                    if (!DatabaseManager::instance().validateUser(username, password)) {
-                        json resp;
-                        resp["type"] = "login_response";
-                        resp["success"] = false;
-                        resp["error"] = "Invalid username or password";
-                        std::string respStr = resp.dump();
-                        auto frameData = protocols::WebSocketCodec::buildFrame(protocols::WebSocketOpcode::TEXT, respStr);
-                        conn->send(std::string(frameData.begin(), frameData.end()));
-                        LOG_WARN("WS Login failed for {}: invalid credentials", username);
-                        return;
-                    }
+    {
+        // Frames behind a login still being checked wait for its result, so that they see the user
+        std::lock_guard<std::mutex> lock(ws_pending_login_mutex_);
+        auto pending = ws_pending_login_.find(conn->name());
+        if (pending != ws_pending_login_.end()) {
+            if (pending->second.size() < kMaxPendingLoginFrames) {
+                pending->second.push_back(frame);
+            } else {
+                LOG_WARN("WS frame from {} dropped: too many frames waiting for login", conn->name());
+            }
+            return;
+        }
+    }
 
-                    {
-                        std::lock_guard<std::mutex> lock(ws_mutex_);
-                        ws_connections_[conn->name()] = username;
-                        user_connections_[username] = conn;
-                    }
-                    
-                    json resp;
-                    resp["type"] = "login_response";
-                    resp["success"] = true;
-                    resp["username"] = username;
-                    resp["user_id"] = DatabaseManager::instance().getUserId(username);
-                    
-                    std::string respStr = resp.dump();
-                    auto frameData = protocols::WebSocketCodec::buildFrame(protocols::WebSocketOpcode::TEXT, respStr);
-                    conn->send(std::string(frameData.begin(), frameData.end()));
-                    LOG_INFO("WS User login: {}", username);
-                }
-            } else if (type == "join_room") {
-                std::string room_id = j.value("room_id", "");
-                std::string username;
-                {
-                    std::lock_guard<std::mutex> lock(ws_mutex_);
-                    auto it = ws_connections_.find(conn->name());
-                    if (it != ws_connections_.end()) {
-                        username = it->second;
-                    }
-                }
-                
-                if (!username.empty() && !room_id.empty()) {
-                    {
-                        std::lock_guard<std::mutex> lock(ws_mutex_);
-                        room_members_[room_id].insert(username);
-                    }
-                    LOG_INFO("User {} joined room {}", username, room_id);
-                }
-            } else if (type == "leave_room") {
-                std::string room_id = j.value("room_id", "");
-                std::string username;
+    if (frame.opcode == protocols::WebSocketOpcode::TEXT || frame.opcode == protocols::WebSocketOpcode::BINARY) {
+        protocols::ChatWireMessage in;
+        bool decoded = frame.opcode == protocols::WebSocketOpcode::BINARY
+                           ? protocols::ChatWireCodec::decodeMsgpack(frame.payload, in)
+                           : protocols::ChatWireCodec::decodeJson(frame.payload, in);
+        if (!decoded) {
+            LOG_ERROR("WS message decode error");
+            return;
+        }
+
+        if (in.type == protocols::ChatWireType::kLogin) {
+            const std::string& username = in.username;
+
+            if (validateUsername(username)) {
                 {
-                    std::lock_guard<std::mutex> lock(ws_mutex_);
-                    auto it = ws_connections_.find(conn->name());
-                    if (it != ws_connections_.end()) {
-                        username = it->second;
-                    }
+                    std::lock_guard<std::mutex> lock(ws_pending_login_mutex_);
+                    ws_pending_login_[conn->name()];
                 }
-                
-                if (!username.empty() && !room_id.empty()) {
-                    {
-                        std::lock_guard<std::mutex> lock(ws_mutex_);
-                        room_members_[room_id].erase(username);
-                        if (room_members_[room_id].empty()) {
-                            room_members_.erase(room_id);
+                // Verify password on a query thread; the reply is sent from this connection's loop
+                DatabaseManager::instance().async(
+                    [username, password = in.password](DatabaseManager& db) {
+                        return db.validateUser(username, password) ? db.getUserId(username) : -1LL;
+                    },
+                    onLoop(conn->getLoop()),
+                    [this, conn, username](long long user_id) {
+                        protocols::ChatWireMessage resp;
+                        resp.type = protocols::ChatWireType::kLoginResponse;
+                        if (user_id < 0) {
+                            resp.success = false;
+                            resp.error = "Invalid username or password";
+                            sendWebSocketReply(conn, resp);
+                            LOG_WARN("WS Login failed for {}: invalid credentials", username);
+                        } else if (conn->connected()) {
+                            ws_directory_.login(conn, username);
+
+                            resp.success = true;
+                            resp.username = username;
+                            resp.user_id = user_id;
+                            sendWebSocketReply(conn, resp);
+                            LOG_INFO("WS User login: {}", username);
+                            publishPresenceEvent(username, true);
                         }
+                        replayPendingWebSocketFrames(conn);
+                    });
+            }
+        } else if (in.type == protocols::ChatWireType::kJoinRoom) {
+            const std::string& room_id = in.room_id;
+            std::string username = ws_directory_.usernameOf(conn->name());
+
+            if (!username.empty() && !room_id.empty() && ws_directory_.join(username, room_id)) {
+                LOG_INFO("User {} joined room {}", username, room_id);
+                publishRoomEvent(room_id, username, true);
+                notifyRoomPresence(room_id, username, true);
+            }
+        } else if (in.type == protocols::ChatWireType::kLeaveRoom) {
+            const std::string& room_id = in.room_id;
+            std::string username = ws_directory_.usernameOf(conn->name());
+
+            if (!username.empty() && !room_id.empty()) {
+                ws_directory_.leave(username, room_id);
+                LOG_INFO("User {} left room {}", username, room_id);
+                publishRoomEvent(room_id, username, false);
+                notifyRoomPresence(room_id, username, false);
+            }
+        } else if (in.type == protocols::ChatWireType::kMessage) {
+            const std::string& content = in.content;
+            const std::string& target = in.target_user;
+            const std::string& room = in.room_id;
+
+            std::string username = ws_directory_.usernameOf(conn->name());
+
+            if (!username.empty() && validateMessage(content)) {
+                ChatMessage msg;
+                msg.username = username;
+                msg.content = content;
+                msg.timestamp = getCurrentTimestamp();
+                msg.target_user = target;
+                msg.room_id = room;
+
+                // Forwarding Logic
+                protocols::ChatWireMessage forward;
+                forward.type = protocols::ChatWireType::kMessage;
+                forward.username = username;
+                forward.content = content;
+                forward.timestamp = msg.timestamp;
+                forward.target_user = target;
+                forward.room_id = room;
+
+                // The id is assigned here, in arrival order; forwarding and the confirmation wait for
+                // the commit on the writer thread and then run back on this connection's loop.
+                // A message that could not be stored is not forwarded
+                auto deliver = [this, conn, forward](bool stored) {
+                    if (stored) {
+                        broadcastWebSocketChat(
+                            webSocketRecipients(forward.username, forward.target_user, forward.room_id), forward);
                     }
-                    LOG_INFO("User {} left room {}", username, room_id);
-                }
-            } else if (type == "message") {
-                std::string content = j.value("content", "");
-                std::string target = j.value("target_user", "");
-                std::string room = j.value("room_id", "");
-                
-                std::string username;
-                {
-                    std::lock_guard<std::mutex> lock(ws_mutex_);
-                    auto it = ws_connections_.find(conn->name());
-                    if (it != ws_connections_.end()) {
-                        username = it->second;
+
+                    // Echo confirmation
+                    protocols::ChatWireMessage resp;
+                    resp.type = protocols::ChatWireType::kMessageResponse;
+                    resp.success = stored;
+                    if (!stored) {
+                        resp.error = "Failed to store message";
                     }
-                }
-                
-                if (!username.empty() && validateMessage(content)) {
-                    ChatMessage msg;
-                    msg.username = username;
-                    msg.content = content;
-                    msg.timestamp = getCurrentTimestamp();
-                    msg.target_user = target;
-                    msg.room_id = room;
-                    
-                    if (DatabaseManager::instance().addMessage(msg)) {
+                    sendWebSocketReply(conn, resp);
+
+                    if (stored) {
                         metrics_collector_->updateMessageCount(DatabaseManager::instance().getMessageCount());
                     }
-                    
-                    // Forwarding Logic
-                    json forward_msg;
-                    forward_msg["type"] = "message"; 
-                    forward_msg["username"] = username;
-                    forward_msg["content"] = content;
-                    forward_msg["timestamp"] = msg.timestamp;
-                    if (!target.empty()) forward_msg["target_user"] = target;
-                    if (!room.empty()) forward_msg["room_id"] = room;
-                    
-                    std::string forwardStr = forward_msg.dump();
-                    auto forwardFrame = protocols::WebSocketCodec::buildFrame(protocols::WebSocketOpcode::TEXT, forwardStr);
-                    std::string forwardData(forwardFrame.begin(), forwardFrame.end());
-
-                    {
-                        std::lock_guard<std::mutex> lock(ws_mutex_);
-                        if (!target.empty()) {
-                            // Private message
-                            auto it = user_connections_.find(target);
-                            if (it != user_connections_.end()) {
-                                it->second->send(forwardData);
-                            }
-                        } else if (!room.empty()) {
-                            // Room Broadcast
-                            auto it = room_members_.find(room);
-                            if (it != room_members_.end()) {
-                                for (const auto& member : it->second) {
-                                    if (member != username) {
-                                        auto user_it = user_connections_.find(member);
-                                        if (user_it != user_connections_.end()) {
-                                            user_it->second->send(forwardData);
-                                        }
-                                    }
-                                }
-                            }
-                        } else {
-                            // Global Broadcast (to all except sender)
-                            for (auto& pair : user_connections_) {
-                                if (pair.first != username) {
-                                    pair.second->send(forwardData);
-                                }
-                            }
-                        }
-                    }
-                    
-                    // Echo confirmation
-                    json resp;
-                    resp["type"] = "message_response";
-                    resp["success"] = true;
-                    std::string respStr = resp.dump();
-                    auto frameData = protocols::WebSocketCodec::buildFrame(protocols::WebSocketOpcode::TEXT, respStr);
-                    conn->send(std::string(frameData.begin(), frameData.end()));
-                    
-                    LOG_INFO("WS Message from {}: {}", username, content);
+                };
+                if (!DatabaseManager::instance().addMessageAsync(msg, onLoop(conn->getLoop()), deliver)) {
+                    deliver(false);
                 }
+
+                LOG_INFO("WS Message from {}: {}", username, content);
+            }
+        } else if (in.type == protocols::ChatWireType::kTyping) {
+            std::string username = ws_directory_.usernameOf(conn->name());
+
+            if (!username.empty()) {
+                protocols::ChatWireMessage typing;
+                typing.type = protocols::ChatWireType::kTyping;
+                typing.username = username;
+                typing.target_user = in.target_user;
+                typing.room_id = in.room_id;
+                // Not persisted and not acknowledged; the first thing shed when a recipient falls behind
+                broadcastWebSocketChat(webSocketRecipients(username, in.target_user, in.room_id), typing,
+                                       WebSocketEventClass::kDroppable);
             }
-        } catch (...) {
-            LOG_ERROR("WS JSON parse error");
         }
     } else if (frame.opcode == protocols::WebSocketOpcode::CLOSE) {
-        std::lock_guard<std::mutex> lock(ws_mutex_);
-        auto it = ws_connections_.find(conn->name());
-        if (it != ws_connections_.end()) {
-            std::string username = it->second;
-            user_connections_.erase(username);
-            ws_connections_.erase(it);
-            
-            // Remove from all rooms
-            for (auto& pair : room_members_) {
-                pair.second.erase(username);
-            }
-            // Cleanup empty rooms
-             for (auto it_room = room_members_.begin(); it_room != room_members_.end(); ) {
-                if (it_room->second.empty()) {
-                    it_room = room_members_.erase(it_room);
-                } else {
-                    ++it_room;
-                }
-            }
+        // Leaves only the rooms this user joined
+        std::string username = ws_directory_.remove(conn);
+        if (!username.empty()) {
+            publishPresenceEvent(username, false);
         }
     }
 }
 
+void ChatRoomServer::replayPendingWebSocketFrames(const TcpConnectionPtr& conn) {
+    std::vector<protocols::WebSocketFrame> frames;
+    {
+        std::lock_guard<std::mutex> lock(ws_pending_login_mutex_);
+        auto pending = ws_pending_login_.find(conn->name());
+        if (pending == ws_pending_login_.end()) {
+            return;
+        }
+        frames = std::move(pending->second);
+        ws_pending_login_.erase(pending);
+    }
+    if (!conn->connected()) {
+        return;
+    }
+    // A replayed login queues the frames after it again
+    for (const auto& frame : frames) {
+        handleWebSocketMessage(conn, frame);
+    }
+}
+
 void ChatRoomServer::handleRtspMessage(std::shared_ptr<TcpConnection> conn, const protocols::RtspRequest& request) {
     protocols::RtspResponse response;
     response.cseq = request.cseq;
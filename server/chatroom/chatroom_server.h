@@ -1,6 +1,7 @@
 #pragma once
 
 #include "http/http_server.h"
+#include "http/sse_hub.h"
 #include "rtsp/rtsp_server.h"
 #include "sip/sip_server.h"
 #include "ftp/ftp_server.h"
@@ -8,6 +9,11 @@
 #include "utils/server_error.h"
 #include "utils/rate_limiter.h"
 #include "chatroom/session_manager.h"
+#include "net/timer_fd.h"
+#include "chatroom/long_poll_hub.h"
+#include "chatroom/connection_directory.h"
+#include "chatroom/user_directory.h"
+#include "websocket/chat_wire.h"
 #include "chat_message.h"
 #include <string>
 #include <vector>
@@ -72,7 +78,13 @@ private:
 
     std::shared_ptr<MetricsCollector> metrics_collector_; ///< 指标收集器
     std::unique_ptr<SessionManager> session_manager_;   ///< 会话管理器
+    std::unique_ptr<TimerFd> maintenance_timer_;        ///< 数据库后台维护定时器
     std::unique_ptr<ChatService> chat_service_;         ///< 聊天业务服务
+    std::shared_ptr<LongPollHub> long_poll_hub_;        ///< 长轮询等待队列
+    std::shared_ptr<SseHub> sse_hub_;                   ///< SSE 事件推送中心
+    int message_listener_ = 0;                          ///< DatabaseManager 消息监听句柄
+    int user_listener_ = 0;                             ///< DatabaseManager 注册监听句柄
+    UserDirectory user_directory_;                      ///< /users 使用的带版本号用户目录
     
     std::chrono::system_clock::time_point start_time_;  ///< 服务器启动时间
     std::atomic<bool> running_;                         ///< 运行状态标志
@@ -104,9 +116,79 @@ private:
      * @return HttpResponse HTTP响应对象
      */
     HttpResponse handleGetMessages(const HttpRequest& request);
+
+    /**
+     * @brief 处理单个聊天室或私聊会话的分页历史请求
+     *
+     * GET /history?room=R 或 /history?username=A&with=B，配合 before/after 游标与 limit 分页，
+     * 每页只扫描对应索引上的 limit 行，与历史总量无关。
+     * @param request HTTP请求对象
+     * @return HttpResponse HTTP响应对象
+     */
+    HttpResponse handleGetHistory(const HttpRequest& request);
+
+    /**
+     * @brief 处理全文检索请求
+     *
+     * GET /search?q=关键词，可选 room/from/start/end 过滤与 limit，按相关度返回前 limit 条。
+     * 查询走内存倒排索引，不扫描消息表；私聊消息只对会话双方可见。
+     * @param request HTTP请求对象
+     * @return HttpResponse HTTP响应对象
+     */
+    HttpResponse handleSearch(const HttpRequest& request);
+
+    /**
+     * @brief /messages 异步入口，支持长轮询
+     *
+     * 带 wait=N 且没有新消息时，请求挂起在连接所属IO线程上（不占用业务线程），
+     * 有可见的新消息写入时立即返回该消息，N 秒后仍无消息则返回空列表。
+     * 不带 wait 时等同于 handleGetMessages。
+     * @param request HTTP请求对象
+     * @param ioLoop 连接所属IO线程
+     * @param respond 异步响应回调
+     */
+    void handlePollMessages(const HttpRequest& request, EventLoop* ioLoop, HttpResponder respond);
+
+    /**
+     * @brief 处理历史消息导出请求（NDJSON 流式响应）
+     *
+     * 以游标分页扫描数据库，每行输出一条消息的 JSON，通过 chunked 编码流式发送，
+     * 内存占用与历史总量无关。
+     * @param request HTTP请求对象
+     * @return HttpResponse 带 stream 生产者的HTTP响应对象
+     */
+    HttpResponse handleExportMessages(const HttpRequest& request);
     
+    /**
+     * @brief 处理 SSE 事件流订阅请求（/events）
+     *
+     * 保持响应打开并推送 message / presence / room 事件。
+     * 带 Last-Event-ID 时先从数据库补发该ID之后的消息，再无缝衔接实时事件。
+     * @param request HTTP请求对象
+     * @return HttpResponse 带 event_stream 回调的HTTP响应对象
+     */
+    HttpResponse handleEventStream(const HttpRequest& request);
+
+    /**
+     * @brief 向 SSE 订阅者发布消息事件（私聊消息只发给收发双方）
+     */
+    void publishMessageEvent(const ChatMessage& msg);
+
+    /**
+     * @brief 向 SSE 订阅者发布用户上下线事件
+     */
+    void publishPresenceEvent(const std::string& username, bool online);
+
+    /**
+     * @brief 向 SSE 订阅者发布聊天室加入/离开事件
+     */
+    void publishRoomEvent(const std::string& room_id, const std::string& username, bool joined);
+
     /**
      * @brief 处理获取用户列表请求
+     *
+     * 从内存用户目录回答，不查询数据库。since_version=V 只返回 V 之后变化的用户，
+     * 没有变化时返回 304；online=1 只列在线用户；limit/after 按用户名分页。
      * @param request HTTP请求对象
      * @return HttpResponse HTTP响应对象
      */
@@ -119,6 +201,13 @@ private:
      */
     HttpResponse handleMetrics(const HttpRequest& request);
 
+    /**
+     * @brief 调试视图：按待发字节数排序的 WebSocket 慢连接（/debug/slow_consumers?limit=N）
+     * @param request HTTP请求对象
+     * @return HttpResponse HTTP响应对象
+     */
+    HttpResponse handleSlowConsumers(const HttpRequest& request);
+
     /**
      * @brief 获取当前时间戳字符串
      * @return 格式化的时间字符串
@@ -173,10 +262,36 @@ private:
      * @param frame WebSocket数据帧
      */
     void handleWebSocketMessage(std::shared_ptr<TcpConnection> conn, const protocols::WebSocketFrame& frame);
-    std::unordered_map<std::string, std::string> ws_connections_; ///< WebSocket连接映射 (conn_name -> username)
-    std::unordered_map<std::string, std::shared_ptr<TcpConnection>> user_connections_; ///< 用户连接映射 (username -> TcpConnection)
-    std::unordered_map<std::string, std::unordered_set<std::string>> room_members_; ///< 聊天室成员映射 (room_id -> set<username>)
-    std::mutex ws_mutex_;                                 ///< WebSocket连接映射互斥锁
+    /**
+     * @brief 按连接协商的子协议（JSON 或 MessagePack）编码并发送一条消息
+     */
+    void sendWebSocketReply(const TcpConnectionPtr& conn, const protocols::ChatWireMessage& msg);
+    /**
+     * @brief 向一组连接转发消息，每种线上格式只编码一次
+     * @param event_class kDroppable 的事件在接收方积压时被丢弃
+     */
+    void broadcastWebSocketChat(const std::vector<TcpConnectionPtr>& recipients, const protocols::ChatWireMessage& msg,
+                                WebSocketEventClass event_class = WebSocketEventClass::kReliable);
+    /**
+     * @brief 转发目标：私聊对象、聊天室其他成员或除发送者外的所有在线用户
+     */
+    std::vector<TcpConnectionPtr> webSocketRecipients(const std::string& sender, const std::string& target,
+                                                      const std::string& room) const;
+    /**
+     * @brief 通知聊天室其他成员有用户进出（可丢弃事件）
+     */
+    void notifyRoomPresence(const std::string& room_id, const std::string& username, bool joined);
+    /**
+     * @brief 登录校验完成后按到达顺序重放期间收到的帧；连接已断开时直接丢弃
+     */
+    void replayPendingWebSocketFrames(const TcpConnectionPtr& conn);
+    ConnectionDirectory ws_directory_;                    ///< WebSocket 连接/用户/聊天室分片目录
+
+    /// 登录校验进行中的连接（按连接名）在结果返回前收到的帧。客户端可以把登录与加入聊天室、
+    /// 发消息放在同一次写入里，这些帧若立即处理会因尚未登录而被丢弃
+    std::unordered_map<std::string, std::vector<protocols::WebSocketFrame>> ws_pending_login_;
+    std::mutex ws_pending_login_mutex_;
+    static constexpr std::size_t kMaxPendingLoginFrames = 64;
 
     // RTSP Handling
     /**
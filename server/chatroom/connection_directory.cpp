@@ -0,0 +1,245 @@
+#include "chatroom/connection_directory.h"
+#include "net/tcp_connection.h"
+
+#include <functional>
+
+ConnectionDirectory::ConnectionDirectory(std::size_t shard_count) {
+    std::size_t n = 1;
+    while (n < shard_count) {
+        n <<= 1;
+    }
+    shards_.reserve(n);
+    for (std::size_t i = 0; i < n; ++i) {
+        shards_.push_back(std::make_unique<Shard>());
+    }
+    mask_ = n - 1;
+}
+
+ConnectionDirectory::Shard& ConnectionDirectory::shardFor(const std::string& key) const {
+    return *shards_[std::hash<std::string>{}(key) & mask_];
+}
+
+std::unique_lock<std::shared_mutex> ConnectionDirectory::lockExclusive(const Shard& shard) {
+    shard.acquisitions.fetch_add(1, std::memory_order_relaxed);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex, std::try_to_lock);
+    if (!lock.owns_lock()) {
+        shard.contended.fetch_add(1, std::memory_order_relaxed);
+        lock.lock();
+    }
+    return lock;
+}
+
+std::shared_lock<std::shared_mutex> ConnectionDirectory::lockShared(const Shard& shard) {
+    shard.acquisitions.fetch_add(1, std::memory_order_relaxed);
+    std::shared_lock<std::shared_mutex> lock(shard.mutex, std::try_to_lock);
+    if (!lock.owns_lock()) {
+        shard.contended.fetch_add(1, std::memory_order_relaxed);
+        lock.lock();
+    }
+    return lock;
+}
+
+std::pair<std::unique_lock<std::shared_mutex>, std::unique_lock<std::shared_mutex>> ConnectionDirectory::lockPair(
+    const Shard& a, const Shard& b) {
+    if (&a == &b) {
+        return {lockExclusive(a), std::unique_lock<std::shared_mutex>()};
+    }
+    // A fixed global order keeps two-shard operations from deadlocking each other
+    if (std::less<const Shard*>()(&a, &b)) {
+        auto first = lockExclusive(a);
+        return {std::move(first), lockExclusive(b)};
+    }
+    auto first = lockExclusive(b);
+    return {std::move(first), lockExclusive(a)};
+}
+
+void ConnectionDirectory::login(const TcpConnectionPtr& conn, const std::string& username) {
+    std::string previous;
+    {
+        Shard& shard = shardFor(conn->name());
+        auto lock = lockExclusive(shard);
+        std::string& bound = shard.conn_users[conn->name()];
+        previous.swap(bound);
+        bound = username;
+    }
+    if (!previous.empty() && previous != username) {
+        // The connection switched accounts: the old account loses this connection
+        Shard& shard = shardFor(previous);
+        auto lock = lockExclusive(shard);
+        auto it = shard.users.find(previous);
+        if (it != shard.users.end() && it->second.conn == conn) {
+            std::unordered_set<std::string> rooms = std::move(it->second.rooms);
+            shard.users.erase(it);
+            lock.unlock();
+            dropMemberships(previous, rooms, conn);
+        }
+    }
+
+    std::vector<std::string> rooms;
+    {
+        Shard& shard = shardFor(username);
+        auto lock = lockExclusive(shard);
+        UserEntry& entry = shard.users[username];
+        entry.conn = conn;
+        rooms.assign(entry.rooms.begin(), entry.rooms.end());
+    }
+    // Rooms joined from an earlier connection follow the user to the new one
+    for (const auto& room_id : rooms) {
+        Shard& shard = shardFor(room_id);
+        auto lock = lockExclusive(shard);
+        auto room = shard.rooms.find(room_id);
+        if (room != shard.rooms.end()) {
+            auto member = room->second.find(username);
+            if (member != room->second.end()) {
+                member->second = conn;
+            }
+        }
+    }
+}
+
+std::string ConnectionDirectory::usernameOf(const std::string& conn_name) const {
+    const Shard& shard = shardFor(conn_name);
+    auto lock = lockShared(shard);
+    auto it = shard.conn_users.find(conn_name);
+    return it != shard.conn_users.end() ? it->second : std::string();
+}
+
+bool ConnectionDirectory::join(const std::string& username, const std::string& room_id) {
+    Shard& user_shard = shardFor(username);
+    Shard& room_shard = shardFor(room_id);
+    auto locks = lockPair(user_shard, room_shard);
+    auto it = user_shard.users.find(username);
+    if (it == user_shard.users.end()) {
+        return false;
+    }
+    it->second.rooms.insert(room_id);
+    room_shard.rooms[room_id][username] = it->second.conn;
+    return true;
+}
+
+void ConnectionDirectory::leave(const std::string& username, const std::string& room_id) {
+    Shard& user_shard = shardFor(username);
+    Shard& room_shard = shardFor(room_id);
+    auto locks = lockPair(user_shard, room_shard);
+    auto it = user_shard.users.find(username);
+    if (it != user_shard.users.end()) {
+        it->second.rooms.erase(room_id);
+    }
+    auto room = room_shard.rooms.find(room_id);
+    if (room != room_shard.rooms.end()) {
+        room->second.erase(username);
+        if (room->second.empty()) {
+            room_shard.rooms.erase(room);
+        }
+    }
+}
+
+std::string ConnectionDirectory::remove(const TcpConnectionPtr& conn) {
+    std::string username;
+    {
+        Shard& shard = shardFor(conn->name());
+        auto lock = lockExclusive(shard);
+        auto it = shard.conn_users.find(conn->name());
+        if (it == shard.conn_users.end()) {
+            return std::string();
+        }
+        username = std::move(it->second);
+        shard.conn_users.erase(it);
+    }
+
+    std::unordered_set<std::string> rooms;
+    {
+        Shard& shard = shardFor(username);
+        auto lock = lockExclusive(shard);
+        auto it = shard.users.find(username);
+        // A newer login on another connection keeps the user (and its rooms) online
+        if (it == shard.users.end() || it->second.conn != conn) {
+            return std::string();
+        }
+        rooms = std::move(it->second.rooms);
+        shard.users.erase(it);
+    }
+
+    dropMemberships(username, rooms, conn);
+    return username;
+}
+
+void ConnectionDirectory::dropMemberships(const std::string& username, const std::unordered_set<std::string>& rooms,
+                                          const TcpConnectionPtr& conn) {
+    // Only the rooms this user joined; entries from a later login carry a different connection
+    for (const auto& room_id : rooms) {
+        Shard& shard = shardFor(room_id);
+        auto lock = lockExclusive(shard);
+        auto room = shard.rooms.find(room_id);
+        if (room == shard.rooms.end()) {
+            continue;
+        }
+        auto member = room->second.find(username);
+        if (member != room->second.end() && member->second == conn) {
+            room->second.erase(member);
+            if (room->second.empty()) {
+                shard.rooms.erase(room);
+            }
+        }
+    }
+}
+
+TcpConnectionPtr ConnectionDirectory::connectionOf(const std::string& username) const {
+    const Shard& shard = shardFor(username);
+    auto lock = lockShared(shard);
+    auto it = shard.users.find(username);
+    return it != shard.users.end() ? it->second.conn : nullptr;
+}
+
+std::vector<TcpConnectionPtr> ConnectionDirectory::roomConnections(const std::string& room_id,
+                                                                   const std::string& exclude) const {
+    std::vector<TcpConnectionPtr> conns;
+    const Shard& shard = shardFor(room_id);
+    auto lock = lockShared(shard);
+    auto room = shard.rooms.find(room_id);
+    if (room == shard.rooms.end()) {
+        return conns;
+    }
+    conns.reserve(room->second.size());
+    for (const auto& [member, conn] : room->second) {
+        if (member != exclude) {
+            conns.push_back(conn);
+        }
+    }
+    return conns;
+}
+
+std::vector<TcpConnectionPtr> ConnectionDirectory::allConnections(const std::string& exclude) const {
+    std::vector<TcpConnectionPtr> conns;
+    // One shard at a time; the snapshot is not atomic across shards, like any broadcast racing a login
+    for (const auto& shard : shards_) {
+        auto lock = lockShared(*shard);
+        for (const auto& [username, entry] : shard->users) {
+            if (username != exclude) {
+                conns.push_back(entry.conn);
+            }
+        }
+    }
+    return conns;
+}
+
+std::size_t ConnectionDirectory::userCount() const {
+    std::size_t count = 0;
+    for (const auto& shard : shards_) {
+        auto lock = lockShared(*shard);
+        count += shard->users.size();
+    }
+    return count;
+}
+
+std::vector<DirectoryShardStats> ConnectionDirectory::shardStats() const {
+    std::vector<DirectoryShardStats> stats;
+    stats.reserve(shards_.size());
+    for (const auto& shard : shards_) {
+        DirectoryShardStats s;
+        s.acquisitions = shard->acquisitions.load(std::memory_order_relaxed);
+        s.contended = shard->contended.load(std::memory_order_relaxed);
+        stats.push_back(s);
+    }
+    return stats;
+}
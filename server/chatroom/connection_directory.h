@@ -0,0 +1,109 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "net/callbacks.h"
+
+/**
+ * @brief 目录分片锁统计快照
+ */
+struct DirectoryShardStats {
+    uint64_t acquisitions = 0;  ///< 加锁次数（读写合计）
+    uint64_t contended = 0;     ///< 未能立即获得锁、需要等待的次数
+};
+
+/**
+ * @brief WebSocket 用户/连接/聊天室目录
+ *
+ * 连接名 -> 用户名、用户名 -> (连接, 已加入的聊天室)、聊天室 -> (成员 -> 连接) 三张表按键的哈希
+ * 分布到固定数量的分片中，每个分片一把读写锁。查询（按连接查用户、私聊、房间广播）只对一个分片加读锁，
+ * 所有IO线程与业务线程可以并发查询；每个用户保存已加入聊天室的反向索引，断开时只需访问这些聊天室，
+ * 复杂度与聊天室总数无关。
+ *
+ * 同时涉及用户分片和聊天室分片的加入/离开操作按固定顺序锁住两个分片，保证与断开连接互不交错；
+ * 广播只持有单个分片的读锁，得到接收方列表后立即释放。线程安全。
+ */
+class ConnectionDirectory {
+public:
+    /**
+     * @param shard_count 分片数，向上取整为 2 的幂
+     */
+    explicit ConnectionDirectory(std::size_t shard_count = 16);
+
+    /**
+     * @brief 登记连接上登录的用户
+     *
+     * 同一用户在新连接上重新登录时，已加入的聊天室改为投递到新连接；
+     * 同一连接改换用户登录时，先按断开处理原用户。
+     */
+    void login(const TcpConnectionPtr& conn, const std::string& username);
+
+    /**
+     * @brief 连接上登录的用户名，未登录返回空串
+     */
+    std::string usernameOf(const std::string& conn_name) const;
+
+    /**
+     * @brief 用户加入聊天室
+     * @return false 用户已不在线
+     */
+    bool join(const std::string& username, const std::string& room_id);
+
+    /**
+     * @brief 用户离开聊天室，聊天室没有成员后删除
+     */
+    void leave(const std::string& username, const std::string& room_id);
+
+    /**
+     * @brief 移除连接，复杂度为 O(该用户加入的聊天室数)
+     * @return 因此下线的用户名；连接未登录或该用户已在其他连接上重新登录时返回空串
+     */
+    std::string remove(const TcpConnectionPtr& conn);
+
+    /// 用户当前的连接，不在线返回空
+    TcpConnectionPtr connectionOf(const std::string& username) const;
+    /// 聊天室中除 exclude 以外所有成员的连接
+    std::vector<TcpConnectionPtr> roomConnections(const std::string& room_id, const std::string& exclude) const;
+    /// 除 exclude 以外所有在线用户的连接
+    std::vector<TcpConnectionPtr> allConnections(const std::string& exclude) const;
+
+    std::size_t userCount() const;
+    std::size_t shardCount() const { return shards_.size(); }
+    std::vector<DirectoryShardStats> shardStats() const;
+
+private:
+    struct UserEntry {
+        TcpConnectionPtr conn;
+        std::unordered_set<std::string> rooms;  ///< 反向索引：已加入的聊天室
+    };
+
+    struct alignas(64) Shard {
+        mutable std::shared_mutex mutex;
+        mutable std::atomic<uint64_t> acquisitions{0};
+        mutable std::atomic<uint64_t> contended{0};
+        std::unordered_map<std::string, std::string> conn_users;  ///< 连接名 -> 用户名
+        std::unordered_map<std::string, UserEntry> users;         ///< 用户名 -> 连接与聊天室
+        std::unordered_map<std::string, std::unordered_map<std::string, TcpConnectionPtr>> rooms; ///< 聊天室 -> 成员
+    };
+
+    Shard& shardFor(const std::string& key) const;
+    static std::unique_lock<std::shared_mutex> lockExclusive(const Shard& shard);
+    static std::shared_lock<std::shared_mutex> lockShared(const Shard& shard);
+    /// 从反向索引中的聊天室移除仍指向 conn 的成员记录
+    void dropMemberships(const std::string& username, const std::unordered_set<std::string>& rooms,
+                         const TcpConnectionPtr& conn);
+    /// 同时锁住两个分片（按地址顺序，同一分片只锁一次）
+    static std::pair<std::unique_lock<std::shared_mutex>, std::unique_lock<std::shared_mutex>> lockPair(
+        const Shard& a, const Shard& b);
+
+    std::vector<std::unique_ptr<Shard>> shards_;
+    std::size_t mask_;
+};
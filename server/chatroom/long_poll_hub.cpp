@@ -0,0 +1,130 @@
+#include "chatroom/long_poll_hub.h"
+#include "net/event_loop.h"
+
+#include <chrono>
+#include <vector>
+
+uint64_t LongPollHub::version() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return version_;
+}
+
+bool LongPollHub::park(EventLoop* loop, const std::string& username, uint64_t seen_version,
+                       double timeout_seconds, WakeCallback cb) {
+    uint64_t id;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (version_ != seen_version) {
+            return false;
+        }
+        id = ++next_id_;
+        waiters_.emplace(id, Waiter{username, loop, std::move(cb)});
+        by_user_[username].insert(id);
+    }
+    stats_.parked++;
+    stats_.parked_total++;
+
+    // TimerQueue has no cancellation; a timer whose waiter was already woken is a no-op
+    std::weak_ptr<LongPollHub> weak_self = shared_from_this();
+    loop->runAfter(timeout_seconds, [weak_self, id]() {
+        if (auto self = weak_self.lock()) {
+            self->expire(id);
+        }
+    });
+    return true;
+}
+
+void LongPollHub::notify(const ChatMessage& msg) {
+    auto enqueued = std::chrono::steady_clock::now();
+    std::vector<Waiter> woken;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ++version_;
+        if (waiters_.empty()) {
+            return;
+        }
+
+        std::vector<uint64_t> ids;
+        if (msg.target_user.empty()) {
+            ids.reserve(waiters_.size());
+            for (const auto& entry : waiters_) {
+                ids.push_back(entry.first);
+            }
+        } else {
+            for (const std::string* user : {&msg.target_user, &msg.username}) {
+                auto it = by_user_.find(*user);
+                if (it != by_user_.end()) {
+                    ids.insert(ids.end(), it->second.begin(), it->second.end());
+                }
+            }
+        }
+
+        for (uint64_t id : ids) {
+            auto it = waiters_.find(id);
+            if (it == waiters_.end()) {
+                continue; // sender == target, already collected
+            }
+            unindex(id, it->second.username);
+            woken.push_back(std::move(it->second));
+            waiters_.erase(it);
+        }
+    }
+    if (woken.empty()) {
+        return;
+    }
+    stats_.parked -= woken.size();
+    stats_.woken_total += woken.size();
+
+    // Always queue: notify() runs under the store lock and must not re-enter request handling
+    std::weak_ptr<LongPollHub> weak_self = shared_from_this();
+    for (auto& waiter : woken) {
+        waiter.loop->queueInLoop([weak_self, enqueued, cb = std::move(waiter.cb)]() {
+            cb(true);
+            if (auto self = weak_self.lock()) {
+                auto latency = std::chrono::steady_clock::now() - enqueued;
+                self->recordWakeLatency(std::chrono::duration_cast<std::chrono::microseconds>(latency).count());
+            }
+        });
+    }
+}
+
+void LongPollHub::expire(uint64_t id) {
+    WakeCallback cb;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = waiters_.find(id);
+        if (it == waiters_.end()) {
+            return;
+        }
+        unindex(id, it->second.username);
+        cb = std::move(it->second.cb);
+        waiters_.erase(it);
+    }
+    stats_.parked--;
+    stats_.timeouts_total++;
+    cb(false);
+}
+
+void LongPollHub::unindex(uint64_t id, const std::string& username) {
+    auto it = by_user_.find(username);
+    if (it == by_user_.end()) {
+        return;
+    }
+    it->second.erase(id);
+    if (it->second.empty()) {
+        by_user_.erase(it);
+    }
+}
+
+void LongPollHub::recordWakeLatency(int64_t micros) {
+    if (micros < 0) {
+        micros = 0;
+    }
+    stats_.wake_latency_us_sum += static_cast<uint64_t>(micros);
+    double seconds = static_cast<double>(micros) / 1e6;
+    std::size_t bucket = 0;
+    while (bucket < LongPollStats::kLatencyBuckets.size() && seconds > LongPollStats::kLatencyBuckets[bucket]) {
+        ++bucket;
+    }
+    stats_.wake_latency_buckets[bucket]++;
+}
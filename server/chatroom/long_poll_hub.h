@@ -0,0 +1,100 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include "chat_message.h"
+
+class EventLoop;
+
+/**
+ * @brief 长轮询统计
+ *
+ * 唤醒延迟从消息写入存储开始计时，到唤醒回调在连接所属IO线程中执行为止。
+ */
+struct LongPollStats {
+    /// 唤醒延迟直方图上界（秒），最后一个桶为 +Inf
+    static constexpr std::array<double, 8> kLatencyBuckets = {0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.05};
+
+    std::atomic<uint64_t> parked{0};        ///< 当前挂起的请求数
+    std::atomic<uint64_t> parked_total{0};  ///< 累计挂起次数
+    std::atomic<uint64_t> woken_total{0};   ///< 因新消息被唤醒的次数
+    std::atomic<uint64_t> timeouts_total{0};///< 超时返回空结果的次数
+    std::atomic<uint64_t> wake_latency_us_sum{0};
+    std::array<std::atomic<uint64_t>, kLatencyBuckets.size() + 1> wake_latency_buckets{}; ///< 非累积计数
+};
+
+/**
+ * @brief 长轮询等待队列
+ *
+ * 没有新消息的 /messages?wait=N 请求在此挂起：挂起期间只占用一个等待记录和
+ * 所属IO线程上的一个超时定时器，不占用业务线程。消息写入存储后由 notify()
+ * 唤醒可见该消息的等待者，超时则以空结果唤醒。
+ *
+ * 所有回调都在等待者所属的IO线程中执行。定时器只持有 weak_ptr，
+ * 因此必须通过 std::make_shared 创建。
+ */
+class LongPollHub : public std::enable_shared_from_this<LongPollHub> {
+public:
+    /**
+     * @brief 唤醒回调
+     * @param woken true 表示有可见的新消息写入，调用方应按自己的游标重新查询；超时时为 false
+     *
+     * 触发唤醒的消息不传给回调：它的 id 可能不大于请求的游标，与它同批写入的其他消息也不会再次唤醒同一个等待者。
+     */
+    using WakeCallback = std::function<void(bool woken)>;
+
+    /**
+     * @brief 当前消息版本号，每次 notify() 递增
+     *
+     * 调用方应在查询数据库之前读取，并在挂起时传给 park()，
+     * 以发现查询与挂起之间写入的消息。
+     */
+    uint64_t version() const;
+
+    /**
+     * @brief 挂起一个等待者
+     * @param loop 连接所属IO线程
+     * @param username 请求者用户名（为空只接收公开消息，与 getMessagesAfter 的过滤规则一致）
+     * @param seen_version 查询数据库前读取的 version()
+     * @param timeout_seconds 最长等待时间
+     * @param cb 唤醒回调
+     * @return false 表示期间已有新消息写入，调用方应重新查询而不是挂起
+     */
+    bool park(EventLoop* loop, const std::string& username, uint64_t seen_version,
+              double timeout_seconds, WakeCallback cb);
+
+    /**
+     * @brief 新消息写入存储后调用，唤醒所有可见该消息的等待者
+     *
+     * 必须按消息 id 顺序调用（由 DatabaseManager 的消息监听保证），
+     * 否则被唤醒的客户端可能以较大的 next_since 跳过较早的消息。
+     */
+    void notify(const ChatMessage& msg);
+
+    const LongPollStats& stats() const { return stats_; }
+
+private:
+    struct Waiter {
+        std::string username;
+        EventLoop* loop;
+        WakeCallback cb;
+    };
+
+    void expire(uint64_t id);
+    void unindex(uint64_t id, const std::string& username);
+    void recordWakeLatency(int64_t micros);
+
+    mutable std::mutex mutex_;
+    uint64_t version_ = 0;
+    uint64_t next_id_ = 0;
+    std::unordered_map<uint64_t, Waiter> waiters_;
+    std::unordered_map<std::string, std::unordered_set<uint64_t>> by_user_; ///< 私聊消息只需唤醒收发双方
+    LongPollStats stats_;
+};
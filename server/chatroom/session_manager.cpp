@@ -39,28 +39,35 @@ std::string SessionManager::generateConnectionId() {
 }
 
 SessionManager::LoginResult SessionManager::login(const std::string& username, const std::string& client_type) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    
-    // Check if username is already taken
-    for (const auto& kv : sessions_) {
-        if (kv.second.username == username) {
+    LoginResult result;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        // Check if username is already taken
+        if (connection_by_user_.count(username)) {
             return {false, "Username already taken", "", -1};
         }
+
+        std::string connection_id = generateConnectionId();
+        UserSession session;
+        session.username = username;
+        session.user_id = DatabaseManager::instance().getUserId(username);
+        session.connection_id = connection_id;
+        session.client_type = client_type;
+        session.last_heartbeat = std::chrono::system_clock::now();
+        session.login_time = session.last_heartbeat;
+
+        sessions_[connection_id] = session;
+        connection_by_user_[username] = connection_id;
+        metrics_collector_->updateActiveSessions(sessions_.size());
+
+        result = {true, "", connection_id, session.user_id};
     }
 
-    std::string connection_id = generateConnectionId();
-    UserSession session;
-    session.username = username;
-    session.user_id = DatabaseManager::instance().getUserId(username);
-    session.connection_id = connection_id;
-    session.client_type = client_type;
-    session.last_heartbeat = std::chrono::system_clock::now();
-    session.login_time = session.last_heartbeat;
-    
-    sessions_[connection_id] = session;
-    metrics_collector_->updateActiveSessions(sessions_.size());
-    
-    return {true, "", connection_id, session.user_id};
+    if (presence_callback_) {
+        presence_callback_(username, true);
+    }
+    return result;
 }
 
 void SessionManager::registerSipSession(const std::string& username, std::shared_ptr<TcpConnection> conn) {
@@ -108,16 +115,27 @@ std::vector<UserSession> SessionManager::getAllSessions() {
     return result;
 }
 
+bool SessionManager::findSession(const std::string& username, UserSession& session) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = connection_by_user_.find(username);
+    if (it == connection_by_user_.end()) return false;
+    session = sessions_.at(it->second);
+    return true;
+}
+
 void SessionManager::cleanup() {
     using namespace std::chrono;
     int timeout = ServerConfig::instance().heartbeat_timeout_seconds;
     
     auto now = system_clock::now();
-    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<std::string> expired;
+    std::unique_lock<std::mutex> lock(mutex_);
     for (auto it = sessions_.begin(); it != sessions_.end();) {
         auto diff = duration_cast<seconds>(now - it->second.last_heartbeat).count();
         if (diff > timeout) {
             LOG_INFO("移除超时会话: {} {}", it->second.username, it->second.connection_id);
+            expired.push_back(it->second.username);
+            connection_by_user_.erase(it->second.username);
             it = sessions_.erase(it);
         } else {
             ++it;
@@ -134,4 +152,11 @@ void SessionManager::cleanup() {
     }
 
     metrics_collector_->updateActiveSessions(sessions_.size());
+    lock.unlock();
+
+    if (presence_callback_) {
+        for (const auto& username : expired) {
+            presence_callback_(username, false);
+        }
+    }
 }
@@ -9,6 +9,7 @@
 #include <condition_variable>
 #include <vector>
 #include <memory>
+#include <functional>
 #include "utils/metrics_collector.h"
 #include "net/timer_fd.h"
 
@@ -38,6 +39,13 @@ struct UserSession {
  */
 class SessionManager {
 public:
+    /**
+     * @brief 在线状态变化回调
+     * @param username 用户名
+     * @param online true 为上线（登录），false 为下线（会话超时被清理）
+     */
+    using PresenceCallback = std::function<void(const std::string& username, bool online)>;
+
     explicit SessionManager(EventLoop* loop, std::shared_ptr<MetricsCollector> metrics);
     ~SessionManager();
 
@@ -55,6 +63,11 @@ public:
      */
     void stop();
 
+    /**
+     * @brief 设置在线状态变化回调（在锁外调用）
+     */
+    void setPresenceCallback(PresenceCallback cb) { presence_callback_ = std::move(cb); }
+
     // Session Management
     /**
      * @brief 登录结果结构体
@@ -100,6 +113,14 @@ public:
      * @return std::vector<UserSession> 会话列表
      */
     std::vector<UserSession> getAllSessions();
+
+    /**
+     * @brief 按用户名查找会话
+     * @param username 用户名
+     * @param session 找到时写入会话副本
+     * @return false 该用户不在线
+     */
+    bool findSession(const std::string& username, UserSession& session);
     
 private:
     void cleanup();
@@ -108,8 +129,10 @@ private:
     EventLoop* loop_;
     std::shared_ptr<MetricsCollector> metrics_collector_;
     std::unordered_map<std::string, UserSession> sessions_;
+    std::unordered_map<std::string, std::string> connection_by_user_; // username -> connection_id
     std::unordered_map<std::string, std::weak_ptr<TcpConnection>> sip_sessions_; // username -> connection
     std::mutex mutex_;
     
     std::unique_ptr<TimerFd> timer_;
+    PresenceCallback presence_callback_;
 };
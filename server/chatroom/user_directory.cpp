@@ -0,0 +1,94 @@
+#include "chatroom/user_directory.h"
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+
+void UserDirectory::load(const std::vector<std::pair<std::string, long long>>& users) {
+    auto now_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                      std::chrono::system_clock::now().time_since_epoch()).count();
+
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    // Above every version handed out before, by this process or an earlier one
+    version_ = std::max(version_ + 1, static_cast<uint64_t>(now_us));
+    load_version_ = version_;
+    users_.clear();
+    online_.clear();
+    changes_.clear();
+    for (const auto& [username, user_id] : users) {
+        Entry& entry = users_[username];
+        entry.username = username;
+        entry.user_id = user_id;
+        entry.version = version_;
+    }
+}
+
+void UserDirectory::touch(Entry& entry) {
+    if (entry.version > load_version_) changes_.erase(entry.version);
+    entry.version = ++version_;
+    changes_.emplace(entry.version, entry.username);
+}
+
+void UserDirectory::addUser(const std::string& username, long long user_id) {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    auto [it, inserted] = users_.try_emplace(username);
+    Entry& entry = it->second;
+    if (!inserted && entry.user_id == user_id) return;
+    entry.username = username;
+    entry.user_id = user_id;
+    touch(entry);
+}
+
+void UserDirectory::setOnline(const std::string& username, bool online) {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    auto it = users_.find(username);
+    if (it == users_.end() || it->second.online == online) return;
+    it->second.online = online;
+    if (online) {
+        online_.insert(username);
+    } else {
+        online_.erase(username);
+    }
+    touch(it->second);
+}
+
+uint64_t UserDirectory::version() const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    return version_;
+}
+
+UserDirectory::Page UserDirectory::query(uint64_t since_version, bool online_only, const std::string& after,
+                                         std::size_t limit) const {
+    Page page;
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    page.version = version_;
+
+    auto take = [&](const Entry& entry) {
+        if (limit > 0 && page.entries.size() == limit) {
+            page.has_more = true;
+            return false;
+        }
+        page.entries.push_back(entry);
+        return true;
+    };
+
+    // A version from before the load, or one this directory never issued, gets everything
+    if (since_version >= load_version_ && since_version > 0 && since_version <= version_) {
+        std::vector<const std::string*> changed;
+        for (auto it = changes_.upper_bound(since_version); it != changes_.end(); ++it) {
+            if (it->second > after) changed.push_back(&it->second);
+        }
+        std::sort(changed.begin(), changed.end(), [](const std::string* a, const std::string* b) { return *a < *b; });
+        for (const std::string* username : changed) {
+            if (!take(users_.at(*username))) break;
+        }
+    } else if (online_only && since_version == 0) {
+        for (auto it = online_.upper_bound(after); it != online_.end(); ++it) {
+            if (!take(users_.at(*it))) break;
+        }
+    } else {
+        for (auto it = users_.upper_bound(after); it != users_.end(); ++it) {
+            if (!take(it->second)) break;
+        }
+    }
+    return page;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <set>
+#include <shared_mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief 带版本号的用户目录
+ *
+ * 启动时从数据库加载一次全部注册用户，之后由注册与上下线增量维护，/users 不再每次查询用户表。
+ * 每次变化（新注册、上线、下线）分配一个递增的版本号并记在该用户上，另有 版本号 -> 用户名
+ * 的变更索引，因此 "自版本 V 以来的变化" 只需访问这之后的变更，与用户总数无关。
+ *
+ * 版本号以加载时刻的微秒时间为起点，服务重启后新版本号大于旧进程发出的任何版本号；
+ * 早于加载时刻的版本号查询得到全部用户。线程安全。
+ */
+class UserDirectory {
+public:
+    struct Entry {
+        std::string username;
+        long long user_id = -1;
+        bool online = false;
+        uint64_t version = 0; ///< 最近一次变化的版本号
+    };
+
+    struct Page {
+        uint64_t version = 0;       ///< 查询时目录的版本号，下次以它作为 since_version
+        std::vector<Entry> entries; ///< 按用户名排序
+        bool has_more = false;      ///< 本页已满且之后还有，下一页以最后一个用户名作为 after
+    };
+
+    /**
+     * @brief 用数据库中的注册用户替换目录内容，全部视为离线
+     */
+    void load(const std::vector<std::pair<std::string, long long>>& users);
+
+    /**
+     * @brief 登记新注册的用户（已存在时只更新ID）
+     */
+    void addUser(const std::string& username, long long user_id);
+
+    /**
+     * @brief 更新在线状态，状态不变或用户未注册时不产生新版本
+     */
+    void setOnline(const std::string& username, bool online);
+
+    uint64_t version() const;
+
+    /**
+     * @brief 查询一页用户
+     * @param since_version 0 返回全部用户；否则只返回该版本之后变化过的用户（含已下线的），
+     *        早于本次加载或大于当前版本（非本进程发出）的版本号同样返回全部用户
+     * @param online_only 只返回在线用户（仅对全量查询生效，增量结果需要带上下线的用户）
+     * @param after 分页游标：只返回用户名大于它的用户
+     * @param limit 每页上限，0 为不限
+     */
+    Page query(uint64_t since_version, bool online_only, const std::string& after, std::size_t limit) const;
+
+private:
+    // Gives entry the next version; caller holds mutex_ exclusively
+    void touch(Entry& entry);
+
+    mutable std::shared_mutex mutex_;
+    std::map<std::string, Entry> users_;      // by username
+    std::set<std::string> online_;            // usernames currently online
+    std::map<uint64_t, std::string> changes_; // version -> username, latest change since load()
+    uint64_t version_ = 0;
+    uint64_t load_version_ = 0; // version of every entry loaded and not changed since
+};
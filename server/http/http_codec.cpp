@@ -6,6 +6,7 @@
 #include <string_view>
 #include <algorithm>
 #include <iostream>
+#include <cstdio>
 
 HttpRequest parseRequestFromBuffer(Buffer* buf, bool& complete, bool& bad_request) {
     complete = false;
@@ -124,3 +125,17 @@ std::string buildResponse(const HttpResponse& response) {
     oss << response.body;
     return oss.str();
 }
+
+std::string encodeChunk(std::string_view data) {
+    if (data.empty()) {
+        return "0\r\n\r\n";
+    }
+    char size_line[24];
+    int n = snprintf(size_line, sizeof(size_line), "%zx\r\n", data.size());
+    std::string chunk;
+    chunk.reserve(n + data.size() + 2);
+    chunk.append(size_line, n);
+    chunk.append(data.data(), data.size());
+    chunk.append("\r\n");
+    return chunk;
+}
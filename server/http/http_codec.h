@@ -1,16 +1,59 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <map>
+#include <functional>
+#include <memory>
 #include "net/buffer.h"
 
+class TcpConnection;
+
+/**
+ * @brief 流式响应的数据生产者
+ *
+ * 每次调用向 out 追加下一段响应体数据。
+ * 返回 false 表示数据已全部产出（本次追加的数据仍会被发送）。
+ * 在阻塞线程池中被调用，可以执行阻塞操作（如数据库游标扫描）。
+ */
+using HttpChunkProducer = std::function<bool(std::string& out)>;
+
+/**
+ * @brief 事件流（text/event-stream）建立回调
+ *
+ * 响应头发出、连接切换为事件流模式后在IO线程中调用，
+ * 之后写入该连接的数据都作为响应体的一部分，直到连接关闭。
+ */
+using HttpEventStreamOpen = std::function<void(const std::shared_ptr<TcpConnection>& conn)>;
+
+/**
+ * @brief 头部名称比较（不区分大小写）
+ *
+ * HTTP/1.1 客户端大小写随意，HTTP/2 头部名称一律小写，
+ * 按不区分大小写查找使 "Accept-Encoding" 等查找在两种协议下都有效。
+ */
+struct HeaderNameLess {
+    using is_transparent = void;
+    bool operator()(std::string_view a, std::string_view b) const {
+        std::size_t n = a.size() < b.size() ? a.size() : b.size();
+        for (std::size_t i = 0; i < n; ++i) {
+            char ca = (a[i] >= 'A' && a[i] <= 'Z') ? static_cast<char>(a[i] + 32) : a[i];
+            char cb = (b[i] >= 'A' && b[i] <= 'Z') ? static_cast<char>(b[i] + 32) : b[i];
+            if (ca != cb) {
+                return ca < cb;
+            }
+        }
+        return a.size() < b.size();
+    }
+};
+
 struct HttpRequest {
     std::string method;
     std::string path;
     std::string body;
     std::string content_type;
     std::string remote_ip;
-    std::map<std::string, std::string> headers;
+    std::map<std::string, std::string, HeaderNameLess> headers;
 };
 
 struct HttpResponse {
@@ -19,6 +62,8 @@ struct HttpResponse {
     std::string body;
     std::string content_type = "application/json";
     std::map<std::string, std::string> headers;
+    HttpChunkProducer stream; ///< 非空时以 Transfer-Encoding: chunked 流式发送，忽略 body
+    HttpEventStreamOpen event_stream; ///< 非空时不带 Content-Length 发送响应头并保持连接推送事件，忽略 body
 };
 
 // Zero-copy optimized parsing
@@ -26,3 +71,6 @@ HttpRequest parseRequestFromBuffer(Buffer* buf, bool& complete, bool& bad_reques
 
 std::string buildResponse(const HttpResponse& response);
 
+// Encode one HTTP/1.1 chunk ("<hex-size>\r\n<data>\r\n"); empty data yields the last-chunk marker
+std::string encodeChunk(std::string_view data);
+
@@ -0,0 +1,167 @@
+#include "http/http_compressor.h"
+#include "logger.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <time.h>
+
+namespace {
+// zlib windowBits: 15 = zlib wrapper (Content-Encoding: deflate), +16 = gzip wrapper
+constexpr int kWindowBits[2] = {15 + 16, 15};
+constexpr int kMemLevel = 8;
+
+int slot(HttpCompressor::Encoding encoding) {
+    return encoding == HttpCompressor::kGzip ? 0 : 1;
+}
+
+std::string_view trimView(std::string_view v) {
+    while (!v.empty() && (v.front() == ' ' || v.front() == '\t')) v.remove_prefix(1);
+    while (!v.empty() && (v.back() == ' ' || v.back() == '\t')) v.remove_suffix(1);
+    return v;
+}
+
+bool iequals(std::string_view a, std::string_view b) {
+    return a.size() == b.size() &&
+           std::equal(a.begin(), a.end(), b.begin(), [](char x, char y) {
+               return std::tolower(static_cast<unsigned char>(x)) == std::tolower(static_cast<unsigned char>(y));
+           });
+}
+}
+
+HttpCompressor::HttpCompressor(int level)
+    : level_(level), initialized_{false, false}, active_(kIdentity) {
+    std::memset(streams_, 0, sizeof(streams_));
+}
+
+HttpCompressor::~HttpCompressor() {
+    for (int i = 0; i < 2; ++i) {
+        if (initialized_[i]) {
+            deflateEnd(&streams_[i]);
+        }
+    }
+}
+
+z_stream* HttpCompressor::stream(Encoding encoding) {
+    if (encoding == kIdentity) {
+        return nullptr;
+    }
+    int i = slot(encoding);
+    z_stream* zs = &streams_[i];
+    if (!initialized_[i]) {
+        if (deflateInit2(zs, level_, Z_DEFLATED, kWindowBits[i], kMemLevel, Z_DEFAULT_STRATEGY) != Z_OK) {
+            LOG_ERROR("deflateInit2 failed");
+            return nullptr;
+        }
+        initialized_[i] = true;
+    } else if (deflateReset(zs) != Z_OK) {
+        return nullptr;
+    }
+    return zs;
+}
+
+bool HttpCompressor::deflateInto(z_stream* zs, std::string_view in, std::string& out, int flush) {
+    zs->next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in.data()));
+    zs->avail_in = static_cast<uInt>(in.size());
+
+    // deflateBound covers the whole input; sync-flush/finish trailers fit in the extra slack
+    std::size_t bound = deflateBound(zs, static_cast<uLong>(in.size())) + 16;
+    do {
+        std::size_t old_size = out.size();
+        out.resize(old_size + bound);
+        zs->next_out = reinterpret_cast<Bytef*>(&out[old_size]);
+        zs->avail_out = static_cast<uInt>(bound);
+        int rc = deflate(zs, flush);
+        if (rc == Z_STREAM_ERROR) {
+            out.resize(old_size);
+            return false;
+        }
+        out.resize(old_size + (bound - zs->avail_out));
+    } while (zs->avail_out == 0);
+    return true;
+}
+
+bool HttpCompressor::compress(Encoding encoding, std::string_view in, std::string& out) {
+    z_stream* zs = stream(encoding);
+    if (!zs) {
+        return false;
+    }
+    out.clear();
+    return deflateInto(zs, in, out, Z_FINISH);
+}
+
+bool HttpCompressor::begin(Encoding encoding) {
+    active_ = encoding;
+    return stream(encoding) != nullptr;
+}
+
+bool HttpCompressor::update(std::string_view in, std::string& out, bool finish) {
+    if (active_ == kIdentity) {
+        return false;
+    }
+    z_stream* zs = &streams_[slot(active_)];
+    return deflateInto(zs, in, out, finish ? Z_FINISH : Z_SYNC_FLUSH);
+}
+
+HttpCompressor::Encoding HttpCompressor::negotiate(const std::string& accept_encoding) {
+    // q-values, -1 where the coding is not listed; "*" only covers codings not listed by name
+    double gzip = -1.0;
+    double deflate = -1.0;
+    double any = -1.0;
+    std::string_view rest(accept_encoding);
+    while (!rest.empty()) {
+        std::size_t comma = rest.find(',');
+        std::string_view item = rest.substr(0, comma);
+        rest = comma == std::string_view::npos ? std::string_view() : rest.substr(comma + 1);
+
+        std::string_view coding = item;
+        double q = 1.0;
+        std::size_t semi = item.find(';');
+        if (semi != std::string_view::npos) {
+            coding = item.substr(0, semi);
+            std::string_view param = trimView(item.substr(semi + 1));
+            if (param.size() > 2 && (param[0] == 'q' || param[0] == 'Q') && param[1] == '=') {
+                try {
+                    q = std::stod(std::string(param.substr(2)));
+                } catch (...) {
+                    q = 0.0;
+                }
+            }
+        }
+        coding = trimView(coding);
+        if (iequals(coding, "gzip")) {
+            gzip = q;
+        } else if (iequals(coding, "deflate")) {
+            deflate = q;
+        } else if (coding == "*") {
+            any = q;
+        }
+    }
+    if (gzip < 0.0) gzip = any;
+    if (deflate < 0.0) deflate = any;
+    // The higher q wins; gzip only breaks ties
+    if (gzip > 0.0 && gzip >= deflate) return kGzip;
+    if (deflate > 0.0) return kDeflate;
+    return kIdentity;
+}
+
+const char* HttpCompressor::name(Encoding encoding) {
+    switch (encoding) {
+        case kGzip: return "gzip";
+        case kDeflate: return "deflate";
+        default: return "identity";
+    }
+}
+
+HttpCompressor& HttpCompressor::threadLocal(int level) {
+    thread_local HttpCompressor compressor(level);
+    return compressor;
+}
+
+uint64_t HttpCompressor::threadCpuNanos() {
+    struct timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0) {
+        return 0;
+    }
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + static_cast<uint64_t>(ts.tv_nsec);
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <zlib.h>
+
+/**
+ * @brief HTTP 响应压缩统计
+ *
+ * 由所有IO线程/业务线程并发更新，供 /metrics 导出。
+ */
+struct HttpCompressionStats {
+    std::atomic<uint64_t> responses{0};  ///< 被压缩的响应数
+    std::atomic<uint64_t> bytes_in{0};   ///< 压缩前字节数
+    std::atomic<uint64_t> bytes_out{0};  ///< 压缩后字节数
+    std::atomic<uint64_t> cpu_ns{0};     ///< 压缩消耗的线程CPU时间（纳秒）
+};
+
+/**
+ * @brief gzip/deflate 响应压缩器
+ *
+ * 内部持有 zlib 流状态并通过 deflateReset 复用，避免每次请求重新分配压缩窗口。
+ * 非线程安全：一次性压缩使用 threadLocal() 获取当前线程独占实例，
+ * 流式响应则每个流持有一个独立实例。
+ */
+class HttpCompressor {
+public:
+    enum Encoding { kIdentity, kGzip, kDeflate };
+
+    explicit HttpCompressor(int level = Z_DEFAULT_COMPRESSION);
+    ~HttpCompressor();
+
+    HttpCompressor(const HttpCompressor&) = delete;
+    HttpCompressor& operator=(const HttpCompressor&) = delete;
+
+    /**
+     * @brief 一次性压缩完整数据
+     * @param encoding 目标编码（gzip 或 deflate）
+     * @param in 原始数据
+     * @param out [out] 压缩结果（覆盖写入）
+     * @return false 表示 zlib 出错，调用方应发送未压缩数据
+     */
+    bool compress(Encoding encoding, std::string_view in, std::string& out);
+
+    /**
+     * @brief 开始一个新的流式压缩
+     */
+    bool begin(Encoding encoding);
+
+    /**
+     * @brief 追加流式数据
+     *
+     * 每次调用以 Z_SYNC_FLUSH 刷出，保证客户端可以立即解压已收到的部分；
+     * finish 为 true 时写出流结尾。
+     * @param out [out] 本次产出的压缩数据（追加写入）
+     */
+    bool update(std::string_view in, std::string& out, bool finish);
+
+    /**
+     * @brief 根据 Accept-Encoding 协商编码（取 q 值较高者，相同时优先 gzip，忽略 q=0；`*` 只代表未单独列出的编码）
+     */
+    static Encoding negotiate(const std::string& accept_encoding);
+
+    /**
+     * @brief Content-Encoding 头取值
+     */
+    static const char* name(Encoding encoding);
+
+    /**
+     * @brief 当前线程复用的压缩器实例
+     * @param level 压缩级别，仅在该线程首次调用时生效
+     */
+    static HttpCompressor& threadLocal(int level = Z_DEFAULT_COMPRESSION);
+
+    /**
+     * @brief 当前线程已消耗的CPU时间（纳秒），用于统计压缩开销
+     */
+    static uint64_t threadCpuNanos();
+
+private:
+    z_stream* stream(Encoding encoding);
+    bool deflateInto(z_stream* zs, std::string_view in, std::string& out, int flush);
+
+    int level_;
+    z_stream streams_[2];      ///< [0] gzip, [1] deflate(zlib)
+    bool initialized_[2];
+    Encoding active_;          ///< 流式压缩当前使用的编码
+};
@@ -5,6 +5,7 @@
 #include "http/http_codec.h"
 #include "net/tcp_connection.h"
 #include "utils/server_config.h"
+#include "database_manager.h"
 #include "net/event_loop_thread_pool.h"
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -18,44 +19,278 @@
 #include <fstream>
 #include <filesystem>
 #include <cctype>
+#include <atomic>
+#include <algorithm>
+
+/**
+ * @brief 正在进行中的流式响应状态
+ *
+ * 由连接上下文与线程池任务共享；producing/finished 只在IO线程中读写。
+ */
+struct HttpStream {
+    HttpChunkProducer producer;
+    std::unique_ptr<HttpCompressor> compressor; ///< 非空表示对整个流做 gzip/deflate 压缩
+    bool producing = false;
+    bool finished = false;
+};
 
 struct HttpConnectionContext {
-    enum Protocol { kHttp, kWebSocket };
+    enum Protocol { kHttp, kWebSocket, kEventStream, kHttp2 };
     Protocol protocol = kHttp;
+    std::shared_ptr<HttpStream> stream; ///< 非空表示该连接正在发送流式响应
+    bool awaiting = false;              ///< 当前请求的响应尚未就绪（处理中或被挂起）
+    std::shared_ptr<protocols::Http2Session> h2;                ///< kHttp2 时的会话
+    std::map<uint32_t, std::shared_ptr<HttpStream>> h2_streams; ///< HTTP/2 流上进行中的流式响应
+    std::shared_ptr<protocols::WebSocketAssembler> ws;          ///< kWebSocket 时的消息组装器
+    std::shared_ptr<protocols::WebSocketDeflate> ws_deflate;    ///< 协商了 permessage-deflate 时的压缩状态
+    std::shared_ptr<WebSocketKeepalive::Peer> ws_peer;          ///< 服务端心跳状态
+    bool ws_close_delivered = false;                            ///< CLOSE 已交给 WebSocket 处理器
+    std::string ws_subprotocol;                                 ///< 握手时选中的子协议
+    std::shared_ptr<WebSocketConsumer> ws_consumer;             ///< 发送积压状态
 };
 
+namespace {
+
+/**
+ * @brief 缓冲区开头是否为 HTTP/2 连接前言
+ * @param partial [out] 数据还不足以判断时置为 true
+ */
+bool matchHttp2Preface(const Buffer* buf, bool& partial) {
+    std::string_view preface = protocols::Http2Session::kPreface;
+    std::size_t n = std::min(buf->readableBytes(), preface.size());
+    if (std::memcmp(buf->peek(), preface.data(), n) != 0) {
+        partial = false;
+        return false;
+    }
+    partial = n < preface.size();
+    return !partial;
+}
+
+protocols::HpackHeaderList buildHttp2Headers(const HttpResponse& resp) {
+    protocols::HpackHeaderList headers;
+    headers.push_back({":status", std::to_string(resp.status_code)});
+    headers.push_back({"content-type", resp.content_type});
+    if (!resp.stream && resp.headers.find("Content-Length") == resp.headers.end()) {
+        headers.push_back({"content-length", std::to_string(resp.body.size())});
+    }
+    for (const auto& [key, value] : resp.headers) {
+        std::string name(key);
+        std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return std::tolower(c); });
+        // Connection-specific fields are forbidden in HTTP/2 (RFC 7540 8.1.2.2)
+        if (name == "connection" || name == "keep-alive" || name == "transfer-encoding" || name == "upgrade") {
+            continue;
+        }
+        headers.push_back({std::move(name), value});
+    }
+    headers.push_back({"access-control-allow-origin", "*"});
+    return headers;
+}
+
+std::string_view queryValue(std::string_view path, std::string_view key) {
+    auto pos = path.find('?');
+    if (pos == std::string_view::npos) {
+        return {};
+    }
+    std::string_view query = path.substr(pos + 1);
+    while (!query.empty()) {
+        auto amp = query.find('&');
+        std::string_view pair = query.substr(0, amp);
+        if (pair.size() > key.size() && pair.compare(0, key.size(), key) == 0 && pair[key.size()] == '=') {
+            return pair.substr(key.size() + 1);
+        }
+        if (amp == std::string_view::npos) {
+            break;
+        }
+        query.remove_prefix(amp + 1);
+    }
+    return {};
+}
+
+std::shared_ptr<protocols::WebSocketDeflate> webSocketDeflateOf(const TcpConnectionPtr& conn) {
+    // Set once during the upgrade, before the connection can be handed to other threads
+    const auto* context = std::any_cast<HttpConnectionContext>(&conn->getContext());
+    return context ? context->ws_deflate : nullptr;
+}
+
+std::shared_ptr<WebSocketConsumer> webSocketConsumerOf(const TcpConnectionPtr& conn) {
+    const auto* context = std::any_cast<HttpConnectionContext>(&conn->getContext());
+    return context ? context->ws_consumer : nullptr;
+}
+
+} // namespace
+
 HttpServer::HttpServer(EventLoop* loop, int port) 
     : server_(loop, InetAddress(port), "HttpServer", TcpServer::kReusePort),
       port_(port),
       thread_pool_(ServerConfig::instance().thread_pool.core_threads,
                    ServerConfig::instance().thread_pool.max_threads,
-                   ServerConfig::instance().thread_pool.queue_capacity) {
+                   ServerConfig::instance().thread_pool.queue_capacity),
+      blocking_pool_(ServerConfig::instance().thread_pool.blocking_threads,
+                     ServerConfig::instance().thread_pool.blocking_threads,
+                     ServerConfig::instance().thread_pool.queue_capacity),
+      ws_broadcaster_(ws_deflate_stats_) {
+    const auto& ws_config = ServerConfig::instance().websocket;
+    if (ws_config.ping_interval_seconds > 0) {
+        ws_keepalive_ = std::make_shared<WebSocketKeepalive>(ws_config.ping_interval_seconds, ws_config.ping_max_missed);
+    }
+    WebSocketSendPolicy send_policy;
+    send_policy.soft_queue_bytes = ws_config.send_queue_soft_bytes;
+    send_policy.hard_queue_bytes = ws_config.send_queue_hard_bytes;
+    send_policy.close_grace_seconds = ws_config.slow_close_grace_seconds;
+    ws_broadcaster_.setSendPolicy(send_policy);
     
     // Set IO threads
     int ioThreads = ServerConfig::instance().thread_pool.io_threads;
     if (ioThreads > 0) {
         server_.setThreadNum(ioThreads);
     }
+    server_.setWriteCoalescing(ServerConfig::instance().thread_pool.write_coalescing);
 
     server_.setConnectionCallback(
         std::bind(&HttpServer::onConnection, this, std::placeholders::_1));
     server_.setMessageCallback(
         std::bind(&HttpServer::onMessage, this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3));
+    server_.setWriteCompleteCallback(
+        std::bind(&HttpServer::onWriteComplete, this, std::placeholders::_1));
 }
 
 HttpServer::~HttpServer() {
     stop();
 }
 
-void HttpServer::registerHandler(const std::string& path, HttpHandler handler) {
-    handlers_[path] = handler;
+void HttpServer::registerHandler(const std::string& path, HttpHandler handler, HttpExecution execution) {
+    handlers_[path] = Route{[handler = std::move(handler)](const HttpRequest& req, EventLoop*, HttpResponder respond) {
+        respond(handler(req));
+    }, execution};
     LOG_INFO("注册路由: {}", path);
 }
 
+void HttpServer::registerAsyncHandler(const std::string& path, AsyncHttpHandler handler, HttpExecution execution) {
+    handlers_[path] = Route{std::move(handler), execution};
+    LOG_INFO("注册异步路由: {}", path);
+}
+
 void HttpServer::setWebSocketHandler(WebSocketHandler handler) {
     ws_handler_ = std::move(handler);
 }
 
+void HttpServer::setWebSocketSubprotocolSelector(WebSocketSubprotocolSelector selector) {
+    ws_subprotocol_selector_ = std::move(selector);
+}
+
+const std::string& HttpServer::webSocketSubprotocol(const TcpConnectionPtr& conn) {
+    static const std::string kNone;
+    // Set once during the upgrade, before the connection can be handed to other threads
+    const auto* context = std::any_cast<HttpConnectionContext>(&conn->getContext());
+    return context ? context->ws_subprotocol : kNone;
+}
+
+std::shared_ptr<const WebSocketConsumer> HttpServer::webSocketConsumer(const TcpConnectionPtr& conn) {
+    return webSocketConsumerOf(conn);
+}
+
+void HttpServer::upgradeWebSocket(const TcpConnectionPtr& conn, const HttpRequest& req) {
+    HttpConnectionContext* context = std::any_cast<HttpConnectionContext>(conn->getMutableContext());
+    context->protocol = HttpConnectionContext::kWebSocket;
+    context->ws_consumer = std::make_shared<WebSocketConsumer>();
+
+    std::string secKey = "";
+    if (req.headers.count("Sec-WebSocket-Key")) {
+        secKey = req.headers.at("Sec-WebSocket-Key");
+    }
+    LOG_INFO("WebSocket连接升级请求，Sec-WebSocket-Key: {}", secKey);
+
+    std::string acceptKey = protocols::WebSocketCodec::computeAcceptKey(secKey);
+    LOG_INFO("WebSocket连接升级响应，Sec-WebSocket-Accept: {}", acceptKey);
+
+    std::string resp = "HTTP/1.1 101 Switching Protocols\r\n"
+                       "Upgrade: websocket\r\n"
+                       "Connection: Upgrade\r\n"
+                       "Sec-WebSocket-Accept: " + acceptKey + "\r\n";
+
+    const ServerConfig& config = ServerConfig::instance();
+    // The assembler lives in the connection context, so its callbacks must not own the connection
+    std::weak_ptr<TcpConnection> weak_conn(conn);
+    context->ws = std::make_shared<protocols::WebSocketAssembler>(
+        config.websocket.max_message_bytes,
+        [weak_conn](const std::string& data) {
+            if (TcpConnectionPtr conn = weak_conn.lock()) {
+                conn->send(data);
+            }
+        },
+        [this, weak_conn](const protocols::WebSocketFrame& message) {
+            TcpConnectionPtr conn = weak_conn.lock();
+            if (!conn) {
+                return;
+            }
+            if (message.rsv1) {
+                ws_deflate_stats_.messages_in++;
+            }
+            if (message.opcode == protocols::WebSocketOpcode::CLOSE) {
+                std::any_cast<HttpConnectionContext>(conn->getMutableContext())->ws_close_delivered = true;
+            }
+            if (ws_handler_) {
+                ws_handler_(conn, message);
+            }
+        });
+
+    if (ws_keepalive_) {
+        auto user_agent = req.headers.find("User-Agent");
+        auto cls = WebSocketKeepalive::classify(queryValue(req.path, "client"),
+                                                user_agent != req.headers.end() ? user_agent->second : "");
+        context->ws_peer = ws_keepalive_->track(conn, cls);
+        // The peer is owned by the same context as the assembler, so a plain reference cannot dangle
+        context->ws->setPongCallback([this, peer = context->ws_peer.get()](std::string_view payload) {
+            ws_keepalive_->onPong(*peer, payload);
+        });
+    }
+
+    auto protocols_offered = req.headers.find("Sec-WebSocket-Protocol");
+    if (ws_subprotocol_selector_ && protocols_offered != req.headers.end()) {
+        context->ws_subprotocol = ws_subprotocol_selector_(protocols_offered->second);
+        if (!context->ws_subprotocol.empty()) {
+            resp += "Sec-WebSocket-Protocol: " + context->ws_subprotocol + "\r\n";
+        }
+    }
+
+    auto extensions = req.headers.find("Sec-WebSocket-Extensions");
+    if (config.websocket.deflate_enabled && extensions != req.headers.end()) {
+        protocols::WebSocketDeflateOptions options;
+        options.max_window_bits = config.websocket.deflate_max_window_bits;
+        options.context_takeover = config.websocket.deflate_context_takeover;
+        options.max_memory = config.websocket.deflate_max_memory;
+        protocols::WebSocketDeflateParams params;
+        std::string accepted;
+        if (protocols::WebSocketCodec::negotiateDeflate(extensions->second, options, params, accepted)) {
+            context->ws_deflate = std::make_shared<protocols::WebSocketDeflate>(params, config.compression.level);
+            context->ws->setDeflate(context->ws_deflate);
+            ws_deflate_stats_.connections++;
+            resp += "Sec-WebSocket-Extensions: " + accepted + "\r\n";
+            LOG_INFO("WebSocket 压缩协商: {}", accepted);
+        }
+    }
+    resp += "\r\n";
+    conn->send(resp);
+}
+
+void HttpServer::sendWebSocketMessage(const TcpConnectionPtr& conn, protocols::WebSocketOpcode opcode,
+                                      const std::string& payload) {
+    broadcastWebSocketMessage({conn}, opcode, payload);
+}
+
+void HttpServer::broadcastWebSocketMessage(const std::vector<TcpConnectionPtr>& conns,
+                                           protocols::WebSocketOpcode opcode, const std::string& payload,
+                                           WebSocketEventClass event_class) {
+    const ServerConfig& config = ServerConfig::instance();
+    std::vector<WebSocketBroadcaster::Recipient> recipients;
+    recipients.reserve(conns.size());
+    for (const auto& conn : conns) {
+        recipients.push_back({conn, webSocketDeflateOf(conn), webSocketConsumerOf(conn)});
+    }
+    ws_broadcaster_.broadcast(std::move(recipients), opcode, payload, config.websocket.deflate_min_bytes,
+                              config.compression.level, event_class);
+}
+
 void HttpServer::setStaticResourceDir(const std::string& dir) {
     static_resource_dir_ = dir;
 }
@@ -86,9 +321,31 @@ std::size_t HttpServer::getThreadPoolActiveThreadCount() const {
     return thread_pool_.activeThreadCount();
 }
 
+std::size_t HttpServer::getBlockingPoolQueueSize() const {
+    return blocking_pool_.queueSize();
+}
+
+std::size_t HttpServer::getBlockingPoolActiveThreadCount() const {
+    return blocking_pool_.activeThreadCount();
+}
+
 void HttpServer::onConnection(const TcpConnectionPtr& conn) {
     if (conn->connected()) {
         conn->setContext(HttpConnectionContext());
+        return;
+    }
+    // Peers that vanish without a CLOSE frame (dead clients, missed pings, protocol errors) still get
+    // one, so the handler can release whatever it keyed on the connection
+    auto* context = std::any_cast<HttpConnectionContext>(conn->getMutableContext());
+    if (context && context->protocol == HttpConnectionContext::kWebSocket && !context->ws_close_delivered) {
+        context->ws_close_delivered = true;
+        if (ws_handler_) {
+            protocols::WebSocketFrame close;
+            close.fin = true;
+            close.opcode = protocols::WebSocketOpcode::CLOSE;
+            close.masked = false;
+            ws_handler_(conn, close);
+        }
     }
 }
 
@@ -104,6 +361,19 @@ void HttpServer::onMessage(const TcpConnectionPtr& conn, Buffer* buf, Timestamp
 
     while (buf->readableBytes() > 0) {
         if (context->protocol == HttpConnectionContext::kHttp) {
+            if (context->stream || context->awaiting) {
+                // Pipelined request behind an unfinished response; resumed once it is sent
+                break;
+            }
+            bool partial = false;
+            if (matchHttp2Preface(buf, partial)) {
+                LOG_INFO("HTTP/2 先验知识连接");
+                startHttp2(conn);
+                continue;
+            }
+            if (partial) {
+                break;
+            }
             LOG_INFO("处理HTTP请求");
             bool complete = false;
             bool bad = false;
@@ -124,23 +394,23 @@ void HttpServer::onMessage(const TcpConnectionPtr& conn, Buffer* buf, Timestamp
                 break; // Wait for more data
             }
         } else if (context->protocol == HttpConnectionContext::kWebSocket) {
-            LOG_INFO("处理WebSocket请求");
-            protocols::WebSocketFrame frame;
-            // Use beginRead() to get mutable pointer for in-place unmasking
-            int consumed = protocols::WebSocketCodec::parseFrame(reinterpret_cast<uint8_t*>(buf->beginRead()), buf->readableBytes(), frame);
-            
-            if (consumed > 0) {
-                buf->retrieve(consumed);
-                if (ws_handler_) {
-                    ws_handler_(conn, frame);
-                }
-            } else if (consumed < 0) {
-                conn->send("HTTP/1.1 400 Bad Request\r\n\r\n");
-                conn->forceClose();
-                return;
-            } else {
-                break; // Incomplete frame
+            if (!context->ws->feed(buf)) {
+                // A close frame has been written; nothing after it will be processed
+                buf->retrieveAll();
+                conn->shutdown();
+            }
+            break;
+        } else if (context->protocol == HttpConnectionContext::kHttp2) {
+            if (!context->h2->feed(buf)) {
+                // GOAWAY has been written; nothing after it will be processed
+                buf->retrieveAll();
+                conn->shutdown();
             }
+            break;
+        } else if (context->protocol == HttpConnectionContext::kEventStream) {
+            // The response body never ends, so nothing the client sends can be answered
+            buf->retrieveAll();
+            break;
         }else{
             LOG_ERROR("未知协议");
             conn->forceClose();
@@ -152,74 +422,511 @@ void HttpServer::onMessage(const TcpConnectionPtr& conn, Buffer* buf, Timestamp
 void HttpServer::onRequest(const TcpConnectionPtr& conn, const HttpRequest& req) {
     // Check for WebSocket Upgrade
     if (req.headers.count("Upgrade") && req.headers.at("Upgrade") == "websocket") {
+        upgradeWebSocket(conn, req);
+        return;
+    }
+
+    // h2c upgrade (RFC 7540 3.2); requests with a body are simply answered over HTTP/1.1
+    auto upgrade = req.headers.find("Upgrade");
+    auto settings = req.headers.find("HTTP2-Settings");
+    if (upgrade != req.headers.end() && upgrade->second == "h2c" && settings != req.headers.end() &&
+        req.body.empty()) {
+        LOG_INFO("HTTP/2 升级请求: {}", req.path);
+        conn->send("HTTP/1.1 101 Switching Protocols\r\n"
+                   "Connection: Upgrade\r\n"
+                   "Upgrade: h2c\r\n\r\n");
+        startHttp2(conn);
+        HttpRequest h2_req = req;
+        h2_req.headers.erase("Upgrade");
+        h2_req.headers.erase("HTTP2-Settings");
+        h2_req.headers.erase("Connection");
         HttpConnectionContext* context = std::any_cast<HttpConnectionContext>(conn->getMutableContext());
-        context->protocol = HttpConnectionContext::kWebSocket;
-        
-        std::string secKey = "";
-        if (req.headers.count("Sec-WebSocket-Key")) {
-            secKey = req.headers.at("Sec-WebSocket-Key");
+        if (!context->h2->startFromUpgrade(settings->second, std::move(h2_req))) {
+            conn->shutdown();
         }
-        LOG_INFO("WebSocket连接升级请求，Sec-WebSocket-Key: {}", secKey);
-        
-        std::string acceptKey = protocols::WebSocketCodec::computeAcceptKey(secKey);
-        LOG_INFO("WebSocket连接升级响应，Sec-WebSocket-Accept: {}", acceptKey);
-        
-        std::string resp = "HTTP/1.1 101 Switching Protocols\r\n"
-                           "Upgrade: websocket\r\n"
-                           "Connection: Upgrade\r\n"
-                           "Sec-WebSocket-Accept: " + acceptKey + "\r\n\r\n";
-        conn->send(resp);
         return;
     }
 
+    Route target = route(req);
+    if (target.handler) {
+        dispatch(conn, req, negotiateEncoding(req), target);
+    } else {
+        HttpResponse resp;
+        resp.status_code = 404;
+        resp.status_text = "Not Found";
+        conn->send(buildResponse(resp));
+    }
+}
+
+HttpServer::Route HttpServer::route(const HttpRequest& req) {
     std::string handler_path = req.path;
     auto query_pos = handler_path.find('?');
     if (query_pos != std::string::npos) {
         handler_path = handler_path.substr(0, query_pos);
     }
 
-    if (handlers_.count(handler_path)) {
-        // Dispatch to thread pool
-        thread_pool_.post([this, conn, req, handler = handlers_[handler_path]]() {
-            HttpResponse resp = handler(req);
-            
-            // Send response back in IO loop
-            conn->getLoop()->runInLoop([this, conn, resp]() {
-                std::string responseStr = buildResponse(resp);
-                conn->send(responseStr);
-            });
+    auto it = handlers_.find(handler_path);
+    if (it != handlers_.end()) {
+        return it->second;
+    }
+    // Try to serve static file
+    if (static_resource_dir_.empty() || (req.method != "GET" && req.method != "HEAD")) {
+        return Route{};
+    }
+    return Route{[this](const HttpRequest& req, EventLoop*, HttpResponder respond) {
+        std::string url_path = req.path;
+        // Default to index.html for root
+        if (url_path == "/") {
+            url_path = "/index.html";
+        }
+
+        HttpResponse resp = serveStaticFile(url_path);
+
+        // Handle HEAD method: set Content-Length and clear body
+        if (req.method == "HEAD") {
+            resp.headers["Content-Length"] = std::to_string(resp.body.size());
+            resp.body.clear();
+        }
+        respond(std::move(resp));
+    }, HttpExecution::kPool};
+}
+
+void HttpServer::dispatch(const TcpConnectionPtr& conn, const HttpRequest& req,
+                          HttpCompressor::Encoding encoding, const Route& route) {
+    if (route.execution == HttpExecution::kInline) {
+        runInline(conn, req, encoding, route.handler);
+        return;
+    }
+    HttpConnectionContext* context = std::any_cast<HttpConnectionContext>(conn->getMutableContext());
+    if (context) {
+        context->awaiting = true;
+    }
+    runHandler(req, conn->getLoop(), makeResponder(conn, encoding), route);
+}
+
+void HttpServer::runInline(const TcpConnectionPtr& conn, const HttpRequest& req,
+                           HttpCompressor::Encoding encoding, const AsyncHttpHandler& handler) {
+    struct InlineResult {
+        std::atomic<bool> responded{false};
+        bool running = true;   ///< IO线程内读写
+        bool ready = false;
+        HttpResponse resp;
+    };
+    auto result = std::make_shared<InlineResult>();
+    HttpResponder deferred = makeResponder(conn, encoding);
+    EventLoop* loop = conn->getLoop();
+    HttpResponder respond = [result, deferred, loop](HttpResponse resp) {
+        if (result->responded.exchange(true)) {
+            return;
+        }
+        // Checked in this order so that other threads never read `running`
+        if (loop->isInLoopThread() && result->running) {
+            result->resp = std::move(resp);
+            result->ready = true;
+            return;
+        }
+        deferred(std::move(resp));
+    };
+
+    callInline(handler, req, loop, respond);
+    result->running = false;
+
+    if (result->ready) {
+        // Written straight to the connection: no pool hop, no runInLoop round trip
+        sendResponse(conn, std::move(result->resp), encoding);
+        return;
+    }
+    // The handler kept the responder; park the connection like a pooled request
+    HttpConnectionContext* context = std::any_cast<HttpConnectionContext>(conn->getMutableContext());
+    if (context) {
+        context->awaiting = true;
+    }
+}
+
+void HttpServer::callInline(const AsyncHttpHandler& handler, const HttpRequest& req, EventLoop* ioLoop,
+                            const HttpResponder& respond) {
+    inline_requests_++;
+    try {
+        DatabaseManager::NoAccessScope no_db;
+        handler(req, ioLoop, respond);
+    } catch (const std::exception& e) {
+        LOG_ERROR("HTTP处理器异常 {}: {}", req.path, e.what());
+        HttpResponse resp;
+        resp.status_code = 500;
+        resp.status_text = "Internal Server Error";
+        respond(std::move(resp));
+    }
+}
+
+void HttpServer::runHandler(const HttpRequest& req, EventLoop* ioLoop, HttpResponder respond, const Route& route) {
+    ThreadPool& pool = route.execution == HttpExecution::kBlocking ? blocking_pool_ : thread_pool_;
+    pool.post([req, ioLoop, respond, handler = route.handler]() {
+        try {
+            handler(req, ioLoop, respond);
+        } catch (const std::exception& e) {
+            LOG_ERROR("HTTP处理器异常 {}: {}", req.path, e.what());
+            HttpResponse resp;
+            resp.status_code = 500;
+            resp.status_text = "Internal Server Error";
+            respond(std::move(resp));
+        }
+    });
+}
+
+HttpResponder HttpServer::makeResponder(const TcpConnectionPtr& conn, HttpCompressor::Encoding encoding,
+                                        uint32_t h2_stream) {
+    std::weak_ptr<TcpConnection> weak_conn(conn);
+    auto responded = std::make_shared<std::atomic<bool>>(false);
+    return [this, weak_conn, encoding, h2_stream, responded](HttpResponse resp) {
+        if (responded->exchange(true)) {
+            return;
+        }
+        TcpConnectionPtr conn = weak_conn.lock();
+        if (!conn) {
+            return;
+        }
+        conn->getLoop()->runInLoop([this, conn, encoding, h2_stream, resp = std::move(resp)]() mutable {
+            if (h2_stream != 0) {
+                sendHttp2Response(conn, h2_stream, std::move(resp), encoding);
+            } else {
+                completeRequest(conn, std::move(resp), encoding);
+            }
         });
-    } else {
-        // Try to serve static file
-        if (!static_resource_dir_.empty() && (req.method == "GET" || req.method == "HEAD")) {
-            thread_pool_.post([this, conn, req]() {
-                std::string url_path = req.path;
-                // Default to index.html for root
-                if (url_path == "/") {
-                    url_path = "/index.html";
-                }
-                
-                HttpResponse resp = serveStaticFile(url_path);
-                
-                // Handle HEAD method: set Content-Length and clear body
-                if (req.method == "HEAD") {
-                    resp.headers["Content-Length"] = std::to_string(resp.body.size());
-                    resp.body.clear();
-                }
-
-                conn->getLoop()->runInLoop([conn, resp, this]() {
-                    std::string responseStr = buildResponse(resp);
-                    conn->send(responseStr);
-                });
-            });
+    };
+}
+
+void HttpServer::completeRequest(const TcpConnectionPtr& conn, HttpResponse resp, HttpCompressor::Encoding encoding) {
+    HttpConnectionContext* context = std::any_cast<HttpConnectionContext>(conn->getMutableContext());
+    if (!context || !conn->connected()) {
+        return;
+    }
+    context->awaiting = false;
+    sendResponse(conn, std::move(resp), encoding);
+    if (!context->stream && conn->inputBuffer()->readableBytes() > 0) {
+        onMessage(conn, conn->inputBuffer(), Timestamp::now());
+    }
+}
+
+HttpCompressor::Encoding HttpServer::negotiateEncoding(const HttpRequest& req) const {
+    if (!ServerConfig::instance().compression.enabled) {
+        return HttpCompressor::kIdentity;
+    }
+    auto it = req.headers.find("Accept-Encoding");
+    if (it == req.headers.end()) {
+        return HttpCompressor::kIdentity;
+    }
+    return HttpCompressor::negotiate(it->second);
+}
+
+bool HttpServer::isCompressible(const HttpResponse& resp) const {
+    if (resp.status_code < 200 || resp.status_code == 204 || resp.status_code == 304) {
+        return false;
+    }
+    if (resp.headers.count("Content-Encoding") || resp.headers.count("Content-Length")) {
+        return false;
+    }
+    std::string_view type(resp.content_type);
+    type = type.substr(0, type.find(';'));
+    for (const auto& prefix : ServerConfig::instance().compression.types) {
+        if (type.compare(0, prefix.size(), prefix) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void HttpServer::compressBody(HttpResponse& resp, HttpCompressor::Encoding encoding) {
+    if (encoding == HttpCompressor::kIdentity || !isCompressible(resp)) {
+        return;
+    }
+    const auto& cfg = ServerConfig::instance().compression;
+    if (resp.body.size() >= cfg.min_bytes) {
+        std::string compressed;
+        uint64_t cpu_start = HttpCompressor::threadCpuNanos();
+        bool ok = HttpCompressor::threadLocal(cfg.level).compress(encoding, resp.body, compressed);
+        compression_stats_.cpu_ns += HttpCompressor::threadCpuNanos() - cpu_start;
+
+        if (ok && compressed.size() < resp.body.size()) {
+            compression_stats_.responses++;
+            compression_stats_.bytes_in += resp.body.size();
+            compression_stats_.bytes_out += compressed.size();
+            resp.body.swap(compressed);
+            resp.headers["Content-Encoding"] = HttpCompressor::name(encoding);
+        }
+    }
+    resp.headers["Vary"] = "Accept-Encoding";
+}
+
+std::unique_ptr<HttpCompressor> HttpServer::beginStreamCompression(HttpResponse& resp, HttpCompressor::Encoding encoding) {
+    if (encoding == HttpCompressor::kIdentity || !isCompressible(resp)) {
+        return nullptr;
+    }
+    // Stream size is unknown upfront, so the size threshold does not apply
+    auto compressor = std::make_unique<HttpCompressor>(ServerConfig::instance().compression.level);
+    if (!compressor->begin(encoding)) {
+        return nullptr;
+    }
+    resp.headers["Content-Encoding"] = HttpCompressor::name(encoding);
+    resp.headers["Vary"] = "Accept-Encoding";
+    compression_stats_.responses++;
+    return compressor;
+}
+
+void HttpServer::sendResponse(const TcpConnectionPtr& conn, HttpResponse resp, HttpCompressor::Encoding encoding) {
+
+    if (resp.event_stream) {
+        HttpConnectionContext* context = std::any_cast<HttpConnectionContext>(conn->getMutableContext());
+        if (!context || !conn->connected()) {
             return;
         }
+        // Events are pushed one by one as they happen; compression would only add buffering
+        resp.headers["Cache-Control"] = "no-cache";
+        resp.headers["X-Accel-Buffering"] = "no";
+        context->protocol = HttpConnectionContext::kEventStream;
+        conn->send(buildResponse(resp));
+        resp.event_stream(conn);
+        return;
+    }
+
+    if (!resp.stream) {
+        compressBody(resp, encoding);
+        conn->send(buildResponse(resp));
+        return;
+    }
+
+    HttpConnectionContext* context = std::any_cast<HttpConnectionContext>(conn->getMutableContext());
+    if (!context || !conn->connected()) {
+        return;
+    }
+    // Headers only; the first chunk is produced once they are flushed (onWriteComplete)
+    auto stream = std::make_shared<HttpStream>();
+    stream->compressor = beginStreamCompression(resp, encoding);
+    std::string headers = buildResponse(resp);
+    stream->producer = std::move(resp.stream);
+    context->stream = stream;
+    conn->send(headers);
+}
+
+void HttpServer::onWriteComplete(const TcpConnectionPtr& conn) {
+    HttpConnectionContext* context = std::any_cast<HttpConnectionContext>(conn->getMutableContext());
+    if (context && context->ws_consumer) {
+        context->ws_consumer->queued_bytes.store(0, std::memory_order_relaxed);
+    }
+    if (!context || !context->stream) {
+        return;
+    }
+    const auto& stream = context->stream;
+    if (stream->producing || stream->finished) {
+        return;
+    }
+    stream->producing = true;
+    pumpStream(conn, stream);
+}
+
+void HttpServer::pumpStream(const TcpConnectionPtr& conn, std::shared_ptr<HttpStream> stream) {
+    blocking_pool_.post([this, conn, stream]() {
+        if (!conn->connected()) {
+            return;
+        }
+
+        std::string data;
+        bool more = true;
+        bool failed = !produceChunk(*stream, data, more);
+
+        conn->getLoop()->runInLoop([this, conn, stream, data = std::move(data), more, failed]() {
+            stream->producing = false;
+            HttpConnectionContext* context = std::any_cast<HttpConnectionContext>(conn->getMutableContext());
+            if (!context || context->stream != stream) {
+                return;
+            }
+            if (failed) {
+                // Headers are already on the wire, the only way to signal failure is to abort
+                context->stream.reset();
+                conn->forceClose();
+                return;
+            }
+
+            std::string out;
+            if (!data.empty()) {
+                out = encodeChunk(data);
+            }
+            if (!more) {
+                out += encodeChunk({});
+                stream->finished = true;
+                context->stream.reset();
+            }
+
+            if (out.empty()) {
+                // Producer yielded nothing yet; nothing will be written, so pump again directly
+                stream->producing = true;
+                pumpStream(conn, stream);
+                return;
+            }
+            conn->send(out);
+
+            if (stream->finished && conn->inputBuffer()->readableBytes() > 0) {
+                onMessage(conn, conn->inputBuffer(), Timestamp::now());
+            }
+        });
+    });
+}
+
+bool HttpServer::produceChunk(HttpStream& stream, std::string& data, bool& more) {
+    more = true;
+    try {
+        while (more && data.size() < kStreamChunkBytes) {
+            more = stream.producer(data);
+        }
+    } catch (const std::exception& e) {
+        LOG_ERROR("流式响应生产失败: {}", e.what());
+        return false;
+    }
+
+    if (stream.compressor && (!data.empty() || !more)) {
+        std::string compressed;
+        uint64_t cpu_start = HttpCompressor::threadCpuNanos();
+        bool ok = stream.compressor->update(data, compressed, !more);
+        compression_stats_.cpu_ns += HttpCompressor::threadCpuNanos() - cpu_start;
+        compression_stats_.bytes_in += data.size();
+        compression_stats_.bytes_out += compressed.size();
+        data.swap(compressed);
+        return ok;
+    }
+    return true;
+}
+
+void HttpServer::startHttp2(const TcpConnectionPtr& conn) {
+    HttpConnectionContext* context = std::any_cast<HttpConnectionContext>(conn->getMutableContext());
+    context->protocol = HttpConnectionContext::kHttp2;
+
+    // The session lives in the connection context, so its callbacks must not own the connection
+    std::weak_ptr<TcpConnection> weak_conn(conn);
+    context->h2 = std::make_shared<protocols::Http2Session>(
+        [weak_conn](const std::string& data) {
+            if (TcpConnectionPtr conn = weak_conn.lock()) {
+                conn->send(data);
+            }
+        },
+        [this, weak_conn](uint32_t stream_id, HttpRequest req) {
+            if (TcpConnectionPtr conn = weak_conn.lock()) {
+                onHttp2Request(conn, stream_id, std::move(req));
+            }
+        });
+    context->h2->setDrainCallback([this, weak_conn](uint32_t stream_id) {
+        if (TcpConnectionPtr conn = weak_conn.lock()) {
+            onHttp2Drain(conn, stream_id);
+        }
+    });
+    context->h2->start();
+}
 
+void HttpServer::onHttp2Request(const TcpConnectionPtr& conn, uint32_t stream_id, HttpRequest req) {
+    LOG_INFO("处理HTTP/2请求 stream={} {} {}", stream_id, req.method, req.path);
+    HttpCompressor::Encoding encoding = negotiateEncoding(req);
+    Route target = route(req);
+    if (!target.handler) {
         HttpResponse resp;
         resp.status_code = 404;
         resp.status_text = "Not Found";
-        conn->send(buildResponse(resp));
+        sendHttp2Response(conn, stream_id, std::move(resp), HttpCompressor::kIdentity);
+        return;
+    }
+    HttpResponder respond = makeResponder(conn, encoding, stream_id);
+    if (target.execution == HttpExecution::kInline) {
+        // The responder's runInLoop runs synchronously here, so the response is submitted right away
+        callInline(target.handler, req, conn->getLoop(), respond);
+        return;
     }
+    // Streams are independent, so unlike HTTP/1.1 pipelining nothing waits for this response
+    runHandler(req, conn->getLoop(), std::move(respond), target);
+}
+
+void HttpServer::sendHttp2Response(const TcpConnectionPtr& conn, uint32_t stream_id, HttpResponse resp,
+                                   HttpCompressor::Encoding encoding) {
+    HttpConnectionContext* context = std::any_cast<HttpConnectionContext>(conn->getMutableContext());
+    if (!context || !context->h2 || !conn->connected()) {
+        return;
+    }
+    protocols::Http2Session& session = *context->h2;
+    if (resp.event_stream) {
+        session.resetStream(stream_id, protocols::Http2ErrorCode::HTTP_1_1_REQUIRED);
+        return;
+    }
+    if (!session.isStreamWritable(stream_id)) {
+        return; // Reset by the client meanwhile
+    }
+
+    if (!resp.stream) {
+        compressBody(resp, encoding);
+        session.submitHeaders(stream_id, buildHttp2Headers(resp), resp.body.empty());
+        if (!resp.body.empty()) {
+            session.submitData(stream_id, std::move(resp.body), true);
+        }
+        return;
+    }
+
+    auto stream = std::make_shared<HttpStream>();
+    stream->compressor = beginStreamCompression(resp, encoding);
+    session.submitHeaders(stream_id, buildHttp2Headers(resp), false);
+    stream->producer = std::move(resp.stream);
+    stream->producing = true;
+    context->h2_streams[stream_id] = stream;
+    pumpHttp2Stream(conn, stream_id, stream);
+}
+
+void HttpServer::onHttp2Drain(const TcpConnectionPtr& conn, uint32_t stream_id) {
+    HttpConnectionContext* context = std::any_cast<HttpConnectionContext>(conn->getMutableContext());
+    if (!context) {
+        return;
+    }
+    auto it = context->h2_streams.find(stream_id);
+    if (it == context->h2_streams.end() || it->second->producing) {
+        return;
+    }
+    it->second->producing = true;
+    pumpHttp2Stream(conn, stream_id, it->second);
+}
+
+void HttpServer::pumpHttp2Stream(const TcpConnectionPtr& conn, uint32_t stream_id, std::shared_ptr<HttpStream> stream) {
+    blocking_pool_.post([this, conn, stream_id, stream]() {
+        if (!conn->connected()) {
+            return;
+        }
+        std::string data;
+        bool more = true;
+        bool failed = !produceChunk(*stream, data, more);
+
+        conn->getLoop()->runInLoop([this, conn, stream_id, stream, data = std::move(data), more, failed]() mutable {
+            stream->producing = false;
+            HttpConnectionContext* context = std::any_cast<HttpConnectionContext>(conn->getMutableContext());
+            if (!context || !context->h2) {
+                return;
+            }
+            auto it = context->h2_streams.find(stream_id);
+            if (it == context->h2_streams.end() || it->second != stream) {
+                return;
+            }
+            protocols::Http2Session& session = *context->h2;
+            if (failed || !session.isStreamWritable(stream_id)) {
+                // Only this stream is aborted; the connection carries on
+                context->h2_streams.erase(it);
+                session.resetStream(stream_id, protocols::Http2ErrorCode::INTERNAL_ERROR);
+                return;
+            }
+            if (!more) {
+                context->h2_streams.erase(it);
+                session.submitData(stream_id, std::move(data), true);
+                return;
+            }
+            if (data.empty()) {
+                stream->producing = true;
+                pumpHttp2Stream(conn, stream_id, stream);
+                return;
+            }
+            // The next chunk is produced once the session has written this one (onHttp2Drain)
+            session.submitData(stream_id, std::move(data), false);
+        });
+    });
 }
 
 HttpResponse HttpServer::serveStaticFile(const std::string& path) {
@@ -279,15 +986,22 @@ std::string HttpServer::buildResponse(const HttpResponse& resp) {
     std::ostringstream oss;
     oss << "HTTP/1.1 " << resp.status_code << " " << resp.status_text << "\r\n";
     oss << "Content-Type: " << resp.content_type << "\r\n";
-    if (resp.headers.find("Content-Length") == resp.headers.end()) {
+    if (resp.stream) {
+        oss << "Transfer-Encoding: chunked\r\n";
+    } else if (resp.event_stream) {
+        // Body is delimited by connection close
+    } else if (resp.headers.find("Content-Length") == resp.headers.end()) {
         oss << "Content-Length: " << resp.body.size() << "\r\n";
     }
     for (const auto& [key, value] : resp.headers) {
         oss << key << ": " << value << "\r\n";
     }
-    oss << "Connection: keep-alive\r\n";
+    // An event stream has no length framing and ends only when the connection does
+    oss << "Connection: " << (resp.event_stream ? "close" : "keep-alive") << "\r\n";
     oss << "Access-Control-Allow-Origin: *\r\n";
     oss << "\r\n";
-    oss << resp.body;
+    if (!resp.stream && !resp.event_stream) {
+        oss << resp.body;
+    }
     return oss.str();
 }
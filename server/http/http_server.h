@@ -1,31 +1,80 @@
 #pragma once
 
+#include <atomic>
 #include <functional>
 #include <map>
 #include <string>
+#include <string_view>
+#include <vector>
 #include "net/tcp_server.h"
 #include "net/event_loop.h"
+#include "net/io_stats.h"
 #include "http/http_codec.h"
+#include "http/http_compressor.h"
+#include "http/websocket_broadcaster.h"
+#include "http/websocket_keepalive.h"
 #include "utils/thread_pool.h"
 #include "websocket/websocket_codec.h"
+#include "websocket/websocket_assembler.h"
+#include "websocket/websocket_deflate.h"
+#include "http2/http2_session.h"
 
 class TcpConnection;
+struct HttpStream;
 
 /**
  * @brief HTTP请求处理函数类型
  */
 using HttpHandler = std::function<HttpResponse(const HttpRequest&)>;
 
+/**
+ * @brief 异步响应回调
+ *
+ * 线程安全，可在任意线程调用，只有第一次调用生效；响应会被投递回连接所属IO线程发送。
+ * 连接已关闭时调用为空操作。
+ */
+using HttpResponder = std::function<void(HttpResponse)>;
+
+/**
+ * @brief 异步HTTP请求处理函数类型
+ *
+ * 在业务线程池中执行，可以立即调用 responder，也可以把它保存起来稍后再调用
+ * （例如长轮询挂起请求），期间不占用任何业务线程。
+ * ioLoop 为连接所属的IO线程，可用于注册超时定时器。
+ */
+using AsyncHttpHandler = std::function<void(const HttpRequest&, EventLoop* ioLoop, HttpResponder)>;
+
+/**
+ * @brief 路由处理器的执行方式
+ */
+enum class HttpExecution {
+    kInline,   ///< 直接在连接所属IO线程中执行；只适用于微秒级、不阻塞的处理器，不得访问数据库
+    kPool,     ///< 业务线程池（默认）
+    kBlocking  ///< 独立的阻塞线程池，用于耗时的数据库扫描等，避免占满业务线程池
+};
+
 /**
  * @brief WebSocket消息处理函数类型
+ *
+ * 每次调用对应一条完整消息（分片已拼接、压缩已解开），opcode 为 TEXT、BINARY 或 CLOSE；
+ * PING/PONG 由服务器在IO线程中自动处理。连接未发送 CLOSE 就断开（心跳超时、协议错误、网络中断）时
+ * 也会收到一次负载为空的 CLOSE。payload 只在调用期间有效。
  */
 using WebSocketHandler = std::function<void(const TcpConnectionPtr&, const protocols::WebSocketFrame&)>;
 
+/**
+ * @brief WebSocket 子协议选择函数类型
+ *
+ * 参数为请求头 Sec-WebSocket-Protocol 的值，返回选中的子协议（必须是客户端提议之一），空串表示不选择。
+ */
+using WebSocketSubprotocolSelector = std::function<std::string(std::string_view offered)>;
+
 /**
  * @brief HTTP服务器核心类
  * 
  * 负责监听端口、接受连接、分发请求到对应的处理器。
- * 支持HTTP和WebSocket协议。
+ * 支持HTTP/1.1、明文HTTP/2（h2c，先验知识或 Upgrade 建立）和WebSocket协议，
+ * HTTP/2 的每个流与 HTTP/1.1 请求共用同一套路由与处理器。
  */
 class HttpServer {
 public:
@@ -36,6 +85,9 @@ public:
      * @param port 服务器监听端口
      */
     explicit HttpServer(EventLoop* loop, int port);
+
+    /// 流式响应每个 chunk 的目标大小（字节），生产者输出累积到该大小后发送一次
+    static constexpr std::size_t kStreamChunkBytes = 16 * 1024;
     
     /**
      * @brief 析构函数
@@ -48,14 +100,66 @@ public:
      * @brief 注册HTTP路由处理器
      * @param path 请求路径 (例如 "/api/login")
      * @param handler 处理函数
+     * @param execution 执行方式
      */
-    void registerHandler(const std::string& path, HttpHandler handler);
+    void registerHandler(const std::string& path, HttpHandler handler,
+                         HttpExecution execution = HttpExecution::kPool);
+
+    /**
+     * @brief 注册异步HTTP路由处理器
+     *
+     * 同一连接上的后续请求会等到该请求的响应发出后才开始处理，保证流水线请求按序响应。
+     * @param path 请求路径
+     * @param handler 异步处理函数
+     * @param execution 执行方式
+     */
+    void registerAsyncHandler(const std::string& path, AsyncHttpHandler handler,
+                              HttpExecution execution = HttpExecution::kPool);
 
     /**
      * @brief 设置WebSocket消息处理器
      * @param handler 处理函数
      */
     void setWebSocketHandler(WebSocketHandler handler);
+
+    /**
+     * @brief 设置 WebSocket 子协议选择函数，未设置时不回应 Sec-WebSocket-Protocol
+     */
+    void setWebSocketSubprotocolSelector(WebSocketSubprotocolSelector selector);
+
+    /**
+     * @brief 连接握手时选中的 WebSocket 子协议，没有选择时返回空串
+     *
+     * 升级完成后不再改变，可在任意线程调用。
+     */
+    static const std::string& webSocketSubprotocol(const TcpConnectionPtr& conn);
+
+    /**
+     * @brief WebSocket 连接的发送积压状态，非 WebSocket 连接返回空
+     *
+     * 升级时创建，之后指针不再改变，可在任意线程调用并读取其中的计数。
+     */
+    static std::shared_ptr<const WebSocketConsumer> webSocketConsumer(const TcpConnectionPtr& conn);
+
+    /**
+     * @brief 向 WebSocket 连接发送一条消息，按握手时协商的 permessage-deflate 参数压缩
+     *
+     * 线程安全，可在任意线程调用。
+     */
+    void sendWebSocketMessage(const TcpConnectionPtr& conn, protocols::WebSocketOpcode opcode,
+                              const std::string& payload);
+
+    /**
+     * @brief 向多个 WebSocket 连接发送同一条消息
+     *
+     * 由 WebSocketBroadcaster 扇出：帧只编码一次，每个IO线程只投递一个任务。
+     * 无上下文接管的连接按协商参数共享压缩帧；保留上下文的连接在各自IO线程中逐个压缩，
+     * 保证压缩顺序与发送顺序一致。线程安全，调用方不应持有自己的锁。
+     * 积压超过 ws_send_queue_soft_bytes 的连接跳过 kDroppable 事件；超过 ws_send_queue_hard_bytes 的连接被关闭。
+     */
+    void broadcastWebSocketMessage(const std::vector<TcpConnectionPtr>& conns, protocols::WebSocketOpcode opcode,
+                                   const std::string& payload,
+                                   WebSocketEventClass event_class = WebSocketEventClass::kReliable);
     
     /**
      * @brief 设置静态资源目录
@@ -107,6 +211,48 @@ public:
      */
     std::size_t getThreadPoolActiveThreadCount() const;
 
+    /**
+     * @brief 获取阻塞线程池任务队列大小
+     */
+    std::size_t getBlockingPoolQueueSize() const;
+
+    /**
+     * @brief 获取阻塞线程池活跃线程数
+     */
+    std::size_t getBlockingPoolActiveThreadCount() const;
+
+    /**
+     * @brief 获取在IO线程中内联处理的请求总数
+     */
+    uint64_t getInlineRequestCount() const { return inline_requests_.load(); }
+
+    /**
+     * @brief 获取响应压缩统计
+     */
+    const HttpCompressionStats& getCompressionStats() const { return compression_stats_; }
+
+    /**
+     * @brief 获取进程级 TCP 写出统计（消息数、写系统调用数、唤醒次数）
+     */
+    const NetIoStats& getNetIoStats() const { return NetIoStats::instance(); }
+
+    /**
+     * @brief 获取 WebSocket permessage-deflate 统计
+     */
+    const protocols::WebSocketDeflateStats& getWebSocketDeflateStats() const { return ws_deflate_stats_; }
+
+    /**
+     * @brief 获取 WebSocket 广播扇出统计
+     */
+    const WebSocketBroadcastStats& getWebSocketBroadcastStats() const { return ws_broadcaster_.stats(); }
+
+    /**
+     * @brief 获取 WebSocket 服务端心跳统计，心跳关闭时返回空
+     */
+    const WebSocketKeepaliveStats* getWebSocketKeepaliveStats() const {
+        return ws_keepalive_ ? &ws_keepalive_->stats() : nullptr;
+    }
+
     /**
      * @brief 处理静态文件请求
      * @param url_path 请求的URL路径
@@ -115,17 +261,147 @@ public:
     HttpResponse serveStaticFile(const std::string& url_path);
 
 private:
+    struct Route {
+        AsyncHttpHandler handler;
+        HttpExecution execution = HttpExecution::kPool;
+    };
+
     void onConnection(const TcpConnectionPtr& conn);
     void onMessage(const TcpConnectionPtr& conn, Buffer* buf, Timestamp receiveTime);
     void onRequest(const TcpConnectionPtr& conn, const HttpRequest& req);
+    void onWriteComplete(const TcpConnectionPtr& conn);
+
+    /**
+     * @brief 处理 WebSocket 升级请求，协商 permessage-deflate
+     */
+    void upgradeWebSocket(const TcpConnectionPtr& conn, const HttpRequest& req);
+
+    /**
+     * @brief 查找请求对应的处理器（注册的路由或静态文件）
+     * @return handler 为空表示 404
+     */
+    Route route(const HttpRequest& req);
+
+    /**
+     * @brief 按路由的执行方式在线程池中执行处理器，异常转换为 500 响应
+     */
+    void runHandler(const HttpRequest& req, EventLoop* ioLoop, HttpResponder respond, const Route& route);
+
+    /**
+     * @brief 在IO线程中直接执行处理器，同步产生的响应直接写入连接
+     *
+     * 处理器保存 responder 稍后再响应时，退化为与线程池路由相同的挂起流程。
+     * 执行期间禁止访问 DatabaseManager（调试构建中断言）。
+     */
+    void runInline(const TcpConnectionPtr& conn, const HttpRequest& req,
+                   HttpCompressor::Encoding encoding, const AsyncHttpHandler& handler);
+
+    /**
+     * @brief 在当前（IO）线程调用内联处理器：计数、禁止数据库访问、异常转换为 500
+     */
+    void callInline(const AsyncHttpHandler& handler, const HttpRequest& req, EventLoop* ioLoop,
+                    const HttpResponder& respond);
+
+    /**
+     * @brief 把连接切换为 HTTP/2 并发送服务端 SETTINGS
+     */
+    void startHttp2(const TcpConnectionPtr& conn);
+
+    /**
+     * @brief HTTP/2 流上的请求接收完整
+     */
+    void onHttp2Request(const TcpConnectionPtr& conn, uint32_t stream_id, HttpRequest req);
+
+    /**
+     * @brief IO线程中在 HTTP/2 流上发送响应
+     *
+     * 事件流响应需要独占连接，在 HTTP/2 上以 HTTP_1_1_REQUIRED 重置该流。
+     */
+    void sendHttp2Response(const TcpConnectionPtr& conn, uint32_t stream_id, HttpResponse resp,
+                           HttpCompressor::Encoding encoding);
+
+    /**
+     * @brief HTTP/2 流的待发送数据已全部写出，继续生产流式响应的下一块
+     */
+    void onHttp2Drain(const TcpConnectionPtr& conn, uint32_t stream_id);
+    void pumpHttp2Stream(const TcpConnectionPtr& conn, uint32_t stream_id, std::shared_ptr<HttpStream> stream);
+
+    /**
+     * @brief 执行路由处理器，并在响应就绪前暂停该连接的请求解析
+     */
+    void dispatch(const TcpConnectionPtr& conn, const HttpRequest& req,
+                  HttpCompressor::Encoding encoding, const Route& route);
+
+    /**
+     * @brief 构造绑定到连接的一次性 responder
+     * @param h2_stream 非 0 时响应发往该 HTTP/2 流
+     */
+    HttpResponder makeResponder(const TcpConnectionPtr& conn, HttpCompressor::Encoding encoding,
+                                uint32_t h2_stream = 0);
+
+    /**
+     * @brief IO线程中发送异步响应，并继续解析流水线中的下一个请求
+     */
+    void completeRequest(const TcpConnectionPtr& conn, HttpResponse resp, HttpCompressor::Encoding encoding);
+
+    /**
+     * @brief 在IO线程中发送响应
+     *
+     * 普通响应直接发送；带 stream 的响应先发送响应头，再由写完成回调驱动分块发送。
+     */
+    void sendResponse(const TcpConnectionPtr& conn, HttpResponse resp,
+                      HttpCompressor::Encoding encoding = HttpCompressor::kIdentity);
+
+    /**
+     * @brief 根据请求的 Accept-Encoding 与配置协商响应编码
+     */
+    HttpCompressor::Encoding negotiateEncoding(const HttpRequest& req) const;
+
+    /**
+     * @brief 响应的 Content-Type 是否在压缩白名单内
+     */
+    bool isCompressible(const HttpResponse& resp) const;
+
+    /**
+     * @brief 按协商结果压缩普通响应体（HTTP/1.1 与 HTTP/2 共用）
+     */
+    void compressBody(HttpResponse& resp, HttpCompressor::Encoding encoding);
+
+    /**
+     * @brief 为流式响应创建压缩器并设置 Content-Encoding
+     * @return nullptr 表示不压缩
+     */
+    std::unique_ptr<HttpCompressor> beginStreamCompression(HttpResponse& resp, HttpCompressor::Encoding encoding);
+
+    /**
+     * @brief 在业务线程中调用生产者，累积约 kStreamChunkBytes 字节（按需压缩）
+     * @param more [out] 生产者是否还有数据
+     * @return false 表示生产或压缩失败
+     */
+    bool produceChunk(HttpStream& stream, std::string& data, bool& more);
+
+    /**
+     * @brief 在阻塞线程池中生产下一个 chunk 并回到IO线程发送
+     *
+     * 只有在上一个 chunk 写入内核（输出缓冲区清空）后才会被再次调用，
+     * 从而以慢客户端的消费速度为上限，避免输出缓冲区无限增长。
+     */
+    void pumpStream(const TcpConnectionPtr& conn, std::shared_ptr<HttpStream> stream);
 
     TcpServer server_;
     int port_;
-    std::map<std::string, HttpHandler> handlers_;
+    std::map<std::string, Route> handlers_;
     ThreadPool thread_pool_;
+    ThreadPool blocking_pool_;  ///< kBlocking 路由与流式响应生产者
+    std::atomic<uint64_t> inline_requests_{0};
     
     WebSocketHandler ws_handler_;
+    WebSocketSubprotocolSelector ws_subprotocol_selector_;
     std::string static_resource_dir_;
+    HttpCompressionStats compression_stats_;
+    protocols::WebSocketDeflateStats ws_deflate_stats_;
+    WebSocketBroadcaster ws_broadcaster_;   ///< 依赖 ws_deflate_stats_，必须声明在其后
+    std::shared_ptr<WebSocketKeepalive> ws_keepalive_;  ///< ws_ping_interval_seconds 为 0 时为空
     
     std::string buildResponse(const HttpResponse& resp);
 };
@@ -0,0 +1,151 @@
+#include "http/sse_hub.h"
+#include "net/event_loop.h"
+#include "net/tcp_connection.h"
+
+#include <algorithm>
+
+SseHub::SseHub(double heartbeat_seconds, std::size_t replay_capacity)
+    : heartbeat_seconds_(heartbeat_seconds),
+      replay_capacity_(replay_capacity),
+      heartbeat_payload_(std::make_shared<const std::string>(": heartbeat\n\n")) {
+}
+
+std::string SseHub::encodeEvent(std::string_view event, std::string_view data, long long id) {
+    std::string out;
+    out.reserve(data.size() + event.size() + 32);
+    if (id > 0) {
+        out += "id: ";
+        out += std::to_string(id);
+        out += '\n';
+    }
+    out += "event: ";
+    out += event;
+    out += '\n';
+    std::size_t start = 0;
+    do {
+        std::size_t nl = data.find('\n', start);
+        std::string_view line = data.substr(start, nl == std::string_view::npos ? std::string_view::npos : nl - start);
+        out += "data: ";
+        out += line;
+        out += '\n';
+        start = nl == std::string_view::npos ? data.size() + 1 : nl + 1;
+    } while (start <= data.size());
+    out += '\n';
+    return out;
+}
+
+bool SseHub::visible(const std::vector<std::string>& audience, const std::string& user) {
+    return audience.empty() || std::find(audience.begin(), audience.end(), user) != audience.end();
+}
+
+long long SseHub::lastEventId() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return last_id_;
+}
+
+bool SseHub::subscribe(const TcpConnectionPtr& conn, const std::string& user, long long last_id) {
+    EventLoop* loop = conn->getLoop();
+    std::vector<Payload> replay;
+    bool start_heartbeat = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (last_id < evicted_id_) {
+            stats_.resume_gaps_total++;
+            return false;
+        }
+        for (const auto& entry : replay_) {
+            if (entry.id > last_id && visible(entry.audience, user)) {
+                replay.push_back(entry.payload);
+            }
+        }
+        // A loop's subscriber map is created once and never erased, so it doubles as the heartbeat-started flag
+        start_heartbeat = loops_.find(loop) == loops_.end();
+        loops_[loop][conn->name()] = Subscriber{conn, user};
+    }
+    stats_.subscribers++;
+
+    if (start_heartbeat) {
+        std::weak_ptr<SseHub> weak_self = shared_from_this();
+        loop->runEvery(heartbeat_seconds_, [weak_self, loop]() {
+            if (auto self = weak_self.lock()) {
+                self->heartbeat(loop);
+            }
+        });
+    }
+
+    for (const auto& payload : replay) {
+        conn->send(*payload);
+    }
+    stats_.replayed_total += replay.size();
+    stats_.deliveries_total += replay.size();
+    return true;
+}
+
+void SseHub::publish(long long id, Payload payload, std::vector<std::string> audience) {
+    std::vector<std::pair<EventLoop*, std::vector<TcpConnectionPtr>>> targets;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto& [loop, subscribers] : loops_) {
+            std::vector<TcpConnectionPtr> conns;
+            for (auto it = subscribers.begin(); it != subscribers.end();) {
+                TcpConnectionPtr conn = it->second.conn.lock();
+                if (!conn || !conn->connected()) {
+                    it = subscribers.erase(it);
+                    stats_.subscribers--;
+                    continue;
+                }
+                if (visible(audience, it->second.user)) {
+                    conns.push_back(std::move(conn));
+                }
+                ++it;
+            }
+            if (!conns.empty()) {
+                targets.emplace_back(loop, std::move(conns));
+            }
+        }
+
+        if (id > 0) {
+            last_id_ = id;
+            replay_.push_back(ReplayEntry{id, payload, std::move(audience)});
+            while (replay_.size() > replay_capacity_) {
+                evicted_id_ = replay_.front().id;
+                replay_.pop_front();
+            }
+        }
+    }
+    stats_.events_total++;
+
+    // One task per IO loop; every subscriber on it is written from the same payload
+    std::weak_ptr<SseHub> weak_self = shared_from_this();
+    for (auto& [loop, conns] : targets) {
+        loop->queueInLoop([weak_self, payload, conns = std::move(conns)]() {
+            for (const auto& conn : conns) {
+                conn->send(*payload);
+            }
+            if (auto self = weak_self.lock()) {
+                self->stats_.deliveries_total += conns.size();
+            }
+        });
+    }
+}
+
+void SseHub::heartbeat(EventLoop* loop) {
+    std::vector<TcpConnectionPtr> conns;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto& subscribers = loops_[loop];
+        for (auto it = subscribers.begin(); it != subscribers.end();) {
+            TcpConnectionPtr conn = it->second.conn.lock();
+            if (!conn || !conn->connected()) {
+                it = subscribers.erase(it);
+                stats_.subscribers--;
+                continue;
+            }
+            conns.push_back(std::move(conn));
+            ++it;
+        }
+    }
+    for (const auto& conn : conns) {
+        conn->send(*heartbeat_payload_);
+    }
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "net/callbacks.h"
+
+class EventLoop;
+
+/**
+ * @brief SSE 推送统计
+ */
+struct SseStats {
+    std::atomic<uint64_t> subscribers{0};     ///< 当前订阅连接数
+    std::atomic<uint64_t> events_total{0};    ///< 已发布事件数（每个事件只编码一次）
+    std::atomic<uint64_t> deliveries_total{0};///< 事件写入订阅连接的次数
+    std::atomic<uint64_t> replayed_total{0};  ///< 断线续传时从重放缓冲区补发的事件数
+    std::atomic<uint64_t> resume_gaps_total{0};///< 重放缓冲区无法覆盖 Last-Event-ID 而关闭的订阅数
+};
+
+/**
+ * @brief Server-Sent Events 订阅与广播中心
+ *
+ * 事件在发布时编码一次为共享 payload，按订阅者所属IO线程分组，
+ * 每个IO线程只投递一个任务完成扇出。带 ID 的事件（聊天消息）进入固定容量的
+ * 重放缓冲区，用于 Last-Event-ID 断线续传；每个IO线程有一个心跳定时器，
+ * 定期写入注释行防止代理因空闲断开连接。
+ *
+ * 必须通过 std::make_shared 创建（定时器与投递任务只持有 weak_ptr）。
+ */
+class SseHub : public std::enable_shared_from_this<SseHub> {
+public:
+    using Payload = std::shared_ptr<const std::string>;
+
+    /**
+     * @param heartbeat_seconds 心跳间隔
+     * @param replay_capacity 重放缓冲区保留的带 ID 事件数
+     */
+    explicit SseHub(double heartbeat_seconds = 15.0, std::size_t replay_capacity = 1024);
+
+    /**
+     * @brief 按 text/event-stream 格式编码一个事件
+     *
+     * data 中的换行会被拆分为多行 "data:"。
+     * @param id 事件ID，0 表示不输出 id 字段
+     */
+    static std::string encodeEvent(std::string_view event, std::string_view data, long long id = 0);
+
+    /**
+     * @brief 最近一次发布的带 ID 事件的ID
+     *
+     * 续传时调用方先读取该值再查询数据库补发历史，再以两者中较大的ID调用 subscribe()，
+     * 查询期间新发布的事件由重放缓冲区补上，既不遗漏也不重复。
+     */
+    long long lastEventId() const;
+
+    /**
+     * @brief 登记订阅者（必须在连接所属IO线程中调用，响应头已发送）
+     * @param conn 订阅连接
+     * @param user 订阅者用户名，决定可以收到哪些定向事件
+     * @param last_id 客户端已经收到的最后一个事件ID，之后已发布的事件会立即补发
+     * @return false 表示重放缓冲区已不完整覆盖 last_id 之后的事件，调用方应关闭连接，
+     *         让客户端带着 Last-Event-ID 重连并从数据库续传
+     */
+    bool subscribe(const TcpConnectionPtr& conn, const std::string& user, long long last_id);
+
+    /**
+     * @brief 发布事件（线程安全）
+     * @param id 事件ID，大于 0 时进入重放缓冲区；必须单调递增
+     * @param payload encodeEvent() 的结果
+     * @param audience 可见用户；为空表示所有订阅者
+     */
+    void publish(long long id, Payload payload, std::vector<std::string> audience = {});
+
+    const SseStats& stats() const { return stats_; }
+
+private:
+    struct Subscriber {
+        std::weak_ptr<TcpConnection> conn;
+        std::string user;
+    };
+
+    struct ReplayEntry {
+        long long id;
+        Payload payload;
+        std::vector<std::string> audience;
+    };
+
+    static bool visible(const std::vector<std::string>& audience, const std::string& user);
+    void heartbeat(EventLoop* loop);
+
+    double heartbeat_seconds_;
+    std::size_t replay_capacity_;
+    Payload heartbeat_payload_;
+
+    mutable std::mutex mutex_;
+    std::unordered_map<EventLoop*, std::unordered_map<std::string, Subscriber>> loops_; ///< IO线程 -> (连接名 -> 订阅者)
+    std::deque<ReplayEntry> replay_;
+    long long last_id_ = 0;
+    long long evicted_id_ = 0;  ///< 已被挤出重放缓冲区的最大ID
+    SseStats stats_;
+};
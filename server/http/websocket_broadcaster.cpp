@@ -0,0 +1,197 @@
+#include "http/websocket_broadcaster.h"
+#include "net/event_loop.h"
+#include "net/tcp_connection.h"
+#include "logger.h"
+#include "websocket/websocket_assembler.h"
+
+#include <map>
+#include <utility>
+
+namespace {
+
+using SharedFrame = std::shared_ptr<const std::string>;
+
+/**
+ * @brief 一次广播中所有IO线程共享的已编码帧
+ *
+ * 构建完成后不再修改，各IO线程的任务只读访问。帧以 shared_ptr 交给连接，
+ * 写合并模式下直接进入各连接的待发队列，不再为每个接收方复制。
+ */
+struct BroadcastBatch {
+    protocols::WebSocketOpcode opcode = protocols::WebSocketOpcode::TEXT;
+    SharedFrame plain;                                   ///< 未压缩帧
+    std::map<std::pair<int, int>, SharedFrame> shared;   ///< (窗口位数, memLevel) -> 无状态压缩帧
+    std::string payload;                                 ///< 需要在IO线程中各自压缩时保留的原始负载
+};
+
+struct Delivery {
+    TcpConnectionPtr conn;
+    SharedFrame frame;                                    ///< 为空表示在IO线程中用 deflate 压缩
+    std::shared_ptr<protocols::WebSocketDeflate> deflate;
+    std::shared_ptr<WebSocketConsumer> consumer;
+};
+
+void raisePeak(std::atomic<uint64_t>& peak, uint64_t value) {
+    uint64_t current = peak.load(std::memory_order_relaxed);
+    while (value > current && !peak.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+    }
+}
+
+} // namespace
+
+WebSocketBroadcaster::WebSocketBroadcaster(protocols::WebSocketDeflateStats& deflate_stats)
+    : deflate_stats_(deflate_stats) {
+}
+
+bool WebSocketBroadcaster::admit(const TcpConnectionPtr& conn, WebSocketConsumer& consumer, std::size_t frame_bytes,
+                                 WebSocketEventClass event_class) {
+    if (consumer.closing.load(std::memory_order_relaxed)) {
+        return false;
+    }
+    const std::size_t queued = conn->queuedBytes();
+    if (event_class == WebSocketEventClass::kDroppable && policy_.soft_queue_bytes > 0 &&
+        queued >= policy_.soft_queue_bytes) {
+        consumer.dropped.fetch_add(1, std::memory_order_relaxed);
+        consumer.queued_bytes.store(queued, std::memory_order_relaxed);
+        stats_.dropped++;
+        return false;
+    }
+    if (policy_.hard_queue_bytes > 0 && queued + frame_bytes > policy_.hard_queue_bytes) {
+        consumer.closing.store(true, std::memory_order_relaxed);
+        consumer.queued_bytes.store(queued, std::memory_order_relaxed);
+        stats_.slow_closes++;
+        LOG_WARN("WebSocket 慢连接 {} 积压 {} 字节，关闭连接", conn->name(), queued);
+
+        uint16_t code = static_cast<uint16_t>(protocols::WebSocketCloseCode::POLICY_VIOLATION);
+        std::string close_payload{static_cast<char>(code >> 8), static_cast<char>(code & 0xff)};
+        close_payload += "slow consumer";
+        // Queued behind the backlog: a peer that catches up still sees an orderly close. shutdown()
+        // stops anything further from being queued; the timer covers peers that never drain
+        conn->send(encodeFrame(protocols::WebSocketOpcode::CLOSE, close_payload, false));
+        conn->shutdown();
+        std::weak_ptr<TcpConnection> weak_conn = conn;
+        conn->getLoop()->runAfter(policy_.close_grace_seconds, [weak_conn]() {
+            if (auto conn = weak_conn.lock()) {
+                conn->forceClose();
+            }
+        });
+        return false;
+    }
+    const uint64_t after = queued + frame_bytes;
+    consumer.queued_bytes.store(after, std::memory_order_relaxed);
+    raisePeak(consumer.peak_queued_bytes, after);
+    return true;
+}
+
+std::string WebSocketBroadcaster::encodeFrame(protocols::WebSocketOpcode opcode, std::string_view payload,
+                                              bool compressed) {
+    protocols::WebSocketFrame frame;
+    frame.fin = true;
+    frame.opcode = opcode;
+    frame.masked = false;
+    frame.payload = payload;
+    frame.rsv1 = compressed;
+    auto data = protocols::WebSocketCodec::buildFrame(frame);
+    return std::string(data.begin(), data.end());
+}
+
+void WebSocketBroadcaster::broadcast(std::vector<Recipient> recipients, protocols::WebSocketOpcode opcode,
+                                     const std::string& payload, std::size_t min_compress_bytes, int level,
+                                     WebSocketEventClass event_class) {
+    if (recipients.empty()) {
+        return;
+    }
+    stats_.broadcasts++;
+    const bool compressible = payload.size() >= min_compress_bytes;
+
+    auto batch = std::make_shared<BroadcastBatch>();
+    batch->opcode = opcode;
+    // IO threads are few; a linear scan beats hashing for the handful of groups
+    std::vector<std::pair<EventLoop*, std::vector<Delivery>>> groups;
+    std::size_t last_group = 0;
+
+    for (auto& recipient : recipients) {
+        SharedFrame frame;
+        std::shared_ptr<protocols::WebSocketDeflate> deflate;
+        if (compressible && recipient.deflate && recipient.deflate->stateless()) {
+            // No-context-takeover output depends only on (window bits, memLevel); compress once per distinct pair
+            const auto& params = recipient.deflate->params();
+            auto key = std::make_pair(params.server_max_window_bits, params.mem_level);
+            auto it = batch->shared.find(key);
+            if (it == batch->shared.end()) {
+                std::string compressed;
+                if (protocols::WebSocketDeflate::compressStateless(params, level, payload, compressed)) {
+                    deflate_stats_.compressions++;
+                    deflate_stats_.bytes_in += payload.size();
+                    deflate_stats_.bytes_out += compressed.size();
+                    it = batch->shared.emplace(key, std::make_shared<const std::string>(
+                                                        encodeFrame(opcode, compressed, true))).first;
+                }
+            }
+            if (it != batch->shared.end()) {
+                deflate_stats_.messages_out++;
+                frame = it->second;
+            }
+        } else if (compressible && recipient.deflate) {
+            if (batch->payload.empty()) {
+                batch->payload = payload;
+            }
+            deflate = std::move(recipient.deflate);
+        }
+        if (!frame && !deflate) {
+            if (!batch->plain) {
+                batch->plain = std::make_shared<const std::string>(encodeFrame(opcode, payload, false));
+            }
+            frame = batch->plain;
+        }
+
+        EventLoop* loop = recipient.conn->getLoop();
+        if (last_group >= groups.size() || groups[last_group].first != loop) {
+            last_group = 0;
+            while (last_group < groups.size() && groups[last_group].first != loop) {
+                ++last_group;
+            }
+            if (last_group == groups.size()) {
+                groups.emplace_back(loop, std::vector<Delivery>());
+            }
+        }
+        groups[last_group].second.push_back(
+            Delivery{std::move(recipient.conn), frame, std::move(deflate), std::move(recipient.consumer)});
+    }
+
+    // One task per IO loop carrying the shared batch; runs inline when the caller already owns that loop
+    std::shared_ptr<const BroadcastBatch> shared_batch = std::move(batch);
+    for (auto& [loop, deliveries] : groups) {
+        stats_.loop_tasks++;
+        loop->runInLoop([this, shared_batch, event_class, deliveries = std::move(deliveries)]() {
+            std::string compressed;
+            std::size_t delivered = 0;
+            for (const auto& delivery : deliveries) {
+                // Decided before compressing: skipping a message after it entered the LZ77 window would
+                // desynchronize a context-takeover stream
+                std::size_t frame_bytes = delivery.frame ? delivery.frame->size() : shared_batch->payload.size();
+                if (delivery.consumer && !admit(delivery.conn, *delivery.consumer, frame_bytes, event_class)) {
+                    continue;
+                }
+                ++delivered;
+                if (delivery.frame) {
+                    delivery.conn->send(delivery.frame);
+                    continue;
+                }
+                // The compressor is confined to the connection's IO thread, which also fixes the
+                // order in which compressed messages enter its LZ77 window
+                const std::string& payload = shared_batch->payload;
+                if (delivery.deflate->compress(payload, compressed)) {
+                    deflate_stats_.compressions++;
+                    deflate_stats_.messages_out++;
+                    deflate_stats_.bytes_in += payload.size();
+                    deflate_stats_.bytes_out += compressed.size();
+                    delivery.conn->send(encodeFrame(shared_batch->opcode, compressed, true));
+                } else {
+                    delivery.conn->send(encodeFrame(shared_batch->opcode, payload, false));
+                }
+            }
+            stats_.deliveries += delivered;
+        });
+    }
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "net/callbacks.h"
+#include "websocket/websocket_codec.h"
+#include "websocket/websocket_deflate.h"
+
+/**
+ * @brief WebSocket 广播统计
+ */
+struct WebSocketBroadcastStats {
+    std::atomic<uint64_t> broadcasts{0};  ///< 广播（含单播）次数
+    std::atomic<uint64_t> loop_tasks{0};  ///< 投递到IO线程的扇出任务数（每次广播每个IO线程一个）
+    std::atomic<uint64_t> deliveries{0};  ///< 写入接收方连接的帧数
+    std::atomic<uint64_t> dropped{0};     ///< 因接收方积压而丢弃的可丢弃事件数
+    std::atomic<uint64_t> slow_closes{0}; ///< 积压超过硬上限而被关闭的连接数
+};
+
+/**
+ * @brief 广播事件类别
+ */
+enum class WebSocketEventClass {
+    kReliable,   ///< 聊天消息等：只要连接未超过硬上限就一定入队
+    kDroppable   ///< 在线状态、输入提示等：接收方积压超过软上限时直接丢弃
+};
+
+/**
+ * @brief 慢连接处理策略
+ */
+struct WebSocketSendPolicy {
+    std::size_t soft_queue_bytes = 0;    ///< 待发字节达到该值时丢弃可丢弃事件，0 为不丢弃
+    std::size_t hard_queue_bytes = 0;    ///< 入队后待发字节超过该值时以 1008 关闭连接，0 为不限制
+    double close_grace_seconds = 5.0;    ///< 发出关闭帧后等待对端的时间，超时强制断开
+};
+
+/**
+ * @brief 单个 WebSocket 连接的积压状态
+ *
+ * 由连接上下文持有；计数在连接的IO线程中更新，可在任意线程读取（调试视图）。
+ */
+struct WebSocketConsumer {
+    std::atomic<uint64_t> queued_bytes{0};       ///< 最近一次投递后的待发字节数，写完时清零
+    std::atomic<uint64_t> peak_queued_bytes{0};  ///< 待发字节数峰值
+    std::atomic<uint64_t> dropped{0};            ///< 丢弃的可丢弃事件数
+    std::atomic<bool> closing{false};            ///< 已因积压发出关闭帧，不再投递
+};
+
+/**
+ * @brief WebSocket 消息扇出引擎
+ *
+ * 每条消息只编码一次：未压缩帧与无上下文接管连接的压缩帧（按协商参数区分）
+ * 放进一个共享的不可变批次里；接收方按所属IO线程分组，每个IO线程只投递一个任务，
+ * 任务在IO线程内直接把共享帧写入各连接，不再为每个接收方复制帧、单独唤醒IO线程。
+ * 保留上下文接管的连接压缩器状态各不相同，在同一个任务中逐个压缩，
+ * 压缩顺序因此与该连接的发送顺序一致。
+ * 投递前检查接收方积压（WebSocketSendPolicy）：超过软上限的连接跳过可丢弃事件，
+ * 超过硬上限的连接收到 1008 关闭帧并在宽限期后被强制断开。检查先于逐连接压缩，
+ * 丢弃不会破坏保留上下文的压缩流。
+ * broadcast() 线程安全，调用方不应持有自己的锁。
+ */
+class WebSocketBroadcaster {
+public:
+    struct Recipient {
+        TcpConnectionPtr conn;
+        std::shared_ptr<protocols::WebSocketDeflate> deflate; ///< 未协商压缩时为空
+        std::shared_ptr<WebSocketConsumer> consumer;          ///< 为空时不做积压检查
+    };
+
+    /**
+     * @param deflate_stats 压缩统计（由调用方持有，生命周期长于本对象）
+     */
+    explicit WebSocketBroadcaster(protocols::WebSocketDeflateStats& deflate_stats);
+
+    /**
+     * @brief 设置慢连接处理策略，必须在第一次广播之前调用
+     */
+    void setSendPolicy(const WebSocketSendPolicy& policy) { policy_ = policy; }
+
+    /**
+     * @brief 构建一个服务端到客户端的完整数据帧（不带掩码）
+     * @param compressed 负载是否为 permessage-deflate 压缩数据（置 RSV1）
+     */
+    static std::string encodeFrame(protocols::WebSocketOpcode opcode, std::string_view payload, bool compressed);
+
+    /**
+     * @brief 向一组连接发送同一条消息
+     * @param min_compress_bytes 小于该长度的负载不压缩
+     * @param level zlib 压缩级别
+     * @param event_class 事件类别，决定积压连接上是否可以丢弃
+     */
+    void broadcast(std::vector<Recipient> recipients, protocols::WebSocketOpcode opcode, const std::string& payload,
+                   std::size_t min_compress_bytes, int level,
+                   WebSocketEventClass event_class = WebSocketEventClass::kReliable);
+
+    const WebSocketBroadcastStats& stats() const { return stats_; }
+
+private:
+    /**
+     * @brief 在接收方IO线程中按积压决定是否投递，必要时发起关闭
+     * @param frame_bytes 将要入队的帧大小（逐连接压缩时为负载大小的估计）
+     */
+    bool admit(const TcpConnectionPtr& conn, WebSocketConsumer& consumer, std::size_t frame_bytes,
+               WebSocketEventClass event_class);
+
+    protocols::WebSocketDeflateStats& deflate_stats_;
+    WebSocketBroadcastStats stats_;
+    WebSocketSendPolicy policy_;
+};
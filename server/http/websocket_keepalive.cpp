@@ -0,0 +1,203 @@
+#include "http/websocket_keepalive.h"
+#include "http/websocket_broadcaster.h"
+#include "net/event_loop.h"
+#include "net/tcp_connection.h"
+
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <random>
+
+namespace {
+
+// Enough slots that a reconnect storm is spread thin, few enough that ticks stay coarse
+constexpr std::size_t kWheelSlots = 16;
+
+int64_t nowMicros() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+std::size_t randomSlot() {
+    thread_local std::minstd_rand rng(std::random_device{}());
+    return std::uniform_int_distribution<std::size_t>(0, kWheelSlots - 1)(rng);
+}
+
+} // namespace
+
+double WebSocketKeepaliveStats::bucketBound(std::size_t i) {
+    if (i + 1 >= kRttBuckets) {
+        return std::numeric_limits<double>::infinity();
+    }
+    return kRttFirstBound * std::pow(2.0, static_cast<double>(i) / 2.0);
+}
+
+double WebSocketKeepaliveStats::rttQuantile(WebSocketClientClass cls, double q) const {
+    const Rtt& h = rtt[static_cast<std::size_t>(cls)];
+    std::array<uint64_t, kRttBuckets> counts;
+    uint64_t total = 0;
+    for (std::size_t i = 0; i < kRttBuckets; ++i) {
+        counts[i] = h.buckets[i].load(std::memory_order_relaxed);
+        total += counts[i];
+    }
+    if (total == 0) {
+        return 0.0;
+    }
+    const double target = q * static_cast<double>(total);
+    uint64_t cumulative = 0;
+    for (std::size_t i = 0; i < kRttBuckets; ++i) {
+        if (counts[i] == 0) {
+            continue;
+        }
+        uint64_t before = cumulative;
+        cumulative += counts[i];
+        if (static_cast<double>(cumulative) >= target) {
+            double lower = i == 0 ? 0.0 : bucketBound(i - 1);
+            double upper = bucketBound(i);
+            if (std::isinf(upper)) {
+                return lower;
+            }
+            // Assume samples are spread evenly inside the bucket
+            double fraction = (target - static_cast<double>(before)) / static_cast<double>(counts[i]);
+            return lower + (upper - lower) * fraction;
+        }
+    }
+    return bucketBound(kRttBuckets - 2);
+}
+
+WebSocketKeepalive::WebSocketKeepalive(double interval_seconds, int max_missed)
+    : interval_seconds_(interval_seconds), max_missed_(max_missed), slot_count_(kWheelSlots) {
+}
+
+const char* WebSocketKeepalive::className(WebSocketClientClass cls) {
+    switch (cls) {
+        case WebSocketClientClass::kWeb:
+            return "web";
+        case WebSocketClientClass::kMobile:
+            return "mobile";
+        default:
+            return "other";
+    }
+}
+
+WebSocketClientClass WebSocketKeepalive::classify(std::string_view client_param, std::string_view user_agent) {
+    if (client_param == "web") {
+        return WebSocketClientClass::kWeb;
+    }
+    if (client_param == "mobile") {
+        return WebSocketClientClass::kMobile;
+    }
+    if (client_param == "other") {
+        return WebSocketClientClass::kOther;
+    }
+    for (std::string_view marker : {"Mobile", "Android", "iPhone", "iPad"}) {
+        if (user_agent.find(marker) != std::string_view::npos) {
+            return WebSocketClientClass::kMobile;
+        }
+    }
+    if (user_agent.find("Mozilla/") != std::string_view::npos) {
+        return WebSocketClientClass::kWeb;
+    }
+    return WebSocketClientClass::kOther;
+}
+
+std::shared_ptr<WebSocketKeepalive::Peer> WebSocketKeepalive::track(const TcpConnectionPtr& conn,
+                                                                    WebSocketClientClass cls) {
+    EventLoop* loop = conn->getLoop();
+    std::shared_ptr<Wheel> wheel;
+    bool start_timer = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto& entry = wheels_[loop];
+        if (!entry) {
+            entry = std::make_shared<Wheel>();
+            entry->slots.resize(slot_count_);
+            start_timer = true;
+        }
+        wheel = entry;
+    }
+
+    if (start_timer) {
+        std::weak_ptr<WebSocketKeepalive> weak_self = shared_from_this();
+        loop->runEvery(interval_seconds_ / static_cast<double>(slot_count_), [weak_self, wheel]() {
+            if (auto self = weak_self.lock()) {
+                self->tick(*wheel);
+            }
+        });
+    }
+
+    auto peer = std::make_shared<Peer>();
+    peer->conn = conn;
+    peer->cls = cls;
+    // A random slot is the jitter: its first PING lands anywhere within one interval
+    wheel->slots[randomSlot()].push_back(peer);
+    stats_.tracked++;
+    return peer;
+}
+
+void WebSocketKeepalive::tick(Wheel& wheel) {
+    auto& slot = wheel.slots[wheel.cursor];
+    wheel.cursor = (wheel.cursor + 1) % wheel.slots.size();
+
+    for (std::size_t i = 0; i < slot.size();) {
+        std::shared_ptr<Peer> peer = slot[i].lock();
+        TcpConnectionPtr conn = peer ? peer->conn.lock() : nullptr;
+        bool drop = !conn || !conn->connected();
+        if (!drop && peer->outstanding_us != 0 && ++peer->missed >= max_missed_) {
+            stats_.timeouts++;
+            conn->forceClose();
+            drop = true;
+        }
+        if (drop) {
+            slot[i] = std::move(slot.back());
+            slot.pop_back();
+            stats_.tracked--;
+            continue;
+        }
+
+        int64_t now = nowMicros();
+        std::string payload(8, '\0');
+        for (int b = 0; b < 8; ++b) {
+            payload[b] = static_cast<char>((static_cast<uint64_t>(now) >> (56 - 8 * b)) & 0xff);
+        }
+        conn->send(WebSocketBroadcaster::encodeFrame(protocols::WebSocketOpcode::PING, payload, false));
+        peer->outstanding_us = now;
+        stats_.pings_sent++;
+        ++i;
+    }
+}
+
+void WebSocketKeepalive::onPong(Peer& peer, std::string_view payload) {
+    // Unsolicited PONGs (RFC 6455 5.5.3) carry their own payload and are not ours to time
+    if (payload.size() != 8) {
+        return;
+    }
+    uint64_t value = 0;
+    for (char c : payload) {
+        value = (value << 8) | static_cast<uint8_t>(c);
+    }
+    int64_t sent = static_cast<int64_t>(value);
+    int64_t now = nowMicros();
+    if (sent <= 0 || sent > now) {
+        return;
+    }
+    recordRtt(peer.cls, now - sent);
+    stats_.pongs++;
+    peer.missed = 0;
+    if (sent == peer.outstanding_us) {
+        peer.outstanding_us = 0;
+    }
+}
+
+void WebSocketKeepalive::recordRtt(WebSocketClientClass cls, int64_t micros) {
+    auto& h = stats_.rtt[static_cast<std::size_t>(cls)];
+    h.count++;
+    h.us_sum += static_cast<uint64_t>(micros);
+    double seconds = static_cast<double>(micros) / 1e6;
+    std::size_t bucket = 0;
+    while (bucket + 1 < WebSocketKeepaliveStats::kRttBuckets &&
+           seconds > WebSocketKeepaliveStats::bucketBound(bucket)) {
+        ++bucket;
+    }
+    h.buckets[bucket]++;
+}
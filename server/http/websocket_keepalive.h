@@ -0,0 +1,112 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "net/callbacks.h"
+
+class EventLoop;
+
+/**
+ * @brief WebSocket 客户端类别，用于按类别统计往返时间
+ */
+enum class WebSocketClientClass { kWeb = 0, kMobile = 1, kOther = 2 };
+
+/**
+ * @brief 服务端心跳统计
+ *
+ * 往返时间按类别记录在对数间隔的直方图中（相邻桶上界相差 √2 倍），导出时估算分位数。
+ */
+struct WebSocketKeepaliveStats {
+    static constexpr std::size_t kClassCount = 3;
+    static constexpr std::size_t kRttBuckets = 32;
+    static constexpr double kRttFirstBound = 0.00025;  ///< 第一个桶的上界（秒），最后一个桶为 +Inf
+
+    struct Rtt {
+        std::atomic<uint64_t> count{0};
+        std::atomic<uint64_t> us_sum{0};
+        std::array<std::atomic<uint64_t>, kRttBuckets> buckets{};  ///< 非累积计数
+    };
+
+    std::atomic<uint64_t> tracked{0};      ///< 当前参与心跳的连接数
+    std::atomic<uint64_t> pings_sent{0};   ///< 发出的 PING 数
+    std::atomic<uint64_t> pongs{0};        ///< 收到的有效 PONG 数
+    std::atomic<uint64_t> timeouts{0};     ///< 连续未回复而被断开的连接数
+    std::array<Rtt, kClassCount> rtt;
+
+    /// 第 i 个桶的上界（秒）
+    static double bucketBound(std::size_t i);
+    /// 估算某类别往返时间的分位数（秒），没有样本时返回 0
+    double rttQuantile(WebSocketClientClass cls, double q) const;
+};
+
+/**
+ * @brief WebSocket 服务端心跳 (RFC 6455 5.5.2)
+ *
+ * 每个IO线程一个时间轮：心跳间隔被分成固定数量的槽，定时器每次只处理一个槽。
+ * 新连接放入随机的槽，各连接的 PING 在整个间隔内均匀错开，不会在同一时刻集中发出，
+ * 每个连接每个间隔恰好被访问一次。PING 负载为发送时刻，PONG 原样带回，据此计算往返时间；
+ * 连续 max_missed 个 PING 没有回复的连接被强制关闭。
+ *
+ * track() 与 onPong() 必须在连接所属IO线程中调用。必须通过 std::make_shared 创建
+ * （定时器只持有 weak_ptr）。
+ */
+class WebSocketKeepalive : public std::enable_shared_from_this<WebSocketKeepalive> {
+public:
+    /// 单个连接的心跳状态，由连接上下文持有，时间轮只持有 weak_ptr
+    struct Peer {
+        std::weak_ptr<TcpConnection> conn;
+        WebSocketClientClass cls = WebSocketClientClass::kOther;
+        int64_t outstanding_us = 0;  ///< 尚未收到 PONG 的 PING 发送时刻，0 表示没有
+        int missed = 0;              ///< 连续未回复的 PING 数
+    };
+
+    /**
+     * @param interval_seconds 每个连接的 PING 间隔
+     * @param max_missed 连续未回复多少个 PING 后断开
+     */
+    WebSocketKeepalive(double interval_seconds, int max_missed);
+
+    static const char* className(WebSocketClientClass cls);
+    /**
+     * @brief 根据 ?client= 参数或 User-Agent 判断客户端类别
+     */
+    static WebSocketClientClass classify(std::string_view client_param, std::string_view user_agent);
+
+    /**
+     * @brief 让连接参与心跳
+     * @return 心跳状态，调用方需在连接存活期间持有
+     */
+    std::shared_ptr<Peer> track(const TcpConnectionPtr& conn, WebSocketClientClass cls);
+
+    /**
+     * @brief 处理收到的 PONG
+     */
+    void onPong(Peer& peer, std::string_view payload);
+
+    const WebSocketKeepaliveStats& stats() const { return stats_; }
+
+private:
+    struct Wheel {
+        std::vector<std::vector<std::weak_ptr<Peer>>> slots;
+        std::size_t cursor = 0;
+    };
+
+    void tick(Wheel& wheel);
+    void recordRtt(WebSocketClientClass cls, int64_t micros);
+
+    double interval_seconds_;
+    int max_missed_;
+    std::size_t slot_count_;
+
+    std::mutex mutex_;
+    std::unordered_map<EventLoop*, std::shared_ptr<Wheel>> wheels_;  ///< 只在创建时加锁，槽只在所属IO线程中访问
+    WebSocketKeepaliveStats stats_;
+};
@@ -0,0 +1,489 @@
+#include "http2/hpack.h"
+
+#include <algorithm>
+
+namespace protocols {
+
+namespace {
+
+const HpackHeader kStaticTable[HpackTable::kStaticTableSize] = {
+    {":authority", ""},
+    {":method", "GET"},
+    {":method", "POST"},
+    {":path", "/"},
+    {":path", "/index.html"},
+    {":scheme", "http"},
+    {":scheme", "https"},
+    {":status", "200"},
+    {":status", "204"},
+    {":status", "206"},
+    {":status", "304"},
+    {":status", "400"},
+    {":status", "404"},
+    {":status", "500"},
+    {"accept-charset", ""},
+    {"accept-encoding", "gzip, deflate"},
+    {"accept-language", ""},
+    {"accept-ranges", ""},
+    {"accept", ""},
+    {"access-control-allow-origin", ""},
+    {"age", ""},
+    {"allow", ""},
+    {"authorization", ""},
+    {"cache-control", ""},
+    {"content-disposition", ""},
+    {"content-encoding", ""},
+    {"content-language", ""},
+    {"content-length", ""},
+    {"content-location", ""},
+    {"content-range", ""},
+    {"content-type", ""},
+    {"cookie", ""},
+    {"date", ""},
+    {"etag", ""},
+    {"expect", ""},
+    {"expires", ""},
+    {"from", ""},
+    {"host", ""},
+    {"if-match", ""},
+    {"if-modified-since", ""},
+    {"if-none-match", ""},
+    {"if-range", ""},
+    {"if-unmodified-since", ""},
+    {"last-modified", ""},
+    {"link", ""},
+    {"location", ""},
+    {"max-forwards", ""},
+    {"proxy-authenticate", ""},
+    {"proxy-authorization", ""},
+    {"range", ""},
+    {"referer", ""},
+    {"refresh", ""},
+    {"retry-after", ""},
+    {"server", ""},
+    {"set-cookie", ""},
+    {"strict-transport-security", ""},
+    {"transfer-encoding", ""},
+    {"user-agent", ""},
+    {"vary", ""},
+    {"via", ""},
+    {"www-authenticate", ""},
+};
+
+// RFC 7541 Appendix B: code (right-aligned) and bit length for symbols 0-255; EOS (256) is 30 one-bits
+const uint32_t kHuffmanCodes[256] = {
+    0x1ff8, 0x7fffd8, 0xfffffe2, 0xfffffe3, 0xfffffe4, 0xfffffe5, 0xfffffe6, 0xfffffe7,
+    0xfffffe8, 0xffffea, 0x3ffffffc, 0xfffffe9, 0xfffffea, 0x3ffffffd, 0xfffffeb, 0xfffffec,
+    0xfffffed, 0xfffffee, 0xfffffef, 0xffffff0, 0xffffff1, 0xffffff2, 0x3ffffffe, 0xffffff3,
+    0xffffff4, 0xffffff5, 0xffffff6, 0xffffff7, 0xffffff8, 0xffffff9, 0xffffffa, 0xffffffb,
+    0x14, 0x3f8, 0x3f9, 0xffa, 0x1ff9, 0x15, 0xf8, 0x7fa,
+    0x3fa, 0x3fb, 0xf9, 0x7fb, 0xfa, 0x16, 0x17, 0x18,
+    0x0, 0x1, 0x2, 0x19, 0x1a, 0x1b, 0x1c, 0x1d,
+    0x1e, 0x1f, 0x5c, 0xfb, 0x7ffc, 0x20, 0xffb, 0x3fc,
+    0x1ffa, 0x21, 0x5d, 0x5e, 0x5f, 0x60, 0x61, 0x62,
+    0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a,
+    0x6b, 0x6c, 0x6d, 0x6e, 0x6f, 0x70, 0x71, 0x72,
+    0xfc, 0x73, 0xfd, 0x1ffb, 0x7fff0, 0x1ffc, 0x3ffc, 0x22,
+    0x7ffd, 0x3, 0x23, 0x4, 0x24, 0x5, 0x25, 0x26,
+    0x27, 0x6, 0x74, 0x75, 0x28, 0x29, 0x2a, 0x7,
+    0x2b, 0x76, 0x2c, 0x8, 0x9, 0x2d, 0x77, 0x78,
+    0x79, 0x7a, 0x7b, 0x7ffe, 0x7fc, 0x3ffd, 0x1ffd, 0xffffffc,
+    0xfffe6, 0x3fffd2, 0xfffe7, 0xfffe8, 0x3fffd3, 0x3fffd4, 0x3fffd5, 0x7fffd9,
+    0x3fffd6, 0x7fffda, 0x7fffdb, 0x7fffdc, 0x7fffdd, 0x7fffde, 0xffffeb, 0x7fffdf,
+    0xffffec, 0xffffed, 0x3fffd7, 0x7fffe0, 0xffffee, 0x7fffe1, 0x7fffe2, 0x7fffe3,
+    0x7fffe4, 0x1fffdc, 0x3fffd8, 0x7fffe5, 0x3fffd9, 0x7fffe6, 0x7fffe7, 0xffffef,
+    0x3fffda, 0x1fffdd, 0xfffe9, 0x3fffdb, 0x3fffdc, 0x7fffe8, 0x7fffe9, 0x1fffde,
+    0x7fffea, 0x3fffdd, 0x3fffde, 0xfffff0, 0x1fffdf, 0x3fffdf, 0x7fffeb, 0x7fffec,
+    0x1fffe0, 0x1fffe1, 0x3fffe0, 0x1fffe2, 0x7fffed, 0x3fffe1, 0x7fffee, 0x7fffef,
+    0xfffea, 0x3fffe2, 0x3fffe3, 0x3fffe4, 0x7ffff0, 0x3fffe5, 0x3fffe6, 0x7ffff1,
+    0x3ffffe0, 0x3ffffe1, 0xfffeb, 0x7fff1, 0x3fffe7, 0x7ffff2, 0x3fffe8, 0x1ffffec,
+    0x3ffffe2, 0x3ffffe3, 0x3ffffe4, 0x7ffffde, 0x7ffffdf, 0x3ffffe5, 0xfffff1, 0x1ffffed,
+    0x7fff2, 0x1fffe3, 0x3ffffe6, 0x7ffffe0, 0x7ffffe1, 0x3ffffe7, 0x7ffffe2, 0xfffff2,
+    0x1fffe4, 0x1fffe5, 0x3ffffe8, 0x3ffffe9, 0xffffffd, 0x7ffffe3, 0x7ffffe4, 0x7ffffe5,
+    0xfffec, 0xfffff3, 0xfffed, 0x1fffe6, 0x3fffe9, 0x1fffe7, 0x1fffe8, 0x7ffff3,
+    0x3fffea, 0x3fffeb, 0x1ffffee, 0x1ffffef, 0xfffff4, 0xfffff5, 0x3ffffea, 0x7ffff4,
+    0x3ffffeb, 0x7ffffe6, 0x3ffffec, 0x3ffffed, 0x7ffffe7, 0x7ffffe8, 0x7ffffe9, 0x7ffffea,
+    0x7ffffeb, 0xffffffe, 0x7ffffec, 0x7ffffed, 0x7ffffee, 0x7ffffef, 0x7fffff0, 0x3ffffee,
+};
+
+const uint8_t kHuffmanCodeLengths[256] = {
+    13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+    28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+    6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+    5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+    13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+    15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+    6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+    20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+    24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+    22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+    21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+    26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+    19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+    20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+    26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+};
+
+constexpr uint32_t kHuffmanEos = 0x3fffffff;
+constexpr int kHuffmanEosLength = 30;
+constexpr int kHuffmanEosSymbol = 256;
+
+/**
+ * @brief Huffman 解码树（按码表一次性构建，叶子保存符号）
+ */
+struct HuffmanTree {
+    struct Node {
+        int16_t child[2] = {-1, -1};
+        int16_t symbol = -1;
+    };
+    std::vector<Node> nodes;
+
+    HuffmanTree() {
+        nodes.reserve(2 * (kHuffmanEosSymbol + 1));
+        nodes.emplace_back();
+        for (int sym = 0; sym < 256; ++sym) {
+            insert(kHuffmanCodes[sym], kHuffmanCodeLengths[sym], sym);
+        }
+        insert(kHuffmanEos, kHuffmanEosLength, kHuffmanEosSymbol);
+    }
+
+    void insert(uint32_t code, int length, int symbol) {
+        int node = 0;
+        for (int i = length - 1; i >= 0; --i) {
+            int bit = (code >> i) & 1;
+            if (nodes[node].child[bit] < 0) {
+                nodes[node].child[bit] = static_cast<int16_t>(nodes.size());
+                nodes.emplace_back();
+            }
+            node = nodes[node].child[bit];
+        }
+        nodes[node].symbol = static_cast<int16_t>(symbol);
+    }
+};
+
+const HuffmanTree& huffmanTree() {
+    static const HuffmanTree tree;
+    return tree;
+}
+
+bool isVolatileHeader(std::string_view name) {
+    return name == "content-length" || name == "date" || name == "etag" || name == "last-modified" ||
+           name == ":path" || name == "set-cookie";
+}
+
+} // namespace
+
+// ---------------------------------------------------------------------------
+// Integers and Huffman strings
+
+void hpackEncodeInteger(std::string& out, int prefix_bits, uint8_t flags, uint64_t value) {
+    uint64_t max_prefix = (1u << prefix_bits) - 1;
+    if (value < max_prefix) {
+        out.push_back(static_cast<char>(flags | value));
+        return;
+    }
+    out.push_back(static_cast<char>(flags | max_prefix));
+    value -= max_prefix;
+    while (value >= 128) {
+        out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+bool hpackDecodeInteger(const uint8_t*& p, const uint8_t* end, int prefix_bits, uint64_t& value) {
+    if (p >= end) {
+        return false;
+    }
+    uint64_t max_prefix = (1u << prefix_bits) - 1;
+    value = *p++ & max_prefix;
+    if (value < max_prefix) {
+        return true;
+    }
+    int shift = 0;
+    while (p < end) {
+        uint8_t b = *p++;
+        value += static_cast<uint64_t>(b & 0x7f) << shift;
+        if ((b & 0x80) == 0) {
+            return value <= 0xffffffffu;
+        }
+        shift += 7;
+        if (shift > 28) {
+            return false; // Far beyond any sane length or index
+        }
+    }
+    return false;
+}
+
+std::size_t huffmanEncodedLength(std::string_view in) {
+    std::size_t bits = 0;
+    for (unsigned char c : in) {
+        bits += kHuffmanCodeLengths[c];
+    }
+    return (bits + 7) / 8;
+}
+
+void huffmanEncode(std::string_view in, std::string& out) {
+    uint64_t acc = 0;
+    int acc_bits = 0;
+    for (unsigned char c : in) {
+        acc = (acc << kHuffmanCodeLengths[c]) | kHuffmanCodes[c];
+        acc_bits += kHuffmanCodeLengths[c];
+        while (acc_bits >= 8) {
+            acc_bits -= 8;
+            out.push_back(static_cast<char>(acc >> acc_bits));
+        }
+    }
+    if (acc_bits > 0) {
+        // Pad with the most significant bits of EOS (all ones)
+        acc = (acc << (8 - acc_bits)) | (0xff >> acc_bits);
+        out.push_back(static_cast<char>(acc));
+    }
+}
+
+bool huffmanDecode(const uint8_t* data, std::size_t len, std::string& out) {
+    const HuffmanTree& tree = huffmanTree();
+    int node = 0;
+    int pending_bits = 0;      // bits consumed since the last emitted symbol
+    bool pending_ones = true;  // whether those bits are all ones (valid EOS padding)
+    for (std::size_t i = 0; i < len; ++i) {
+        for (int b = 7; b >= 0; --b) {
+            int bit = (data[i] >> b) & 1;
+            node = tree.nodes[node].child[bit];
+            if (node < 0) {
+                return false;
+            }
+            ++pending_bits;
+            pending_ones = pending_ones && bit;
+            int symbol = tree.nodes[node].symbol;
+            if (symbol >= 0) {
+                if (symbol == kHuffmanEosSymbol) {
+                    return false;
+                }
+                out.push_back(static_cast<char>(symbol));
+                node = 0;
+                pending_bits = 0;
+                pending_ones = true;
+            }
+        }
+    }
+    return pending_bits <= 7 && pending_ones;
+}
+
+// ---------------------------------------------------------------------------
+// HpackTable
+
+HpackTable::HpackTable(std::size_t max_size)
+    : size_(0), max_size_(max_size) {
+}
+
+void HpackTable::setMaxSize(std::size_t max_size) {
+    max_size_ = max_size;
+    evict(max_size_);
+}
+
+void HpackTable::evict(std::size_t target) {
+    while (size_ > target && !entries_.empty()) {
+        const HpackHeader& oldest = entries_.back();
+        size_ -= oldest.name.size() + oldest.value.size() + kEntryOverhead;
+        entries_.pop_back();
+    }
+}
+
+void HpackTable::add(std::string name, std::string value) {
+    std::size_t entry_size = name.size() + value.size() + kEntryOverhead;
+    if (entry_size > max_size_) {
+        evict(0);
+        return;
+    }
+    evict(max_size_ - entry_size);
+    entries_.push_front(HpackHeader{std::move(name), std::move(value)});
+    size_ += entry_size;
+}
+
+const HpackHeader* HpackTable::get(std::size_t index) const {
+    if (index == 0) {
+        return nullptr;
+    }
+    if (index <= kStaticTableSize) {
+        return &kStaticTable[index - 1];
+    }
+    index -= kStaticTableSize + 1;
+    return index < entries_.size() ? &entries_[index] : nullptr;
+}
+
+std::size_t HpackTable::find(std::string_view name, std::string_view value, bool& value_matched) const {
+    std::size_t name_index = 0;
+    value_matched = false;
+    for (std::size_t i = 0; i < kStaticTableSize; ++i) {
+        if (kStaticTable[i].name == name) {
+            if (kStaticTable[i].value == value) {
+                value_matched = true;
+                return i + 1;
+            }
+            if (name_index == 0) {
+                name_index = i + 1;
+            }
+        }
+    }
+    for (std::size_t i = 0; i < entries_.size(); ++i) {
+        if (entries_[i].name == name) {
+            if (entries_[i].value == value) {
+                value_matched = true;
+                return kStaticTableSize + 1 + i;
+            }
+            if (name_index == 0) {
+                name_index = kStaticTableSize + 1 + i;
+            }
+        }
+    }
+    return name_index;
+}
+
+// ---------------------------------------------------------------------------
+// HpackDecoder
+
+HpackDecoder::HpackDecoder(std::size_t max_table_size, std::size_t max_header_list_size)
+    : table_(max_table_size), max_table_size_(max_table_size), max_header_list_size_(max_header_list_size) {
+}
+
+bool HpackDecoder::readString(const uint8_t*& p, const uint8_t* end, std::string& out) {
+    if (p >= end) {
+        return false;
+    }
+    bool huffman = (*p & 0x80) != 0;
+    uint64_t len;
+    if (!hpackDecodeInteger(p, end, 7, len) || len > static_cast<uint64_t>(end - p)) {
+        return false;
+    }
+    out.clear();
+    bool ok = true;
+    if (huffman) {
+        ok = huffmanDecode(p, len, out);
+    } else {
+        out.assign(reinterpret_cast<const char*>(p), len);
+    }
+    p += len;
+    return ok;
+}
+
+bool HpackDecoder::decode(const uint8_t* data, std::size_t len, HpackHeaderList& out) {
+    const uint8_t* p = data;
+    const uint8_t* end = data + len;
+    bool header_seen = false;
+    std::size_t list_size = 0;
+    too_large_ = false;
+
+    // Counts a field against the list limit; false once over it, and the list is dropped
+    auto admit = [&](const HpackHeader& header) {
+        if (too_large_) return false;
+        list_size += header.name.size() + header.value.size() + 32;
+        if (list_size > max_header_list_size_) {
+            too_large_ = true;
+            out.clear();
+            return false;
+        }
+        return true;
+    };
+
+    while (p < end) {
+        uint8_t b = *p;
+        if (b & 0x80) {
+            // Indexed header field
+            uint64_t index;
+            if (!hpackDecodeInteger(p, end, 7, index)) return false;
+            const HpackHeader* entry = table_.get(index);
+            if (!entry) return false;
+            if (admit(*entry)) out.push_back(*entry);
+            header_seen = true;
+            continue;
+        }
+        if ((b & 0xe0) == 0x20) {
+            // Dynamic table size update, only allowed before the first field of a block
+            uint64_t size;
+            if (header_seen || !hpackDecodeInteger(p, end, 5, size) || size > max_table_size_) return false;
+            table_.setMaxSize(size);
+            continue;
+        }
+
+        bool incremental = (b & 0xc0) == 0x40;
+        int prefix = incremental ? 6 : 4;
+        uint64_t name_index;
+        if (!hpackDecodeInteger(p, end, prefix, name_index)) return false;
+
+        HpackHeader header;
+        if (name_index > 0) {
+            const HpackHeader* entry = table_.get(name_index);
+            if (!entry) return false;
+            header.name = entry->name;
+        } else if (!readString(p, end, header.name)) {
+            return false;
+        }
+        if (!readString(p, end, header.value)) return false;
+
+        if (incremental) {
+            table_.add(header.name, header.value);
+        }
+        if (admit(header)) out.push_back(std::move(header));
+        header_seen = true;
+    }
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// HpackEncoder
+
+HpackEncoder::HpackEncoder(std::size_t max_table_size)
+    : table_(max_table_size), pending_size_update_(false) {
+}
+
+void HpackEncoder::setMaxTableSize(std::size_t max_size) {
+    // Never grow beyond the default: a larger table only costs memory for our small header sets
+    max_size = std::min<std::size_t>(max_size, 4096);
+    if (max_size != table_.maxSize()) {
+        table_.setMaxSize(max_size);
+        pending_size_update_ = true;
+    }
+}
+
+void HpackEncoder::writeString(std::string& out, std::string_view str) {
+    std::size_t huffman_len = huffmanEncodedLength(str);
+    if (huffman_len < str.size()) {
+        hpackEncodeInteger(out, 7, 0x80, huffman_len);
+        huffmanEncode(str, out);
+    } else {
+        hpackEncodeInteger(out, 7, 0x00, str.size());
+        out.append(str.data(), str.size());
+    }
+}
+
+void HpackEncoder::encode(const HpackHeaderList& headers, std::string& out) {
+    if (pending_size_update_) {
+        hpackEncodeInteger(out, 5, 0x20, table_.maxSize());
+        pending_size_update_ = false;
+    }
+    for (const auto& header : headers) {
+        bool value_matched;
+        std::size_t index = table_.find(header.name, header.value, value_matched);
+        if (value_matched) {
+            hpackEncodeInteger(out, 7, 0x80, index);
+            continue;
+        }
+        bool indexing = !isVolatileHeader(header.name);
+        if (indexing) {
+            hpackEncodeInteger(out, 6, 0x40, index);
+        } else {
+            hpackEncodeInteger(out, 4, 0x00, index);
+        }
+        if (index == 0) {
+            writeString(out, header.name);
+        }
+        writeString(out, header.value);
+        if (indexing) {
+            table_.add(header.name, header.value);
+        }
+    }
+}
+
+} // namespace protocols
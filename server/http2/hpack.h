@@ -0,0 +1,161 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace protocols {
+
+/**
+ * @brief HPACK 头部字段
+ */
+struct HpackHeader {
+    std::string name;
+    std::string value;
+};
+
+using HpackHeaderList = std::vector<HpackHeader>;
+
+/**
+ * @brief HPACK 索引表（静态表 + 动态表）
+ *
+ * 索引从 1 开始：1..61 为 RFC 7541 附录 A 静态表，之后为动态表（最新插入的索引最小）。
+ * 每个条目按 name.size() + value.size() + 32 计入表大小，超过上限时淘汰最旧条目。
+ */
+class HpackTable {
+public:
+    static constexpr std::size_t kStaticTableSize = 61;
+    static constexpr std::size_t kEntryOverhead = 32;
+
+    explicit HpackTable(std::size_t max_size = 4096);
+
+    /**
+     * @brief 调整动态表容量并淘汰超出部分
+     */
+    void setMaxSize(std::size_t max_size);
+    std::size_t maxSize() const { return max_size_; }
+    std::size_t size() const { return size_; }
+    std::size_t entryCount() const { return entries_.size(); }
+
+    /**
+     * @brief 插入动态表（条目本身大于容量时清空动态表）
+     */
+    void add(std::string name, std::string value);
+
+    /**
+     * @brief 按 HPACK 索引取条目
+     * @return nullptr 表示索引越界
+     */
+    const HpackHeader* get(std::size_t index) const;
+
+    /**
+     * @brief 查找条目
+     * @param value_matched [out] 返回的索引是否名称与值都匹配
+     * @return 0 表示名称也不存在
+     */
+    std::size_t find(std::string_view name, std::string_view value, bool& value_matched) const;
+
+private:
+    void evict(std::size_t target);
+
+    std::deque<HpackHeader> entries_;   ///< front 为最新条目
+    std::size_t size_;
+    std::size_t max_size_;
+};
+
+/**
+ * @brief HPACK 头部块解码器（每个 HTTP/2 连接一个，保存对端编码器的动态表状态）
+ *
+ * 解码后的头部列表大小按 RFC 7540 6.5.2 计算（每个字段 name + value + 32 字节）。
+ * 1 字节的索引引用可以展开成一个很大的动态表条目，所以只限制头部块的编码长度不够。
+ * 超过上限后不再复制字段，但仍然解析完整个块，使动态表与对端保持同步。
+ */
+class HpackDecoder {
+public:
+    /**
+     * @param max_table_size 本端通过 SETTINGS_HEADER_TABLE_SIZE 通告的上限
+     * @param max_header_list_size 本端通过 SETTINGS_MAX_HEADER_LIST_SIZE 通告的上限
+     */
+    explicit HpackDecoder(std::size_t max_table_size = 4096,
+                          std::size_t max_header_list_size = SIZE_MAX);
+
+    /**
+     * @brief 解码一个完整的头部块
+     * @return false 表示压缩错误（连接必须以 COMPRESSION_ERROR 终止）；
+     *         头部列表超限不算压缩错误，返回 true 且 out 为空，由 headerListTooLarge() 区分
+     */
+    bool decode(const uint8_t* data, std::size_t len, HpackHeaderList& out);
+
+    /**
+     * @brief 最近一次 decode() 的头部列表是否超过上限
+     */
+    bool headerListTooLarge() const { return too_large_; }
+
+    const HpackTable& table() const { return table_; }
+
+private:
+    bool readString(const uint8_t*& p, const uint8_t* end, std::string& out);
+
+    HpackTable table_;
+    std::size_t max_table_size_;
+    std::size_t max_header_list_size_;
+    bool too_large_ = false;
+};
+
+/**
+ * @brief HPACK 头部块编码器（每个 HTTP/2 连接一个）
+ *
+ * 完全匹配静态表或动态表的字段编码为索引；其余字段带增量索引写入动态表，
+ * 使重复出现的响应头（content-type、vary 等）在后续响应中只占 1 字节。
+ * content-length、date 这类每次都变化的字段不进入动态表。
+ * 字符串在 Huffman 编码更短时使用 Huffman 编码。
+ */
+class HpackEncoder {
+public:
+    explicit HpackEncoder(std::size_t max_table_size = 4096);
+
+    /**
+     * @brief 对端 SETTINGS_HEADER_TABLE_SIZE 变化时调用，下一个头部块开头会带上表大小更新指令
+     */
+    void setMaxTableSize(std::size_t max_size);
+
+    void encode(const HpackHeaderList& headers, std::string& out);
+
+    const HpackTable& table() const { return table_; }
+
+private:
+    void writeString(std::string& out, std::string_view str);
+
+    HpackTable table_;
+    bool pending_size_update_;
+};
+
+/**
+ * @brief HPACK 整数编码（RFC 7541 5.1）
+ * @param prefix_bits 前缀位数 (1-8)
+ * @param flags 首字节高位标志
+ */
+void hpackEncodeInteger(std::string& out, int prefix_bits, uint8_t flags, uint64_t value);
+
+/**
+ * @brief HPACK 整数解码
+ * @return false 表示数据不完整或溢出
+ */
+bool hpackDecodeInteger(const uint8_t*& p, const uint8_t* end, int prefix_bits, uint64_t& value);
+
+/**
+ * @brief Huffman 编码（RFC 7541 附录 B）
+ */
+void huffmanEncode(std::string_view in, std::string& out);
+std::size_t huffmanEncodedLength(std::string_view in);
+
+/**
+ * @brief Huffman 解码
+ * @return false 表示编码非法（含 EOS 符号或填充不正确）
+ */
+bool huffmanDecode(const uint8_t* data, std::size_t len, std::string& out);
+
+} // namespace protocols
@@ -0,0 +1,825 @@
+#include "http2/http2_session.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+namespace protocols {
+
+namespace {
+
+constexpr std::size_t kFrameHeaderSize = 9;
+constexpr uint8_t kFlagEndStream = 0x1;
+constexpr uint8_t kFlagAck = 0x1;
+constexpr uint8_t kFlagEndHeaders = 0x4;
+constexpr uint8_t kFlagPadded = 0x8;
+constexpr uint8_t kFlagPriority = 0x20;
+
+constexpr uint16_t kSettingsHeaderTableSize = 0x1;
+constexpr uint16_t kSettingsEnablePush = 0x2;
+constexpr uint16_t kSettingsMaxConcurrentStreams = 0x3;
+constexpr uint16_t kSettingsInitialWindowSize = 0x4;
+constexpr uint16_t kSettingsMaxFrameSize = 0x5;
+constexpr uint16_t kSettingsMaxHeaderListSize = 0x6;
+
+uint32_t readUint32(const uint8_t* p) {
+    return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) |
+           (static_cast<uint32_t>(p[2]) << 8) | static_cast<uint32_t>(p[3]);
+}
+
+void appendUint16(std::string& out, uint16_t value) {
+    out.push_back(static_cast<char>(value >> 8));
+    out.push_back(static_cast<char>(value & 0xff));
+}
+
+void appendUint32(std::string& out, uint32_t value) {
+    out.push_back(static_cast<char>(value >> 24));
+    out.push_back(static_cast<char>((value >> 16) & 0xff));
+    out.push_back(static_cast<char>((value >> 8) & 0xff));
+    out.push_back(static_cast<char>(value & 0xff));
+}
+
+// HTTP2-Settings is base64url without padding (RFC 7540 3.2.1)
+bool base64UrlDecode(std::string_view in, std::string& out) {
+    auto value = [](char c) -> int {
+        if (c >= 'A' && c <= 'Z') return c - 'A';
+        if (c >= 'a' && c <= 'z') return c - 'a' + 26;
+        if (c >= '0' && c <= '9') return c - '0' + 52;
+        if (c == '-' || c == '+') return 62;
+        if (c == '_' || c == '/') return 63;
+        return -1;
+    };
+    while (!in.empty() && in.back() == '=') {
+        in.remove_suffix(1);
+    }
+    uint32_t acc = 0;
+    int bits = 0;
+    for (char c : in) {
+        int v = value(c);
+        if (v < 0) {
+            return false;
+        }
+        acc = (acc << 6) | static_cast<uint32_t>(v);
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            out.push_back(static_cast<char>((acc >> bits) & 0xff));
+        }
+    }
+    return true;
+}
+
+bool isConnectionSpecific(const std::string& name) {
+    return name == "connection" || name == "keep-alive" || name == "proxy-connection" ||
+           name == "transfer-encoding" || name == "upgrade";
+}
+
+} // namespace
+
+Http2Session::Http2Session(WriteCallback write, RequestCallback on_request)
+    : write_(std::move(write)),
+      on_request_(std::move(on_request)),
+      decoder_(4096, kMaxHeaderListSize) {
+}
+
+void Http2Session::start() {
+    std::string payload;
+    appendUint16(payload, kSettingsMaxConcurrentStreams);
+    appendUint32(payload, kMaxConcurrentStreams);
+    appendUint16(payload, kSettingsMaxHeaderListSize);
+    appendUint32(payload, static_cast<uint32_t>(kMaxHeaderListSize));
+    writeFrame(Http2FrameType::SETTINGS, 0, 0, payload);
+    emit();
+}
+
+bool Http2Session::startFromUpgrade(const std::string& http2_settings, HttpRequest req) {
+    std::string settings;
+    if (!base64UrlDecode(http2_settings, settings) || settings.size() % 6 != 0) {
+        return connectionError(Http2ErrorCode::PROTOCOL_ERROR);
+    }
+    if (!applySettings(reinterpret_cast<const uint8_t*>(settings.data()), settings.size())) {
+        return false;
+    }
+
+    last_stream_id_ = 1;
+    Stream& stream = streams_[1];
+    stream.send_window = peer_initial_window_;
+    stream.headers_received = true;
+    stream.request = std::move(req);
+    requestComplete(1);
+    emit();
+    return true;
+}
+
+bool Http2Session::feed(Buffer* buf) {
+    if (!preface_received_) {
+        std::size_t n = std::min(buf->readableBytes(), kPreface.size());
+        if (std::memcmp(buf->peek(), kPreface.data(), n) != 0) {
+            return connectionError(Http2ErrorCode::PROTOCOL_ERROR);
+        }
+        if (n < kPreface.size()) {
+            return true;
+        }
+        buf->retrieve(kPreface.size());
+        preface_received_ = true;
+    }
+
+    bool ok = true;
+    while (buf->readableBytes() >= kFrameHeaderSize) {
+        const uint8_t* p = reinterpret_cast<const uint8_t*>(buf->peek());
+        std::size_t len = (static_cast<std::size_t>(p[0]) << 16) | (static_cast<std::size_t>(p[1]) << 8) | p[2];
+        if (len > kDefaultMaxFrameSize) {
+            ok = connectionError(Http2ErrorCode::FRAME_SIZE_ERROR);
+            break;
+        }
+        if (buf->readableBytes() < kFrameHeaderSize + len) {
+            break;
+        }
+        uint8_t type = p[3];
+        uint8_t flags = p[4];
+        uint32_t stream_id = readUint32(p + 5) & 0x7fffffff;
+        ok = processFrame(type, flags, stream_id, p + kFrameHeaderSize, len);
+        buf->retrieve(kFrameHeaderSize + len);
+        if (!ok) {
+            break;
+        }
+    }
+
+    if (ok) {
+        flush();
+    }
+    emit();
+    return ok;
+}
+
+bool Http2Session::processFrame(uint8_t type, uint8_t flags, uint32_t stream_id,
+                                const uint8_t* payload, std::size_t len) {
+    auto frame_type = static_cast<Http2FrameType>(type);
+    // A header block must be contiguous (RFC 7540 6.10)
+    if (continuation_stream_ != 0 && frame_type != Http2FrameType::CONTINUATION) {
+        return connectionError(Http2ErrorCode::PROTOCOL_ERROR);
+    }
+    // The client preface ends with a SETTINGS frame (RFC 7540 3.5)
+    if (!settings_received_ && frame_type != Http2FrameType::SETTINGS) {
+        return connectionError(Http2ErrorCode::PROTOCOL_ERROR);
+    }
+
+    switch (frame_type) {
+    case Http2FrameType::DATA:
+        return onData(flags, stream_id, payload, len);
+    case Http2FrameType::HEADERS:
+        return onHeaders(flags, stream_id, payload, len);
+    case Http2FrameType::PRIORITY:
+        return onPriority(stream_id, payload, len);
+    case Http2FrameType::RST_STREAM:
+        return onRstStream(stream_id, payload, len);
+    case Http2FrameType::SETTINGS:
+        return onSettings(flags, stream_id, payload, len);
+    case Http2FrameType::PUSH_PROMISE:
+        // Clients never push
+        return connectionError(Http2ErrorCode::PROTOCOL_ERROR);
+    case Http2FrameType::PING:
+        return onPing(flags, stream_id, payload, len);
+    case Http2FrameType::GOAWAY:
+        return onGoaway(stream_id, len);
+    case Http2FrameType::WINDOW_UPDATE:
+        return onWindowUpdate(stream_id, payload, len);
+    case Http2FrameType::CONTINUATION:
+        return onContinuation(flags, stream_id, payload, len);
+    }
+    // Unknown frame types are ignored (RFC 7540 4.1)
+    return true;
+}
+
+bool Http2Session::onHeaders(uint8_t flags, uint32_t stream_id, const uint8_t* payload, std::size_t len) {
+    if (stream_id == 0 || stream_id % 2 == 0) {
+        return connectionError(Http2ErrorCode::PROTOCOL_ERROR);
+    }
+
+    std::size_t pad = 0;
+    if (flags & kFlagPadded) {
+        if (len < 1) {
+            return connectionError(Http2ErrorCode::FRAME_SIZE_ERROR);
+        }
+        pad = payload[0];
+        ++payload;
+        --len;
+    }
+    uint32_t dependency = 0;
+    int weight = 16;
+    bool exclusive = false;
+    if (flags & kFlagPriority) {
+        if (len < 5) {
+            return connectionError(Http2ErrorCode::FRAME_SIZE_ERROR);
+        }
+        uint32_t raw = readUint32(payload);
+        exclusive = (raw & 0x80000000u) != 0;
+        dependency = raw & 0x7fffffff;
+        weight = payload[4] + 1;
+        payload += 5;
+        len -= 5;
+    }
+    if (pad > len) {
+        return connectionError(Http2ErrorCode::PROTOCOL_ERROR);
+    }
+    len -= pad;
+
+    auto it = streams_.find(stream_id);
+    if (it == streams_.end()) {
+        if (stream_id <= last_stream_id_) {
+            return connectionError(Http2ErrorCode::STREAM_CLOSED);
+        }
+        last_stream_id_ = stream_id;
+        // Count before inserting so the new stream is not counted against itself
+        bool over_limit = streams_.size() >= kMaxConcurrentStreams;
+        Stream& stream = streams_[stream_id];
+        stream.send_window = peer_initial_window_;
+        stream.vtime = vtime_;
+        // The block is still decoded so the HPACK state stays in sync with the client
+        stream.refused = over_limit || going_away_;
+    } else if (it->second.state == StreamState::kHalfClosedRemote || it->second.state == StreamState::kClosed) {
+        return connectionError(Http2ErrorCode::STREAM_CLOSED);
+    }
+
+    if (flags & kFlagPriority) {
+        if (dependency == stream_id) {
+            return connectionError(Http2ErrorCode::PROTOCOL_ERROR);
+        }
+        setPriority(stream_id, dependency, weight, exclusive);
+    }
+
+    if (len > kMaxHeaderBlockSize) {
+        return connectionError(Http2ErrorCode::ENHANCE_YOUR_CALM);
+    }
+    header_block_.assign(reinterpret_cast<const char*>(payload), len);
+    bool end_stream = (flags & kFlagEndStream) != 0;
+    if (flags & kFlagEndHeaders) {
+        return endHeaderBlock(stream_id, end_stream);
+    }
+    continuation_stream_ = stream_id;
+    continuation_end_stream_ = end_stream;
+    return true;
+}
+
+bool Http2Session::onContinuation(uint8_t flags, uint32_t stream_id, const uint8_t* payload, std::size_t len) {
+    if (continuation_stream_ == 0 || stream_id != continuation_stream_) {
+        return connectionError(Http2ErrorCode::PROTOCOL_ERROR);
+    }
+    if (header_block_.size() + len > kMaxHeaderBlockSize) {
+        return connectionError(Http2ErrorCode::ENHANCE_YOUR_CALM);
+    }
+    header_block_.append(reinterpret_cast<const char*>(payload), len);
+    if (flags & kFlagEndHeaders) {
+        continuation_stream_ = 0;
+        return endHeaderBlock(stream_id, continuation_end_stream_);
+    }
+    return true;
+}
+
+bool Http2Session::endHeaderBlock(uint32_t stream_id, bool end_stream) {
+    HpackHeaderList headers;
+    bool decoded = decoder_.decode(reinterpret_cast<const uint8_t*>(header_block_.data()), header_block_.size(), headers);
+    header_block_.clear();
+    if (!decoded) {
+        return connectionError(Http2ErrorCode::COMPRESSION_ERROR);
+    }
+
+    auto it = streams_.find(stream_id);
+    if (it == streams_.end()) {
+        return true;
+    }
+    Stream& stream = it->second;
+    if (stream.refused) {
+        return streamError(stream_id, Http2ErrorCode::REFUSED_STREAM);
+    }
+    if (decoder_.headerListTooLarge()) {
+        // RFC 7540 10.5.1: reject with 431. If the client is still sending, reset the stream
+        // with NO_ERROR after the response so that no body is buffered
+        submitHeaders(stream_id, {{":status", "431"}, {"content-length", "0"}}, true);
+        if (end_stream) {
+            closeStream(stream_id);
+            return true;
+        }
+        return streamError(stream_id, Http2ErrorCode::NO_ERROR);
+    }
+    if (stream.headers_received) {
+        // Trailers: accepted and ignored, but they must close the request
+        if (!end_stream) {
+            return streamError(stream_id, Http2ErrorCode::PROTOCOL_ERROR);
+        }
+        requestComplete(stream_id);
+        return true;
+    }
+    stream.headers_received = true;
+
+    HttpRequest& req = stream.request;
+    bool regular_seen = false;
+    for (auto& header : headers) {
+        if (header.name.empty() ||
+            std::any_of(header.name.begin(), header.name.end(), [](char c) { return c >= 'A' && c <= 'Z'; })) {
+            return streamError(stream_id, Http2ErrorCode::PROTOCOL_ERROR);
+        }
+        if (header.name[0] == ':') {
+            if (regular_seen) {
+                return streamError(stream_id, Http2ErrorCode::PROTOCOL_ERROR);
+            }
+            if (header.name == ":method") {
+                req.method = std::move(header.value);
+            } else if (header.name == ":path") {
+                req.path = std::move(header.value);
+            } else if (header.name == ":authority") {
+                req.headers["Host"] = std::move(header.value);
+            } else if (header.name != ":scheme") {
+                return streamError(stream_id, Http2ErrorCode::PROTOCOL_ERROR);
+            }
+            continue;
+        }
+        regular_seen = true;
+        if (isConnectionSpecific(header.name) || (header.name == "te" && header.value != "trailers")) {
+            return streamError(stream_id, Http2ErrorCode::PROTOCOL_ERROR);
+        }
+        if (header.name == "content-type") {
+            req.content_type = header.value;
+        }
+        auto existing = req.headers.find(header.name);
+        if (existing == req.headers.end()) {
+            req.headers.emplace(std::move(header.name), std::move(header.value));
+        } else {
+            existing->second += header.name == "cookie" ? "; " : ", ";
+            existing->second += header.value;
+        }
+    }
+    if (req.method.empty() || req.path.empty()) {
+        return streamError(stream_id, Http2ErrorCode::PROTOCOL_ERROR);
+    }
+
+    if (end_stream) {
+        requestComplete(stream_id);
+    }
+    return true;
+}
+
+bool Http2Session::onData(uint8_t flags, uint32_t stream_id, const uint8_t* payload, std::size_t len) {
+    if (stream_id == 0) {
+        return connectionError(Http2ErrorCode::PROTOCOL_ERROR);
+    }
+    // Padding counts against flow control as well
+    std::size_t flow_len = len;
+    if (flags & kFlagPadded) {
+        if (len < 1 || payload[0] >= len) {
+            return connectionError(Http2ErrorCode::PROTOCOL_ERROR);
+        }
+        len -= 1 + payload[0];
+        ++payload;
+    }
+    // Request bodies are bounded by kMaxRequestBodySize, so receive windows are replenished right away
+    if (flow_len > 0) {
+        writeWindowUpdate(0, static_cast<uint32_t>(flow_len));
+    }
+
+    auto it = streams_.find(stream_id);
+    if (it == streams_.end()) {
+        if (stream_id > last_stream_id_) {
+            return connectionError(Http2ErrorCode::PROTOCOL_ERROR);
+        }
+        return streamError(stream_id, Http2ErrorCode::STREAM_CLOSED);
+    }
+    Stream& stream = it->second;
+    if (!stream.headers_received || stream.state == StreamState::kHalfClosedRemote ||
+        stream.state == StreamState::kClosed) {
+        return streamError(stream_id, Http2ErrorCode::STREAM_CLOSED);
+    }
+    if (stream.request.body.size() + len > kMaxRequestBodySize) {
+        return streamError(stream_id, Http2ErrorCode::ENHANCE_YOUR_CALM);
+    }
+    stream.request.body.append(reinterpret_cast<const char*>(payload), len);
+
+    if (flags & kFlagEndStream) {
+        requestComplete(stream_id);
+    } else if (flow_len > 0) {
+        writeWindowUpdate(stream_id, static_cast<uint32_t>(flow_len));
+    }
+    return true;
+}
+
+bool Http2Session::onSettings(uint8_t flags, uint32_t stream_id, const uint8_t* payload, std::size_t len) {
+    if (stream_id != 0) {
+        return connectionError(Http2ErrorCode::PROTOCOL_ERROR);
+    }
+    if (flags & kFlagAck) {
+        return len == 0 ? true : connectionError(Http2ErrorCode::FRAME_SIZE_ERROR);
+    }
+    if (len % 6 != 0) {
+        return connectionError(Http2ErrorCode::FRAME_SIZE_ERROR);
+    }
+    if (!applySettings(payload, len)) {
+        return false;
+    }
+    settings_received_ = true;
+    writeFrame(Http2FrameType::SETTINGS, kFlagAck, 0, {});
+    return true;
+}
+
+bool Http2Session::applySettings(const uint8_t* payload, std::size_t len) {
+    for (std::size_t off = 0; off + 6 <= len; off += 6) {
+        uint16_t id = static_cast<uint16_t>((payload[off] << 8) | payload[off + 1]);
+        uint32_t value = readUint32(payload + off + 2);
+        switch (id) {
+        case kSettingsHeaderTableSize:
+            encoder_.setMaxTableSize(value);
+            break;
+        case kSettingsEnablePush:
+            if (value > 1) {
+                return connectionError(Http2ErrorCode::PROTOCOL_ERROR);
+            }
+            break;
+        case kSettingsInitialWindowSize: {
+            if (value > kMaxWindowSize) {
+                return connectionError(Http2ErrorCode::FLOW_CONTROL_ERROR);
+            }
+            // The change applies to every open stream's window (RFC 7540 6.9.2)
+            int64_t delta = static_cast<int64_t>(value) - static_cast<int64_t>(peer_initial_window_);
+            for (auto& entry : streams_) {
+                entry.second.send_window += delta;
+                if (entry.second.send_window > kMaxWindowSize) {
+                    return connectionError(Http2ErrorCode::FLOW_CONTROL_ERROR);
+                }
+            }
+            peer_initial_window_ = value;
+            break;
+        }
+        case kSettingsMaxFrameSize:
+            if (value < kDefaultMaxFrameSize || value > 0xffffff) {
+                return connectionError(Http2ErrorCode::PROTOCOL_ERROR);
+            }
+            peer_max_frame_size_ = value;
+            break;
+        default:
+            // MAX_CONCURRENT_STREAMS only limits server push; unknown settings are ignored
+            break;
+        }
+    }
+    return true;
+}
+
+bool Http2Session::onWindowUpdate(uint32_t stream_id, const uint8_t* payload, std::size_t len) {
+    if (len != 4) {
+        return connectionError(Http2ErrorCode::FRAME_SIZE_ERROR);
+    }
+    uint32_t increment = readUint32(payload) & 0x7fffffff;
+    if (stream_id == 0) {
+        if (increment == 0) {
+            return connectionError(Http2ErrorCode::PROTOCOL_ERROR);
+        }
+        conn_send_window_ += increment;
+        if (conn_send_window_ > kMaxWindowSize) {
+            return connectionError(Http2ErrorCode::FLOW_CONTROL_ERROR);
+        }
+        return true;
+    }
+
+    auto it = streams_.find(stream_id);
+    if (it == streams_.end()) {
+        return stream_id > last_stream_id_ ? connectionError(Http2ErrorCode::PROTOCOL_ERROR) : true;
+    }
+    if (increment == 0) {
+        return streamError(stream_id, Http2ErrorCode::PROTOCOL_ERROR);
+    }
+    it->second.send_window += increment;
+    if (it->second.send_window > kMaxWindowSize) {
+        return streamError(stream_id, Http2ErrorCode::FLOW_CONTROL_ERROR);
+    }
+    return true;
+}
+
+bool Http2Session::onPriority(uint32_t stream_id, const uint8_t* payload, std::size_t len) {
+    if (stream_id == 0) {
+        return connectionError(Http2ErrorCode::PROTOCOL_ERROR);
+    }
+    if (len != 5) {
+        return streamError(stream_id, Http2ErrorCode::FRAME_SIZE_ERROR);
+    }
+    uint32_t raw = readUint32(payload);
+    uint32_t dependency = raw & 0x7fffffff;
+    if (dependency == stream_id) {
+        return streamError(stream_id, Http2ErrorCode::PROTOCOL_ERROR);
+    }
+    // Priorities of idle and closed streams are not retained
+    if (streams_.count(stream_id) != 0) {
+        setPriority(stream_id, dependency, payload[4] + 1, (raw & 0x80000000u) != 0);
+    }
+    return true;
+}
+
+void Http2Session::setPriority(uint32_t stream_id, uint32_t parent, int weight, bool exclusive) {
+    auto self = streams_.find(stream_id);
+    if (self == streams_.end()) {
+        return;
+    }
+    if (parent != 0 && streams_.find(parent) == streams_.end()) {
+        // Dependency on a stream not in the tree gets the default priority (RFC 7540 5.3.1)
+        parent = 0;
+        weight = 16;
+    }
+
+    // Depending on one of our own descendants: move that descendant up first (RFC 7540 5.3.3)
+    if (parent != 0) {
+        for (uint32_t cur = streams_[parent].parent; cur != 0;) {
+            if (cur == stream_id) {
+                streams_[parent].parent = self->second.parent;
+                break;
+            }
+            auto up = streams_.find(cur);
+            if (up == streams_.end()) {
+                break;
+            }
+            cur = up->second.parent;
+        }
+    }
+    if (exclusive) {
+        for (auto& entry : streams_) {
+            if (entry.first != stream_id && entry.second.parent == parent) {
+                entry.second.parent = stream_id;
+            }
+        }
+    }
+    self->second.parent = parent;
+    self->second.weight = weight;
+}
+
+bool Http2Session::onRstStream(uint32_t stream_id, const uint8_t* payload, std::size_t len) {
+    (void)payload;
+    if (stream_id == 0) {
+        return connectionError(Http2ErrorCode::PROTOCOL_ERROR);
+    }
+    if (len != 4) {
+        return connectionError(Http2ErrorCode::FRAME_SIZE_ERROR);
+    }
+    if (streams_.count(stream_id) == 0) {
+        return stream_id > last_stream_id_ ? connectionError(Http2ErrorCode::PROTOCOL_ERROR) : true;
+    }
+    closeStream(stream_id);
+    return true;
+}
+
+bool Http2Session::onPing(uint8_t flags, uint32_t stream_id, const uint8_t* payload, std::size_t len) {
+    if (stream_id != 0) {
+        return connectionError(Http2ErrorCode::PROTOCOL_ERROR);
+    }
+    if (len != 8) {
+        return connectionError(Http2ErrorCode::FRAME_SIZE_ERROR);
+    }
+    if (!(flags & kFlagAck)) {
+        writeFrame(Http2FrameType::PING, kFlagAck, 0,
+                   std::string_view(reinterpret_cast<const char*>(payload), len));
+    }
+    return true;
+}
+
+bool Http2Session::onGoaway(uint32_t stream_id, std::size_t len) {
+    if (stream_id != 0) {
+        return connectionError(Http2ErrorCode::PROTOCOL_ERROR);
+    }
+    if (len < 8) {
+        return connectionError(Http2ErrorCode::FRAME_SIZE_ERROR);
+    }
+    // Streams already accepted are still answered
+    going_away_ = true;
+    return true;
+}
+
+void Http2Session::requestComplete(uint32_t stream_id) {
+    auto it = streams_.find(stream_id);
+    if (it == streams_.end()) {
+        return;
+    }
+    it->second.state = StreamState::kHalfClosedRemote;
+    HttpRequest req = std::move(it->second.request);
+    // The callback may respond synchronously; no iterator is used after it
+    on_request_(stream_id, std::move(req));
+}
+
+void Http2Session::finishLocal(uint32_t stream_id) {
+    auto it = streams_.find(stream_id);
+    if (it == streams_.end()) {
+        return;
+    }
+    if (it->second.state == StreamState::kHalfClosedRemote) {
+        closeStream(stream_id);
+    } else {
+        it->second.state = StreamState::kHalfClosedLocal;
+    }
+}
+
+void Http2Session::closeStream(uint32_t stream_id) {
+    auto it = streams_.find(stream_id);
+    if (it == streams_.end()) {
+        return;
+    }
+    uint32_t parent = it->second.parent;
+    for (auto& entry : streams_) {
+        if (entry.second.parent == stream_id) {
+            entry.second.parent = parent;
+        }
+    }
+    streams_.erase(it);
+}
+
+bool Http2Session::streamError(uint32_t stream_id, Http2ErrorCode code) {
+    std::string payload;
+    appendUint32(payload, static_cast<uint32_t>(code));
+    writeFrame(Http2FrameType::RST_STREAM, 0, stream_id, payload);
+    closeStream(stream_id);
+    return true;
+}
+
+bool Http2Session::connectionError(Http2ErrorCode code) {
+    std::string payload;
+    appendUint32(payload, last_stream_id_);
+    appendUint32(payload, static_cast<uint32_t>(code));
+    writeFrame(Http2FrameType::GOAWAY, 0, 0, payload);
+    going_away_ = true;
+    emit();
+    return false;
+}
+
+void Http2Session::submitHeaders(uint32_t stream_id, const HpackHeaderList& headers, bool end_stream) {
+    auto it = streams_.find(stream_id);
+    if (it == streams_.end() || it->second.state == StreamState::kHalfClosedLocal ||
+        it->second.state == StreamState::kClosed) {
+        return;
+    }
+
+    std::string block;
+    encoder_.encode(headers, block);
+    std::string_view rest(block);
+    bool first = true;
+    do {
+        std::string_view chunk = rest.substr(0, peer_max_frame_size_);
+        rest.remove_prefix(chunk.size());
+        uint8_t flags = rest.empty() ? kFlagEndHeaders : 0;
+        if (first) {
+            if (end_stream) {
+                flags |= kFlagEndStream;
+            }
+            writeFrame(Http2FrameType::HEADERS, flags, stream_id, chunk);
+            first = false;
+        } else {
+            writeFrame(Http2FrameType::CONTINUATION, flags, stream_id, chunk);
+        }
+    } while (!rest.empty());
+
+    if (end_stream) {
+        finishLocal(stream_id);
+    }
+    flush();
+    emit();
+}
+
+void Http2Session::submitData(uint32_t stream_id, std::string data, bool end_stream) {
+    auto it = streams_.find(stream_id);
+    if (it == streams_.end() || !isStreamWritable(stream_id)) {
+        return;
+    }
+    Stream& stream = it->second;
+    if (!data.empty()) {
+        // A stream that was idle rejoins the schedule at the current virtual time
+        if (stream.pending_bytes == 0) {
+            stream.vtime = std::max(stream.vtime, vtime_);
+        }
+        stream.pending_bytes += data.size();
+        stream.pending.push_back(std::move(data));
+    }
+    stream.end_queued = end_stream;
+    flush();
+    emit();
+}
+
+void Http2Session::resetStream(uint32_t stream_id, Http2ErrorCode code) {
+    if (streams_.count(stream_id) == 0) {
+        return;
+    }
+    streamError(stream_id, code);
+    emit();
+}
+
+bool Http2Session::isStreamWritable(uint32_t stream_id) const {
+    auto it = streams_.find(stream_id);
+    return it != streams_.end() && !it->second.end_queued &&
+           it->second.state != StreamState::kHalfClosedLocal && it->second.state != StreamState::kClosed;
+}
+
+std::size_t Http2Session::pendingBytes(uint32_t stream_id) const {
+    auto it = streams_.find(stream_id);
+    return it == streams_.end() ? 0 : it->second.pending_bytes;
+}
+
+bool Http2Session::hasSendable(const Stream& stream) const {
+    if (stream.pending_bytes == 0) {
+        return stream.end_queued;
+    }
+    return stream.send_window > 0 && conn_send_window_ > 0;
+}
+
+uint32_t Http2Session::pickStream() const {
+    uint32_t best = 0;
+    uint64_t best_vtime = 0;
+    for (const auto& [id, stream] : streams_) {
+        if (!hasSendable(stream)) {
+            continue;
+        }
+        // A dependent stream only gets bandwidth when none of its ancestors can use it
+        bool blocked = false;
+        for (uint32_t p = stream.parent; p != 0;) {
+            auto it = streams_.find(p);
+            if (it == streams_.end()) {
+                break;
+            }
+            if (hasSendable(it->second)) {
+                blocked = true;
+                break;
+            }
+            p = it->second.parent;
+        }
+        if (!blocked && (best == 0 || stream.vtime < best_vtime)) {
+            best = id;
+            best_vtime = stream.vtime;
+        }
+    }
+    return best;
+}
+
+void Http2Session::flush() {
+    std::vector<uint32_t> drained;
+    while (uint32_t stream_id = pickStream()) {
+        Stream& stream = streams_[stream_id];
+        if (stream.pending_bytes == 0) {
+            writeFrame(Http2FrameType::DATA, kFlagEndStream, stream_id, {});
+            finishLocal(stream_id);
+            continue;
+        }
+
+        std::size_t n = std::min<int64_t>({static_cast<int64_t>(stream.pending_bytes),
+                                           static_cast<int64_t>(peer_max_frame_size_),
+                                           stream.send_window, conn_send_window_});
+        std::string payload;
+        payload.reserve(n);
+        while (payload.size() < n) {
+            std::string& front = stream.pending.front();
+            std::size_t take = std::min(n - payload.size(), front.size() - stream.pending_offset);
+            payload.append(front, stream.pending_offset, take);
+            stream.pending_offset += take;
+            if (stream.pending_offset == front.size()) {
+                stream.pending.pop_front();
+                stream.pending_offset = 0;
+            }
+        }
+        stream.pending_bytes -= n;
+        stream.send_window -= static_cast<int64_t>(n);
+        conn_send_window_ -= static_cast<int64_t>(n);
+        stream.vtime += n * 256 / static_cast<uint64_t>(stream.weight);
+        vtime_ = std::max(vtime_, stream.vtime);
+
+        bool last = stream.pending_bytes == 0 && stream.end_queued;
+        writeFrame(Http2FrameType::DATA, last ? kFlagEndStream : 0, stream_id, payload);
+        if (last) {
+            finishLocal(stream_id);
+        } else if (stream.pending_bytes == 0) {
+            drained.push_back(stream_id);
+        }
+    }
+
+    if (on_drain_) {
+        for (uint32_t stream_id : drained) {
+            on_drain_(stream_id);
+        }
+    }
+}
+
+void Http2Session::writeFrame(Http2FrameType type, uint8_t flags, uint32_t stream_id, std::string_view payload) {
+    std::size_t len = payload.size();
+    out_.push_back(static_cast<char>((len >> 16) & 0xff));
+    out_.push_back(static_cast<char>((len >> 8) & 0xff));
+    out_.push_back(static_cast<char>(len & 0xff));
+    out_.push_back(static_cast<char>(type));
+    out_.push_back(static_cast<char>(flags));
+    appendUint32(out_, stream_id & 0x7fffffff);
+    out_.append(payload.data(), payload.size());
+}
+
+void Http2Session::writeWindowUpdate(uint32_t stream_id, uint32_t increment) {
+    std::string payload;
+    appendUint32(payload, increment & 0x7fffffff);
+    writeFrame(Http2FrameType::WINDOW_UPDATE, 0, stream_id, payload);
+}
+
+void Http2Session::emit() {
+    if (out_.empty()) {
+        return;
+    }
+    std::string data;
+    data.swap(out_);
+    write_(data);
+}
+
+} // namespace protocols
@@ -0,0 +1,215 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <string>
+#include <string_view>
+#include "http/http_codec.h"
+#include "http2/hpack.h"
+
+namespace protocols {
+
+/**
+ * @brief HTTP/2 帧类型 (RFC 7540 6)
+ */
+enum class Http2FrameType : uint8_t {
+    DATA = 0x0,
+    HEADERS = 0x1,
+    PRIORITY = 0x2,
+    RST_STREAM = 0x3,
+    SETTINGS = 0x4,
+    PUSH_PROMISE = 0x5,
+    PING = 0x6,
+    GOAWAY = 0x7,
+    WINDOW_UPDATE = 0x8,
+    CONTINUATION = 0x9
+};
+
+/**
+ * @brief HTTP/2 错误码 (RFC 7540 7)
+ */
+enum class Http2ErrorCode : uint32_t {
+    NO_ERROR = 0x0,
+    PROTOCOL_ERROR = 0x1,
+    INTERNAL_ERROR = 0x2,
+    FLOW_CONTROL_ERROR = 0x3,
+    SETTINGS_TIMEOUT = 0x4,
+    STREAM_CLOSED = 0x5,
+    FRAME_SIZE_ERROR = 0x6,
+    REFUSED_STREAM = 0x7,
+    CANCEL = 0x8,
+    COMPRESSION_ERROR = 0x9,
+    CONNECT_ERROR = 0xa,
+    ENHANCE_YOUR_CALM = 0xb,
+    INADEQUATE_SECURITY = 0xc,
+    HTTP_1_1_REQUIRED = 0xd
+};
+
+/**
+ * @brief HTTP/2 (h2c) 服务端连接会话
+ *
+ * 负责一个连接上的帧解析、HPACK 编解码、流状态、流量控制与优先级调度，
+ * 与传输层解耦：输入通过 feed() 喂入，输出通过 WriteCallback 写出。
+ * 非线程安全，只能在连接所属IO线程中使用。
+ *
+ * 发送调度：响应数据先进入各流的待发送队列，在连接窗口与流窗口允许的范围内按
+ * RFC 7540 5.3 的依赖树与权重选择下一个流——只有祖先流都没有待发送数据的流才可发送，
+ * 同层之间按 已发送字节/权重 的虚拟时间做加权公平调度。
+ */
+class Http2Session {
+public:
+    /// 客户端连接前言
+    static constexpr std::string_view kPreface{"PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"};
+    static constexpr uint32_t kDefaultWindowSize = 65535;
+    static constexpr uint32_t kMaxWindowSize = 0x7fffffff;
+    static constexpr uint32_t kDefaultMaxFrameSize = 16384;
+    static constexpr uint32_t kMaxConcurrentStreams = 100;
+    static constexpr std::size_t kMaxHeaderBlockSize = 64 * 1024;
+    /// 解码后的头部列表上限（SETTINGS_MAX_HEADER_LIST_SIZE），超出的请求以 431 拒绝
+    static constexpr std::size_t kMaxHeaderListSize = 64 * 1024;
+    static constexpr std::size_t kMaxRequestBodySize = 8 * 1024 * 1024;
+
+    using WriteCallback = std::function<void(const std::string& data)>;
+    /// 请求（头部与请求体）接收完整后调用
+    using RequestCallback = std::function<void(uint32_t stream_id, HttpRequest req)>;
+    /// 流的待发送数据全部写出（但流尚未结束）时调用，用于驱动流式响应生产下一块
+    using DrainCallback = std::function<void(uint32_t stream_id)>;
+
+    Http2Session(WriteCallback write, RequestCallback on_request);
+
+    void setDrainCallback(DrainCallback cb) { on_drain_ = std::move(cb); }
+
+    /**
+     * @brief 发送服务端 SETTINGS，开始等待客户端前言
+     */
+    void start();
+
+    /**
+     * @brief 通过 HTTP/1.1 Upgrade: h2c 建立会话
+     *
+     * 应用 HTTP2-Settings 头中的客户端设置，并把升级请求作为流 1（对端已半关闭）交给请求回调。
+     * 必须在 start() 之后调用。
+     * @return false 表示 HTTP2-Settings 非法
+     */
+    bool startFromUpgrade(const std::string& http2_settings, HttpRequest req);
+
+    /**
+     * @brief 处理输入数据，消费所有完整的帧
+     * @return false 表示发生连接错误（GOAWAY 已写出），调用方应关闭连接
+     */
+    bool feed(Buffer* buf);
+
+    /**
+     * @brief 发送响应头
+     * @param end_stream 为 true 时表示没有响应体
+     */
+    void submitHeaders(uint32_t stream_id, const HpackHeaderList& headers, bool end_stream);
+
+    /**
+     * @brief 追加响应体数据（受流量控制，可能延后发送）
+     */
+    void submitData(uint32_t stream_id, std::string data, bool end_stream);
+
+    /**
+     * @brief 以错误码重置流
+     */
+    void resetStream(uint32_t stream_id, Http2ErrorCode code);
+
+    /**
+     * @brief 流是否仍可发送数据
+     */
+    bool isStreamWritable(uint32_t stream_id) const;
+
+    /**
+     * @brief 流尚未写出的数据字节数
+     */
+    std::size_t pendingBytes(uint32_t stream_id) const;
+
+    /**
+     * @brief 对端是否已发送 GOAWAY 或本端已因错误终止连接
+     */
+    bool goingAway() const { return going_away_; }
+
+    std::size_t streamCount() const { return streams_.size(); }
+    const HpackEncoder& encoder() const { return encoder_; }
+    const HpackDecoder& decoder() const { return decoder_; }
+
+private:
+    enum class StreamState { kOpen, kHalfClosedRemote, kHalfClosedLocal, kClosed };
+
+    struct Stream {
+        StreamState state = StreamState::kOpen;
+        int64_t send_window = kDefaultWindowSize;
+        HttpRequest request;
+        std::deque<std::string> pending;   ///< 待发送的响应体片段
+        std::size_t pending_bytes = 0;
+        std::size_t pending_offset = 0;    ///< pending.front() 已发送的字节数
+        bool end_queued = false;           ///< 待发送数据之后结束流
+        bool headers_received = false;     ///< 已收到请求头（之后的 HEADERS 为 trailers）
+        bool refused = false;              ///< 超出并发上限，头部块解码后以 REFUSED_STREAM 重置
+        uint32_t parent = 0;               ///< 依赖的流，0 为根
+        int weight = 16;                   ///< 1-256
+        uint64_t vtime = 0;                ///< 加权公平调度的虚拟时间
+    };
+
+    bool processFrame(uint8_t type, uint8_t flags, uint32_t stream_id, const uint8_t* payload, std::size_t len);
+    bool onHeaders(uint8_t flags, uint32_t stream_id, const uint8_t* payload, std::size_t len);
+    bool onContinuation(uint8_t flags, uint32_t stream_id, const uint8_t* payload, std::size_t len);
+    bool onData(uint8_t flags, uint32_t stream_id, const uint8_t* payload, std::size_t len);
+    bool onSettings(uint8_t flags, uint32_t stream_id, const uint8_t* payload, std::size_t len);
+    bool onWindowUpdate(uint32_t stream_id, const uint8_t* payload, std::size_t len);
+    bool onPriority(uint32_t stream_id, const uint8_t* payload, std::size_t len);
+    bool onRstStream(uint32_t stream_id, const uint8_t* payload, std::size_t len);
+    bool onPing(uint8_t flags, uint32_t stream_id, const uint8_t* payload, std::size_t len);
+    bool onGoaway(uint32_t stream_id, std::size_t len);
+
+    bool applySettings(const uint8_t* payload, std::size_t len);
+    bool endHeaderBlock(uint32_t stream_id, bool end_stream);
+    void setPriority(uint32_t stream_id, uint32_t parent, int weight, bool exclusive);
+    void requestComplete(uint32_t stream_id);
+    void finishLocal(uint32_t stream_id);
+    void closeStream(uint32_t stream_id);
+    bool streamError(uint32_t stream_id, Http2ErrorCode code);
+    bool connectionError(Http2ErrorCode code);
+    void writeFrame(Http2FrameType type, uint8_t flags, uint32_t stream_id, std::string_view payload);
+    void writeWindowUpdate(uint32_t stream_id, uint32_t increment);
+
+    /**
+     * @brief 把本轮累积的帧一次性交给 WriteCallback，减少系统调用
+     */
+    void emit();
+
+    /**
+     * @brief 在窗口允许范围内按优先级写出待发送数据
+     */
+    void flush();
+    uint32_t pickStream() const;
+    bool hasSendable(const Stream& stream) const;
+
+    WriteCallback write_;
+    RequestCallback on_request_;
+    DrainCallback on_drain_;
+    std::string out_;                      ///< 尚未交给 WriteCallback 的帧
+
+    HpackDecoder decoder_;
+    HpackEncoder encoder_;
+    std::map<uint32_t, Stream> streams_;
+
+    bool preface_received_ = false;
+    bool settings_received_ = false;
+    bool going_away_ = false;
+    uint32_t last_stream_id_ = 0;          ///< 已接受的最大客户端流ID
+    uint32_t peer_max_frame_size_ = kDefaultMaxFrameSize;
+    uint32_t peer_initial_window_ = kDefaultWindowSize;
+    int64_t conn_send_window_ = kDefaultWindowSize;
+    uint64_t vtime_ = 0;
+
+    // Header block in progress (HEADERS followed by CONTINUATION)
+    uint32_t continuation_stream_ = 0;
+    bool continuation_end_stream_ = false;
+    std::string header_block_;
+};
+
+} // namespace protocols
@@ -2,6 +2,7 @@
 #include "net/channel.h"
 #include "net/poller.h"
 #include "net/timer_queue.h"
+#include "net/io_stats.h"
 #include "logger.h"
 
 #include <sys/eventfd.h>
@@ -33,6 +34,8 @@ EventLoop::EventLoop()
       poller_(Poller::newDefaultPoller(this)),
       wakeupFd_(createEventfd()),
       wakeupChannel_(new Channel(this, wakeupFd_)),
+      wakeupPending_(false),
+      flushing_(false),
       timerQueue_(new net::TimerQueue(this)) {
     
     if (t_loopInThisThread) {
@@ -70,6 +73,7 @@ void EventLoop::loop() {
         eventHandling_ = false;
 
         doPendingFunctors();
+        doFlushes();
     }
     LOG_INFO("EventLoop {} stop looping", (void*)this);
     looping_ = false;
@@ -95,11 +99,16 @@ void EventLoop::queueInLoop(Functor cb) {
         std::lock_guard<std::mutex> lock(mutex_);
         pendingFunctors_.emplace_back(std::move(cb));
     }
-    if (!isInLoopThread() || callingPendingFunctors_) {
+    if (!isInLoopThread() || callingPendingFunctors_ || flushing_) {
         wakeup();
     }
 }
 
+void EventLoop::queueFlush(Functor cb) {
+    assertInLoopThread();
+    flushFunctors_.emplace_back(std::move(cb));
+}
+
 void EventLoop::updateChannel(Channel* channel) {
     poller_->updateChannel(channel);
 }
@@ -113,6 +122,11 @@ bool EventLoop::hasChannel(Channel* channel) {
 }
 
 void EventLoop::wakeup() {
+    // One pending eventfd write is enough: handleRead clears the flag before pending functors are swapped
+    if (wakeupPending_.exchange(true)) {
+        return;
+    }
+    NetIoStats::instance().wakeups.fetch_add(1, std::memory_order_relaxed);
     uint64_t one = 1;
     ssize_t n = ::write(wakeupFd_, &one, sizeof(one));
     if (n != sizeof(one)) {
@@ -121,6 +135,7 @@ void EventLoop::wakeup() {
 }
 
 void EventLoop::handleRead() {
+    wakeupPending_ = false;
     uint64_t one = 1;
     ssize_t n = ::read(wakeupFd_, &one, sizeof(one));
     if (n != sizeof(one)) {
@@ -143,6 +158,20 @@ void EventLoop::doPendingFunctors() {
     callingPendingFunctors_ = false;
 }
 
+void EventLoop::doFlushes() {
+    flushing_ = true;
+    // A flush may queue another (e.g. a write-complete callback that sends), so drain to a fixed point
+    std::vector<Functor> flushes;
+    while (!flushFunctors_.empty()) {
+        flushes.swap(flushFunctors_);
+        for (const auto& flush : flushes) {
+            flush();
+        }
+        flushes.clear();
+    }
+    flushing_ = false;
+}
+
 void EventLoop::runAt(Timestamp time, TimerCallback cb) {
     timerQueue_->addTimer(std::move(cb), time, 0.0);
 }
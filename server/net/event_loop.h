@@ -58,6 +58,13 @@ public:
      */
     void queueInLoop(Functor cb);
 
+    /**
+     * @brief 在本轮事件与回调处理完、下一次 poll 之前执行
+     *
+     * 只能在 Loop 线程中调用，用于把一轮循环中产生的写操作合并为一次系统调用。
+     */
+    void queueFlush(Functor cb);
+
     // Channel 管理
     void updateChannel(Channel* channel);
     void removeChannel(Channel* channel);
@@ -83,6 +90,7 @@ public:
 private:
     void handleRead(); // handle wakeup
     void doPendingFunctors();
+    void doFlushes();
 
     using ChannelList = std::vector<Channel*>;
 
@@ -100,8 +108,12 @@ private:
     
     ChannelList activeChannels_;
     
+    std::atomic<bool> wakeupPending_;  ///< eventfd 已写入尚未读出，重复唤醒可以省略
+    
     std::mutex mutex_;
     std::vector<Functor> pendingFunctors_;
+    std::vector<Functor> flushFunctors_;  ///< Loop 线程专用，无需加锁
+    bool flushing_;
     
     std::unique_ptr<net::TimerQueue> timerQueue_;
 };
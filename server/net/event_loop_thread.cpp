@@ -11,9 +11,13 @@ EventLoopThread::EventLoopThread(const ThreadInitCallback& cb,
 
 EventLoopThread::~EventLoopThread() {
     exiting_ = true;
-    if (loop_) {
-        loop_->stop();
-        loop_->wakeup();
+    {
+        // threadFunc takes mutex_ before its EventLoop goes out of scope, so the loop
+        // outlives stop() (which also wakes it) even if it exits right away
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (loop_) {
+            loop_->stop();
+        }
     }
     if (thread_.joinable()) {
         thread_.join();
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+/**
+ * @brief 进程级网络写出统计
+ *
+ * 所有IO线程共享，relaxed 计数；sends 与 write_calls 之比即每条消息的写系统调用数。
+ */
+struct NetIoStats {
+    std::atomic<uint64_t> sends{0};        ///< TcpConnection::send 调用数（应用层消息数）
+    std::atomic<uint64_t> write_calls{0};  ///< write/writev 系统调用数
+    std::atomic<uint64_t> bytes{0};        ///< 写入内核的字节数
+    std::atomic<uint64_t> wakeups{0};      ///< 唤醒IO线程写 eventfd 的次数
+
+    static NetIoStats& instance() {
+        static NetIoStats stats;
+        return stats;
+    }
+};
@@ -1,9 +1,11 @@
 #include "net/tcp_connection.h"
 #include "net/event_loop.h"
 #include "net/channel.h"
+#include "net/io_stats.h"
 #include "logger.h"
 
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include <errno.h>
 
@@ -49,16 +51,34 @@ TcpConnection::TcpConnection(EventLoop* loop,
 TcpConnection::~TcpConnection() {
     // LOG_DEBUG("TcpConnection::dtor[{}] at fd={} state={}", 
     //           name_, channel_->fd(), (int)state_);
-    printf("TcpConnection::~TcpConnection name=%s fd=%d\n", name_.c_str(), channel_->fd());
     if (state_ != kDisconnected) {
         // ...
     }
 }
 
+int TcpConnection::fd() const {
+    return channel_->fd();
+}
+
+namespace {
+
+// Small writes are merged into one segment; broadcast frames stay shared
+constexpr size_t kMergeLimit = 16 * 1024;
+constexpr int kMaxIovecs = 64;
+
+} // namespace
+
 void TcpConnection::send(const std::string& message) {
     if (state_ == kConnected) {
+        NetIoStats::instance().sends.fetch_add(1, std::memory_order_relaxed);
         if (loop_->isInLoopThread()) {
-            sendInLoop(message);
+            if (coalescing_) {
+                enqueueInLoop(message.data(), message.size());
+            } else {
+                sendInLoop(message);
+            }
+        } else if (coalescing_) {
+            enqueueFromOtherThread(message.data(), message.size(), nullptr);
         } else {
             loop_->runInLoop([this, message]() {
                 sendInLoop(message);
@@ -69,8 +89,16 @@ void TcpConnection::send(const std::string& message) {
 
 void TcpConnection::send(Buffer* message) {
     if (state_ == kConnected) {
+        NetIoStats::instance().sends.fetch_add(1, std::memory_order_relaxed);
         if (loop_->isInLoopThread()) {
-            sendInLoop(message->peek(), message->readableBytes());
+            if (coalescing_) {
+                enqueueInLoop(message->peek(), message->readableBytes());
+            } else {
+                sendInLoop(message->peek(), message->readableBytes());
+            }
+            message->retrieveAll();
+        } else if (coalescing_) {
+            enqueueFromOtherThread(message->peek(), message->readableBytes(), nullptr);
             message->retrieveAll();
         } else {
             // Copy data for cross-thread safety
@@ -83,6 +111,184 @@ void TcpConnection::send(Buffer* message) {
     }
 }
 
+void TcpConnection::send(std::shared_ptr<const std::string> message) {
+    if (state_ == kConnected) {
+        NetIoStats::instance().sends.fetch_add(1, std::memory_order_relaxed);
+        if (loop_->isInLoopThread()) {
+            if (coalescing_) {
+                enqueueInLoop(std::move(message));
+            } else {
+                sendInLoop(*message);
+            }
+        } else if (coalescing_) {
+            enqueueFromOtherThread(nullptr, 0, std::move(message));
+        } else {
+            loop_->runInLoop([this, message]() {
+                sendInLoop(*message);
+            });
+        }
+    }
+}
+
+void TcpConnection::appendSegment(std::vector<OutputSegment>& queue, const char* data, size_t len) {
+    if (!queue.empty() && !queue.back().shared && queue.back().owned.size() + len <= kMergeLimit) {
+        queue.back().owned.append(data, len);
+        return;
+    }
+    OutputSegment segment;
+    segment.owned.assign(data, len);
+    queue.push_back(std::move(segment));
+}
+
+void TcpConnection::enqueueInLoop(const char* data, size_t len) {
+    if (state_ == kDisconnected || len == 0) {
+        return;
+    }
+    appendSegment(pending_, data, len);
+    pendingBytes_ += len;
+    scheduleFlush();
+}
+
+void TcpConnection::enqueueInLoop(std::shared_ptr<const std::string> message) {
+    if (state_ == kDisconnected || message->empty()) {
+        return;
+    }
+    OutputSegment segment;
+    pendingBytes_ += message->size();
+    segment.shared = std::move(message);
+    pending_.push_back(std::move(segment));
+    scheduleFlush();
+}
+
+void TcpConnection::enqueueFromOtherThread(const char* data, size_t len, std::shared_ptr<const std::string> shared) {
+    bool first;
+    {
+        std::lock_guard<std::mutex> lock(inboxMutex_);
+        first = inbox_.empty();
+        if (shared) {
+            OutputSegment segment;
+            segment.shared = std::move(shared);
+            inbox_.push_back(std::move(segment));
+        } else {
+            appendSegment(inbox_, data, len);
+        }
+    }
+    // Only the send that finds the inbox empty posts a task; later ones ride along with it
+    if (first) {
+        loop_->queueInLoop([self = shared_from_this()]() { self->drainInbox(); });
+    }
+}
+
+void TcpConnection::drainInbox() {
+    loop_->assertInLoopThread();
+    std::vector<OutputSegment> batch;
+    {
+        std::lock_guard<std::mutex> lock(inboxMutex_);
+        batch.swap(inbox_);
+    }
+    if (state_ == kDisconnected) {
+        return;
+    }
+    for (auto& segment : batch) {
+        pendingBytes_ += segment.size();
+        if (segment.shared) {
+            pending_.push_back(std::move(segment));
+        } else {
+            appendSegment(pending_, segment.owned.data(), segment.owned.size());
+        }
+    }
+    if (!pending_.empty()) {
+        scheduleFlush();
+    }
+}
+
+void TcpConnection::scheduleFlush() {
+    if (!flushScheduled_) {
+        flushScheduled_ = true;
+        loop_->queueFlush([self = shared_from_this()]() { self->flushOutput(); });
+    }
+}
+
+void TcpConnection::flushOutput() {
+    loop_->assertInLoopThread();
+    flushScheduled_ = false;
+    if (pending_.empty()) {
+        return;
+    }
+    if (state_ == kDisconnected) {
+        pending_.clear();
+        pendingBytes_ = 0;
+        return;
+    }
+
+    size_t index = 0;
+    bool faultError = false;
+    // While EPOLLOUT is armed the socket is full; handleWrite drains outputBuffer_ in order
+    bool blocked = channel_->isWriting();
+    while (!blocked && index < pending_.size()) {
+        struct iovec iov[kMaxIovecs];
+        int count = 0;
+        size_t batch = 0;
+        for (size_t i = index; i < pending_.size() && count < kMaxIovecs; ++i, ++count) {
+            iov[count].iov_base = const_cast<char*>(pending_[i].data());
+            iov[count].iov_len = pending_[i].size();
+            batch += iov[count].iov_len;
+        }
+        ssize_t n = ::writev(channel_->fd(), iov, count);
+        NetIoStats::instance().write_calls.fetch_add(1, std::memory_order_relaxed);
+        if (n < 0) {
+            if (errno != EWOULDBLOCK) {
+                LOG_ERROR("TcpConnection::flushOutput");
+                faultError = errno == EPIPE || errno == ECONNRESET;
+            }
+            break;
+        }
+        NetIoStats::instance().bytes.fetch_add(static_cast<uint64_t>(n), std::memory_order_relaxed);
+        size_t written = static_cast<size_t>(n);
+        while (written > 0) {
+            size_t size = pending_[index].size();
+            if (written < size) {
+                pending_[index].offset += written;
+                break;
+            }
+            written -= size;
+            ++index;
+        }
+        blocked = static_cast<size_t>(n) < batch;
+    }
+
+    if (faultError) {
+        pending_.clear();
+        pendingBytes_ = 0;
+        return;
+    }
+    if (index == pending_.size()) {
+        pending_.clear();
+        pendingBytes_ = 0;
+        if (!channel_->isWriting() && writeCompleteCallback_) {
+            loop_->queueInLoop(std::bind(writeCompleteCallback_, shared_from_this()));
+        }
+        return;
+    }
+
+    size_t oldLen = outputBuffer_.readableBytes();
+    size_t remaining = 0;
+    for (size_t i = index; i < pending_.size(); ++i) {
+        remaining += pending_[i].size();
+    }
+    if (oldLen + remaining >= highWaterMark_ && oldLen < highWaterMark_ && highWaterMarkCallback_) {
+        loop_->queueInLoop(std::bind(highWaterMarkCallback_, shared_from_this(), oldLen + remaining));
+    }
+    for (size_t i = index; i < pending_.size(); ++i) {
+        outputBuffer_.append(pending_[i].data(), pending_[i].size());
+    }
+    pending_.clear();
+    pendingBytes_ = 0;
+    if (!channel_->isWriting()) {
+        channel_->enableWriting();
+    }
+}
+
 void TcpConnection::sendInLoop(const std::string& message) {
     sendInLoop(message.data(), message.size());
 }
@@ -92,7 +298,6 @@ void TcpConnection::sendInLoop(const void* data, size_t len) {
     ssize_t nwrote = 0;
     size_t remaining = len;
     bool faultError = false;
-    printf("TcpConnection::sendInLoop len=%ld state=%d\n", len, state_.load());
 
     if (state_ == kDisconnected) {
         LOG_WARN("disconnected, give up writing");
@@ -102,8 +307,9 @@ void TcpConnection::sendInLoop(const void* data, size_t len) {
     // if no thing in output queue, try write directly
     if (!channel_->isWriting() && outputBuffer_.readableBytes() == 0) {
         nwrote = ::write(channel_->fd(), data, len);
-        printf("TcpConnection::sendInLoop direct write nwrote=%ld\n", nwrote);
+        NetIoStats::instance().write_calls.fetch_add(1, std::memory_order_relaxed);
         if (nwrote >= 0) {
+            NetIoStats::instance().bytes.fetch_add(static_cast<uint64_t>(nwrote), std::memory_order_relaxed);
             remaining = len - nwrote;
             if (remaining == 0 && writeCompleteCallback_) {
                 loop_->queueInLoop(std::bind(writeCompleteCallback_, shared_from_this()));
@@ -143,6 +349,8 @@ void TcpConnection::shutdown() {
 
 void TcpConnection::shutdownInLoop() {
     loop_->assertInLoopThread();
+    // Data queued earlier in this iteration goes out before the FIN
+    flushOutput();
     if (!channel_->isWriting()) {
         ::shutdown(channel_->fd(), SHUT_WR);
     }
@@ -158,6 +366,8 @@ void TcpConnection::forceClose() {
 void TcpConnection::forceCloseInLoop() {
     loop_->assertInLoopThread();
     if (state_ == kConnected || state_ == kDisconnecting) {
+        // Coalesced sends from this iteration are still in pending_; give them one write before closing
+        flushOutput();
         handleClose();
     }
 }
@@ -189,21 +399,28 @@ void TcpConnection::connectDestroyed() {
 
 void TcpConnection::handleRead() {
     loop_->assertInLoopThread();
-    int savedErrno = 0;
-    // printf("TcpConnection::handleRead fd=%d\n", channel_->fd());
-    ssize_t n = inputBuffer_.readFd(channel_->fd(), &savedErrno);
-    printf("TcpConnection::handleRead read %ld bytes\n", n);
-    if (n > 0) {
-        if (messageCallback_) {
-            printf("TcpConnection::handleRead calling messageCallback_\n");
-            messageCallback_(shared_from_this(), &inputBuffer_, Timestamp::now());
+    // The channel is edge-triggered: read until the socket is drained, or data left behind in the
+    // kernel never raises another edge once the sender has filled the receive window
+    while (state_ != kDisconnected) {
+        int savedErrno = 0;
+        // printf("TcpConnection::handleRead fd=%d\n", channel_->fd());
+        ssize_t n = inputBuffer_.readFd(channel_->fd(), &savedErrno);
+        if (n > 0) {
+            if (messageCallback_) {
+                messageCallback_(shared_from_this(), &inputBuffer_, Timestamp::now());
+            }
+        } else if (n == 0) {
+            handleClose();
+            return;
+        } else {
+            if (savedErrno == EAGAIN || savedErrno == EWOULDBLOCK) {
+                return;
+            }
+            errno = savedErrno;
+            LOG_ERROR("TcpConnection::handleRead");
+            handleError();
+            return;
         }
-    } else if (n == 0) {
-        handleClose();
-    } else {
-        errno = savedErrno;
-        LOG_ERROR("TcpConnection::handleRead");
-        handleError();
     }
 }
 
@@ -213,7 +430,9 @@ void TcpConnection::handleWrite() {
         ssize_t n = ::write(channel_->fd(),
                             outputBuffer_.peek(),
                             outputBuffer_.readableBytes());
+        NetIoStats::instance().write_calls.fetch_add(1, std::memory_order_relaxed);
         if (n >= 0) {
+            NetIoStats::instance().bytes.fetch_add(static_cast<uint64_t>(n), std::memory_order_relaxed);
             outputBuffer_.retrieve(n);
             if (outputBuffer_.readableBytes() == 0) {
                 channel_->disableWriting();
@@ -5,6 +5,7 @@
 #include <vector>
 #include <any>
 #include <atomic>
+#include <mutex>
 #include "net/callbacks.h"
 #include "net/buffer.h"
 #include "net/inet_address.h"
@@ -30,10 +31,25 @@ public:
     const InetAddress& peerAddress() const { return peerAddr_; }
     bool connected() const { return state_ == kConnected; }
     bool disconnected() const { return state_ == kDisconnected; }
+    int fd() const;
 
     // Send data (thread-safe)
     void send(const std::string& message);
     void send(Buffer* message);
+    /// Zero-copy send of a frame shared by many connections (broadcast)
+    void send(std::shared_ptr<const std::string> message);
+
+    /**
+     * @brief 写合并模式
+     *
+     * 开启后，IO线程中的 send 只把数据追加到连接的待发队列并标记连接，事件与回调处理完后由
+     * EventLoop 对每个有数据的连接调用一次 writev；其他线程的 send 先进入连接的收件箱，
+     * 同一批只向IO线程投递一个任务。必须在 connectEstablished 之前设置。
+     */
+    void setWriteCoalescing(bool on) { coalescing_ = on; }
+
+    /// 已交给连接但尚未写入内核的字节数（IO线程）
+    size_t queuedBytes() const { return outputBuffer_.readableBytes() + pendingBytes_; }
 
     void shutdown();
     void forceClose();
@@ -53,6 +69,10 @@ public:
     const std::any& getContext() const { return context_; }
     std::any* getMutableContext() { return &context_; }
 
+    // Buffers (IO loop thread only)
+    Buffer* inputBuffer() { return &inputBuffer_; }
+    Buffer* outputBuffer() { return &outputBuffer_; }
+
     // Internal use
     void connectEstablished();
     void connectDestroyed();
@@ -71,6 +91,23 @@ private:
     
     void sendInLoop(const std::string& message);
     void sendInLoop(const void* data, size_t len);
+
+    /// 待发数据段：自有副本或共享的广播帧
+    struct OutputSegment {
+        std::shared_ptr<const std::string> shared;
+        std::string owned;
+        size_t offset = 0;  ///< 已写出的字节数
+
+        const char* data() const { return (shared ? shared->data() : owned.data()) + offset; }
+        size_t size() const { return (shared ? shared->size() : owned.size()) - offset; }
+    };
+    static void appendSegment(std::vector<OutputSegment>& queue, const char* data, size_t len);
+    void enqueueInLoop(const char* data, size_t len);
+    void enqueueInLoop(std::shared_ptr<const std::string> message);
+    void enqueueFromOtherThread(const char* data, size_t len, std::shared_ptr<const std::string> shared);
+    void scheduleFlush();
+    void drainInbox();
+    void flushOutput();
     void shutdownInLoop();
     void forceCloseInLoop();
     void setState(StateE s) { state_ = s; }
@@ -93,6 +130,13 @@ private:
     size_t highWaterMark_;
     Buffer inputBuffer_;
     Buffer outputBuffer_;
+
+    bool coalescing_ = false;
+    bool flushScheduled_ = false;
+    std::vector<OutputSegment> pending_;  ///< 本轮循环尚未写出的数据（IO线程）
+    size_t pendingBytes_ = 0;
+    std::mutex inboxMutex_;
+    std::vector<OutputSegment> inbox_;    ///< 其他线程发来、尚未转入 pending_ 的数据
     std::any context_;
 };
 
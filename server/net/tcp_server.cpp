@@ -5,6 +5,7 @@
 #include "logger.h"
 
 #include <stdio.h>
+#include <unistd.h>
 
 TcpServer::TcpServer(EventLoop* loop,
                      const InetAddress& listenAddr,
@@ -74,6 +75,7 @@ void TcpServer::newConnection(int sockfd, const InetAddress& peerAddr) {
     conn->setConnectionCallback(connectionCallback_);
     conn->setMessageCallback(messageCallback_);
     conn->setWriteCompleteCallback(writeCompleteCallback_);
+    conn->setWriteCoalescing(writeCoalescing_);
     conn->setCloseCallback(
         std::bind(&TcpServer::removeConnection, this, std::placeholders::_1));
         
@@ -97,6 +99,10 @@ void TcpServer::removeConnectionInLoop(const TcpConnectionPtr& conn) {
     }
     
     EventLoop* ioLoop = conn->getLoop();
-    ioLoop->queueInLoop(
-        std::bind(&TcpConnection::connectDestroyed, conn));
+    ioLoop->queueInLoop([conn]() {
+        conn->connectDestroyed();
+        // The server accepted the socket, so it releases it; without this a server-side
+        // forceClose() never reaches the peer and every closed connection leaks its fd
+        ::close(conn->fd());
+    });
 }
@@ -36,6 +36,8 @@ public:
     void setConnectionCallback(const ConnectionCallback& cb) { connectionCallback_ = cb; }
     void setMessageCallback(const MessageCallback& cb) { messageCallback_ = cb; }
     void setWriteCompleteCallback(const WriteCompleteCallback& cb) { writeCompleteCallback_ = cb; }
+    /// 新连接是否启用写合并（见 TcpConnection::setWriteCoalescing）
+    void setWriteCoalescing(bool on) { writeCoalescing_ = on; }
 
 private:
     void newConnection(int sockfd, const InetAddress& peerAddr);
@@ -54,6 +56,7 @@ private:
     ConnectionCallback connectionCallback_;
     MessageCallback messageCallback_;
     WriteCompleteCallback writeCompleteCallback_;
+    bool writeCoalescing_ = false;
     
     std::atomic_int32_t started_;
     int nextConnId_;
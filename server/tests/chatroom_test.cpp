@@ -1,18 +1,31 @@
 #include <gtest/gtest.h>
 #include "chatroom/chatroom_server.h"
+#include "chatroom/connection_directory.h"
 #include "utils/metrics_collector.h"
 #include "utils/server_config.h"
 #include "database_manager.h"
+#include "message_cache.h"
+#include "message_writer.h"
+#include "search_index.h"
+#include "sqlite_database.h"
 #include "net/tcp_connection.h"
 #include "net/event_loop.h"
 #include "net/inet_address.h"
+#include "net/event_loop_thread.h"
 #include "websocket/websocket_codec.h"
+#include "websocket/websocket_deflate.h"
 #include "rtsp/rtsp_codec.h"
 #include <nlohmann/json.hpp>
+#include <sqlite3.h>
 #include <sys/socket.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <algorithm>
+#include <cstdio>
+#include <atomic>
 #include <future>
+#include <map>
+#include <thread>
 #include <chrono>
 
 using json = nlohmann::json;
@@ -32,6 +45,8 @@ protected:
         DatabaseManager::instance().init(config.db);
 
         server_ = std::make_unique<ChatRoomServer>(8080);
+        // start() is not called here; load the user directory as it would after init
+        server_->user_directory_.load(DatabaseManager::instance().getAllUsers());
     }
 
     void TearDown() override {
@@ -68,6 +83,30 @@ protected:
         return server_->handleGetMessages(req);
     }
 
+    HttpResponse CallHandleGetHistory(const std::string& path) {
+        HttpRequest req;
+        req.method = "GET";
+        req.path = path;
+        req.remote_ip = "127.0.0.1";
+        return server_->handleGetHistory(req);
+    }
+
+    HttpResponse CallHandleGetUsers(const std::string& path) {
+        HttpRequest req;
+        req.method = "GET";
+        req.path = path;
+        req.remote_ip = "127.0.0.1";
+        return server_->handleGetUsers(req);
+    }
+
+    HttpResponse CallHandleSearch(const std::string& path) {
+        HttpRequest req;
+        req.method = "GET";
+        req.path = path;
+        req.remote_ip = "127.0.0.1";
+        return server_->handleSearch(req);
+    }
+
     json GetMetrics() {
         return server_->metrics_collector_->getMetrics();
     }
@@ -76,8 +115,36 @@ protected:
         return server_->http_server_.get();
     }
 
+    std::string BuildHttpResponse(const HttpResponse& resp) {
+        return server_->http_server_->buildResponse(resp);
+    }
+
+    // WebSocket logins and messages finish on the connection's loop once their database work
+    // is done; the tests own that loop, so run it until every async call has completed
+    static void RunUntilDatabaseIdle(EventLoop* loop) {
+        const auto& async_stats = DatabaseManager::instance().asyncStats();
+        for (int i = 0; i < 500 && async_stats.pending.load() > 0; ++i) {
+            loop->runAfter(0.005, [loop]() { loop->stop(); });
+            loop->loop();
+        }
+    }
+
     void HandleWebSocketMessage(std::shared_ptr<TcpConnection> conn, const protocols::WebSocketFrame& frame) {
         server_->handleWebSocketMessage(conn, frame);
+        RunUntilDatabaseIdle(conn->getLoop());
+    }
+
+    void CallHandlePollMessages(const std::string& path, EventLoop* loop, HttpResponder respond) {
+        HttpRequest req;
+        req.method = "GET";
+        req.path = path;
+        req.remote_ip = "127.0.0.1";
+        server_->handlePollMessages(req, loop, std::move(respond));
+    }
+
+    void DispatchHttp(const std::shared_ptr<TcpConnection>& conn) {
+        server_->http_server_->onMessage(conn, conn->inputBuffer(), Timestamp::now());
+        RunUntilDatabaseIdle(conn->getLoop());
     }
 
     void HandleRtspMessage(std::shared_ptr<TcpConnection> conn, const protocols::RtspRequest& request) {
@@ -171,6 +238,62 @@ TEST_F(ChatRoomServerTest, WebSocketLoginAndMessage) {
     // fds[0] closed by TcpConnection
 }
 
+TEST_F(ChatRoomServerTest, WebSocketFramesPipelinedBehindLogin) {
+    RegisterUser("ws_pipelined", "123456");
+    EventLoop* loop = GetHttpServer()->getLoop();
+    int fds[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    fcntl(fds[1], F_SETFL, O_NONBLOCK);
+    auto conn = std::make_shared<TcpConnection>(loop, "test-ws-pipelined", fds[0], InetAddress(0), InetAddress(0));
+    conn->connectEstablished();
+    conn->inputBuffer()->append("GET /ws HTTP/1.1\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                                "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n\r\n");
+    DispatchHttp(conn);
+    char buf[4096];
+    ASSERT_GT(read(fds[1], buf, sizeof(buf)), 0);
+
+    // Login, join and a room message in one read: the last two arrive before the login is checked
+    auto masked = [](const std::string& payload) {
+        const uint8_t key[4] = {1, 2, 3, 4};
+        std::string frame = {static_cast<char>(0x81), static_cast<char>(0x80 | payload.size())};
+        frame.append(reinterpret_cast<const char*>(key), 4);
+        for (std::size_t i = 0; i < payload.size(); ++i) {
+            frame.push_back(static_cast<char>(payload[i] ^ key[i % 4]));
+        }
+        return frame;
+    };
+    conn->inputBuffer()->append(masked(R"({"type":"login","username":"ws_pipelined","password":"123456"})") +
+                                masked(R"({"type":"join_room","room_id":"pipe"})") +
+                                masked(R"({"type":"message","content":"sent with login","room_id":"pipe"})"));
+    DispatchHttp(conn);
+
+    ssize_t n = read(fds[1], buf, sizeof(buf));
+    ASSERT_GT(n, 0);
+    std::vector<uint8_t> data(buf, buf + n);
+    std::vector<json> replies;
+    std::size_t off = 0;
+    while (off < data.size()) {
+        protocols::WebSocketFrame frame;
+        int consumed = protocols::WebSocketCodec::parseFrame(data.data() + off, data.size() - off, frame);
+        ASSERT_GT(consumed, 0);
+        replies.push_back(json::parse(frame.payload));
+        off += static_cast<std::size_t>(consumed);
+    }
+    ASSERT_EQ(replies.size(), 2u);
+    EXPECT_EQ(replies[0]["type"], "login_response");
+    EXPECT_TRUE(replies[0]["success"]);
+    EXPECT_EQ(replies[1]["type"], "message_response");
+    EXPECT_TRUE(replies[1]["success"]);
+
+    auto history = DatabaseManager::instance().getRoomHistory("pipe", HistoryCursor{});
+    ASSERT_EQ(history.size(), 1u);
+    EXPECT_EQ(history[0].username, "ws_pipelined");
+    EXPECT_EQ(history[0].content, "sent with login");
+
+    conn->connectDestroyed();
+    close(fds[1]);
+}
+
 TEST_F(ChatRoomServerTest, WebSocketForwarding) {
     RegisterUser("Alice", "123456");
     RegisterUser("Bob", "123456");
@@ -427,3 +550,1121 @@ TEST_F(ChatRoomServerTest, GetMessagesSuccess) {
     EXPECT_EQ(body["messages"][0]["content"], "c1");
     EXPECT_EQ(body["messages"][1]["content"], "c2");
 }
+
+TEST_F(ChatRoomServerTest, HistoryPagesThroughRoomAndConversation) {
+    for (int i = 0; i < 5; ++i) {
+        ChatMessage msg; msg.username = "u1"; msg.content = "room " + std::to_string(i); msg.room_id = "r1";
+        ASSERT_TRUE(DatabaseManager::instance().addMessage(msg));
+        ChatMessage dm; dm.username = "u2"; dm.content = "dm " + std::to_string(i); dm.target_user = "u1";
+        ASSERT_TRUE(DatabaseManager::instance().addMessage(dm));
+    }
+
+    auto newest = json::parse(CallHandleGetHistory("/history?room=r1&limit=3").body);
+    ASSERT_EQ(newest["messages"].size(), 3);
+    EXPECT_EQ(newest["messages"][2]["content"], "room 4");
+    EXPECT_TRUE(newest["has_more"]);
+    EXPECT_EQ(newest["total"], 5);
+
+    auto older = json::parse(
+        CallHandleGetHistory("/history?room=r1&limit=3&before=" + std::to_string(newest["before"].get<long long>())).body);
+    ASSERT_EQ(older["messages"].size(), 2);
+    EXPECT_EQ(older["messages"][0]["content"], "room 0");
+    EXPECT_FALSE(older["has_more"]);
+
+    auto dms = json::parse(CallHandleGetHistory("/history?username=u1&with=u2").body);
+    ASSERT_EQ(dms["messages"].size(), 5);
+    EXPECT_EQ(dms["messages"][0]["target_user"], "u1");
+
+    EXPECT_EQ(CallHandleGetHistory("/history?limit=3").status_code, 400);
+}
+
+TEST_F(ChatRoomServerTest, SearchRanksMatchesAndHidesOthersPrivateMessages) {
+    auto add = [](const std::string& user, const std::string& content, const std::string& room,
+                  const std::string& target = "") {
+        ChatMessage msg; msg.username = user; msg.content = content; msg.room_id = room; msg.target_user = target;
+        msg.timestamp = "2026-10-18 12:00:00";
+        ASSERT_TRUE(DatabaseManager::instance().addMessage(msg));
+    };
+    add("u1", "明天下午开会", "r1");
+    add("u2", "开会开会，明天开会", "r2");
+    add("u2", "明天见", "r1");
+    add("u3", "私下说：明天开会别迟到", "", "u1");
+
+    // 开会 percent-encoded
+    auto body = json::parse(CallHandleSearch("/search?q=%E5%BC%80%E4%BC%9A").body);
+    ASSERT_EQ(body["results"].size(), 2);
+    EXPECT_EQ(body["results"][0]["content"], "开会开会，明天开会");
+    EXPECT_GT(body["results"][0]["score"].get<double>(), body["results"][1]["score"].get<double>());
+
+    body = json::parse(CallHandleSearch("/search?q=%E5%BC%80%E4%BC%9A&username=u1").body);
+    EXPECT_EQ(body["results"].size(), 3);
+    body = json::parse(CallHandleSearch("/search?q=%E6%98%8E%E5%A4%A9&room=r1&from=u2").body);
+    ASSERT_EQ(body["results"].size(), 1);
+    EXPECT_EQ(body["results"][0]["content"], "明天见");
+    EXPECT_TRUE(json::parse(CallHandleSearch("/search?q=%E6%98%8E%E5%A4%A9&end=2026-10-17").body)["results"].empty());
+
+    EXPECT_EQ(CallHandleSearch("/search?room=r1").status_code, 400);
+    EXPECT_EQ(DatabaseManager::instance().searchStats().documents.load(), 4u);
+}
+
+TEST_F(ChatRoomServerTest, UsersReturnsDeltasSinceVersion) {
+    RegisterUser("ua", "123456");
+    RegisterUser("ub", "123456");
+    RegisterUser("uc", "123456");
+
+    auto full = json::parse(CallHandleGetUsers("/users").body);
+    ASSERT_EQ(full["users"].size(), 3);
+    EXPECT_EQ(full["users"][1]["username"], "ub");
+    EXPECT_EQ(full["users"][1]["status"], "offline");
+    EXPECT_FALSE(full["has_more"]);
+    auto version = full["version"].get<uint64_t>();
+
+    // Nothing changed
+    auto same = CallHandleGetUsers("/users?since_version=" + std::to_string(version));
+    EXPECT_EQ(same.status_code, 304);
+    EXPECT_TRUE(same.body.empty());
+
+    // Only the user who came online, then only the one who registered
+    json login;
+    login["username"] = "ub";
+    login["password"] = "123456";
+    ASSERT_EQ(CallHandleLogin(login.dump()).status_code, 200);
+    auto delta = json::parse(CallHandleGetUsers("/users?since_version=" + std::to_string(version)).body);
+    ASSERT_EQ(delta["users"].size(), 1);
+    EXPECT_EQ(delta["users"][0]["username"], "ub");
+    EXPECT_EQ(delta["users"][0]["status"], "online");
+    EXPECT_GT(delta["version"].get<uint64_t>(), version);
+    version = delta["version"].get<uint64_t>();
+
+    RegisterUser("ud", "123456");
+    delta = json::parse(CallHandleGetUsers("/users?since_version=" + std::to_string(version)).body);
+    ASSERT_EQ(delta["users"].size(), 1);
+    EXPECT_EQ(delta["users"][0]["username"], "ud");
+
+    // A version this server never issued gets the full list
+    EXPECT_EQ(json::parse(CallHandleGetUsers("/users?since_version=1").body)["users"].size(), 4);
+
+    auto online = json::parse(CallHandleGetUsers("/users?online=1").body);
+    ASSERT_EQ(online["users"].size(), 1);
+    EXPECT_EQ(online["users"][0]["username"], "ub");
+
+    auto first = json::parse(CallHandleGetUsers("/users?limit=3").body);
+    ASSERT_EQ(first["users"].size(), 3);
+    EXPECT_TRUE(first["has_more"]);
+    auto rest = json::parse(CallHandleGetUsers("/users?limit=3&after=uc").body);
+    ASSERT_EQ(rest["users"].size(), 1);
+    EXPECT_EQ(rest["users"][0]["username"], "ud");
+    EXPECT_FALSE(rest["has_more"]);
+
+    EXPECT_EQ(CallHandleGetUsers("/users?since_version=abc").status_code, 400);
+}
+
+TEST_F(ChatRoomServerTest, LongPollWokenByMessage) {
+    EventLoopThread loop_thread;
+    EventLoop* loop = loop_thread.startLoop();
+
+    std::promise<HttpResponse> promise;
+    auto future = promise.get_future();
+    CallHandlePollMessages("/messages?since=0&wait=10", loop,
+                           [&promise](HttpResponse resp) { promise.set_value(std::move(resp)); });
+
+    // Nothing to return yet: the request is parked, not answered
+    EXPECT_EQ(future.wait_for(std::chrono::milliseconds(200)), std::future_status::timeout);
+
+    ChatMessage msg; msg.username = "u1"; msg.content = "wake up";
+    ASSERT_TRUE(DatabaseManager::instance().addMessage(msg));
+    EXPECT_GT(msg.id, 0);
+
+    ASSERT_EQ(future.wait_for(std::chrono::seconds(2)), std::future_status::ready);
+    auto body = json::parse(future.get().body);
+    ASSERT_EQ(body["messages"].size(), 1);
+    EXPECT_EQ(body["messages"][0]["content"], "wake up");
+    EXPECT_EQ(body["next_since"], msg.id);
+}
+
+TEST_F(ChatRoomServerTest, LongPollAnswersFromCursorAfterWake) {
+    ChatMessage first; first.username = "u1"; first.content = "before";
+    ASSERT_TRUE(DatabaseManager::instance().addMessage(first));
+
+    EventLoopThread loop_thread;
+    EventLoop* loop = loop_thread.startLoop();
+    std::promise<HttpResponse> promise;
+    auto future = promise.get_future();
+    // A cursor ahead of every stored id: the next message wakes the request but is not newer than it
+    long long since = first.id + 100;
+    CallHandlePollMessages("/messages?since=" + std::to_string(since) + "&wait=10", loop,
+                           [&promise](HttpResponse resp) { promise.set_value(std::move(resp)); });
+    EXPECT_EQ(future.wait_for(std::chrono::milliseconds(200)), std::future_status::timeout);
+
+    ChatMessage msg; msg.username = "u1"; msg.content = "older than the cursor";
+    ASSERT_TRUE(DatabaseManager::instance().addMessage(msg));
+
+    ASSERT_EQ(future.wait_for(std::chrono::seconds(2)), std::future_status::ready);
+    auto body = json::parse(future.get().body);
+    EXPECT_TRUE(body["messages"].empty());
+    EXPECT_EQ(body["next_since"], since);
+}
+
+TEST_F(ChatRoomServerTest, LongPollIgnoresInvisibleMessageAndTimesOut) {
+    EventLoopThread loop_thread;
+    EventLoop* loop = loop_thread.startLoop();
+
+    std::promise<HttpResponse> promise;
+    auto future = promise.get_future();
+    CallHandlePollMessages("/messages?since=0&username=alice&wait=1", loop,
+                           [&promise](HttpResponse resp) { promise.set_value(std::move(resp)); });
+
+    // Private message between other users must not wake alice
+    ChatMessage msg; msg.username = "bob"; msg.content = "secret"; msg.target_user = "carol";
+    ASSERT_TRUE(DatabaseManager::instance().addMessage(msg));
+    EXPECT_EQ(future.wait_for(std::chrono::milliseconds(500)), std::future_status::timeout);
+
+    ASSERT_EQ(future.wait_for(std::chrono::seconds(3)), std::future_status::ready);
+    auto body = json::parse(future.get().body);
+    EXPECT_TRUE(body["success"]);
+    EXPECT_TRUE(body["messages"].empty());
+    EXPECT_EQ(body["next_since"], 0);
+}
+
+TEST_F(ChatRoomServerTest, HeartbeatRunsInlineOnIoThread) {
+    // The server's base loop belongs to this thread
+    EventLoop* loop = GetHttpServer()->getLoop();
+    int fds[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    fcntl(fds[1], F_SETFL, O_NONBLOCK);
+    auto conn = std::make_shared<TcpConnection>(loop, "inline-conn", fds[0], InetAddress(0), InetAddress(0));
+    conn->connectEstablished();
+
+    std::string body = R"({"username":"u1","connection_id":"c1","client_version":"1.0"})";
+    conn->inputBuffer()->append("POST /heartbeat HTTP/1.1\r\nContent-Length: " + std::to_string(body.size()) +
+                                "\r\n\r\n" + body);
+    DispatchHttp(conn);
+
+    // Answered before onMessage returns: no pool hop and no loop iteration needed
+    char buf[1024];
+    ssize_t n = read(fds[1], buf, sizeof(buf));
+    ASSERT_GT(n, 0);
+    std::string resp(buf, n);
+    EXPECT_EQ(resp.rfind("HTTP/1.1 200 OK", 0), 0u);
+    EXPECT_NE(resp.find("heartbeat ok"), std::string::npos);
+    EXPECT_EQ(GetHttpServer()->getInlineRequestCount(), 1u);
+
+    conn->connectDestroyed();
+    close(fds[1]);
+}
+
+TEST_F(ChatRoomServerTest, EventStreamResponseClosesConnection) {
+    HttpResponse plain;
+    plain.body = "{}";
+    std::string head = BuildHttpResponse(plain);
+    EXPECT_NE(head.find("Content-Length: 2\r\n"), std::string::npos);
+    EXPECT_NE(head.find("Connection: keep-alive\r\n"), std::string::npos);
+
+    // No length framing: the body ends when the connection does, so it must not be kept alive
+    HttpResponse events;
+    events.content_type = "text/event-stream";
+    events.event_stream = [](const std::shared_ptr<TcpConnection>&) {};
+    head = BuildHttpResponse(events);
+    EXPECT_EQ(head.find("Content-Length"), std::string::npos);
+    EXPECT_NE(head.find("Connection: close\r\n"), std::string::npos);
+    EXPECT_EQ(head.find("keep-alive"), std::string::npos);
+}
+
+TEST_F(ChatRoomServerTest, WebSocketDeflateBroadcast) {
+    RegisterUser("deflate_a", "123456");
+    RegisterUser("deflate_b", "123456");
+    RegisterUser("deflate_c", "123456");
+    EventLoop* loop = GetHttpServer()->getLoop();
+    const auto& stats = GetHttpServer()->getWebSocketDeflateStats();
+
+    struct Client {
+        std::shared_ptr<TcpConnection> conn;
+        int fd;
+        std::unique_ptr<protocols::WebSocketDeflate> inflater;
+    };
+    // Upgrades through the HTTP path and returns the negotiated extension header
+    auto connect = [&](const std::string& name, const std::string& offer, Client& client) {
+        int fds[2];
+        EXPECT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+        fcntl(fds[1], F_SETFL, O_NONBLOCK);
+        client.conn = std::make_shared<TcpConnection>(loop, name, fds[0], InetAddress(0), InetAddress(0));
+        client.conn->connectEstablished();
+        client.fd = fds[1];
+        client.conn->inputBuffer()->append("GET /ws HTTP/1.1\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                                           "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+                                           "Sec-WebSocket-Extensions: " + offer + "\r\n\r\n");
+        DispatchHttp(client.conn);
+        char buf[1024];
+        ssize_t n = read(client.fd, buf, sizeof(buf));
+        EXPECT_GT(n, 0);
+        std::string resp(buf, n > 0 ? n : 0);
+        EXPECT_NE(resp.find("Sec-WebSocket-Extensions: permessage-deflate"), std::string::npos);
+
+        protocols::WebSocketDeflateParams params;
+        params.client_max_window_bits = 15;
+        params.client_no_context_takeover = offer.find("server_no_context_takeover") != std::string::npos;
+        client.inflater = std::make_unique<protocols::WebSocketDeflate>(params, 6);
+    };
+    // Reads one server frame and inflates it as the client would; wire is empty for uncompressed frames
+    auto receive = [](Client& client) {
+        char buf[4096];
+        ssize_t n = read(client.fd, buf, sizeof(buf));
+        EXPECT_GT(n, 0);
+        std::vector<uint8_t> data(buf, buf + (n > 0 ? n : 0));
+        protocols::WebSocketFrame frame;
+        EXPECT_GT(protocols::WebSocketCodec::parseFrame(data.data(), data.size(), frame), 0);
+        if (!frame.rsv1) {
+            return std::make_pair(std::string(), json::parse(frame.payload));
+        }
+        std::string out;
+        EXPECT_TRUE(client.inflater->decompress(frame.payload, true, out, 1 << 20));
+        return std::make_pair(std::string(frame.payload), json::parse(out));
+    };
+
+    Client a, b, c;
+    connect("deflate-conn-a", "permessage-deflate; client_max_window_bits", a);
+    connect("deflate-conn-b", "permessage-deflate; server_no_context_takeover", b);
+    connect("deflate-conn-c", "permessage-deflate; server_no_context_takeover", c);
+    EXPECT_EQ(stats.connections.load(), 3u);
+
+    // A logs in with a compressed, masked frame
+    protocols::WebSocketDeflateParams client_params;
+    protocols::WebSocketDeflate client_deflate(client_params, 6);
+    std::string compressed;
+    ASSERT_TRUE(client_deflate.compress(R"({"type":"login","username":"deflate_a","password":"123456"})", compressed));
+    const uint8_t key[4] = {1, 2, 3, 4};
+    std::string frame = {static_cast<char>(0xC1), static_cast<char>(0x80 | compressed.size())};
+    frame.append(reinterpret_cast<const char*>(key), 4);
+    for (std::size_t i = 0; i < compressed.size(); ++i) {
+        frame.push_back(static_cast<char>(compressed[i] ^ key[i % 4]));
+    }
+    a.conn->inputBuffer()->append(frame);
+    DispatchHttp(a.conn);
+    EXPECT_EQ(stats.messages_in.load(), 1u);
+    EXPECT_EQ(receive(a).second["success"], true);
+
+    for (auto* client : {&b, &c}) {
+        json login;
+        login["type"] = "login";
+        login["username"] = client == &b ? "deflate_b" : "deflate_c";
+        login["password"] = "123456";
+        std::string str = login.dump();
+        protocols::WebSocketFrame plain;
+        plain.opcode = protocols::WebSocketOpcode::TEXT;
+        plain.payload = str;
+        HandleWebSocketMessage(client->conn, plain);
+        EXPECT_EQ(receive(*client).second["success"], true);
+    }
+
+    // B and C have stateless compressors with identical parameters: one compression serves both
+    uint64_t compressions = stats.compressions.load();
+    uint64_t messages_out = stats.messages_out.load();
+    json msg;
+    msg["type"] = "message";
+    msg["content"] = "compressed once, delivered to every stateless recipient";
+    std::string msg_str = msg.dump();
+    protocols::WebSocketFrame msg_frame;
+    msg_frame.opcode = protocols::WebSocketOpcode::TEXT;
+    msg_frame.payload = msg_str;
+    HandleWebSocketMessage(a.conn, msg_frame);
+
+    auto [wire_b, json_b] = receive(b);
+    auto [wire_c, json_c] = receive(c);
+    EXPECT_EQ(json_b["content"], msg["content"]);
+    EXPECT_EQ(json_c["content"], msg["content"]);
+    EXPECT_FALSE(wire_b.empty());
+    EXPECT_EQ(wire_b, wire_c);
+    EXPECT_EQ(stats.compressions.load() - compressions, 1u);
+    EXPECT_EQ(stats.messages_out.load() - messages_out, 2u);
+    // The short confirmation to A stays below ws_deflate_min_bytes and is sent uncompressed
+    auto [wire_a, json_a] = receive(a);
+    EXPECT_TRUE(wire_a.empty());
+    EXPECT_EQ(json_a["type"], "message_response");
+
+    for (auto* client : {&a, &b, &c}) {
+        client->conn->connectDestroyed();
+        close(client->fd);
+    }
+}
+
+TEST(ConnectionDirectoryTest, ReverseIndexAndRelogin) {
+    EventLoop loop;
+    auto conn = [&](const std::string& name) {
+        return std::make_shared<TcpConnection>(&loop, name, -1, InetAddress(0), InetAddress(0));
+    };
+    ConnectionDirectory directory(4);
+    EXPECT_EQ(directory.shardCount(), 4u);
+
+    auto alice1 = conn("alice-1");
+    auto bob = conn("bob");
+    directory.login(alice1, "alice");
+    directory.login(bob, "bob");
+    EXPECT_EQ(directory.usernameOf("alice-1"), "alice");
+    EXPECT_FALSE(directory.join("carol", "lobby"));
+    ASSERT_TRUE(directory.join("alice", "lobby"));
+    ASSERT_TRUE(directory.join("alice", "games"));
+    ASSERT_TRUE(directory.join("bob", "lobby"));
+    EXPECT_EQ(directory.roomConnections("lobby", "bob"), std::vector<TcpConnectionPtr>{alice1});
+    EXPECT_EQ(directory.allConnections("alice"), std::vector<TcpConnectionPtr>{bob});
+
+    // Logging in again elsewhere moves room deliveries; closing the stale connection keeps the user online
+    auto alice2 = conn("alice-2");
+    directory.login(alice2, "alice");
+    EXPECT_EQ(directory.roomConnections("games", ""), std::vector<TcpConnectionPtr>{alice2});
+    EXPECT_EQ(directory.remove(alice1), "");
+    EXPECT_EQ(directory.usernameOf("alice-1"), "");
+    EXPECT_EQ(directory.connectionOf("alice"), alice2);
+
+    EXPECT_EQ(directory.remove(alice2), "alice");
+    EXPECT_EQ(directory.connectionOf("alice"), nullptr);
+    EXPECT_TRUE(directory.roomConnections("games", "").empty());
+    EXPECT_EQ(directory.roomConnections("lobby", ""), std::vector<TcpConnectionPtr>{bob});
+    EXPECT_EQ(directory.userCount(), 1u);
+
+    directory.leave("bob", "lobby");
+    EXPECT_TRUE(directory.roomConnections("lobby", "").empty());
+    EXPECT_EQ(directory.remove(bob), "bob");
+    EXPECT_EQ(directory.userCount(), 0u);
+}
+
+TEST(ConnectionDirectoryTest, ConcurrentLookupsAndMembershipChanges) {
+    EventLoop loop;
+    ConnectionDirectory directory;
+    constexpr int kUsers = 64;
+    std::vector<TcpConnectionPtr> conns;
+    for (int i = 0; i < kUsers; ++i) {
+        conns.push_back(std::make_shared<TcpConnection>(&loop, "conn-" + std::to_string(i), -1, InetAddress(0),
+                                                        InetAddress(0)));
+        directory.login(conns[i], "user" + std::to_string(i));
+    }
+
+    // Writers churn room membership while readers resolve senders and room recipients
+    std::atomic<bool> stop{false};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&, t]() {
+            for (int round = 0; round < 200; ++round) {
+                for (int i = t; i < kUsers; i += 4) {
+                    std::string user = "user" + std::to_string(i);
+                    directory.join(user, "room" + std::to_string(round % 8));
+                    directory.leave(user, "room" + std::to_string((round + 4) % 8));
+                }
+            }
+        });
+    }
+    std::atomic<uint64_t> lookups{0};
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&, t]() {
+            while (!stop.load()) {
+                for (int i = 0; i < kUsers; ++i) {
+                    EXPECT_EQ(directory.usernameOf("conn-" + std::to_string(i)), "user" + std::to_string(i));
+                    for (const auto& c : directory.roomConnections("room" + std::to_string((i + t) % 8), "")) {
+                        EXPECT_NE(c, nullptr);
+                    }
+                    lookups++;
+                }
+            }
+        });
+    }
+    for (int t = 0; t < 4; ++t) {
+        threads[t].join();
+    }
+    stop = true;
+    for (std::size_t t = 4; t < threads.size(); ++t) {
+        threads[t].join();
+    }
+    EXPECT_GT(lookups.load(), 0u);
+
+    // Disconnects remove every remaining membership through the reverse index
+    for (int i = 0; i < kUsers; ++i) {
+        EXPECT_EQ(directory.remove(conns[i]), "user" + std::to_string(i));
+    }
+    for (int r = 0; r < 8; ++r) {
+        EXPECT_TRUE(directory.roomConnections("room" + std::to_string(r), "").empty());
+    }
+    uint64_t acquisitions = 0;
+    for (const auto& shard : directory.shardStats()) {
+        EXPECT_LE(shard.contended, shard.acquisitions);
+        acquisitions += shard.acquisitions;
+    }
+    EXPECT_GT(acquisitions, 0u);
+}
+
+TEST(UserDirectoryTest, ReportsEachChangedUserOnce) {
+    UserDirectory directory;
+    directory.load({{"a", 1}, {"b", 2}});
+    uint64_t loaded = directory.version();
+    EXPECT_EQ(directory.query(loaded, false, "", 0).entries.size(), 0u);
+
+    directory.setOnline("a", true);
+    directory.setOnline("a", false);
+    directory.setOnline("a", true);
+    directory.setOnline("a", true);      // no change
+    directory.setOnline("ghost", true);  // not registered
+    directory.addUser("c", 3);
+    EXPECT_EQ(directory.version(), loaded + 4);
+
+    auto delta = directory.query(loaded, false, "", 0);
+    ASSERT_EQ(delta.entries.size(), 2u);
+    EXPECT_EQ(delta.entries[0].username, "a");
+    EXPECT_TRUE(delta.entries[0].online);
+    EXPECT_EQ(delta.entries[1].user_id, 3);
+    EXPECT_EQ(directory.query(loaded + 3, false, "", 0).entries.size(), 1u);
+
+    auto online = directory.query(0, true, "", 0);
+    ASSERT_EQ(online.entries.size(), 1u);
+    EXPECT_EQ(online.entries[0].username, "a");
+
+    // A reload starts above every earlier version; those now mean "everything"
+    directory.load({{"a", 1}, {"b", 2}, {"c", 3}});
+    EXPECT_GT(directory.version(), loaded + 4);
+    EXPECT_EQ(directory.query(loaded + 4, false, "", 0).entries.size(), 3u);
+}
+
+TEST(DatabaseManagerDeathTest, NoAccessFromInlineHandlers) {
+    GTEST_FLAG_SET(death_test_style, "threadsafe");
+    EXPECT_DEBUG_DEATH({
+        DatabaseManager::NoAccessScope scope;
+        DatabaseManager::instance();
+    }, "inline");
+}
+
+TEST(MessageCacheTest, MatchesDatabaseOrFallsBack) {
+    SqliteDatabase db;
+    DatabaseConfig config;
+    config.path = ":memory:";
+    ASSERT_TRUE(db.init(config));
+
+    // Window of 3 per channel; the busy room overflows, the quiet room and the DM do not
+    MessageCache cache;
+    cache.reset(3, {}, true);
+    auto add = [&](const std::string& user, const std::string& room, const std::string& target) {
+        ChatMessage msg;
+        msg.username = user;
+        msg.content = "c";
+        msg.timestamp = "t";
+        msg.room_id = room;
+        msg.target_user = target;
+        ASSERT_TRUE(db.addMessage(msg));
+        cache.append(msg);
+    };
+    add("alice", "quiet", "");
+    add("alice", "", "bob");
+    for (int i = 0; i < 5; ++i) {
+        add("carol", "busy", "");
+    }
+    add("bob", "", "");
+    add("carol", "", "dave");
+
+    auto same = [](const std::vector<ChatMessage>& a, const std::vector<ChatMessage>& b) {
+        if (a.size() != b.size()) return false;
+        for (std::size_t i = 0; i < a.size(); ++i) {
+            if (a[i].id != b[i].id || a[i].room_id != b[i].room_id || a[i].target_user != b[i].target_user) {
+                return false;
+            }
+        }
+        return true;
+    };
+
+    int hits = 0;
+    for (const std::string user : {"", "alice", "bob", "dave", "nobody"}) {
+        for (long long after = 0; after <= 10; ++after) {
+            for (int limit : {0, 1, 2, 5}) {
+                std::vector<ChatMessage> cached;
+                if (cache.messagesAfter(after, user, limit, cached)) {
+                    ++hits;
+                    EXPECT_TRUE(same(cached, db.getMessagesAfter(after, user, limit))) << user << " " << after;
+                }
+            }
+        }
+        for (int limit : {1, 3, 4, 20}) {
+            std::vector<ChatMessage> cached;
+            if (cache.history(limit, user, cached)) {
+                ++hits;
+                EXPECT_TRUE(same(cached, db.getHistory(limit, user))) << user << " " << limit;
+            }
+        }
+    }
+    EXPECT_GT(hits, 0);
+    EXPECT_EQ(cache.stats().hits.load(), static_cast<uint64_t>(hits));
+    EXPECT_EQ(cache.stats().evictions.load(), 2u);
+
+    // Ids 3 and 4 were evicted from the busy room: older cursors must go to the database
+    std::vector<ChatMessage> cached;
+    EXPECT_FALSE(cache.messagesAfter(3, "alice", 0, cached));
+    EXPECT_TRUE(cache.messagesAfter(4, "alice", 0, cached));
+    EXPECT_FALSE(cache.history(20, "alice", cached));
+
+    // Warm-up from a partial load only covers what was loaded
+    cache.reset(3, db.getRecentMessages(3), false);
+    EXPECT_FALSE(cache.messagesAfter(5, "", 0, cached));
+    EXPECT_TRUE(cache.messagesAfter(6, "", 0, cached));
+    EXPECT_TRUE(same(cached, db.getMessagesAfter(6, "", 0)));
+}
+
+TEST(SearchIndexTest, TokenizesCjkAndMatchesAllTerms) {
+    using Tokens = std::vector<std::string>;
+    EXPECT_EQ(SearchIndex::tokenize("Hello, World-42!"), (Tokens{"hello", "world", "42"}));
+    EXPECT_EQ(SearchIndex::tokenize("你好世界"), (Tokens{"你", "好", "世", "界", "你好", "好世", "世界"}));
+    EXPECT_EQ(SearchIndex::tokenize("你好世界", true), (Tokens{"世界", "你好", "好世"}));
+    EXPECT_EQ(SearchIndex::tokenize("去 KTV唱歌。好", true), (Tokens{"ktv", "去", "唱歌", "好"}));
+
+    SearchIndex index;
+    index.clear();
+    auto add = [&index](long long id, const std::string& user, const std::string& content, const std::string& room,
+                        const std::string& target = "") {
+        ChatMessage msg;
+        msg.id = id;
+        msg.username = user;
+        msg.content = content;
+        msg.room_id = room;
+        msg.target_user = target;
+        msg.timestamp = "2026-10-" + std::to_string(10 + id) + " 08:00:00";
+        index.add(msg);
+    };
+    add(1, "alice", "Release notes for version 2", "dev");
+    add(2, "bob", "release release release", "dev");
+    add(3, "bob", "the release is out", "");
+    add(4, "carol", "release to alice only", "", "alice");
+    add(5, "alice", "我们今天发布新版本", "dev");
+
+    auto ids = [&index](SearchIndex::Query query) {
+        std::vector<long long> out;
+        for (const auto& hit : index.search(query)) out.push_back(hit.id);
+        return out;
+    };
+    SearchIndex::Query query;
+    query.text = "RELEASE";
+    EXPECT_EQ(ids(query), (std::vector<long long>{2, 3, 1}));
+    query.viewer = "alice";
+    EXPECT_EQ(ids(query).size(), 4u);
+    query.limit = 2;
+    EXPECT_EQ(ids(query), (std::vector<long long>{2, 4}));
+
+    query = SearchIndex::Query{};
+    query.text = "release notes";
+    EXPECT_EQ(ids(query), (std::vector<long long>{1}));
+    query.text = "release";
+    query.room = "";
+    EXPECT_EQ(ids(query), (std::vector<long long>{3}));
+    query.room.reset();
+    query.sender = "bob";
+    query.start = "2026-10-13";
+    EXPECT_EQ(ids(query), (std::vector<long long>{3}));
+    query.sender = "nobody";
+    EXPECT_TRUE(ids(query).empty());
+
+    query = SearchIndex::Query{};
+    query.text = "发布";
+    EXPECT_EQ(ids(query), (std::vector<long long>{5}));
+    query.text = "布新";
+    EXPECT_EQ(ids(query), (std::vector<long long>{5}));
+    query.text = "新";
+    EXPECT_EQ(ids(query), (std::vector<long long>{5}));
+    query.text = "发新";
+    EXPECT_TRUE(ids(query).empty());
+
+    EXPECT_EQ(index.stats().documents.load(), 5u);
+    EXPECT_GT(index.stats().posting_bytes.load(), 0u);
+}
+
+TEST(DatabaseManagerTest, SearchIndexRebuiltFromDatabase) {
+    const std::string path = ::testing::TempDir() + "search_rebuild_test.db";
+    auto removeFiles = [&path]() {
+        for (const char* suffix : {"", "-wal", "-shm"}) {
+            std::remove((path + suffix).c_str());
+        }
+    };
+    removeFiles();
+
+    DatabaseConfig config;
+    config.path = path;
+    auto& manager = DatabaseManager::instance();
+    ASSERT_TRUE(manager.init(config));
+    for (int i = 0; i < 30; ++i) {
+        ChatMessage msg;
+        msg.username = i % 2 ? "alice" : "bob";
+        msg.content = i % 10 == 0 ? "搜索引擎 " + std::to_string(i) : "闲聊 " + std::to_string(i);
+        msg.timestamp = "2026-10-18 12:00:00";
+        msg.target_user = i == 20 ? "alice" : "";
+        ASSERT_TRUE(manager.addMessage(msg));
+    }
+
+    // A fresh init reads every message back, private ones included
+    ASSERT_TRUE(manager.init(config));
+    EXPECT_EQ(manager.searchStats().documents.load(), 30u);
+    SearchIndex::Query query;
+    query.text = "搜索";
+    EXPECT_EQ(manager.search(query).size(), 2u);
+    query.viewer = "alice";
+    auto results = manager.search(query);
+    ASSERT_EQ(results.size(), 3u);
+    for (const auto& result : results) {
+        EXPECT_EQ(result.message.content.rfind("搜索引擎", 0), 0u);
+        EXPECT_GT(result.score, 0.0);
+    }
+
+    config.search_index = false;
+    ASSERT_TRUE(manager.init(config));
+    EXPECT_TRUE(manager.search(query).empty());
+
+    config.path = ":memory:";
+    ASSERT_TRUE(manager.init(config));
+    removeFiles();
+}
+
+TEST(SqliteDatabaseTest, WalReadersRunAlongsideWriter) {
+    const std::string path = ::testing::TempDir() + "sqlite_wal_test.db";
+    auto removeFiles = [&path]() {
+        for (const char* suffix : {"", "-wal", "-shm"}) {
+            std::remove((path + suffix).c_str());
+        }
+    };
+    removeFiles();
+
+    DatabaseConfig config;
+    config.path = path;
+    config.sqlite_readers = 2;
+    std::vector<ChatMessage> tuned_history;
+    {
+        SqliteDatabase db;
+        ASSERT_TRUE(db.init(config));
+        EXPECT_EQ(db.readerCount(), 2u);
+
+        constexpr int kBatches = 20;
+        constexpr int kBatchSize = 50;
+        std::atomic<bool> writing{true};
+        std::atomic<int> bad_snapshots{0};
+        std::vector<std::thread> readers;
+        for (int r = 0; r < 4; ++r) {
+            readers.emplace_back([&]() {
+                std::size_t last_seen = 0;
+                while (writing.load()) {
+                    // Every read sees a whole number of committed batches, never fewer than before
+                    auto rows = db.getMessagesAfter(0, "", 0);
+                    if (rows.size() % kBatchSize != 0 || rows.size() < last_seen) {
+                        ++bad_snapshots;
+                    }
+                    for (std::size_t i = 0; i < rows.size(); ++i) {
+                        if (rows[i].id != static_cast<long long>(i + 1)) {
+                            ++bad_snapshots;
+                            break;
+                        }
+                    }
+                    last_seen = rows.size();
+                }
+            });
+        }
+        long long next_id = 1;
+        for (int b = 0; b < kBatches; ++b) {
+            std::vector<ChatMessage> batch(kBatchSize);
+            for (auto& msg : batch) {
+                msg.id = next_id++;
+                msg.username = "alice";
+                msg.content = "c";
+                msg.timestamp = "t";
+                msg.room_id = b % 2 ? "room" : "";
+            }
+            ASSERT_TRUE(db.addMessages(batch));
+        }
+        writing = false;
+        for (auto& reader : readers) {
+            reader.join();
+        }
+        EXPECT_EQ(bad_snapshots.load(), 0);
+        EXPECT_EQ(db.getMessageCount(), kBatches * kBatchSize);
+        ASSERT_TRUE(db.addUser("bob", "pw"));
+        EXPECT_TRUE(db.validateUser("bob", "pw"));
+        tuned_history = db.getHistory(30, "bob");
+    }
+
+    // Same answers with every tuning switched off (single connection, rollback journal)
+    DatabaseConfig plain = config;
+    plain.sqlite_wal = false;
+    plain.sqlite_readers = 0;
+    plain.sqlite_mmap_bytes = 0;
+    plain.sqlite_statement_cache = false;
+    {
+        SqliteDatabase db;
+        ASSERT_TRUE(db.init(plain));
+        EXPECT_EQ(db.readerCount(), 0u);
+        auto history = db.getHistory(30, "bob");
+        ASSERT_EQ(history.size(), tuned_history.size());
+        for (std::size_t i = 0; i < history.size(); ++i) {
+            EXPECT_EQ(history[i].id, tuned_history[i].id);
+        }
+        EXPECT_TRUE(db.userExists("bob"));
+    }
+    removeFiles();
+}
+
+TEST(SqliteDatabaseTest, MigrationsAddIndexesForKeysetHistory) {
+    const std::string path = ::testing::TempDir() + "sqlite_migration_test.db";
+    auto removeFiles = [&path]() {
+        for (const char* suffix : {"", "-wal", "-shm"}) {
+            std::remove((path + suffix).c_str());
+        }
+    };
+    removeFiles();
+
+    // A database from before schema versioning: bare table, user_version 0
+    sqlite3* raw = nullptr;
+    ASSERT_EQ(sqlite3_open(path.c_str(), &raw), SQLITE_OK);
+    ASSERT_EQ(sqlite3_exec(raw, "CREATE TABLE messages (id INTEGER PRIMARY KEY AUTOINCREMENT, username TEXT NOT NULL, "
+                                "content TEXT NOT NULL, timestamp TEXT NOT NULL, target_user TEXT, room_id TEXT);"
+                                "INSERT INTO messages (username, content, timestamp) VALUES ('old', 'kept', 't');",
+                           0, 0, 0), SQLITE_OK);
+    sqlite3_close(raw);
+
+    DatabaseConfig config;
+    config.path = path;
+    {
+        SqliteDatabase db;
+        ASSERT_TRUE(db.init(config));
+        EXPECT_EQ(db.getMessageCount(), 1);
+
+        // ids 2..61: room r1 every third message, alice<->bob DMs, and noise around them
+        std::vector<ChatMessage> batch;
+        for (long long id = 2; id <= 61; ++id) {
+            ChatMessage msg;
+            msg.id = id;
+            msg.timestamp = "t";
+            msg.content = std::to_string(id);
+            switch (id % 3) {
+                case 0: msg.username = "carol"; msg.room_id = "r1"; break;
+                case 1: msg.username = id % 2 ? "alice" : "bob"; msg.target_user = id % 2 ? "bob" : "alice"; break;
+                default: msg.username = "alice"; msg.target_user = "carol"; break;
+            }
+            batch.push_back(msg);
+        }
+        ASSERT_TRUE(db.addMessages(batch));
+
+        // Newest page first, then walk back with before=<oldest id of the page>
+        std::vector<long long> seen;
+        HistoryCursor cursor;
+        cursor.limit = 8;
+        for (;;) {
+            auto page = db.getRoomHistory("r1", cursor);
+            for (auto it = page.rbegin(); it != page.rend(); ++it) {
+                EXPECT_EQ(it->room_id, "r1");
+                seen.push_back(it->id);
+            }
+            if (static_cast<int>(page.size()) < cursor.limit) break;
+            cursor.before = page.front().id;
+        }
+        ASSERT_EQ(seen.size(), 20u);
+        EXPECT_EQ(seen.front(), 60);
+        EXPECT_EQ(seen.back(), 3);
+        EXPECT_TRUE(std::is_sorted(seen.rbegin(), seen.rend()));
+
+        HistoryCursor forward;
+        forward.after = 30;
+        forward.limit = 3;
+        auto next = db.getRoomHistory("r1", forward);
+        ASSERT_EQ(next.size(), 3u);
+        EXPECT_EQ(next.front().id, 33);
+        EXPECT_EQ(next.back().id, 39);
+
+        // Both directions of the conversation, in id order, and nothing sent to carol
+        HistoryCursor dm;
+        dm.limit = 5;
+        auto conversation = db.getConversationHistory("bob", "alice", dm);
+        ASSERT_EQ(conversation.size(), 5u);
+        EXPECT_EQ(conversation.back().id, 61);
+        for (std::size_t i = 1; i < conversation.size(); ++i) {
+            EXPECT_EQ(conversation[i].id - conversation[i - 1].id, 3);
+        }
+        dm.before = 10;
+        dm.after = 3;
+        auto window = db.getConversationHistory("alice", "bob", dm);
+        ASSERT_EQ(window.size(), 2u);
+        EXPECT_EQ(window[0].id, 4);
+        EXPECT_EQ(window[1].id, 7);
+        EXPECT_TRUE(db.getConversationHistory("bob", "carol", dm).empty());
+    }
+
+    ASSERT_EQ(sqlite3_open(path.c_str(), &raw), SQLITE_OK);
+    sqlite3_stmt* stmt = nullptr;
+    ASSERT_EQ(sqlite3_prepare_v2(raw, "PRAGMA user_version;", -1, &stmt, 0), SQLITE_OK);
+    ASSERT_EQ(sqlite3_step(stmt), SQLITE_ROW);
+    EXPECT_EQ(sqlite3_column_int(stmt, 0), 2);
+    sqlite3_finalize(stmt);
+
+    // The room page is an index range scan, not a table scan
+    ASSERT_EQ(sqlite3_prepare_v2(raw, "EXPLAIN QUERY PLAN SELECT id FROM messages WHERE room_id = 'r1' AND id > 0 "
+                                      "AND id < 100 ORDER BY id DESC LIMIT 8;", -1, &stmt, 0), SQLITE_OK);
+    std::string plan;
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        plan += reinterpret_cast<const char*>(sqlite3_column_text(stmt, 3));
+    }
+    sqlite3_finalize(stmt);
+    sqlite3_close(raw);
+    EXPECT_NE(plan.find("idx_messages_room"), std::string::npos) << plan;
+    removeFiles();
+}
+
+TEST(SqliteDatabaseTest, MessageStatsSeededByMigrationAndKeptByInserts) {
+    const std::string path = ::testing::TempDir() + "sqlite_stats_test.db";
+    auto removeFiles = [&path]() {
+        for (const char* suffix : {"", "-wal", "-shm"}) {
+            std::remove((path + suffix).c_str());
+        }
+    };
+    removeFiles();
+
+    // Rows written before the counters existed are counted once by the migration
+    sqlite3* raw = nullptr;
+    ASSERT_EQ(sqlite3_open(path.c_str(), &raw), SQLITE_OK);
+    ASSERT_EQ(sqlite3_exec(raw, "CREATE TABLE messages (id INTEGER PRIMARY KEY AUTOINCREMENT, username TEXT NOT NULL, "
+                                "content TEXT NOT NULL, timestamp TEXT NOT NULL, target_user TEXT, room_id TEXT);"
+                                "INSERT INTO messages (username, content, timestamp, room_id) VALUES ('old', 'a', 't', 'r1');"
+                                "INSERT INTO messages (username, content, timestamp, room_id) VALUES ('old', 'b', 't', 'r1');"
+                                "INSERT INTO messages (username, content, timestamp, target_user) VALUES ('bob', 'c', 't', 'old');",
+                           0, 0, 0), SQLITE_OK);
+    sqlite3_close(raw);
+
+    DatabaseConfig config;
+    config.path = path;
+    {
+        SqliteDatabase db;
+        ASSERT_TRUE(db.init(config));
+        EXPECT_EQ(db.getMessageCount(), 3);
+        EXPECT_EQ(db.getRoomMessageCount("r1"), 2);
+        EXPECT_EQ(db.getRoomMessageCount(""), 0); // the DM is not a room message
+        EXPECT_EQ(db.getUserMessageCount("old"), 2);
+        EXPECT_EQ(db.getUserMessageCount("bob"), 1);
+
+        std::vector<ChatMessage> batch;
+        for (long long id = 4; id <= 13; ++id) {
+            ChatMessage msg;
+            msg.id = id;
+            msg.username = id % 2 ? "alice" : "bob";
+            msg.content = "m";
+            msg.timestamp = "t";
+            msg.room_id = id % 5 ? "r1" : "r2";
+            batch.push_back(msg);
+        }
+        ASSERT_TRUE(db.addMessages(batch));
+
+        // A rejected batch leaves the counters alone
+        std::vector<ChatMessage> duplicate(batch.begin(), batch.begin() + 1);
+        EXPECT_FALSE(db.addMessages(duplicate));
+
+        ChatMessage single;
+        single.username = "alice";
+        single.content = "x";
+        single.timestamp = "t";
+        ASSERT_TRUE(db.addMessage(single));
+
+        EXPECT_EQ(db.getMessageCount(), 14);
+        EXPECT_EQ(db.getRoomMessageCount("r1"), 10);
+        EXPECT_EQ(db.getRoomMessageCount("r2"), 2);
+        EXPECT_EQ(db.getRoomMessageCount(""), 1);
+        EXPECT_EQ(db.getUserMessageCount("alice"), 6);
+        EXPECT_EQ(db.getUserMessageCount("nobody"), 0);
+    }
+
+    // Persisted: a restart reads the table instead of counting rows
+    {
+        SqliteDatabase db;
+        ASSERT_TRUE(db.init(config));
+        EXPECT_EQ(db.getMessageCount(), 14);
+        EXPECT_EQ(db.getRoomMessageCount("r1"), 10);
+        EXPECT_EQ(db.getUserMessageCount("bob"), 6);
+    }
+
+    ASSERT_EQ(sqlite3_open(path.c_str(), &raw), SQLITE_OK);
+    sqlite3_stmt* stmt = nullptr;
+    ASSERT_EQ(sqlite3_prepare_v2(raw, "SELECT count FROM message_stats WHERE scope = 'total';", -1, &stmt, 0),
+              SQLITE_OK);
+    ASSERT_EQ(sqlite3_step(stmt), SQLITE_ROW);
+    EXPECT_EQ(sqlite3_column_int64(stmt, 0), 14);
+    sqlite3_finalize(stmt);
+    sqlite3_close(raw);
+    removeFiles();
+}
+
+TEST(MessageWriterTest, ConcurrentSendersShareCommits) {
+    auto db = std::make_shared<SqliteDatabase>();
+    DatabaseConfig config;
+    config.path = ":memory:";
+    ASSERT_TRUE(db->init(config));
+
+    MessageWriter::Stats stats;
+    constexpr int kThreads = 8;
+    constexpr int kPerThread = 50;
+    {
+        MessageWriter writer(db, std::chrono::milliseconds(2), 64, stats);
+        std::mutex id_mutex;
+        long long next_id = 1;
+        std::atomic<int> stored{0};
+        std::vector<std::thread> senders;
+        for (int t = 0; t < kThreads; ++t) {
+            senders.emplace_back([&, t]() {
+                for (int i = 0; i < kPerThread; ++i) {
+                    ChatMessage msg;
+                    msg.username = "user" + std::to_string(t);
+                    msg.content = std::to_string(i);
+                    msg.timestamp = "t";
+                    std::shared_ptr<const MessageWriter::Ticket> ticket;
+                    {
+                        // Ids are handed out and submitted in the same order
+                        std::lock_guard<std::mutex> lock(id_mutex);
+                        msg.id = next_id++;
+                        ticket = writer.submit(msg);
+                    }
+                    if (writer.wait(ticket)) {
+                        ++stored;
+                    }
+                }
+            });
+        }
+        for (auto& sender : senders) {
+            sender.join();
+        }
+        EXPECT_EQ(stored.load(), kThreads * kPerThread);
+    }
+
+    EXPECT_EQ(stats.messages.load(), static_cast<uint64_t>(kThreads * kPerThread));
+    EXPECT_LT(stats.batches.load(), stats.messages.load());
+    EXPECT_EQ(stats.failures.load(), 0u);
+    EXPECT_EQ(stats.queued.load(), 0u);
+
+    auto rows = db->getMessagesAfter(0, "", 0);
+    ASSERT_EQ(rows.size(), static_cast<std::size_t>(kThreads * kPerThread));
+    for (std::size_t i = 0; i < rows.size(); ++i) {
+        EXPECT_EQ(rows[i].id, static_cast<long long>(i + 1));
+    }
+}
+
+TEST(MessageWriterTest, DestructorStoresQueuedMessages) {
+    auto db = std::make_shared<SqliteDatabase>();
+    DatabaseConfig config;
+    config.path = ":memory:";
+    ASSERT_TRUE(db->init(config));
+
+    MessageWriter::Stats stats;
+    {
+        // Long window: nothing would be stored before the writer goes away
+        MessageWriter writer(db, std::chrono::seconds(60), 1000, stats);
+        for (long long id = 1; id <= 10; ++id) {
+            ChatMessage msg;
+            msg.id = id;
+            msg.username = "alice";
+            msg.content = "c";
+            msg.timestamp = "t";
+            writer.submit(msg);
+        }
+    }
+    EXPECT_EQ(db->getMessageCount(), 10);
+    EXPECT_EQ(stats.batches.load(), 1u);
+}
+
+TEST(MessageWriterTest, CallbacksRunAfterCommit) {
+    auto db = std::make_shared<SqliteDatabase>();
+    DatabaseConfig config;
+    config.path = ":memory:";
+    ASSERT_TRUE(db->init(config));
+
+    MessageWriter::Stats stats;
+    MessageWriter writer(db, std::chrono::milliseconds(2), 64, stats);
+    std::promise<long long> stored_count;
+    for (long long id = 1; id <= 3; ++id) {
+        ChatMessage msg;
+        msg.id = id;
+        msg.username = "alice";
+        msg.content = "c";
+        msg.timestamp = "t";
+        writer.submit(msg, [&stored_count, db, id](bool ok) {
+            if (id == 3) stored_count.set_value(ok ? db->getMessageCount() : -1);
+        });
+    }
+    EXPECT_EQ(stored_count.get_future().get(), 3);
+}
+
+TEST(MessageWriterTest, FailedTransactionIsNeitherPublishedNorReportedStored) {
+    auto db = std::make_shared<SqliteDatabase>();
+    DatabaseConfig config;
+    config.path = ":memory:";
+    ASSERT_TRUE(db->init(config));
+    auto message = [](long long id) {
+        ChatMessage msg;
+        msg.id = id;
+        msg.username = "alice";
+        msg.content = "c";
+        msg.timestamp = "t";
+        return msg;
+    };
+    // Id 3 is taken, so the transaction holding 3 and 4 is rejected
+    ASSERT_TRUE(db->addMessages({message(3)}));
+
+    MessageWriter::Stats stats;
+    std::vector<long long> published;
+    std::map<long long, bool> results;
+    {
+        // All five gather into one batch, stored two per transaction: {1,2} {3,4} {5}
+        MessageWriter writer(db, std::chrono::milliseconds(200), 2, stats,
+                             [&published](const std::vector<ChatMessage>& msgs) {
+                                 for (const auto& msg : msgs) published.push_back(msg.id);
+                             });
+        std::vector<std::shared_ptr<const MessageWriter::Ticket>> tickets;
+        for (long long id = 1; id <= 5; ++id) {
+            tickets.push_back(writer.submit(message(id)));
+        }
+        for (long long id = 1; id <= 5; ++id) {
+            results[id] = writer.wait(tickets[id - 1]);
+        }
+    }
+    EXPECT_EQ(published, (std::vector<long long>{1, 2, 5}));
+    EXPECT_EQ(results, (std::map<long long, bool>{{1, true}, {2, true}, {3, false}, {4, false}, {5, true}}));
+    EXPECT_EQ(stats.failures.load(), 1u);
+    EXPECT_EQ(db->getMessageCount(), 4);
+}
+
+TEST(DatabaseManagerTest, AsyncCallsCompleteOnCallerLoop) {
+    DatabaseConfig config;
+    config.path = ":memory:";
+    auto& manager = DatabaseManager::instance();
+    ASSERT_TRUE(manager.init(config));
+
+    // Future form
+    EXPECT_TRUE(manager.async([](DatabaseManager& db) { return db.addUser("async_user", "pw"); }).get());
+    auto failing = manager.async([](DatabaseManager&) -> int { throw std::runtime_error("boom"); });
+    EXPECT_THROW(failing.get(), std::runtime_error);
+
+    EventLoopThread loop_thread;
+    EventLoop* loop = loop_thread.startLoop();
+    auto on_loop = [loop](std::function<void()> fn) { loop->queueInLoop(std::move(fn)); };
+
+    // Callback form: the query runs elsewhere, the completion on the given loop
+    std::promise<std::pair<long long, bool>> user_id;
+    manager.async([](DatabaseManager& db) { return db.getUserId("async_user"); }, on_loop,
+                  [&user_id, loop](long long id) { user_id.set_value({id, loop->isInLoopThread()}); });
+    auto [id, on_loop_thread] = user_id.get_future().get();
+    EXPECT_GT(id, 0);
+    EXPECT_TRUE(on_loop_thread);
+
+    // Ids are assigned synchronously; done runs on the loop after the commit
+    std::promise<std::pair<bool, long long>> stored;
+    ChatMessage msg;
+    msg.username = "async_user";
+    msg.content = "hello";
+    msg.timestamp = "t";
+    ASSERT_TRUE(manager.addMessageAsync(msg, on_loop, [&stored, loop](bool ok) {
+        stored.set_value({ok && loop->isInLoopThread(), DatabaseManager::instance().getMessageCount()});
+    }));
+    EXPECT_GT(msg.id, 0);
+    auto [ok, count] = stored.get_future().get();
+    EXPECT_TRUE(ok);
+    EXPECT_EQ(count, 1);
+
+    // Concurrent queries spread over the query threads
+    std::vector<std::future<bool>> checks;
+    for (int i = 0; i < 32; ++i) {
+        checks.push_back(manager.async([](DatabaseManager& db) { return db.validateUser("async_user", "pw"); }));
+    }
+    for (auto& check : checks) {
+        EXPECT_TRUE(check.get());
+    }
+    EXPECT_GE(manager.asyncStats().tasks.load(), 35u);
+}
@@ -1,8 +1,13 @@
 #include <gtest/gtest.h>
 #include "net/event_loop.h"
 #include "net/channel.h"
+#include "net/inet_address.h"
+#include "net/io_stats.h"
+#include "net/tcp_connection.h"
 #include <sys/eventfd.h>
+#include <sys/socket.h>
 #include <unistd.h>
+#include <string>
 #include <thread>
 #include <atomic>
 #include <chrono>
@@ -78,3 +83,105 @@ TEST_F(EventLoopTest, QueueInLoopCrossThread) {
     t.join();
     EXPECT_TRUE(ran);
 }
+
+namespace {
+
+std::string readAvailable(int fd) {
+    std::string data;
+    char buf[4096];
+    ssize_t n;
+    while ((n = ::recv(fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0) {
+        data.append(buf, static_cast<size_t>(n));
+    }
+    return data;
+}
+
+} // namespace
+
+TEST_F(EventLoopTest, CoalescedWritesFlushOncePerIteration) {
+    EventLoop loop;
+    int fds[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    auto conn = std::make_shared<TcpConnection>(&loop, "coalesce", fds[0], InetAddress(0), InetAddress(0));
+    conn->setWriteCoalescing(true);
+    conn->connectEstablished();
+    auto& stats = NetIoStats::instance();
+
+    // Sends made while dispatching one iteration go out in a single writev, in order
+    uint64_t writes_before = stats.write_calls.load();
+    auto shared = std::make_shared<const std::string>("[shared]");
+    loop.queueInLoop([&]() {
+        for (int i = 0; i < 10; ++i) {
+            conn->send("m" + std::to_string(i) + ";");
+            if (i == 4) {
+                conn->send(shared);
+            }
+        }
+        loop.stop();
+    });
+    loop.wakeup();  // queued from the loop thread before loop(), so poll() would otherwise wait
+    loop.loop();
+    EXPECT_EQ(stats.write_calls.load() - writes_before, 1u);
+    EXPECT_EQ(readAvailable(fds[1]), "m0;m1;m2;m3;m4;[shared]m5;m6;m7;m8;m9;");
+
+    // A burst from another thread is one mailbox task, one wakeup and one write
+    writes_before = stats.write_calls.load();
+    uint64_t wakeups_before = stats.wakeups.load();
+    std::thread sender([&]() {
+        for (int i = 0; i < 100; ++i) {
+            conn->send(std::string(1, static_cast<char>('a' + i % 26)));
+        }
+    });
+    sender.join();
+    loop.queueInLoop([&]() { loop.stop(); });
+    loop.loop();
+    EXPECT_EQ(stats.write_calls.load() - writes_before, 1u);
+    EXPECT_LE(stats.wakeups.load() - wakeups_before, 1u);
+    std::string expected;
+    for (int i = 0; i < 100; ++i) {
+        expected.push_back(static_cast<char>('a' + i % 26));
+    }
+    EXPECT_EQ(readAvailable(fds[1]), expected);
+
+    // shutdown() flushes what is still queued before sending FIN
+    loop.queueInLoop([&]() {
+        conn->send("bye");
+        conn->shutdown();
+        loop.stop();
+    });
+    loop.wakeup();
+    loop.loop();
+    char buf[16];
+    ASSERT_EQ(::recv(fds[1], buf, sizeof(buf), 0), 3);
+    EXPECT_EQ(std::string(buf, 3), "bye");
+    EXPECT_EQ(::recv(fds[1], buf, sizeof(buf), 0), 0);
+
+    conn->connectDestroyed();
+    ::close(fds[0]);
+    ::close(fds[1]);
+}
+
+TEST_F(EventLoopTest, ForceCloseSendsCoalescedReplyFirst) {
+    EventLoop loop;
+    int fds[2];
+    // Non-blocking like an accepted socket: handleRead reads until EAGAIN
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds), 0);
+    auto conn = std::make_shared<TcpConnection>(&loop, "force-close", fds[0], InetAddress(0), InetAddress(0));
+    conn->setWriteCoalescing(true);
+    // Reject the request and close from the read handler, as HttpServer does for a malformed request
+    conn->setMessageCallback([](const TcpConnectionPtr& c, Buffer* buf, Timestamp) {
+        buf->retrieveAll();
+        c->send("HTTP/1.1 400 Bad Request\r\n\r\n");
+        c->forceClose();
+    });
+    conn->setCloseCallback([&loop](const TcpConnectionPtr&) { loop.stop(); });
+    conn->connectEstablished();
+
+    ASSERT_EQ(::write(fds[1], "NOT_HTTP_REQUEST\r\n\r\n", 20), 20);
+    loop.loop();
+    EXPECT_EQ(readAvailable(fds[1]), "HTTP/1.1 400 Bad Request\r\n\r\n");
+
+    conn->connectDestroyed();
+    ::close(fds[0]);
+    ::close(fds[1]);
+}
@@ -0,0 +1,297 @@
+#include <gtest/gtest.h>
+#include "log_database.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+std::string readFile(const fs::path& path) {
+    std::ifstream in(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+// Offset just past the last record: records are [u32 length][u32 crc][payload], then zero fill
+std::size_t recordsEnd(const std::string& data) {
+    std::size_t offset = 0;
+    while (offset + 8 <= data.size()) {
+        uint32_t len = 0;
+        for (int i = 0; i < 4; ++i) {
+            len |= static_cast<uint32_t>(static_cast<uint8_t>(data[offset + i])) << (8 * i);
+        }
+        if (len == 0) break;
+        offset += 8 + len;
+    }
+    return offset;
+}
+
+} // namespace
+
+class LogDatabaseTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        char dir_template[] = "/tmp/chatroom_log_XXXXXX";
+        ASSERT_NE(mkdtemp(dir_template), nullptr);
+        dir_ = dir_template;
+    }
+
+    void TearDown() override {
+        std::error_code ec;
+        fs::remove_all(dir_, ec);
+    }
+
+    DatabaseConfig config(long long segment_bytes = 1 << 20) const {
+        DatabaseConfig config;
+        config.type = "log";
+        config.log_dir = dir_;
+        config.log_segment_bytes = segment_bytes;
+        config.log_index_interval = 4;
+        config.durability = "batched";
+        return config;
+    }
+
+    // Same shape as MysqlDatabaseTest: every 10th message is alice -> bob, every 3rd is in "general"
+    static std::vector<ChatMessage> messages(long long first, long long last) {
+        std::vector<ChatMessage> batch;
+        for (long long id = first; id <= last; ++id) {
+            ChatMessage msg;
+            msg.id = id;
+            msg.username = id % 10 == 0 ? "alice" : "bob";
+            msg.content = id % 7 == 0 ? std::string(500, 'x') : "m" + std::to_string(id);
+            msg.timestamp = "2026-10-18 12:00:00";
+            msg.target_user = id % 10 == 0 ? "bob" : "";
+            msg.room_id = id % 3 == 0 ? "general" : "";
+            batch.push_back(msg);
+        }
+        return batch;
+    }
+
+    std::vector<fs::path> segmentFiles() const {
+        std::vector<fs::path> files;
+        for (const auto& entry : fs::directory_iterator(dir_)) {
+            if (entry.path().extension() == ".seg") files.push_back(entry.path());
+        }
+        std::sort(files.begin(), files.end());
+        return files;
+    }
+
+    std::string dir_;
+};
+
+TEST_F(LogDatabaseTest, QueriesMatchSqlSemantics) {
+    LogDatabase db;
+    ASSERT_TRUE(db.init(config()));
+
+    ASSERT_TRUE(db.addUser("alice", "pw"));
+    EXPECT_FALSE(db.addUser("alice", "again"));
+    EXPECT_TRUE(db.validateUser("alice", "pw"));
+    EXPECT_FALSE(db.validateUser("alice", "nope"));
+    EXPECT_EQ(db.getUserId("alice"), 1);
+    EXPECT_EQ(db.getUserId("nobody"), -1);
+
+    ASSERT_TRUE(db.addMessages(messages(1, 250)));
+    EXPECT_EQ(db.getMessageCount(), 250);
+
+    auto pub = db.getMessagesAfter(0, "", 0);
+    ASSERT_EQ(pub.size(), 225u);
+    EXPECT_EQ(pub[6].id, 7);
+    EXPECT_EQ(pub[6].content.size(), 500u);
+    EXPECT_EQ(pub[2].room_id, "general");
+    EXPECT_EQ(db.getMessagesAfter(240, "bob", 0).size(), 10u);
+    EXPECT_EQ(db.getMessagesAfter(0, "", 5).back().id, 5);
+    EXPECT_EQ(db.getMessagesAfter(101, "", 1).front().id, 102);
+
+    auto history = db.getHistory(3, "bob");
+    ASSERT_EQ(history.size(), 3u);
+    EXPECT_EQ(history.back().id, 250);
+    EXPECT_EQ(history.back().target_user, "bob");
+    EXPECT_EQ(db.getHistory(2, "").back().id, 249);
+    EXPECT_EQ(db.getRecentMessages(2).front().id, 249);
+
+    // Keyset pages in both directions, oldest first
+    HistoryCursor cursor;
+    cursor.limit = 5;
+    auto room = db.getRoomHistory("general", cursor);
+    ASSERT_EQ(room.size(), 5u);
+    EXPECT_EQ(room.front().id, 234);
+    EXPECT_EQ(room.back().id, 249);
+    cursor.before = room.front().id;
+    EXPECT_EQ(db.getRoomHistory("general", cursor).back().id, 231);
+    cursor.before = 0;
+    cursor.after = 20;
+    room = db.getRoomHistory("general", cursor);
+    ASSERT_EQ(room.size(), 5u);
+    EXPECT_EQ(room.front().id, 21);
+    EXPECT_EQ(room.back().id, 36); // 30 is private
+
+    cursor = HistoryCursor{};
+    cursor.limit = 3;
+    auto dm = db.getConversationHistory("bob", "alice", cursor);
+    ASSERT_EQ(dm.size(), 3u);
+    EXPECT_EQ(dm.front().id, 230);
+    EXPECT_EQ(dm.back().id, 250);
+    EXPECT_TRUE(db.getConversationHistory("bob", "carol", cursor).empty());
+
+    // Index rebuilds see every kind of message
+    auto scanned = db.scanMessages(5, 6);
+    ASSERT_EQ(scanned.size(), 6u);
+    EXPECT_EQ(scanned.front().id, 6);
+    EXPECT_EQ(scanned[4].target_user, "bob");
+    auto by_id = db.getMessagesByIds({250, 3, 999, 3, 7});
+    ASSERT_EQ(by_id.size(), 3u);
+    EXPECT_EQ(by_id[0].id, 3);
+    EXPECT_EQ(by_id[1].content.size(), 500u);
+    EXPECT_EQ(by_id[2].target_user, "bob");
+
+    // Ids must extend the log
+    EXPECT_FALSE(db.addMessages(messages(250, 251)));
+    EXPECT_EQ(db.getMessageCount(), 250);
+
+    ChatMessage single;
+    single.username = "bob";
+    single.content = "auto id";
+    single.timestamp = "t";
+    ASSERT_TRUE(db.addMessage(single));
+    EXPECT_EQ(single.id, 251);
+}
+
+TEST_F(LogDatabaseTest, RecoversAfterRestartAndCutsTornTail) {
+    {
+        LogDatabase db;
+        ASSERT_TRUE(db.init(config()));
+        ASSERT_TRUE(db.addUser("alice", "pw"));
+        ASSERT_TRUE(db.addUser("bob", "pw2"));
+        ASSERT_TRUE(db.addMessages(messages(1, 100)));
+    }
+    {
+        LogDatabase db;
+        ASSERT_TRUE(db.init(config()));
+        EXPECT_EQ(db.getMessageCount(), 100);
+        EXPECT_EQ(db.getRecentMessages(1).front().id, 100);
+        EXPECT_TRUE(db.validateUser("bob", "pw2"));
+        EXPECT_EQ(db.getUserId("bob"), 2);
+        EXPECT_TRUE(db.addUser("carol", "pw3"));
+        EXPECT_EQ(db.getUserId("carol"), 3);
+        ASSERT_TRUE(db.addMessages(messages(101, 110)));
+    }
+
+    // A record whose payload only partly reached the disk, and half a user record
+    auto files = segmentFiles();
+    ASSERT_EQ(files.size(), 1u);
+    std::string data = readFile(files.back());
+    std::size_t end = recordsEnd(data);
+    ASSERT_GT(end, 0u);
+    {
+        std::fstream out(files.back(), std::ios::binary | std::ios::in | std::ios::out);
+        out.seekp(static_cast<std::streamoff>(end));
+        const char torn[] = {40, 0, 0, 0, 1, 2, 3, 4, 111};
+        out.write(torn, sizeof(torn));
+    }
+    {
+        std::ofstream out(fs::path(dir_) / "users.log", std::ios::binary | std::ios::app);
+        out.write("\x20\0\0\0", 4);
+    }
+
+    LogDatabase db;
+    ASSERT_TRUE(db.init(config()));
+    EXPECT_EQ(db.getMessageCount(), 110);
+    EXPECT_EQ(db.getUserMessageCount("alice"), 11);
+    EXPECT_EQ(db.getRoomMessageCount("general"), 33); // 30, 60 and 90 are private
+    EXPECT_EQ(db.getRecentMessages(1).front().id, 110);
+    EXPECT_EQ(db.getAllUsers().size(), 3u);
+    EXPECT_TRUE(db.addUser("dave", "pw4"));
+    EXPECT_EQ(db.getUserId("dave"), 4);
+
+    ChatMessage next;
+    next.username = "alice";
+    next.content = "after recovery";
+    next.timestamp = "t";
+    ASSERT_TRUE(db.addMessage(next));
+    EXPECT_EQ(next.id, 111);
+    EXPECT_EQ(db.getUserMessageCount("alice"), 12);
+    EXPECT_EQ(db.getMessagesAfter(110).front().content, "after recovery");
+}
+
+TEST_F(LogDatabaseTest, RollsFullSegmentsAndTrimsThem) {
+    LogDatabase db;
+    ASSERT_TRUE(db.init(config(8192)));
+    for (long long first = 1; first <= 200; first += 20) {
+        ASSERT_TRUE(db.addMessages(messages(first, first + 19)));
+    }
+    std::size_t rolled = db.segmentCount();
+    EXPECT_GE(rolled, 3u);
+    EXPECT_EQ(db.getMessagesAfter(0, "", 0).size(), 180u);
+
+    // Full segments are not merged, only cut back to their records
+    db.maintain();
+    EXPECT_EQ(db.segmentCount(), rolled);
+    auto files = segmentFiles();
+    ASSERT_EQ(files.size(), rolled);
+    for (std::size_t i = 0; i + 1 < files.size(); ++i) {
+        std::string data = readFile(files[i]);
+        EXPECT_EQ(recordsEnd(data), data.size());
+    }
+
+    HistoryCursor cursor;
+    cursor.before = 150;
+    cursor.limit = 20;
+    auto room = db.getRoomHistory("general", cursor);
+    ASSERT_EQ(room.size(), 20u);
+    EXPECT_EQ(room.back().id, 147);
+    EXPECT_EQ(room.front().id, 84); // 90 and 120 are private
+}
+
+TEST_F(LogDatabaseTest, CompactsSealedSegmentsAndSurvivesInterruptedCompaction) {
+    DatabaseConfig cfg = config();
+    cfg.log_roll_seconds = 0;
+    {
+        LogDatabase db;
+        ASSERT_TRUE(db.init(cfg));
+        ASSERT_TRUE(db.addMessages(messages(1, 30)));
+        db.maintain(); // seals 1..30 and trims it
+        ASSERT_TRUE(db.addMessages(messages(31, 60)));
+        EXPECT_EQ(db.segmentCount(), 2u);
+    }
+
+    // Keep a copy of the second segment as a crash between rename and unlink would
+    auto files = segmentFiles();
+    ASSERT_EQ(files.size(), 2u);
+    std::string leftover = readFile(files[1]);
+
+    {
+        LogDatabase db;
+        ASSERT_TRUE(db.init(cfg));
+        db.maintain(); // seals 31..60 and merges it into the first segment
+        EXPECT_EQ(db.segmentCount(), 2u);
+        ASSERT_TRUE(db.addMessages(messages(61, 70)));
+        db.maintain();
+        EXPECT_EQ(db.segmentCount(), 2u);
+        EXPECT_EQ(db.getMessagesAfter(0, "", 0).size(), 63u);
+    }
+    ASSERT_FALSE(fs::exists(files[1]));
+    {
+        std::ofstream out(files[1], std::ios::binary);
+        out.write(leftover.data(), static_cast<std::streamsize>(leftover.size()));
+        std::ofstream tmp(files[0].string() + ".tmp", std::ios::binary);
+        tmp << "partial merge";
+    }
+
+    LogDatabase db;
+    ASSERT_TRUE(db.init(cfg));
+    EXPECT_EQ(db.getMessageCount(), 70);
+    EXPECT_FALSE(fs::exists(files[1]));
+    EXPECT_FALSE(fs::exists(files[0].string() + ".tmp"));
+    auto all = db.getMessagesAfter(0, "", 0);
+    ASSERT_EQ(all.size(), 63u);
+    for (std::size_t i = 1; i < all.size(); ++i) {
+        EXPECT_LT(all[i - 1].id, all[i].id);
+    }
+    EXPECT_EQ(db.getHistory(1, "bob").front().id, 70);
+}
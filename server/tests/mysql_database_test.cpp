@@ -0,0 +1,271 @@
+#include <gtest/gtest.h>
+#include "mysql_database.h"
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+bool isExecutable(const std::string& path) {
+    return access(path.c_str(), X_OK) == 0;
+}
+
+// $CHATROOM_TEST_MYSQLD, else mariadbd/mysqld from PATH or /usr/sbin
+std::string findServerBinary() {
+    if (const char* env = std::getenv("CHATROOM_TEST_MYSQLD")) {
+        return isExecutable(env) ? env : "";
+    }
+    std::vector<std::string> dirs{"/usr/sbin", "/usr/local/sbin"};
+    if (const char* path = std::getenv("PATH")) {
+        std::string all(path);
+        std::size_t start = 0;
+        while (start <= all.size()) {
+            std::size_t colon = all.find(':', start);
+            dirs.push_back(all.substr(start, colon == std::string::npos ? std::string::npos : colon - start));
+            if (colon == std::string::npos) break;
+            start = colon + 1;
+        }
+    }
+    for (const char* name : {"mariadbd", "mysqld"}) {
+        for (const auto& dir : dirs) {
+            std::string candidate = dir + "/" + name;
+            if (isExecutable(candidate)) return candidate;
+        }
+    }
+    return "";
+}
+
+std::string commandOutput(const std::string& command) {
+    std::string out;
+    if (FILE* pipe = popen(command.c_str(), "r")) {
+        char buf[256];
+        while (fgets(buf, sizeof(buf), pipe)) out += buf;
+        pclose(pipe);
+    }
+    return out;
+}
+
+} // namespace
+
+// Runs against a throwaway mysqld/mariadbd with its own data directory, reached over a
+// unix socket. Skipped when no server binary is installed.
+class MysqlDatabaseTest : public ::testing::Test {
+protected:
+    static void SetUpTestSuite() {
+        std::string server = findServerBinary();
+        if (server.empty()) {
+            skip_reason_ = "no mysqld/mariadbd found (set CHATROOM_TEST_MYSQLD)";
+            return;
+        }
+        char dir_template[] = "/tmp/chatroom_mysql_XXXXXX";
+        if (!mkdtemp(dir_template)) {
+            skip_reason_ = "mkdtemp failed";
+            return;
+        }
+        datadir_ = dir_template;
+        socket_ = datadir_ + "/mysqld.sock";
+
+        bool mariadb = commandOutput(server + " --version").find("MariaDB") != std::string::npos;
+        std::string init_cmd;
+        if (mariadb) {
+            std::string install_db = server.substr(0, server.rfind('/')) + "/../bin/mariadb-install-db";
+            if (!isExecutable(install_db)) install_db = "mariadb-install-db";
+            init_cmd = install_db + " --no-defaults --auth-root-authentication-method=normal --skip-test-db --datadir=" +
+                       datadir_;
+        } else {
+            init_cmd = server + " --no-defaults --initialize-insecure --datadir=" + datadir_;
+        }
+        if (geteuid() == 0) init_cmd += " --user=root";
+        if (std::system((init_cmd + " > " + datadir_ + "/init.log 2>&1").c_str()) != 0) {
+            skip_reason_ = "initializing the data directory failed, see " + datadir_ + "/init.log";
+            return;
+        }
+
+        server_pid_ = fork();
+        if (server_pid_ == 0) {
+            std::string datadir_arg = "--datadir=" + datadir_;
+            std::string socket_arg = "--socket=" + socket_;
+            std::string log_arg = "--log-error=" + datadir_ + "/error.log";
+            std::string pid_arg = "--pid-file=" + datadir_ + "/mysqld.pid";
+            execl(server.c_str(), server.c_str(), "--no-defaults", datadir_arg.c_str(), socket_arg.c_str(),
+                  log_arg.c_str(), pid_arg.c_str(), "--skip-networking", "--user=root", static_cast<char*>(nullptr));
+            _exit(127);
+        }
+
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(60);
+        while (std::chrono::steady_clock::now() < deadline) {
+            if (adminQuery("SELECT 1")) return;
+            std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        }
+        skip_reason_ = "server did not come up, see " + datadir_ + "/error.log";
+        stopServer();
+    }
+
+    static void TearDownTestSuite() {
+        stopServer();
+        if (!datadir_.empty() && skip_reason_.empty()) {
+            std::system(("rm -rf " + datadir_).c_str());
+        }
+    }
+
+    void SetUp() override {
+        if (server_pid_ <= 0) {
+            GTEST_SKIP() << skip_reason_;
+        }
+        ASSERT_TRUE(adminQuery("DROP DATABASE IF EXISTS chatroom_test"));
+        ASSERT_TRUE(adminQuery("CREATE DATABASE chatroom_test"));
+    }
+
+    static DatabaseConfig config() {
+        DatabaseConfig config;
+        config.type = "mysql";
+        config.socket = socket_;
+        config.user = "root";
+        config.db_name = "chatroom_test";
+        return config;
+    }
+
+    // Runs sql on a fresh root connection, discarding any result
+    static bool adminQuery(const std::string& sql) {
+        MYSQL* mysql = mysql_init(nullptr);
+        if (!mysql) return false;
+        bool ok = mysql_real_connect(mysql, "localhost", "root", "", nullptr, 0, socket_.c_str(), 0) &&
+                  mysql_query(mysql, sql.c_str()) == 0;
+        if (ok) {
+            if (MYSQL_RES* res = mysql_store_result(mysql)) mysql_free_result(res);
+        }
+        mysql_close(mysql);
+        return ok;
+    }
+
+    // Kills every server connection using the test database (the pool's connections)
+    static void killPoolConnections() {
+        MYSQL* mysql = mysql_init(nullptr);
+        ASSERT_TRUE(mysql_real_connect(mysql, "localhost", "root", "", nullptr, 0, socket_.c_str(), 0));
+        ASSERT_EQ(mysql_query(mysql, "SELECT id FROM information_schema.processlist "
+                                     "WHERE db = 'chatroom_test' AND id <> CONNECTION_ID()"), 0);
+        std::vector<std::string> ids;
+        if (MYSQL_RES* res = mysql_store_result(mysql)) {
+            while (MYSQL_ROW row = mysql_fetch_row(res)) ids.push_back(row[0]);
+            mysql_free_result(res);
+        }
+        for (const auto& id : ids) {
+            mysql_query(mysql, ("KILL " + id).c_str());
+        }
+        mysql_close(mysql);
+        EXPECT_FALSE(ids.empty());
+    }
+
+    static void stopServer() {
+        if (server_pid_ > 0) {
+            kill(server_pid_, SIGTERM);
+            waitpid(server_pid_, nullptr, 0);
+            server_pid_ = -1;
+        }
+    }
+
+    static pid_t server_pid_;
+    static std::string datadir_;
+    static std::string socket_;
+    static std::string skip_reason_;
+};
+
+pid_t MysqlDatabaseTest::server_pid_ = -1;
+std::string MysqlDatabaseTest::datadir_;
+std::string MysqlDatabaseTest::socket_;
+std::string MysqlDatabaseTest::skip_reason_;
+
+TEST_F(MysqlDatabaseTest, PreparedStatementsRoundTrip) {
+    MysqlDatabase db;
+    ASSERT_TRUE(db.init(config()));
+
+    ASSERT_TRUE(db.addUser("alice", "pw'; DROP TABLE users; --"));
+    EXPECT_FALSE(db.addUser("alice", "again"));
+    EXPECT_TRUE(db.validateUser("alice", "pw'; DROP TABLE users; --"));
+    EXPECT_FALSE(db.validateUser("alice", "pw"));
+    EXPECT_TRUE(db.userExists("alice"));
+    EXPECT_GT(db.getUserId("alice"), 0);
+    EXPECT_EQ(db.getUserId("nobody"), -1);
+    ASSERT_EQ(db.getAllUsers().size(), 1u);
+
+    // 250 rows span three INSERT statements; every 10th is private, long rows exceed the read buffer
+    std::vector<ChatMessage> batch;
+    for (long long id = 1; id <= 250; ++id) {
+        ChatMessage msg;
+        msg.id = id;
+        msg.username = id % 10 == 0 ? "alice" : "bob";
+        msg.content = id % 7 == 0 ? std::string(5000, 'x') : "m" + std::to_string(id);
+        msg.timestamp = "2026-10-18 12:00:00";
+        msg.target_user = id % 10 == 0 ? "bob" : "";
+        msg.room_id = id % 3 == 0 ? "general" : "";
+        batch.push_back(msg);
+    }
+    ASSERT_TRUE(db.addMessages(batch));
+    EXPECT_EQ(db.getMessageCount(), 250);
+    EXPECT_EQ(db.getRoomMessageCount("general"), 75); // public only
+    EXPECT_EQ(db.getUserMessageCount("alice"), 25);
+
+    auto pub = db.getMessagesAfter(0, "", 0);
+    ASSERT_EQ(pub.size(), 225u);
+    EXPECT_EQ(pub[6].id, 7);
+    EXPECT_EQ(pub[6].content.size(), 5000u);
+    EXPECT_EQ(pub[2].room_id, "general");
+    EXPECT_EQ(db.getMessagesAfter(240, "bob", 0).size(), 10u);
+    EXPECT_EQ(db.getMessagesAfter(0, "", 5).back().id, 5);
+
+    auto history = db.getHistory(3, "bob");
+    ASSERT_EQ(history.size(), 3u);
+    EXPECT_EQ(history.back().id, 250);
+    EXPECT_EQ(history.back().target_user, "bob");
+    EXPECT_EQ(db.getRecentMessages(2).front().id, 249);
+
+    // A batch with a duplicate id stores nothing
+    std::vector<ChatMessage> dup(batch.begin(), batch.begin() + 2);
+    dup[0].id = 251;
+    EXPECT_FALSE(db.addMessages(dup));
+    EXPECT_EQ(db.getMessageCount(), 250);
+    EXPECT_EQ(db.getUserMessageCount("bob"), 225);
+
+    ChatMessage single;
+    single.username = "bob";
+    single.content = "auto id";
+    single.timestamp = "t";
+    ASSERT_TRUE(db.addMessage(single));
+    EXPECT_GT(single.id, 250); // the rolled-back insert may have consumed 251
+    EXPECT_EQ(db.getUserMessageCount("bob"), 226);
+    EXPECT_EQ(db.getRoomMessageCount(""), 151);
+}
+
+TEST_F(MysqlDatabaseTest, PoolChecksHealthOnlyAfterIdleOrFailure) {
+    DatabasePoolStats stats;
+    DatabaseConfig cfg = config();
+    cfg.initial_size = 1;
+    cfg.max_size = 1;
+    cfg.health_check_idle_seconds = 3600;
+    MysqlDatabase db(&stats);
+    ASSERT_TRUE(db.init(cfg));
+
+    for (int i = 0; i < 10; ++i) {
+        EXPECT_TRUE(db.getRecentMessages(1).empty());
+    }
+    EXPECT_EQ(stats.acquisitions.load(), 10u);
+    EXPECT_EQ(stats.health_checks.load(), 0u);
+    EXPECT_EQ(stats.in_use.load(), 0);
+    EXPECT_EQ(stats.open.load(), 1);
+
+    // The first query on the killed connection fails; the next one pings and reconnects
+    killPoolConnections();
+    db.getRecentMessages(1);
+    EXPECT_TRUE(db.addUser("carol", "pw"));
+    EXPECT_TRUE(db.userExists("carol"));
+    EXPECT_EQ(stats.health_checks.load(), 1u);
+    EXPECT_EQ(stats.reconnects.load(), 1u);
+    EXPECT_EQ(stats.open.load(), 1);
+}
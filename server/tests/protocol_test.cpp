@@ -1,5 +1,28 @@
 #include <gtest/gtest.h>
 #include "websocket/websocket_codec.h"
+#include "websocket/websocket_mask.h"
+#include "websocket/websocket_deflate.h"
+#include "websocket/websocket_assembler.h"
+#include "websocket/chat_wire.h"
+#include "http/http_codec.h"
+#include "http/http_compressor.h"
+#include "http/sse_hub.h"
+#include "http/websocket_broadcaster.h"
+#include "http/websocket_keepalive.h"
+#include "http2/hpack.h"
+#include "http2/http2_session.h"
+#include "net/event_loop.h"
+#include "net/event_loop_thread.h"
+#include "net/inet_address.h"
+#include "net/tcp_connection.h"
+#include <zlib.h>
+#include <functional>
+#include <future>
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <chrono>
+#include <thread>
 #include "rtsp/rtsp_codec.h"
 #include "rtsp/rtp_rtcp.h"
 #include "utils/crypto_utils.h"
@@ -61,6 +84,1052 @@ TEST(WebSocketTest, ParseFrameMasked) {
     EXPECT_EQ(payload_str, "Hello");
 }
 
+TEST(WebSocketTest, MaskImplementationsMatchReference) {
+    const uint8_t key[4] = {0x37, 0xfa, 0x21, 0x3d};
+    std::vector<WebSocketMaskFn> impls = {webSocketMaskScalar};
+#if defined(__x86_64__) || defined(__i386__)
+    impls.push_back(webSocketMaskSse2);
+    if (webSocketMaskAvx2Supported()) {
+        impls.push_back(webSocketMaskAvx2);
+    }
+#endif
+    impls.push_back([](uint8_t* data, std::size_t len, const uint8_t k[4], std::size_t phase) {
+        applyWebSocketMask(data, len, k, phase);
+    });
+
+    // Every length around the 8/16/32/64-byte block edges, from unaligned starts and all key phases
+    std::vector<uint8_t> source(300);
+    for (std::size_t i = 0; i < source.size(); ++i) {
+        source[i] = static_cast<uint8_t>(i * 31 + 7);
+    }
+    for (std::size_t start : {0, 1, 3}) {
+        for (std::size_t len = 0; len + start <= source.size(); ++len) {
+            for (std::size_t phase = 0; phase < 4; ++phase) {
+                std::vector<uint8_t> expected(source.begin() + start, source.begin() + start + len);
+                for (std::size_t i = 0; i < len; ++i) {
+                    expected[i] ^= key[(phase + i) % 4];
+                }
+                for (WebSocketMaskFn fn : impls) {
+                    std::vector<uint8_t> data = source;
+                    fn(data.data() + start, len, key, phase);
+                    ASSERT_TRUE(std::equal(expected.begin(), expected.end(), data.begin() + start))
+                        << "len=" << len << " start=" << start << " phase=" << phase;
+                    // Bytes outside the range are untouched
+                    ASSERT_TRUE(std::equal(source.begin(), source.begin() + start, data.begin()));
+                    ASSERT_TRUE(std::equal(source.begin() + start + len, source.end(), data.begin() + start + len));
+                }
+            }
+        }
+    }
+}
+
+TEST(WebSocketTest, ParseLargeMaskedFrame) {
+    const uint8_t key[4] = {0x01, 0x02, 0x03, 0x04};
+    std::string payload(70000, 'x');
+    std::vector<uint8_t> buffer = {0x82, 0xFF, 0, 0, 0, 0, 0, 0x01, 0x11, 0x70, key[0], key[1], key[2], key[3]};
+    for (std::size_t i = 0; i < payload.size(); ++i) {
+        buffer.push_back(static_cast<uint8_t>(payload[i]) ^ key[i % 4]);
+    }
+
+    WebSocketFrame frame;
+    EXPECT_EQ(WebSocketCodec::parseFrame(buffer.data(), buffer.size() - 1, frame), 0);
+    ASSERT_EQ(WebSocketCodec::parseFrame(buffer.data(), buffer.size(), frame), static_cast<int>(buffer.size()));
+    EXPECT_EQ(frame.payload, payload);
+
+    // A 64-bit length that would wrap the size check is a protocol error, not a short read
+    std::vector<uint8_t> huge = {0x82, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xF0, 0, 0, 0, 0, 1, 2};
+    EXPECT_EQ(WebSocketCodec::parseFrame(huge.data(), huge.size(), frame), -1);
+}
+
+TEST(WebSocketTest, ParseFrameReservedBits) {
+    std::vector<uint8_t> compressed = {0xC1, 0x01, 0x00};
+    WebSocketFrame frame;
+    ASSERT_EQ(WebSocketCodec::parseFrame(compressed.data(), compressed.size(), frame), 3);
+    EXPECT_TRUE(frame.rsv1);
+
+    std::vector<uint8_t> rsv2 = {0xA1, 0x01, 0x00};
+    EXPECT_EQ(WebSocketCodec::parseFrame(rsv2.data(), rsv2.size(), frame), -1);
+}
+
+TEST(WebSocketTest, NegotiateDeflate) {
+    WebSocketDeflateOptions options;
+    WebSocketDeflateParams params;
+    std::string response;
+
+    ASSERT_TRUE(WebSocketCodec::negotiateDeflate("permessage-deflate", options, params, response));
+    EXPECT_EQ(response, "permessage-deflate");
+    EXPECT_EQ(params.server_max_window_bits, 15);
+    EXPECT_EQ(params.client_max_window_bits, 15);
+    EXPECT_FALSE(params.server_no_context_takeover);
+
+    // Browser-style offer; parameters are echoed as required
+    ASSERT_TRUE(WebSocketCodec::negotiateDeflate(
+        "permessage-deflate; client_max_window_bits; server_no_context_takeover", options, params, response));
+    EXPECT_EQ(response, "permessage-deflate; server_no_context_takeover");
+    EXPECT_TRUE(params.server_no_context_takeover);
+
+    // server_max_window_bits=8 cannot be honoured by zlib; the fallback offer is taken
+    ASSERT_TRUE(WebSocketCodec::negotiateDeflate(
+        "permessage-deflate; server_max_window_bits=8, permessage-deflate; server_max_window_bits=\"10\"", options,
+        params, response));
+    EXPECT_EQ(params.server_max_window_bits, 10);
+    EXPECT_EQ(response, "permessage-deflate; server_max_window_bits=10");
+
+    // Invalid or duplicated parameters decline the offer
+    EXPECT_FALSE(WebSocketCodec::negotiateDeflate("permessage-deflate; foo", options, params, response));
+    EXPECT_FALSE(WebSocketCodec::negotiateDeflate("permessage-deflate; server_max_window_bits=16", options, params,
+                                                  response));
+    EXPECT_FALSE(WebSocketCodec::negotiateDeflate(
+        "permessage-deflate; client_no_context_takeover; client_no_context_takeover", options, params, response));
+    EXPECT_FALSE(WebSocketCodec::negotiateDeflate("x-webkit-deflate-frame", options, params, response));
+
+    // Context takeover disabled by configuration applies to both directions
+    WebSocketDeflateOptions no_takeover;
+    no_takeover.context_takeover = false;
+    ASSERT_TRUE(WebSocketCodec::negotiateDeflate("permessage-deflate", no_takeover, params, response));
+    EXPECT_EQ(response, "permessage-deflate; server_no_context_takeover; client_no_context_takeover");
+
+    // The memory cap shrinks the windows the offer lets us choose, or declines when it cannot fit
+    WebSocketDeflateOptions capped;
+    capped.max_memory = 64 * 1024;
+    ASSERT_TRUE(WebSocketCodec::negotiateDeflate("permessage-deflate; client_max_window_bits", capped, params,
+                                                 response));
+    EXPECT_LE(WebSocketCodec::deflateMemoryUsage(params), capped.max_memory);
+    EXPECT_LT(params.server_max_window_bits, 15);
+    EXPECT_LT(params.client_max_window_bits, 15);
+    EXPECT_NE(response.find("client_max_window_bits=" + std::to_string(params.client_max_window_bits)),
+              std::string::npos);
+    capped.max_memory = 16 * 1024;
+    EXPECT_FALSE(WebSocketCodec::negotiateDeflate("permessage-deflate", capped, params, response));
+}
+
+TEST(WebSocketTest, DeflateRfcExamples) {
+    WebSocketDeflateParams params;
+    WebSocketDeflate deflate(params, 6);
+    std::string out;
+
+    // RFC 7692 7.2.3.1 / 7.2.3.2: "Hello" twice, the second using the shared sliding window
+    ASSERT_TRUE(deflate.decompress(std::string("\xf2\x48\xcd\xc9\xc9\x07\x00", 7), true, out, 1024));
+    EXPECT_EQ(out, "Hello");
+    out.clear();
+    ASSERT_TRUE(deflate.decompress(std::string("\xf2\x00\x11\x00\x00", 5), true, out, 1024));
+    EXPECT_EQ(out, "Hello");
+
+    // The same message split across two fragments; output is appended
+    WebSocketDeflate fragmented(params, 6);
+    out.clear();
+    ASSERT_TRUE(fragmented.decompress(std::string("\xf2\x48\xcd", 3), false, out, 1024));
+    ASSERT_TRUE(fragmented.decompress(std::string("\xc9\xc9\x07\x00", 4), true, out, 1024));
+    EXPECT_EQ(out, "Hello");
+
+    // Decompression bomb is cut off at the message limit
+    std::string big(100000, 'a');
+    std::string compressed;
+    WebSocketDeflate sender(params, 6);
+    ASSERT_TRUE(sender.compress(big, compressed));
+    EXPECT_LT(compressed.size(), 1000u);
+    WebSocketDeflate receiver(params, 6);
+    EXPECT_FALSE(receiver.decompress(compressed, true, out, 65536));
+}
+
+TEST(WebSocketTest, DeflateContextTakeover) {
+    const std::string msg = R"({"type":"message","username":"alice","content":"hello everyone","timestamp":"2024"})";
+
+    WebSocketDeflateParams params;
+    WebSocketDeflate server(params, 6);
+    WebSocketDeflate client(params, 6);
+    std::string first, second, out;
+    ASSERT_TRUE(server.compress(msg, first));
+    ASSERT_TRUE(server.compress(msg, second));
+    // With the window carried over the repeated message is mostly a back-reference
+    EXPECT_LT(second.size(), first.size() / 2);
+    ASSERT_TRUE(client.decompress(first, true, out, 1024));
+    EXPECT_EQ(out, msg);
+    out.clear();
+    ASSERT_TRUE(client.decompress(second, true, out, 1024));
+    EXPECT_EQ(out, msg);
+
+    // Without takeover every message compresses identically and matches the shared stateless encoder
+    params.server_no_context_takeover = true;
+    params.client_no_context_takeover = true;
+    WebSocketDeflate stateless(params, 6);
+    WebSocketDeflate stateless_client(params, 6);
+    std::string a, b, shared;
+    ASSERT_TRUE(stateless.compress(msg, a));
+    ASSERT_TRUE(stateless.compress(msg, b));
+    EXPECT_EQ(a, b);
+    ASSERT_TRUE(WebSocketDeflate::compressStateless(params, 6, msg, shared));
+    EXPECT_EQ(a, shared);
+    out.clear();
+    ASSERT_TRUE(stateless_client.decompress(a, true, out, 1024));
+    out.clear();
+    ASSERT_TRUE(stateless_client.decompress(b, true, out, 1024));
+    EXPECT_EQ(out, msg);
+}
+
+namespace {
+
+// Client-to-server frame: always masked, optional RSV1
+std::string clientFrame(uint8_t opcode, const std::string& payload, bool fin = true, bool rsv1 = false) {
+    const uint8_t key[4] = {0x5a, 0x0f, 0xc3, 0x81};
+    std::string out;
+    out.push_back(static_cast<char>((fin ? 0x80 : 0) | (rsv1 ? 0x40 : 0) | opcode));
+    if (payload.size() < 126) {
+        out.push_back(static_cast<char>(0x80 | payload.size()));
+    } else {
+        out.push_back(static_cast<char>(0x80 | 126));
+        out.push_back(static_cast<char>(payload.size() >> 8));
+        out.push_back(static_cast<char>(payload.size() & 0xff));
+    }
+    out.append(reinterpret_cast<const char*>(key), 4);
+    for (std::size_t i = 0; i < payload.size(); ++i) {
+        out.push_back(static_cast<char>(payload[i] ^ key[i % 4]));
+    }
+    return out;
+}
+
+struct AssemblerHarness {
+    std::string written;
+    std::vector<std::pair<WebSocketOpcode, std::string>> messages;
+    std::vector<bool> zero_copy;
+    Buffer buf;
+    WebSocketAssembler assembler;
+
+    explicit AssemblerHarness(std::size_t max_bytes = 1024)
+        : assembler(max_bytes, [this](const std::string& data) { written += data; },
+                    [this](const WebSocketFrame& message) {
+                        messages.emplace_back(message.opcode, std::string(message.payload));
+                        const char* begin = buf.peek();
+                        zero_copy.push_back(message.payload.data() >= begin &&
+                                            message.payload.data() < begin + buf.readableBytes());
+                    }) {}
+
+    bool feed(const std::string& data) {
+        buf.append(data.data(), data.size());
+        return assembler.feed(&buf);
+    }
+
+    // Close code of the last frame written, 0 if it was not a close frame
+    uint16_t closeCode() const {
+        if (written.size() < 4 || static_cast<uint8_t>(written[written.size() - 4]) != 0x88) return 0;
+        return static_cast<uint16_t>((static_cast<uint8_t>(written[written.size() - 2]) << 8) |
+                                     static_cast<uint8_t>(written.back()));
+    }
+};
+
+} // namespace
+
+TEST(WebSocketAssemblerTest, ReassemblesFragmentsAroundControlFrames) {
+    AssemblerHarness h;
+    std::string stream = clientFrame(0x1, "Hel", false) + clientFrame(0x9, "ping") + clientFrame(0x0, "lo ", false) +
+                         clientFrame(0x0, "world") + clientFrame(0x1, "single");
+
+    // Delivered byte by byte: partial headers and payloads wait for more data
+    for (char ch : stream) {
+        ASSERT_TRUE(h.feed(std::string(1, ch)));
+    }
+    ASSERT_EQ(h.messages.size(), 2u);
+    EXPECT_EQ(h.messages[0].second, "Hello world");
+    EXPECT_FALSE(h.zero_copy[0]);
+    EXPECT_EQ(h.messages[1].second, "single");
+    EXPECT_TRUE(h.zero_copy[1]);   // unfragmented message is a view into the input buffer
+    EXPECT_EQ(h.buf.readableBytes(), 0u);
+
+    // PING answered with an unmasked PONG carrying the same payload
+    EXPECT_EQ(h.written, std::string("\x8a\x04ping", 6));
+    EXPECT_EQ(h.assembler.pingCount(), 1u);
+}
+
+TEST(WebSocketAssemblerTest, EnforcesMessageSizeBeforeBuffering) {
+    // A 2^40-byte frame is refused as soon as its header arrives
+    AssemblerHarness h(1024);
+    std::string header = {static_cast<char>(0x82), static_cast<char>(0xFF), 0, 0, 0, 1, 0, 0, 0, 0, 1, 2, 3, 4};
+    EXPECT_FALSE(h.feed(header));
+    EXPECT_EQ(h.closeCode(), 1009);
+
+    // Fragments that are individually small but exceed the limit together
+    AssemblerHarness f(10);
+    EXPECT_TRUE(f.feed(clientFrame(0x1, "123456", false)));
+    EXPECT_FALSE(f.feed(clientFrame(0x0, "789012")));
+    EXPECT_EQ(f.closeCode(), 1009);
+    EXPECT_TRUE(f.messages.empty());
+}
+
+TEST(WebSocketAssemblerTest, ProtocolErrors) {
+    const std::vector<std::string> invalid = {
+        std::string("\x81\x02hi", 4),                             // unmasked client frame
+        clientFrame(0x0, "orphan"),                                 // CONTINUATION without a message
+        clientFrame(0x1, "a", false) + clientFrame(0x1, "b"),       // new message inside a fragmented one
+        clientFrame(0x9, "p", false),                               // fragmented control frame
+        clientFrame(0x9, std::string(126, 'p')),                    // control payload over 125 bytes
+        clientFrame(0x3, "x"),                                      // reserved opcode
+        clientFrame(0x1, "compressed", true, true),                 // RSV1 without permessage-deflate
+    };
+    for (const auto& data : invalid) {
+        AssemblerHarness h;
+        EXPECT_FALSE(h.feed(data));
+        EXPECT_EQ(h.closeCode(), 1002);
+        EXPECT_TRUE(h.messages.empty());
+    }
+}
+
+TEST(WebSocketAssemblerTest, CloseIsDeliveredAndEchoed) {
+    AssemblerHarness h;
+    EXPECT_FALSE(h.feed(clientFrame(0x8, std::string("\x03\xe8", 2) + "bye") + clientFrame(0x1, "ignored")));
+    ASSERT_EQ(h.messages.size(), 1u);
+    EXPECT_EQ(h.messages[0].first, WebSocketOpcode::CLOSE);
+    EXPECT_EQ(h.closeCode(), 1000);
+}
+
+TEST(WebSocketAssemblerTest, InflatesFragmentedCompressedMessage) {
+    WebSocketDeflateParams params;
+    WebSocketDeflate client(params, 6);
+    const std::string text(500, 'z');
+    std::string compressed;
+    ASSERT_TRUE(client.compress(text, compressed));
+    ASSERT_GT(compressed.size(), 2u);
+
+    AssemblerHarness h;
+    h.assembler.setDeflate(std::make_shared<WebSocketDeflate>(params, 6));
+    std::size_t half = compressed.size() / 2;
+    ASSERT_TRUE(h.feed(clientFrame(0x1, compressed.substr(0, half), false, true) + clientFrame(0xA, "") +
+                       clientFrame(0x0, compressed.substr(half))));
+    ASSERT_EQ(h.messages.size(), 1u);
+    EXPECT_EQ(h.messages[0].second, text);
+
+    // Inflated size counts against the limit as well
+    AssemblerHarness small(100);
+    small.assembler.setDeflate(std::make_shared<WebSocketDeflate>(params, 6));
+    WebSocketDeflate client2(params, 6);
+    ASSERT_TRUE(client2.compress(text, compressed));
+    EXPECT_FALSE(small.feed(clientFrame(0x1, compressed, true, true)));
+    EXPECT_EQ(small.closeCode(), 1009);
+}
+
+TEST(ChatWireTest, JsonMatchesLegacyShape) {
+    ChatWireMessage forward;
+    forward.type = ChatWireType::kMessage;
+    forward.username = "alice";
+    forward.content = "hi";
+    forward.timestamp = "2026-01-01 00:00:00";
+    forward.room_id = "r1";
+    EXPECT_EQ(ChatWireCodec::encodeJson(forward),
+              R"({"content":"hi","room_id":"r1","timestamp":"2026-01-01 00:00:00","type":"message","username":"alice"})");
+
+    ChatWireMessage login;
+    login.type = ChatWireType::kLoginResponse;
+    login.success = true;
+    login.username = "alice";
+    login.user_id = 7;
+    EXPECT_EQ(ChatWireCodec::encodeJson(login),
+              R"({"success":true,"type":"login_response","user_id":7,"username":"alice"})");
+
+    ChatWireMessage in;
+    ASSERT_TRUE(ChatWireCodec::decodeJson(R"({"type":"join_room","room_id":"r9","extra":[1,2]})", in));
+    EXPECT_EQ(in.type, ChatWireType::kJoinRoom);
+    EXPECT_EQ(in.room_id, "r9");
+    EXPECT_FALSE(ChatWireCodec::decodeJson(R"({"type":"login","username":5})", in));
+    EXPECT_FALSE(ChatWireCodec::decodeJson("[1]", in));
+    EXPECT_FALSE(ChatWireCodec::decodeJson("{", in));
+}
+
+TEST(ChatWireTest, MsgpackRoundTripAndMalformedInput) {
+    ChatWireMessage msg;
+    msg.type = ChatWireType::kLoginResponse;
+    msg.success = true;
+    msg.username = "bob";
+    msg.user_id = 1LL << 40;
+    msg.content = std::string(300, 'x');  // str16
+    std::string wire = ChatWireCodec::encodeMsgpack(msg);
+    EXPECT_EQ(static_cast<uint8_t>(wire[0]), 0x85);  // fixmap: type, username, content, success, user_id
+
+    ChatWireMessage out;
+    ASSERT_TRUE(ChatWireCodec::decodeMsgpack(wire, out));
+    EXPECT_EQ(out.type, ChatWireType::kLoginResponse);
+    EXPECT_TRUE(out.success);
+    EXPECT_EQ(out.username, "bob");
+    EXPECT_EQ(out.user_id, 1LL << 40);
+    EXPECT_EQ(out.content, msg.content);
+
+    // Every proper prefix is truncated input
+    for (std::size_t n = 0; n < wire.size(); ++n) {
+        ChatWireMessage partial;
+        EXPECT_FALSE(ChatWireCodec::decodeMsgpack(std::string_view(wire).substr(0, n), partial)) << n;
+    }
+    EXPECT_FALSE(ChatWireCodec::decodeMsgpack(wire + "x", out));
+
+    // Hand-built by a generic client: unknown nested field, nil field, negative int8
+    std::string generic = "\x84\xa4type\xa7message\xa5" "extra\x92\x81\xa1k\x90\xcb" + std::string(8, '\0') +
+                          "\xa7" "content\xc0\xa7user_id\xd0\xfe";
+    ChatWireMessage g;
+    ASSERT_TRUE(ChatWireCodec::decodeMsgpack(generic, g));
+    EXPECT_EQ(g.type, ChatWireType::kMessage);
+    EXPECT_TRUE(g.content.empty());
+    EXPECT_EQ(g.user_id, -2);
+
+    // Wrong value type and nesting beyond the skip limit are rejected
+    EXPECT_FALSE(ChatWireCodec::decodeMsgpack("\x81\xa7" "content\x01", g));
+    EXPECT_FALSE(ChatWireCodec::decodeMsgpack("\x81\xa1z" + std::string(40, '\x91') + "\x01", g));
+}
+
+TEST(ChatWireTest, NegotiateSubprotocol) {
+    EXPECT_EQ(ChatWireCodec::negotiateSubprotocol("chatroom.json, chatroom.msgpack"), "chatroom.msgpack");
+    EXPECT_EQ(ChatWireCodec::negotiateSubprotocol("chatroom.json"), "chatroom.json");
+    EXPECT_EQ(ChatWireCodec::negotiateSubprotocol("mqtt,chatroom.msgpack2"), "");
+}
+
+// --- HTTP Tests ---
+
+TEST(HttpCodecTest, EncodeChunk) {
+    EXPECT_EQ(encodeChunk("hello"), "5\r\nhello\r\n");
+    EXPECT_EQ(encodeChunk(std::string(26, 'x')), "1a\r\n" + std::string(26, 'x') + "\r\n");
+    // Empty data is the terminating chunk
+    EXPECT_EQ(encodeChunk(""), "0\r\n\r\n");
+}
+
+static std::string inflateAll(const std::string& data, int window_bits) {
+    z_stream zs{};
+    inflateInit2(&zs, window_bits);
+    zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+    zs.avail_in = data.size();
+    std::string out;
+    char buf[4096];
+    int rc;
+    do {
+        zs.next_out = reinterpret_cast<Bytef*>(buf);
+        zs.avail_out = sizeof(buf);
+        rc = inflate(&zs, Z_NO_FLUSH);
+        out.append(buf, sizeof(buf) - zs.avail_out);
+    } while (rc == Z_OK && zs.avail_in > 0);
+    inflateEnd(&zs);
+    return out;
+}
+
+TEST(HttpCompressorTest, Negotiate) {
+    EXPECT_EQ(HttpCompressor::negotiate("gzip, deflate, br"), HttpCompressor::kGzip);
+    EXPECT_EQ(HttpCompressor::negotiate("deflate"), HttpCompressor::kDeflate);
+    EXPECT_EQ(HttpCompressor::negotiate("gzip;q=0, deflate;q=0.5"), HttpCompressor::kDeflate);
+    EXPECT_EQ(HttpCompressor::negotiate("br"), HttpCompressor::kIdentity);
+    EXPECT_EQ(HttpCompressor::negotiate(""), HttpCompressor::kIdentity);
+    // "*" stands only for codings that are not listed by name
+    EXPECT_EQ(HttpCompressor::negotiate("*"), HttpCompressor::kGzip);
+    EXPECT_EQ(HttpCompressor::negotiate("gzip;q=0, *"), HttpCompressor::kDeflate);
+    EXPECT_EQ(HttpCompressor::negotiate("*, gzip;q=0, deflate;q=0"), HttpCompressor::kIdentity);
+    EXPECT_EQ(HttpCompressor::negotiate("*;q=0, deflate"), HttpCompressor::kDeflate);
+    // The client's preference wins over gzip; equal q-values fall back to gzip
+    EXPECT_EQ(HttpCompressor::negotiate("gzip;q=0.1, deflate"), HttpCompressor::kDeflate);
+    EXPECT_EQ(HttpCompressor::negotiate("deflate, *;q=0.5"), HttpCompressor::kDeflate);
+    EXPECT_EQ(HttpCompressor::negotiate("deflate;q=0.5, gzip;q=0.5"), HttpCompressor::kGzip);
+}
+
+TEST(HttpCompressorTest, OneShotRoundTrip) {
+    std::string body;
+    for (int i = 0; i < 200; ++i) {
+        body += R"({"username":"alice","content":"hello","timestamp":"2026-01-14 15:30:45"},)";
+    }
+    HttpCompressor& compressor = HttpCompressor::threadLocal();
+    std::string gz;
+    ASSERT_TRUE(compressor.compress(HttpCompressor::kGzip, body, gz));
+    EXPECT_LT(gz.size() * 5, body.size());
+    EXPECT_EQ(inflateAll(gz, 15 + 16), body);
+
+    // The same instance is reused for the next response
+    std::string zl;
+    ASSERT_TRUE(compressor.compress(HttpCompressor::kDeflate, body, zl));
+    EXPECT_EQ(inflateAll(zl, 15), body);
+    ASSERT_TRUE(compressor.compress(HttpCompressor::kGzip, "second", gz));
+    EXPECT_EQ(inflateAll(gz, 15 + 16), "second");
+}
+
+TEST(HttpCompressorTest, StreamingRoundTrip) {
+    HttpCompressor compressor;
+    ASSERT_TRUE(compressor.begin(HttpCompressor::kGzip));
+    std::string wire;
+    ASSERT_TRUE(compressor.update("{\"id\":1}\n", wire, false));
+    ASSERT_TRUE(compressor.update("{\"id\":2}\n", wire, false));
+    ASSERT_TRUE(compressor.update("", wire, true));
+    EXPECT_EQ(inflateAll(wire, 15 + 16), "{\"id\":1}\n{\"id\":2}\n");
+}
+
+// --- HTTP/2 Tests ---
+
+namespace {
+
+std::string fromHex(const std::string& hex) {
+    std::string out;
+    for (std::size_t i = 0; i + 1 < hex.size(); i += 2) {
+        out.push_back(static_cast<char>(std::stoi(hex.substr(i, 2), nullptr, 16)));
+    }
+    return out;
+}
+
+struct Frame {
+    uint8_t type;
+    uint8_t flags;
+    uint32_t stream_id;
+    std::string payload;
+};
+
+std::string buildFrame(Http2FrameType type, uint8_t flags, uint32_t stream_id, const std::string& payload) {
+    std::string out;
+    out.push_back(static_cast<char>(payload.size() >> 16));
+    out.push_back(static_cast<char>(payload.size() >> 8));
+    out.push_back(static_cast<char>(payload.size()));
+    out.push_back(static_cast<char>(type));
+    out.push_back(static_cast<char>(flags));
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        out.push_back(static_cast<char>(stream_id >> shift));
+    }
+    return out + payload;
+}
+
+std::vector<Frame> parseFrames(const std::string& wire) {
+    std::vector<Frame> frames;
+    std::size_t off = 0;
+    auto byte = [&](std::size_t i) { return static_cast<uint8_t>(wire[i]); };
+    while (off + 9 <= wire.size()) {
+        std::size_t len = (byte(off) << 16) | (byte(off + 1) << 8) | byte(off + 2);
+        uint32_t id = ((byte(off + 5) & 0x7f) << 24) | (byte(off + 6) << 16) | (byte(off + 7) << 8) | byte(off + 8);
+        frames.push_back(Frame{byte(off + 3), byte(off + 4), id, wire.substr(off + 9, len)});
+        off += 9 + len;
+    }
+    return frames;
+}
+
+std::string requestHeaders(HpackEncoder& encoder, const std::string& path) {
+    std::string block;
+    encoder.encode({{":method", "GET"}, {":scheme", "http"}, {":path", path}, {":authority", "localhost"},
+                    {"accept-encoding", "gzip"}}, block);
+    return block;
+}
+
+} // namespace
+
+TEST(HpackTest, IntegerEncoding) {
+    // RFC 7541 C.1
+    std::string out;
+    hpackEncodeInteger(out, 5, 0, 10);
+    EXPECT_EQ(out, fromHex("0a"));
+    out.clear();
+    hpackEncodeInteger(out, 5, 0, 1337);
+    EXPECT_EQ(out, fromHex("1f9a0a"));
+
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(out.data());
+    uint64_t value = 0;
+    ASSERT_TRUE(hpackDecodeInteger(p, p + out.size(), 5, value));
+    EXPECT_EQ(value, 1337u);
+    p = reinterpret_cast<const uint8_t*>(out.data());
+    EXPECT_FALSE(hpackDecodeInteger(p, p + 2, 5, value));
+}
+
+TEST(HpackTest, Huffman) {
+    std::string encoded;
+    huffmanEncode("www.example.com", encoded);
+    EXPECT_EQ(encoded, fromHex("f1e3c2e5f23a6ba0ab90f4ff"));
+    EXPECT_EQ(huffmanEncodedLength("www.example.com"), 12u);
+
+    std::string decoded;
+    ASSERT_TRUE(huffmanDecode(reinterpret_cast<const uint8_t*>(encoded.data()), encoded.size(), decoded));
+    EXPECT_EQ(decoded, "www.example.com");
+
+    // Padding longer than 7 bits is invalid
+    std::string padded = encoded + "\xff";
+    decoded.clear();
+    EXPECT_FALSE(huffmanDecode(reinterpret_cast<const uint8_t*>(padded.data()), padded.size(), decoded));
+}
+
+TEST(HpackTest, DecodeRfcRequestSequence) {
+    // RFC 7541 C.4: three requests sharing one dynamic table
+    HpackDecoder decoder;
+    const char* blocks[] = {
+        "828684418cf1e3c2e5f23a6ba0ab90f4ff",
+        "828684be5886a8eb10649cbf",
+        "828785bf408825a849e95ba97d7f8925a849e95bb8e8b4bf",
+    };
+    const std::size_t table_sizes[] = {57, 110, 164};
+    HpackHeaderList headers;
+    for (int i = 0; i < 3; ++i) {
+        std::string block = fromHex(blocks[i]);
+        headers.clear();
+        ASSERT_TRUE(decoder.decode(reinterpret_cast<const uint8_t*>(block.data()), block.size(), headers));
+        EXPECT_EQ(decoder.table().size(), table_sizes[i]);
+    }
+    ASSERT_EQ(headers.size(), 5u);
+    EXPECT_EQ(headers[1].value, "https");
+    EXPECT_EQ(headers[2].value, "/index.html");
+    EXPECT_EQ(headers[3].value, "www.example.com");
+    EXPECT_EQ(headers[4].name, "custom-key");
+    EXPECT_EQ(headers[4].value, "custom-value");
+}
+
+TEST(HpackTest, EncoderRoundTripWithEviction) {
+    HpackEncoder encoder;
+    HpackDecoder decoder;
+    encoder.setMaxTableSize(100);
+
+    HpackHeaderList headers = {{":status", "200"}, {"content-type", "application/json"},
+                               {"vary", "Accept-Encoding"}, {"x-custom", "abcdefghijklmnopqrstuvwxyz"}};
+    std::size_t first_size = 0;
+    for (int i = 0; i < 3; ++i) {
+        std::string block;
+        encoder.encode(headers, block);
+        if (i == 0) {
+            first_size = block.size();
+        } else {
+            // Entries still in the table are sent as a single index byte
+            EXPECT_LT(block.size(), first_size);
+        }
+        HpackHeaderList decoded;
+        ASSERT_TRUE(decoder.decode(reinterpret_cast<const uint8_t*>(block.data()), block.size(), decoded));
+        ASSERT_EQ(decoded.size(), headers.size());
+        for (std::size_t j = 0; j < headers.size(); ++j) {
+            EXPECT_EQ(decoded[j].name, headers[j].name);
+            EXPECT_EQ(decoded[j].value, headers[j].value);
+        }
+        EXPECT_LE(decoder.table().size(), 100u);
+        EXPECT_EQ(decoder.table().size(), encoder.table().size());
+    }
+}
+
+TEST(Http2SessionTest, RequestResponse) {
+    std::string wire;
+    std::vector<std::pair<uint32_t, HttpRequest>> requests;
+    Http2Session session([&](const std::string& data) { wire += data; },
+                         [&](uint32_t id, HttpRequest req) { requests.emplace_back(id, std::move(req)); });
+    session.start();
+
+    HpackEncoder client_encoder;
+    Buffer in;
+    in.append(std::string(Http2Session::kPreface));
+    in.append(buildFrame(Http2FrameType::SETTINGS, 0, 0, ""));
+    in.append(buildFrame(Http2FrameType::HEADERS, 0x5, 1, requestHeaders(client_encoder, "/health")));
+    ASSERT_TRUE(session.feed(&in));
+    EXPECT_EQ(in.readableBytes(), 0u);
+
+    ASSERT_EQ(requests.size(), 1u);
+    EXPECT_EQ(requests[0].first, 1u);
+    EXPECT_EQ(requests[0].second.method, "GET");
+    EXPECT_EQ(requests[0].second.path, "/health");
+    EXPECT_EQ(requests[0].second.headers.at("Host"), "localhost");
+    // Lookups use the HTTP/1.1 spelling
+    EXPECT_EQ(requests[0].second.headers.at("Accept-Encoding"), "gzip");
+
+    session.submitHeaders(1, {{":status", "200"}, {"content-type", "application/json"}}, false);
+    session.submitData(1, "{\"ok\":true}", true);
+    EXPECT_EQ(session.streamCount(), 0u);
+
+    auto frames = parseFrames(wire);
+    ASSERT_EQ(frames.size(), 4u);
+    EXPECT_EQ(frames[0].type, static_cast<uint8_t>(Http2FrameType::SETTINGS));
+    EXPECT_EQ(frames[1].type, static_cast<uint8_t>(Http2FrameType::SETTINGS));
+    EXPECT_EQ(frames[1].flags, 0x1);
+    EXPECT_EQ(frames[2].type, static_cast<uint8_t>(Http2FrameType::HEADERS));
+    EXPECT_EQ(frames[3].type, static_cast<uint8_t>(Http2FrameType::DATA));
+    EXPECT_EQ(frames[3].flags, 0x1);
+    EXPECT_EQ(frames[3].payload, "{\"ok\":true}");
+
+    HpackDecoder client_decoder;
+    HpackHeaderList headers;
+    ASSERT_TRUE(client_decoder.decode(reinterpret_cast<const uint8_t*>(frames[2].payload.data()),
+                                      frames[2].payload.size(), headers));
+    ASSERT_EQ(headers.size(), 2u);
+    EXPECT_EQ(headers[0].value, "200");
+}
+
+TEST(Http2SessionTest, FlowControlAndPriority) {
+    std::string wire;
+    std::vector<uint32_t> requests;
+    Http2Session session([&](const std::string& data) { wire += data; },
+                         [&](uint32_t id, HttpRequest) { requests.push_back(id); });
+    session.start();
+
+    // SETTINGS_INITIAL_WINDOW_SIZE = 10
+    HpackEncoder client_encoder;
+    Buffer in;
+    in.append(std::string(Http2Session::kPreface));
+    in.append(buildFrame(Http2FrameType::SETTINGS, 0, 0, fromHex("00040000000a")));
+    in.append(buildFrame(Http2FrameType::HEADERS, 0x5, 1, requestHeaders(client_encoder, "/a")));
+    // Stream 3 depends on stream 1 (PRIORITY flag, weight 16)
+    in.append(buildFrame(Http2FrameType::HEADERS, 0x25, 3, fromHex("000000010f") + requestHeaders(client_encoder, "/b")));
+    ASSERT_TRUE(session.feed(&in));
+    ASSERT_EQ(requests.size(), 2u);
+
+    wire.clear();
+    session.submitHeaders(3, {{":status", "200"}}, false);
+    session.submitHeaders(1, {{":status", "200"}}, false);
+    session.submitData(3, std::string(30, 'b'), true);
+    session.submitData(1, std::string(30, 'a'), true);
+
+    // Each stream may send 10 bytes; stream 1 goes first since stream 3 depends on it
+    std::vector<Frame> data;
+    for (auto& frame : parseFrames(wire)) {
+        if (frame.type == static_cast<uint8_t>(Http2FrameType::DATA)) {
+            data.push_back(frame);
+        }
+    }
+    ASSERT_EQ(data.size(), 2u);
+    EXPECT_EQ(data[0].stream_id, 3u); // submitted while stream 1 had nothing to send
+    EXPECT_EQ(data[1].stream_id, 1u);
+    EXPECT_EQ(data[1].payload.size(), 10u);
+    EXPECT_EQ(session.pendingBytes(1), 20u);
+    EXPECT_EQ(session.pendingBytes(3), 20u);
+
+    // Both windows reopen at once: the parent is served before its dependent
+    wire.clear();
+    in.append(buildFrame(Http2FrameType::WINDOW_UPDATE, 0, 3, fromHex("00000064")));
+    in.append(buildFrame(Http2FrameType::WINDOW_UPDATE, 0, 1, fromHex("00000064")));
+    ASSERT_TRUE(session.feed(&in));
+    auto frames = parseFrames(wire);
+    ASSERT_EQ(frames.size(), 2u);
+    EXPECT_EQ(frames[0].stream_id, 1u);
+    EXPECT_EQ(frames[0].flags, 0x1);
+    EXPECT_EQ(frames[1].stream_id, 3u);
+    EXPECT_EQ(frames[1].payload, std::string(20, 'b'));
+    EXPECT_EQ(session.streamCount(), 0u);
+}
+
+TEST(Http2SessionTest, OversizedHeaderListAnswered431) {
+    std::string wire;
+    std::vector<std::pair<uint32_t, HttpRequest>> requests;
+    Http2Session session([&](const std::string& data) { wire += data; },
+                         [&](uint32_t id, HttpRequest req) { requests.emplace_back(id, std::move(req)); });
+    session.start();
+
+    // Stream 1 puts a 4000-byte header into the dynamic table
+    std::string big(4000, 'x');
+    std::string block = fromHex("828684") + fromHex("4005") + "x-big";
+    hpackEncodeInteger(block, 7, 0, big.size());
+    block += big;
+    Buffer in;
+    in.append(std::string(Http2Session::kPreface));
+    in.append(buildFrame(Http2FrameType::SETTINGS, 0, 0, ""));
+    in.append(buildFrame(Http2FrameType::HEADERS, 0x5, 1, block));
+    // Stream 3 references it 16000 times in 16 KB: about 64 MB once decoded
+    in.append(buildFrame(Http2FrameType::HEADERS, 0x5, 3, fromHex("828684") + std::string(16000, '\xbe')));
+    // Stream 5 references it once, which only works if the table survived the rejected block
+    in.append(buildFrame(Http2FrameType::HEADERS, 0x5, 5, fromHex("828684be")));
+    ASSERT_TRUE(session.feed(&in));
+
+    ASSERT_EQ(requests.size(), 2u);
+    EXPECT_EQ(requests[0].first, 1u);
+    EXPECT_EQ(requests[1].first, 5u);
+    EXPECT_EQ(requests[1].second.headers.at("x-big"), big);
+
+    HpackDecoder client_decoder;
+    bool rejected = false;
+    for (const auto& frame : parseFrames(wire)) {
+        if (frame.type == static_cast<uint8_t>(Http2FrameType::SETTINGS) && frame.flags == 0) {
+            // SETTINGS_MAX_HEADER_LIST_SIZE is the decoded limit
+            EXPECT_NE(frame.payload.find(fromHex("000600010000")), std::string::npos);
+        }
+        if (frame.type == static_cast<uint8_t>(Http2FrameType::HEADERS)) {
+            EXPECT_EQ(frame.stream_id, 3u);
+            EXPECT_EQ(frame.flags & 0x1, 0x1);
+            HpackHeaderList headers;
+            ASSERT_TRUE(client_decoder.decode(reinterpret_cast<const uint8_t*>(frame.payload.data()),
+                                              frame.payload.size(), headers));
+            ASSERT_FALSE(headers.empty());
+            EXPECT_EQ(headers[0].value, "431");
+            rejected = true;
+        }
+    }
+    EXPECT_TRUE(rejected);
+    EXPECT_EQ(session.streamCount(), 2u); // 1 and 5 are still waiting for their responses
+}
+
+TEST(Http2SessionTest, ProtocolErrorSendsGoaway) {
+    std::string wire;
+    Http2Session session([&](const std::string& data) { wire += data; }, [](uint32_t, HttpRequest) {});
+    session.start();
+
+    HpackEncoder client_encoder;
+    Buffer in;
+    in.append(std::string(Http2Session::kPreface));
+    in.append(buildFrame(Http2FrameType::SETTINGS, 0, 0, ""));
+    // Clients must use odd stream ids
+    in.append(buildFrame(Http2FrameType::HEADERS, 0x5, 2, requestHeaders(client_encoder, "/")));
+    EXPECT_FALSE(session.feed(&in));
+    auto frames = parseFrames(wire);
+    ASSERT_FALSE(frames.empty());
+    EXPECT_EQ(frames.back().type, static_cast<uint8_t>(Http2FrameType::GOAWAY));
+    EXPECT_EQ(frames.back().payload.substr(4), fromHex("00000001"));
+    EXPECT_TRUE(session.goingAway());
+}
+
+// --- SSE Tests ---
+
+TEST(SseHubTest, EncodeEvent) {
+    EXPECT_EQ(SseHub::encodeEvent("message", "{\"a\":1}", 42), "id: 42\nevent: message\ndata: {\"a\":1}\n\n");
+    EXPECT_EQ(SseHub::encodeEvent("presence", "line1\nline2"), "event: presence\ndata: line1\ndata: line2\n\n");
+}
+
+TEST(SseHubTest, ResumeReplaysBufferedEvents) {
+    EventLoop loop;
+    auto hub = std::make_shared<SseHub>(60.0, 2);
+    for (long long id = 1; id <= 3; ++id) {
+        std::vector<std::string> audience;
+        if (id == 2) audience = {"bob"};
+        hub->publish(id, std::make_shared<const std::string>(SseHub::encodeEvent("message", "m" + std::to_string(id), id)),
+                     audience);
+    }
+    EXPECT_EQ(hub->lastEventId(), 3);
+
+    int fds[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    auto conn = std::make_shared<TcpConnection>(&loop, "sse-conn", fds[0], InetAddress(0), InetAddress(0));
+    conn->connectEstablished();
+
+    // Event 1 has been evicted from the two-entry buffer
+    EXPECT_FALSE(hub->subscribe(conn, "alice", 0));
+    EXPECT_EQ(hub->stats().resume_gaps_total.load(), 1u);
+
+    // Event 2 is addressed to bob only, so alice gets just event 3
+    ASSERT_TRUE(hub->subscribe(conn, "alice", 1));
+    char buf[256];
+    ssize_t n = read(fds[1], buf, sizeof(buf));
+    ASSERT_GT(n, 0);
+    EXPECT_EQ(std::string(buf, n), "id: 3\nevent: message\ndata: m3\n\n");
+    EXPECT_EQ(hub->stats().replayed_total.load(), 1u);
+    EXPECT_EQ(hub->stats().subscribers.load(), 1u);
+
+    conn->connectDestroyed();
+    close(fds[1]);
+}
+
+// --- WebSocket Fan-out Tests ---
+
+TEST(WebSocketBroadcasterTest, OneTaskPerLoopSharedFrame) {
+    EventLoopThread thread1, thread2;
+    EventLoop* loops[2] = {thread1.startLoop(), thread2.startLoop()};
+    auto inLoop = [](EventLoop* loop, std::function<void()> fn) {
+        std::promise<void> done;
+        loop->runInLoop([&]() {
+            fn();
+            done.set_value();
+        });
+        done.get_future().wait();
+    };
+
+    protocols::WebSocketDeflateStats deflate_stats;
+    WebSocketBroadcaster broadcaster(deflate_stats);
+    protocols::WebSocketDeflateParams params;
+    auto stateful = std::make_shared<protocols::WebSocketDeflate>(params, 6);
+
+    // Four plain recipients spread over both loops, plus one context-takeover compressor on the second
+    std::vector<WebSocketBroadcaster::Recipient> recipients;
+    std::vector<int> peers;
+    for (int i = 0; i < 5; ++i) {
+        int fds[2];
+        ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+        EventLoop* loop = loops[i % 2];
+        auto conn = std::make_shared<TcpConnection>(loop, "bcast-" + std::to_string(i), fds[0], InetAddress(0),
+                                                    InetAddress(0));
+        inLoop(loop, [conn]() { conn->connectEstablished(); });
+        recipients.push_back({conn, i == 4 ? stateful : nullptr, nullptr});
+        peers.push_back(fds[1]);
+    }
+    auto conns = recipients;
+
+    const std::string payload = "{\"type\":\"message\",\"content\":\"fan-out\"}";
+    broadcaster.broadcast(std::move(recipients), protocols::WebSocketOpcode::TEXT, payload, 0, 6);
+    for (EventLoop* loop : loops) {
+        inLoop(loop, []() {});
+    }
+
+    EXPECT_EQ(broadcaster.stats().broadcasts.load(), 1u);
+    EXPECT_EQ(broadcaster.stats().loop_tasks.load(), 2u);
+    EXPECT_EQ(broadcaster.stats().deliveries.load(), 5u);
+    EXPECT_EQ(deflate_stats.compressions.load(), 1u);
+
+    const std::string plain = WebSocketBroadcaster::encodeFrame(protocols::WebSocketOpcode::TEXT, payload, false);
+    char buf[256];
+    for (int i = 0; i < 4; ++i) {
+        ssize_t n = read(peers[i], buf, sizeof(buf));
+        ASSERT_GT(n, 0);
+        EXPECT_EQ(std::string(buf, n), plain);
+    }
+    ssize_t n = read(peers[4], buf, sizeof(buf));
+    ASSERT_GT(n, 0);
+    WebSocketFrame frame;
+    ASSERT_GT(WebSocketCodec::parseFrame(reinterpret_cast<uint8_t*>(buf), n, frame), 0);
+    EXPECT_TRUE(frame.rsv1);
+    protocols::WebSocketDeflate inflater(params, 6);
+    std::string inflated;
+    ASSERT_TRUE(inflater.decompress(frame.payload, true, inflated, 1 << 20));
+    EXPECT_EQ(inflated, payload);
+
+    for (std::size_t i = 0; i < conns.size(); ++i) {
+        auto conn = conns[i].conn;
+        inLoop(conn->getLoop(), [conn]() { conn->connectDestroyed(); });
+        close(peers[i]);
+    }
+}
+
+TEST(WebSocketBroadcasterTest, SlowConsumerDropsThenCloses) {
+    EventLoopThread thread;
+    EventLoop* loop = thread.startLoop();
+    auto inLoop = [loop](std::function<void()> fn) {
+        std::promise<void> done;
+        loop->runInLoop([&]() {
+            fn();
+            done.set_value();
+        });
+        done.get_future().wait();
+    };
+
+    protocols::WebSocketDeflateStats deflate_stats;
+    WebSocketBroadcaster broadcaster(deflate_stats);
+    WebSocketSendPolicy policy;
+    policy.soft_queue_bytes = 8 * 1024;
+    policy.hard_queue_bytes = 64 * 1024;
+    policy.close_grace_seconds = 0.05;
+    broadcaster.setSendPolicy(policy);
+
+    // The peer never reads and the socket buffers are tiny, so almost everything stays queued
+    int fds[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    int small = 4096;
+    setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &small, sizeof(small));
+    setsockopt(fds[1], SOL_SOCKET, SO_RCVBUF, &small, sizeof(small));
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+    auto conn = std::make_shared<TcpConnection>(loop, "slow", fds[0], InetAddress(0), InetAddress(0));
+    inLoop([conn]() { conn->connectEstablished(); });
+    auto consumer = std::make_shared<WebSocketConsumer>();
+
+    auto send = [&](WebSocketEventClass event_class) {
+        std::vector<WebSocketBroadcaster::Recipient> recipients{{conn, nullptr, consumer}};
+        broadcaster.broadcast(std::move(recipients), protocols::WebSocketOpcode::TEXT, std::string(1024, 'm'), 0, 6,
+                              event_class);
+        inLoop([]() {});
+    };
+
+    for (int i = 0; i < 40; ++i) {
+        send(WebSocketEventClass::kReliable);
+    }
+    EXPECT_EQ(broadcaster.stats().deliveries.load(), 40u);
+    EXPECT_GE(consumer->queued_bytes.load(), policy.soft_queue_bytes);
+
+    // Past the soft cap: presence/typing are shed, chat messages are still queued
+    send(WebSocketEventClass::kDroppable);
+    EXPECT_EQ(broadcaster.stats().dropped.load(), 1u);
+    EXPECT_EQ(consumer->dropped.load(), 1u);
+    EXPECT_EQ(broadcaster.stats().deliveries.load(), 40u);
+
+    // Past the hard limit: one close, nothing more is queued, and the queue never exceeded the limit
+    for (int i = 0; i < 80; ++i) {
+        send(WebSocketEventClass::kReliable);
+    }
+    EXPECT_EQ(broadcaster.stats().slow_closes.load(), 1u);
+    EXPECT_TRUE(consumer->closing.load());
+    EXPECT_LT(broadcaster.stats().deliveries.load(), 120u);
+    EXPECT_LE(consumer->peak_queued_bytes.load(), policy.hard_queue_bytes);
+
+    // The peer never drains, so the grace timer drops the connection
+    for (int i = 0; i < 100 && !conn->disconnected(); ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    EXPECT_TRUE(conn->disconnected());
+
+    inLoop([conn]() { conn->connectDestroyed(); });
+    close(fds[0]);
+    close(fds[1]);
+}
+
+TEST(WebSocketKeepaliveTest, ClassifyAndRttQuantiles) {
+    EXPECT_EQ(WebSocketKeepalive::classify("", "Mozilla/5.0 (X11; Linux x86_64) Chrome/120.0"),
+              WebSocketClientClass::kWeb);
+    EXPECT_EQ(WebSocketKeepalive::classify("", "Mozilla/5.0 (iPhone; CPU iPhone OS 17_0) Mobile/15E148"),
+              WebSocketClientClass::kMobile);
+    EXPECT_EQ(WebSocketKeepalive::classify("", "python-websockets/12"), WebSocketClientClass::kOther);
+    EXPECT_EQ(WebSocketKeepalive::classify("mobile", "Mozilla/5.0"), WebSocketClientClass::kMobile);
+
+    // PONGs echo the send time; replay ones that claim a 5 ms round trip
+    WebSocketKeepalive keepalive(30.0, 2);
+    WebSocketKeepalive::Peer peer;
+    peer.cls = WebSocketClientClass::kMobile;
+    auto pongFor = [](int64_t ago_us) {
+        int64_t sent = std::chrono::duration_cast<std::chrono::microseconds>(
+                           std::chrono::steady_clock::now().time_since_epoch()).count() - ago_us;
+        std::string payload(8, '\0');
+        for (int b = 0; b < 8; ++b) {
+            payload[b] = static_cast<char>((static_cast<uint64_t>(sent) >> (56 - 8 * b)) & 0xff);
+        }
+        return payload;
+    };
+    for (int i = 0; i < 100; ++i) {
+        keepalive.onPong(peer, pongFor(5000));
+    }
+    keepalive.onPong(peer, "unsolicited");
+    const auto& stats = keepalive.stats();
+    EXPECT_EQ(stats.pongs.load(), 100u);
+    EXPECT_EQ(stats.rtt[static_cast<std::size_t>(WebSocketClientClass::kMobile)].count.load(), 100u);
+    double p50 = stats.rttQuantile(WebSocketClientClass::kMobile, 0.5);
+    EXPECT_GT(p50, 0.004);
+    EXPECT_LT(p50, 0.006);
+    EXPECT_EQ(stats.rttQuantile(WebSocketClientClass::kWeb, 0.5), 0.0);
+}
+
+TEST(WebSocketKeepaliveTest, PingsLivePeerAndClosesSilentOne) {
+    EventLoop loop;
+    // 160 ms interval over 16 slots: the wheel ticks every 10 ms
+    auto keepalive = std::make_shared<WebSocketKeepalive>(0.16, 2);
+
+    struct Client {
+        TcpConnectionPtr conn;
+        int fd;
+        std::shared_ptr<WebSocketKeepalive::Peer> peer;
+        bool closed = false;
+    };
+    Client live, silent;
+    for (auto* client : {&live, &silent}) {
+        int fds[2];
+        ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+        fcntl(fds[1], F_SETFL, O_NONBLOCK);
+        client->fd = fds[1];
+        client->conn = std::make_shared<TcpConnection>(&loop, client == &live ? "live" : "silent", fds[0],
+                                                       InetAddress(0), InetAddress(0));
+        client->conn->connectEstablished();
+        client->conn->setConnectionCallback([client](const TcpConnectionPtr& conn) {
+            if (!conn->connected()) {
+                client->closed = true;
+            }
+        });
+        client->peer = keepalive->track(client->conn, WebSocketClientClass::kWeb);
+    }
+
+    // The live client answers every PING it reads with a PONG carrying the same payload
+    loop.runEvery(0.005, [&]() {
+        char buf[256];
+        ssize_t n;
+        while ((n = read(live.fd, buf, sizeof(buf))) > 0) {
+            std::size_t offset = 0;
+            while (offset < static_cast<std::size_t>(n)) {
+                WebSocketFrame frame;
+                int used = WebSocketCodec::parseFrame(reinterpret_cast<uint8_t*>(buf) + offset, n - offset, frame);
+                ASSERT_GT(used, 0);
+                EXPECT_EQ(frame.opcode, WebSocketOpcode::PING);
+                keepalive->onPong(*live.peer, frame.payload);
+                offset += used;
+            }
+        }
+    });
+    loop.runAfter(0.6, [&]() { loop.stop(); });
+    loop.loop();
+
+    const auto& stats = keepalive->stats();
+    EXPECT_FALSE(live.closed);
+    EXPECT_TRUE(silent.closed);
+    EXPECT_EQ(stats.timeouts.load(), 1u);
+    EXPECT_GE(stats.pings_sent.load(), 4u);
+    EXPECT_GE(stats.pongs.load(), 2u);
+    EXPECT_GT(stats.rtt[static_cast<std::size_t>(WebSocketClientClass::kWeb)].count.load(), 0u);
+
+    for (auto* client : {&live, &silent}) {
+        client->conn->connectDestroyed();
+        close(client->fd);
+    }
+}
+
 // --- RTSP Tests ---
 
 TEST(RtspTest, ParseRequest) {
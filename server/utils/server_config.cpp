@@ -1,5 +1,6 @@
 #include "utils/server_config.h"
 #include <algorithm>
+#include <cctype>
 #include <fstream>
 #include <iostream>
 #include <sstream>
@@ -46,6 +47,9 @@ bool ServerConfig::load(const std::string &config_file) {
     return false;
   }
 
+  // Falls back to max_message_history when not given explicitly
+  int message_cache_size = -1;
+
   std::string line;
   while (std::getline(in, line)) {
     std::string t = trim(line);
@@ -80,6 +84,10 @@ bool ServerConfig::load(const std::string &config_file) {
         thread_pool.queue_capacity = std::stoul(value);
       } else if (key == "io_threads") {
         thread_pool.io_threads = std::stoul(value);
+      } else if (key == "thread_pool_blocking") {
+        thread_pool.blocking_threads = std::stoul(value);
+      } else if (key == "io_write_coalescing") {
+        thread_pool.write_coalescing = parseBool(value);
       } else if (key == "check_interval_seconds") {
         connection_check_interval_seconds = std::stoi(value);
       } else if (key == "max_failures") {
@@ -102,6 +110,48 @@ bool ServerConfig::load(const std::string &config_file) {
         rate_limit.window_seconds = std::stoi(value);
       } else if (key == "rate_limit_max_requests") {
         rate_limit.max_requests = std::stoi(value);
+      } else if (key == "compression_enabled") {
+        compression.enabled = parseBool(value);
+      } else if (key == "long_poll_max_wait_seconds") {
+        long_poll_max_wait_seconds = std::stoi(value);
+      } else if (key == "sse_heartbeat_seconds") {
+        sse_heartbeat_seconds = std::stoi(value);
+      } else if (key == "compression_min_bytes") {
+        compression.min_bytes = std::stoul(value);
+      } else if (key == "compression_level") {
+        compression.level = std::stoi(value);
+      } else if (key == "compression_types") {
+        compression.types.clear();
+        std::stringstream ss(value);
+        std::string item;
+        while (std::getline(ss, item, ',')) {
+          item = trim(item);
+          if (!item.empty()) {
+            compression.types.push_back(item);
+          }
+        }
+      } else if (key == "ws_max_message_bytes") {
+        websocket.max_message_bytes = std::stoul(value);
+      } else if (key == "ws_deflate_enabled") {
+        websocket.deflate_enabled = parseBool(value);
+      } else if (key == "ws_deflate_max_window_bits") {
+        websocket.deflate_max_window_bits = std::stoi(value);
+      } else if (key == "ws_deflate_context_takeover") {
+        websocket.deflate_context_takeover = parseBool(value);
+      } else if (key == "ws_deflate_max_memory") {
+        websocket.deflate_max_memory = std::stoul(value);
+      } else if (key == "ws_deflate_min_bytes") {
+        websocket.deflate_min_bytes = std::stoul(value);
+      } else if (key == "ws_ping_interval_seconds") {
+        websocket.ping_interval_seconds = std::stod(value);
+      } else if (key == "ws_ping_max_missed") {
+        websocket.ping_max_missed = std::stoi(value);
+      } else if (key == "ws_send_queue_soft_bytes") {
+        websocket.send_queue_soft_bytes = std::stoul(value);
+      } else if (key == "ws_send_queue_hard_bytes") {
+        websocket.send_queue_hard_bytes = std::stoul(value);
+      } else if (key == "ws_slow_close_grace_seconds") {
+        websocket.slow_close_grace_seconds = std::stod(value);
       } else if (key == "db_type") {
         db.type = value;
       } else if (key == "db_path") {
@@ -120,6 +170,44 @@ bool ServerConfig::load(const std::string &config_file) {
         db.initial_size = std::stoi(value);
       } else if (key == "db_pool_max") {
         db.max_size = std::stoi(value);
+      } else if (key == "db_pool_health_check_idle_seconds") {
+        db.health_check_idle_seconds = std::stoi(value);
+      } else if (key == "db_socket") {
+        db.socket = value;
+      } else if (key == "db_message_cache_size") {
+        message_cache_size = std::stoi(value);
+      } else if (key == "db_durability") {
+        db.durability = value;
+      } else if (key == "db_write_batch_interval_ms") {
+        db.write_batch_interval_ms = std::stoi(value);
+      } else if (key == "db_write_batch_max") {
+        db.write_batch_max = std::stoi(value);
+      } else if (key == "db_async_threads") {
+        db.async_threads = std::stoi(value);
+      } else if (key == "db_search_index") {
+        db.search_index = parseBool(value);
+      } else if (key == "db_sqlite_wal") {
+        db.sqlite_wal = parseBool(value);
+      } else if (key == "db_sqlite_synchronous") {
+        db.sqlite_synchronous = value;
+        std::transform(db.sqlite_synchronous.begin(), db.sqlite_synchronous.end(), db.sqlite_synchronous.begin(),
+                       [](unsigned char c) { return static_cast<char>(std::toupper(c)); });
+      } else if (key == "db_sqlite_readers") {
+        db.sqlite_readers = std::stoi(value);
+      } else if (key == "db_sqlite_mmap_bytes") {
+        db.sqlite_mmap_bytes = std::stoll(value);
+      } else if (key == "db_sqlite_statement_cache") {
+        db.sqlite_statement_cache = parseBool(value);
+      } else if (key == "db_log_dir") {
+        db.log_dir = value;
+      } else if (key == "db_log_segment_bytes") {
+        db.log_segment_bytes = std::stoll(value);
+      } else if (key == "db_log_index_interval") {
+        db.log_index_interval = std::stoi(value);
+      } else if (key == "db_log_roll_seconds") {
+        db.log_roll_seconds = std::stoi(value);
+      } else if (key == "db_maintenance_interval_seconds") {
+        db.maintenance_interval_seconds = std::stoi(value);
       }
     } catch (...) {
       std::cerr << "Error parsing config key: " << key << ", value: " << value
@@ -128,6 +216,7 @@ bool ServerConfig::load(const std::string &config_file) {
   }
 
   // Post-load validation and defaults
+  db.message_cache_size = message_cache_size >= 0 ? message_cache_size : static_cast<int>(max_message_history);
   if (thread_pool.core_threads == 0) {
     std::size_t hw = std::thread::hardware_concurrency();
     if (hw == 0)
@@ -143,6 +232,16 @@ bool ServerConfig::load(const std::string &config_file) {
   if (thread_pool.queue_capacity == 0) {
     thread_pool.queue_capacity = 1024;
   }
+  if (thread_pool.blocking_threads == 0) {
+    thread_pool.blocking_threads = 4;
+  }
+  websocket.deflate_max_window_bits = std::clamp(websocket.deflate_max_window_bits, 9, 15);
+  websocket.ping_interval_seconds = std::max(0.0, websocket.ping_interval_seconds);
+  websocket.ping_max_missed = std::max(1, websocket.ping_max_missed);
+  websocket.slow_close_grace_seconds = std::max(0.0, websocket.slow_close_grace_seconds);
+  if (websocket.send_queue_hard_bytes > 0 && websocket.send_queue_soft_bytes > websocket.send_queue_hard_bytes) {
+    websocket.send_queue_soft_bytes = websocket.send_queue_hard_bytes;
+  }
 
   return true;
 }
@@ -19,6 +19,8 @@ struct ThreadPoolConfig {
     std::size_t max_threads = 0;
     std::size_t queue_capacity = 1024;
     std::size_t io_threads = 0; // 0 means loop in main thread
+    std::size_t blocking_threads = 4; // dedicated pool for long-running routes and stream producers
+    bool write_coalescing = true;     // IO线程每轮循环末尾对每个连接合并写出一次
 };
 
 struct RateLimitConfig {
@@ -27,6 +29,29 @@ struct RateLimitConfig {
     bool enabled = true;
 };
 
+struct CompressionConfig {
+    bool enabled = true;
+    std::size_t min_bytes = 1024;   // 小于该大小的响应不压缩
+    int level = 6;                  // zlib 压缩级别 1-9
+    // Content-Type 前缀白名单（"text/" 匹配所有文本类型）
+    std::vector<std::string> types = {"application/json", "application/x-ndjson", "application/javascript",
+                                      "text/", "image/svg+xml"};
+};
+
+struct WebSocketConfig {
+    std::size_t max_message_bytes = 1024 * 1024;  // 单条消息（解压后）的大小上限
+    bool deflate_enabled = true;                  // permessage-deflate (RFC 7692)
+    int deflate_max_window_bits = 15;             // 本端压缩窗口上限 9-15
+    bool deflate_context_takeover = true;         // false 时每条消息独立压缩，广播可共享压缩结果
+    std::size_t deflate_max_memory = 128 * 1024;  // 每个连接压缩+解压状态的内存上限，0 为不限制
+    std::size_t deflate_min_bytes = 64;           // 小于该大小的消息不压缩
+    double ping_interval_seconds = 30.0;          // 服务端 PING 间隔，0 为关闭
+    int ping_max_missed = 2;                      // 连续多少个 PING 未收到 PONG 后断开连接
+    std::size_t send_queue_soft_bytes = 256 * 1024;      // 待发字节达到该值时丢弃可丢弃事件，0 为不丢弃
+    std::size_t send_queue_hard_bytes = 4 * 1024 * 1024; // 待发字节超过该值时以 1008 关闭连接，0 为不限制
+    double slow_close_grace_seconds = 5.0;               // 慢连接发出关闭帧后等待的时间，超时强制断开
+};
+
 struct ServerConfig {
     // Basic
     int port = 8080;
@@ -50,6 +75,8 @@ struct ServerConfig {
     std::size_t max_message_history = 1000;
     std::size_t max_username_length = 32;
     std::size_t max_message_length = 4096;
+    int long_poll_max_wait_seconds = 60;   // /messages?wait=N 的上限
+    int sse_heartbeat_seconds = 15;        // /events 心跳注释间隔
     std::string history_file_path = "data/chat_history.json";
 
     // Static Resources
@@ -58,6 +85,12 @@ struct ServerConfig {
     // Rate Limiter
     RateLimitConfig rate_limit;
 
+    // HTTP Response Compression
+    CompressionConfig compression;
+
+    // WebSocket
+    WebSocketConfig websocket;
+
     // Singleton access
     static ServerConfig& instance();
     
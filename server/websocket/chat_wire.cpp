@@ -0,0 +1,464 @@
+#include "websocket/chat_wire.h"
+
+#include <nlohmann/json.hpp>
+
+#include <cstring>
+
+namespace protocols {
+
+namespace {
+
+// Unknown fields may nest; bound the recursion a hostile peer can force
+constexpr int kMaxSkipDepth = 16;
+
+struct FieldName {
+    ChatWireType type;
+    const char* name;
+};
+
+constexpr FieldName kTypeNames[] = {
+    {ChatWireType::kLogin, "login"},
+    {ChatWireType::kLoginResponse, "login_response"},
+    {ChatWireType::kJoinRoom, "join_room"},
+    {ChatWireType::kLeaveRoom, "leave_room"},
+    {ChatWireType::kMessage, "message"},
+    {ChatWireType::kMessageResponse, "message_response"},
+    {ChatWireType::kTyping, "typing"},
+    {ChatWireType::kPresence, "presence"},
+};
+
+bool isResponse(ChatWireType type) {
+    return type == ChatWireType::kLoginResponse || type == ChatWireType::kMessageResponse;
+}
+
+/// String fields in wire order; both encoders and the MessagePack decoder walk this table
+struct StringField {
+    const char* name;
+    std::string ChatWireMessage::*member;
+};
+
+constexpr StringField kStringFields[] = {
+    {"username", &ChatWireMessage::username},
+    {"password", &ChatWireMessage::password},
+    {"room_id", &ChatWireMessage::room_id},
+    {"content", &ChatWireMessage::content},
+    {"target_user", &ChatWireMessage::target_user},
+    {"timestamp", &ChatWireMessage::timestamp},
+    {"error", &ChatWireMessage::error},
+    {"action", &ChatWireMessage::action},
+};
+
+class MsgpackWriter {
+public:
+    explicit MsgpackWriter(std::string& out) : out_(out) {}
+
+    void mapHeader(uint32_t n) {
+        if (n < 16) {
+            byte(0x80 | n);
+        } else if (n <= 0xffff) {
+            byte(0xde);
+            be(n, 2);
+        } else {
+            byte(0xdf);
+            be(n, 4);
+        }
+    }
+
+    void str(std::string_view s) {
+        std::size_t n = s.size();
+        if (n < 32) {
+            byte(0xa0 | static_cast<uint8_t>(n));
+        } else if (n <= 0xff) {
+            byte(0xd9);
+            be(n, 1);
+        } else if (n <= 0xffff) {
+            byte(0xda);
+            be(n, 2);
+        } else {
+            byte(0xdb);
+            be(n, 4);
+        }
+        out_.append(s.data(), n);
+    }
+
+    void integer(long long v) {
+        if (v >= 0 && v < 128) {
+            byte(static_cast<uint8_t>(v));
+        } else if (v < 0 && v >= -32) {
+            byte(static_cast<uint8_t>(v));
+        } else if (v >= 0) {
+            byte(0xcf);
+            be(static_cast<uint64_t>(v), 8);
+        } else {
+            byte(0xd3);
+            be(static_cast<uint64_t>(v), 8);
+        }
+    }
+
+    void boolean(bool v) { byte(v ? 0xc3 : 0xc2); }
+
+private:
+    void byte(uint8_t b) { out_.push_back(static_cast<char>(b)); }
+
+    void be(uint64_t v, int bytes) {
+        for (int i = bytes - 1; i >= 0; --i) {
+            byte(static_cast<uint8_t>(v >> (8 * i)));
+        }
+    }
+
+    std::string& out_;
+};
+
+class MsgpackReader {
+public:
+    explicit MsgpackReader(std::string_view data) : data_(data) {}
+
+    bool atEnd() const { return pos_ == data_.size(); }
+
+    bool mapHeader(uint32_t& n) {
+        uint8_t b;
+        if (!byte(b)) {
+            return false;
+        }
+        if ((b & 0xf0) == 0x80) {
+            n = b & 0x0f;
+            return true;
+        }
+        uint64_t v;
+        if (b == 0xde && be(2, v)) {
+            n = static_cast<uint32_t>(v);
+            return true;
+        }
+        if (b == 0xdf && be(4, v)) {
+            n = static_cast<uint32_t>(v);
+            return true;
+        }
+        return false;
+    }
+
+    bool str(std::string_view& s) {
+        uint8_t b;
+        if (!byte(b)) {
+            return false;
+        }
+        uint64_t n;
+        if ((b & 0xe0) == 0xa0) {
+            n = b & 0x1f;
+        } else if (b == 0xd9) {
+            if (!be(1, n)) return false;
+        } else if (b == 0xda) {
+            if (!be(2, n)) return false;
+        } else if (b == 0xdb) {
+            if (!be(4, n)) return false;
+        } else {
+            return false;
+        }
+        if (n > data_.size() - pos_) {
+            return false;
+        }
+        s = data_.substr(pos_, n);
+        pos_ += n;
+        return true;
+    }
+
+    bool integer(long long& v) {
+        uint8_t b;
+        if (!byte(b)) {
+            return false;
+        }
+        uint64_t u;
+        if (b < 0x80) {
+            v = b;
+        } else if (b >= 0xe0) {
+            v = static_cast<int8_t>(b);
+        } else if (b >= 0xcc && b <= 0xcf) {
+            if (!be(1u << (b - 0xcc), u)) return false;
+            v = static_cast<long long>(u);
+        } else if (b >= 0xd0 && b <= 0xd3) {
+            int bytes = 1 << (b - 0xd0);
+            if (!be(bytes, u)) return false;
+            // Sign-extend from the encoded width
+            int shift = 64 - 8 * bytes;
+            v = static_cast<long long>(u << shift) >> shift;
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    bool boolean(bool& v) {
+        uint8_t b;
+        if (!byte(b) || (b != 0xc2 && b != 0xc3)) {
+            return false;
+        }
+        v = b == 0xc3;
+        return true;
+    }
+
+    /// nil stands for an absent field, like JSON null with value()'s default
+    bool nil() {
+        if (pos_ < data_.size() && static_cast<uint8_t>(data_[pos_]) == 0xc0) {
+            ++pos_;
+            return true;
+        }
+        return false;
+    }
+
+    bool skip(int depth = 0) {
+        if (depth > kMaxSkipDepth) {
+            return false;
+        }
+        uint8_t b;
+        if (!byte(b)) {
+            return false;
+        }
+        uint64_t n = 0;
+        if (b < 0x80 || b >= 0xe0 || b == 0xc0 || b == 0xc2 || b == 0xc3) {
+            return true;
+        }
+        if ((b & 0xf0) == 0x80) {
+            return skipItems(2ull * (b & 0x0f), depth);
+        }
+        if ((b & 0xf0) == 0x90) {
+            return skipItems(b & 0x0f, depth);
+        }
+        if ((b & 0xe0) == 0xa0) {
+            return advance(b & 0x1f);
+        }
+        switch (b) {
+            case 0xc4: case 0xd9: return be(1, n) && advance(n);
+            case 0xc5: case 0xda: return be(2, n) && advance(n);
+            case 0xc6: case 0xdb: return be(4, n) && advance(n);
+            case 0xc7: return be(1, n) && advance(n + 1);
+            case 0xc8: return be(2, n) && advance(n + 1);
+            case 0xc9: return be(4, n) && advance(n + 1);
+            case 0xca: return advance(4);
+            case 0xcb: return advance(8);
+            case 0xcc: case 0xd0: return advance(1);
+            case 0xcd: case 0xd1: return advance(2);
+            case 0xce: case 0xd2: return advance(4);
+            case 0xcf: case 0xd3: return advance(8);
+            case 0xd4: return advance(2);
+            case 0xd5: return advance(3);
+            case 0xd6: return advance(5);
+            case 0xd7: return advance(9);
+            case 0xd8: return advance(17);
+            case 0xdc: return be(2, n) && skipItems(n, depth);
+            case 0xdd: return be(4, n) && skipItems(n, depth);
+            case 0xde: return be(2, n) && skipItems(2 * n, depth);
+            case 0xdf: return be(4, n) && skipItems(2 * n, depth);
+            default: return false;  // 0xc1 is never used
+        }
+    }
+
+private:
+    bool byte(uint8_t& b) {
+        if (pos_ >= data_.size()) {
+            return false;
+        }
+        b = static_cast<uint8_t>(data_[pos_++]);
+        return true;
+    }
+
+    bool be(int bytes, uint64_t& v) {
+        if (static_cast<std::size_t>(bytes) > data_.size() - pos_) {
+            return false;
+        }
+        v = 0;
+        for (int i = 0; i < bytes; ++i) {
+            v = (v << 8) | static_cast<uint8_t>(data_[pos_++]);
+        }
+        return true;
+    }
+
+    bool advance(uint64_t n) {
+        if (n > data_.size() - pos_) {
+            return false;
+        }
+        pos_ += n;
+        return true;
+    }
+
+    bool skipItems(uint64_t count, int depth) {
+        // Every item takes at least one byte, so a count beyond the input is a lie
+        if (count > data_.size() - pos_) {
+            return false;
+        }
+        for (uint64_t i = 0; i < count; ++i) {
+            if (!skip(depth + 1)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    std::string_view data_;
+    std::size_t pos_ = 0;
+};
+
+} // namespace
+
+std::string ChatWireCodec::negotiateSubprotocol(std::string_view offered) {
+    bool json = false;
+    while (!offered.empty()) {
+        std::size_t comma = offered.find(',');
+        std::string_view token = offered.substr(0, comma);
+        while (!token.empty() && (token.front() == ' ' || token.front() == '\t')) token.remove_prefix(1);
+        while (!token.empty() && (token.back() == ' ' || token.back() == '\t')) token.remove_suffix(1);
+        // The binary protocol wins whenever it is offered, regardless of the client's order
+        if (token == kMsgpackSubprotocol) {
+            return kMsgpackSubprotocol;
+        }
+        json = json || token == kJsonSubprotocol;
+        if (comma == std::string_view::npos) {
+            break;
+        }
+        offered.remove_prefix(comma + 1);
+    }
+    return json ? kJsonSubprotocol : "";
+}
+
+const char* ChatWireCodec::typeName(ChatWireType type) {
+    for (const auto& entry : kTypeNames) {
+        if (entry.type == type) {
+            return entry.name;
+        }
+    }
+    return "";
+}
+
+ChatWireType ChatWireCodec::typeFromName(std::string_view name) {
+    for (const auto& entry : kTypeNames) {
+        if (name == entry.name) {
+            return entry.type;
+        }
+    }
+    return ChatWireType::kUnknown;
+}
+
+bool ChatWireCodec::decodeJson(std::string_view text, ChatWireMessage& out) {
+    try {
+        auto j = nlohmann::json::parse(text);
+        if (!j.is_object()) {
+            return false;
+        }
+        out.type = typeFromName(j.value("type", ""));
+        for (const auto& field : kStringFields) {
+            out.*field.member = j.value(field.name, "");
+        }
+        out.user_id = j.value("user_id", 0LL);
+        out.success = j.value("success", false);
+        return true;
+    } catch (const nlohmann::json::exception&) {
+        return false;
+    }
+}
+
+std::string ChatWireCodec::encodeJson(const ChatWireMessage& msg) {
+    nlohmann::json j;
+    j["type"] = typeName(msg.type);
+    for (const auto& field : kStringFields) {
+        if (!(msg.*field.member).empty()) {
+            j[field.name] = msg.*field.member;
+        }
+    }
+    if (isResponse(msg.type)) {
+        j["success"] = msg.success;
+    }
+    if (msg.type == ChatWireType::kLoginResponse && msg.success) {
+        j["user_id"] = msg.user_id;
+    }
+    return j.dump();
+}
+
+bool ChatWireCodec::decodeMsgpack(std::string_view data, ChatWireMessage& out) {
+    MsgpackReader reader(data);
+    uint32_t count;
+    if (!reader.mapHeader(count)) {
+        return false;
+    }
+    for (uint32_t i = 0; i < count; ++i) {
+        std::string_view key;
+        if (!reader.str(key)) {
+            return false;
+        }
+        if (key == "type") {
+            std::string_view name;
+            if (!reader.str(name)) {
+                return false;
+            }
+            out.type = typeFromName(name);
+            continue;
+        }
+        if (key == "user_id") {
+            if (!reader.nil() && !reader.integer(out.user_id)) {
+                return false;
+            }
+            continue;
+        }
+        if (key == "success") {
+            if (!reader.nil() && !reader.boolean(out.success)) {
+                return false;
+            }
+            continue;
+        }
+        bool known = false;
+        for (const auto& field : kStringFields) {
+            if (key == field.name) {
+                std::string_view value;
+                if (!reader.nil()) {
+                    if (!reader.str(value)) {
+                        return false;
+                    }
+                    (out.*field.member).assign(value.data(), value.size());
+                }
+                known = true;
+                break;
+            }
+        }
+        if (!known && !reader.skip()) {
+            return false;
+        }
+    }
+    return reader.atEnd();
+}
+
+std::string ChatWireCodec::encodeMsgpack(const ChatWireMessage& msg) {
+    uint32_t count = 1;
+    std::size_t bytes = 16;
+    for (const auto& field : kStringFields) {
+        const std::string& value = msg.*field.member;
+        if (!value.empty()) {
+            ++count;
+            bytes += std::strlen(field.name) + value.size() + 6;
+        }
+    }
+    bool with_success = isResponse(msg.type);
+    bool with_user_id = msg.type == ChatWireType::kLoginResponse && msg.success;
+    count += with_success + with_user_id;
+
+    std::string out;
+    out.reserve(bytes + 24);
+    MsgpackWriter writer(out);
+    writer.mapHeader(count);
+    writer.str("type");
+    writer.str(typeName(msg.type));
+    for (const auto& field : kStringFields) {
+        const std::string& value = msg.*field.member;
+        if (!value.empty()) {
+            writer.str(field.name);
+            writer.str(value);
+        }
+    }
+    if (with_success) {
+        writer.str("success");
+        writer.boolean(msg.success);
+    }
+    if (with_user_id) {
+        writer.str("user_id");
+        writer.integer(msg.user_id);
+    }
+    return out;
+}
+
+} // namespace protocols
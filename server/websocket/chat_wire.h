@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace protocols {
+
+/**
+ * @brief WebSocket 聊天消息类型
+ */
+enum class ChatWireType {
+    kUnknown = 0,
+    kLogin,            ///< "login"
+    kLoginResponse,    ///< "login_response"
+    kJoinRoom,         ///< "join_room"
+    kLeaveRoom,        ///< "leave_room"
+    kMessage,          ///< "message"（客户端发送与服务端转发共用）
+    kMessageResponse,  ///< "message_response"（发送确认）
+    kTyping,           ///< "typing"（输入提示，可丢弃）
+    kPresence          ///< "presence"（聊天室成员进出，可丢弃）
+};
+
+/**
+ * @brief WebSocket 聊天消息，JSON 与 MessagePack 两种线上格式共用
+ *
+ * 字段名与 JSON 协议一致；为空的字符串字段不编码。
+ */
+struct ChatWireMessage {
+    ChatWireType type = ChatWireType::kUnknown;
+    std::string username;
+    std::string password;
+    std::string room_id;
+    std::string content;
+    std::string target_user;
+    std::string timestamp;
+    std::string error;
+    std::string action;     ///< presence 的 "join" / "leave"
+    long long user_id = 0;  ///< 仅 login_response 成功时编码
+    bool success = false;   ///< 仅 *_response 编码
+};
+
+/**
+ * @brief WebSocket 聊天消息编解码器
+ *
+ * 默认使用 JSON 文本帧；握手时通过 Sec-WebSocket-Protocol 选择 chatroom.msgpack 的连接改用
+ * MessagePack 二进制帧。MessagePack 消息是一个以字段名为键的 map，结构与 JSON 完全对应，
+ * 客户端可以直接使用任何 MessagePack 库；服务端编解码不经过 DOM，只支持协议用到的子集
+ * （map、字符串、整数、布尔、nil），未知字段被跳过。两种客户端可以在同一聊天室中互通，
+ * 转发时每种格式只编码一次。
+ */
+class ChatWireCodec {
+public:
+    static constexpr char kJsonSubprotocol[] = "chatroom.json";
+    static constexpr char kMsgpackSubprotocol[] = "chatroom.msgpack";
+
+    /**
+     * @brief 从 Sec-WebSocket-Protocol 请求头中选择子协议
+     * @return 选中的子协议；客户端没有提议本端支持的子协议时返回空串（使用 JSON，不回应该头）
+     */
+    static std::string negotiateSubprotocol(std::string_view offered);
+
+    static const char* typeName(ChatWireType type);
+    static ChatWireType typeFromName(std::string_view name);
+
+    /**
+     * @brief 解码 JSON 文本消息
+     * @return false JSON 非法、不是对象或字段类型不符
+     */
+    static bool decodeJson(std::string_view text, ChatWireMessage& out);
+    static std::string encodeJson(const ChatWireMessage& msg);
+
+    /**
+     * @brief 解码 MessagePack 二进制消息
+     * @return false 数据截断、嵌套过深、顶层不是 map 或字段类型不符
+     */
+    static bool decodeMsgpack(std::string_view data, ChatWireMessage& out);
+    static std::string encodeMsgpack(const ChatWireMessage& msg);
+};
+
+} // namespace protocols
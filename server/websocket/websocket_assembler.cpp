@@ -0,0 +1,162 @@
+#include "websocket/websocket_assembler.h"
+#include "websocket/websocket_mask.h"
+
+namespace protocols {
+
+namespace {
+// Fragmented messages reuse message_; give back large buffers once such a message is delivered
+constexpr std::size_t kRetainedMessageCapacity = 64 * 1024;
+
+std::string encodeFrame(WebSocketOpcode opcode, std::string_view payload) {
+    WebSocketFrame frame;
+    frame.fin = true;
+    frame.opcode = opcode;
+    frame.masked = false;
+    frame.payload = payload;
+    auto data = WebSocketCodec::buildFrame(frame);
+    return std::string(data.begin(), data.end());
+}
+
+std::string closePayload(uint16_t code) {
+    return std::string{static_cast<char>(code >> 8), static_cast<char>(code & 0xff)};
+}
+}
+
+WebSocketAssembler::WebSocketAssembler(std::size_t max_message_bytes, WriteCallback write, MessageCallback on_message)
+    : max_message_bytes_(max_message_bytes), write_(std::move(write)), on_message_(std::move(on_message)) {}
+
+bool WebSocketAssembler::feed(Buffer* buf) {
+    while (!closed_ && buf->readableBytes() > 0) {
+        uint8_t* data = reinterpret_cast<uint8_t*>(buf->beginRead());
+        std::size_t len = buf->readableBytes();
+        WebSocketFrameHeader header;
+        int header_len = WebSocketCodec::parseFrameHeader(data, len, header);
+        if (header_len == 0) {
+            break;
+        }
+        if (header_len < 0 || !header.masked) {
+            // Client-to-server frames must be masked (RFC 6455 5.1)
+            return fail(WebSocketCloseCode::PROTOCOL_ERROR);
+        }
+        const bool control = static_cast<uint8_t>(header.opcode) & 0x8;
+        if (control) {
+            if (!header.fin || header.payload_len > 125 || header.rsv1) {
+                return fail(WebSocketCloseCode::PROTOCOL_ERROR);
+            }
+        } else {
+            // Checked against the declared length, before any of the payload is buffered
+            std::size_t used = in_message_ ? message_wire_bytes_ : 0;
+            if (header.payload_len > max_message_bytes_ - used) {
+                return fail(WebSocketCloseCode::MESSAGE_TOO_BIG);
+            }
+        }
+        std::size_t frame_len = static_cast<std::size_t>(header_len) + static_cast<std::size_t>(header.payload_len);
+        if (len < frame_len) {
+            break;
+        }
+
+        uint8_t* payload = data + header_len;
+        applyWebSocketMask(payload, static_cast<std::size_t>(header.payload_len), header.masking_key);
+        if (!onFrame(header, std::string_view(reinterpret_cast<const char*>(payload), header.payload_len))) {
+            return false;
+        }
+        // The payload view handed to the callback pointed into the buffer, so consume only afterwards
+        buf->retrieve(frame_len);
+    }
+    return !closed_;
+}
+
+bool WebSocketAssembler::onFrame(const WebSocketFrameHeader& header, std::string_view payload) {
+    switch (header.opcode) {
+        case WebSocketOpcode::PING:
+            ++pings_;
+            write_(encodeFrame(WebSocketOpcode::PONG, payload));
+            return true;
+        case WebSocketOpcode::PONG:
+            if (on_pong_) {
+                on_pong_(payload);
+            }
+            return true;
+        case WebSocketOpcode::CLOSE:
+            return onClose(payload);
+        case WebSocketOpcode::TEXT:
+        case WebSocketOpcode::BINARY:
+            if (in_message_ || (header.rsv1 && !deflate_)) {
+                return fail(WebSocketCloseCode::PROTOCOL_ERROR);
+            }
+            if (header.fin && !header.rsv1) {
+                deliver(header.opcode, payload, false);
+                return true;
+            }
+            in_message_ = true;
+            message_opcode_ = header.opcode;
+            message_compressed_ = header.rsv1;
+            message_wire_bytes_ = 0;
+            message_.clear();
+            return appendFragment(payload, header.fin);
+        case WebSocketOpcode::CONTINUATION:
+            // RSV1 is only set on the first frame of a compressed message (RFC 7692 6.1)
+            if (!in_message_ || header.rsv1) {
+                return fail(WebSocketCloseCode::PROTOCOL_ERROR);
+            }
+            return appendFragment(payload, header.fin);
+        default:
+            return fail(WebSocketCloseCode::PROTOCOL_ERROR);
+    }
+}
+
+bool WebSocketAssembler::appendFragment(std::string_view payload, bool fin) {
+    message_wire_bytes_ += payload.size();
+    if (message_compressed_) {
+        if (!deflate_->decompress(payload, fin, message_, max_message_bytes_)) {
+            return fail(message_.size() > max_message_bytes_ ? WebSocketCloseCode::MESSAGE_TOO_BIG
+                                                             : WebSocketCloseCode::INVALID_DATA);
+        }
+    } else {
+        message_.append(payload.data(), payload.size());
+    }
+    if (!fin) {
+        return true;
+    }
+
+    in_message_ = false;
+    deliver(message_opcode_, message_, message_compressed_);
+    if (message_.capacity() > kRetainedMessageCapacity) {
+        std::string().swap(message_);
+    } else {
+        message_.clear();
+    }
+    return true;
+}
+
+bool WebSocketAssembler::onClose(std::string_view payload) {
+    if (payload.size() == 1) {
+        return fail(WebSocketCloseCode::PROTOCOL_ERROR);
+    }
+    deliver(WebSocketOpcode::CLOSE, payload, false);
+    // Echo the status code, then stop reading (RFC 6455 5.5.1)
+    write_(encodeFrame(WebSocketOpcode::CLOSE, payload.substr(0, 2)));
+    closed_ = true;
+    return false;
+}
+
+void WebSocketAssembler::deliver(WebSocketOpcode opcode, std::string_view payload, bool compressed) {
+    if (!on_message_) {
+        return;
+    }
+    WebSocketFrame message;
+    message.fin = true;
+    message.opcode = opcode;
+    message.masked = false;
+    message.payload = payload;
+    message.rsv1 = compressed;
+    on_message_(message);
+}
+
+bool WebSocketAssembler::fail(WebSocketCloseCode code) {
+    write_(encodeFrame(WebSocketOpcode::CLOSE, closePayload(static_cast<uint16_t>(code))));
+    closed_ = true;
+    return false;
+}
+
+} // namespace protocols
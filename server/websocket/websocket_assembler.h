@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include "net/buffer.h"
+#include "websocket/websocket_codec.h"
+#include "websocket/websocket_deflate.h"
+
+namespace protocols {
+
+/**
+ * @brief WebSocket 关闭码 (RFC 6455 7.4.1)
+ */
+enum class WebSocketCloseCode : uint16_t {
+    NORMAL = 1000,
+    PROTOCOL_ERROR = 1002,
+    INVALID_DATA = 1007,
+    POLICY_VIOLATION = 1008,
+    MESSAGE_TOO_BIG = 1009
+};
+
+/**
+ * @brief 单个连接的 WebSocket 消息组装器 (RFC 6455 5.4, 5.5)
+ *
+ * 从输入缓冲区逐帧解析，把分片（fin=0 的首帧 + CONTINUATION）拼接成完整消息再交给回调：
+ * - 未分片且未压缩的消息直接指向输入缓冲区中原地去掩码后的负载（零拷贝）；
+ *   分片或压缩的消息拼接/解压到组装器自己的消息缓冲区。两种视图都只在回调返回前有效。
+ * - 帧头到达时就按声明的长度检查消息上限，超限的帧不会被缓冲（1009 关闭）。
+ * - 控制帧可以穿插在分片之间：PING 立即在IO线程回复 PONG，PONG 交给 PongCallback，
+ *   CLOSE 交给回调后回显关闭码并停止解析。
+ * - 客户端帧必须带掩码，保留操作码、分片的控制帧、错序的 CONTINUATION 均为协议错误（1002 关闭）。
+ * 非线程安全，只能在连接所属IO线程中使用。
+ */
+class WebSocketAssembler {
+public:
+    using WriteCallback = std::function<void(const std::string& data)>;
+    /**
+     * @brief 完整消息回调
+     *
+     * message.opcode 为 TEXT、BINARY 或 CLOSE，fin 恒为 true；rsv1 表示该消息在线路上是压缩的
+     * （payload 已是解压后的数据）。
+     */
+    using MessageCallback = std::function<void(const WebSocketFrame& message)>;
+    /// PONG 回调，payload 只在回调返回前有效
+    using PongCallback = std::function<void(std::string_view payload)>;
+
+    WebSocketAssembler(std::size_t max_message_bytes, WriteCallback write, MessageCallback on_message);
+
+    /**
+     * @brief 启用 permessage-deflate 解压（握手协商成功后调用）
+     */
+    void setDeflate(std::shared_ptr<WebSocketDeflate> deflate) { deflate_ = std::move(deflate); }
+
+    /**
+     * @brief 设置 PONG 回调（服务端心跳用来计算往返时间）
+     */
+    void setPongCallback(PongCallback on_pong) { on_pong_ = std::move(on_pong); }
+
+    /**
+     * @brief 消费缓冲区中所有完整的帧
+     * @return false 表示连接应关闭（关闭帧已写出），缓冲区中剩余的数据应丢弃
+     */
+    bool feed(Buffer* buf);
+
+    /// 已自动回复的 PING 数
+    uint64_t pingCount() const { return pings_; }
+    /// 正在组装的分片消息已缓冲的字节数
+    std::size_t pendingBytes() const { return message_.size(); }
+
+private:
+    bool onFrame(const WebSocketFrameHeader& header, std::string_view payload);
+    bool onClose(std::string_view payload);
+    bool appendFragment(std::string_view payload, bool fin);
+    void deliver(WebSocketOpcode opcode, std::string_view payload, bool compressed);
+    bool fail(WebSocketCloseCode code);
+
+    std::size_t max_message_bytes_;
+    WriteCallback write_;
+    MessageCallback on_message_;
+    PongCallback on_pong_;
+    std::shared_ptr<WebSocketDeflate> deflate_;
+
+    bool in_message_ = false;          ///< 正在接收分片消息
+    WebSocketOpcode message_opcode_ = WebSocketOpcode::TEXT;
+    bool message_compressed_ = false;
+    std::size_t message_wire_bytes_ = 0;   ///< 当前消息已收到的线路负载字节数
+    std::string message_;
+    bool closed_ = false;
+    uint64_t pings_ = 0;
+};
+
+} // namespace protocols
@@ -1,8 +1,11 @@
 #include "websocket/websocket_codec.h"
+#include "websocket/websocket_mask.h"
 #include <sstream>
 #include <algorithm>
 #include <arpa/inet.h> // for htons, htonl, ntohs, ntohl (on Linux)
 #include <cstring> // for memcpy
+#include <cctype>
+#include <string_view>
 
 namespace protocols {
 
@@ -22,16 +25,186 @@ std::string WebSocketCodec::buildHandshakeResponse(const std::string& accept_key
     return response.str();
 }
 
-int WebSocketCodec::parseFrame(uint8_t* data, size_t len, WebSocketFrame& out_frame) {
+namespace {
+
+std::string_view trimView(std::string_view v) {
+    while (!v.empty() && (v.front() == ' ' || v.front() == '\t')) v.remove_prefix(1);
+    while (!v.empty() && (v.back() == ' ' || v.back() == '\t')) v.remove_suffix(1);
+    return v;
+}
+
+bool iequals(std::string_view a, std::string_view b) {
+    return a.size() == b.size() &&
+           std::equal(a.begin(), a.end(), b.begin(), [](char x, char y) {
+               return std::tolower(static_cast<unsigned char>(x)) == std::tolower(static_cast<unsigned char>(y));
+           });
+}
+
+// Window bits parameter value, optionally quoted (RFC 7692 7.1.2); -1 when invalid
+int parseWindowBits(std::string_view value) {
+    if (value.size() >= 2 && value.front() == '"' && value.back() == '"') {
+        value = value.substr(1, value.size() - 2);
+    }
+    if (value.empty() || value.size() > 2 || (value.size() == 2 && value[0] == '0')) {
+        return -1;
+    }
+    int bits = 0;
+    for (char ch : value) {
+        if (ch < '0' || ch > '9') return -1;
+        bits = bits * 10 + (ch - '0');
+    }
+    return bits >= 8 && bits <= 15 ? bits : -1;
+}
+
+struct DeflateOffer {
+    int server_max_window_bits = 0;     ///< 0 = not offered
+    int client_max_window_bits = 0;     ///< 0 = not offered, 15 when offered without a value
+    bool server_no_context_takeover = false;
+    bool client_no_context_takeover = false;
+};
+
+// Parses the parameters of one permessage-deflate offer; false declines the offer
+bool parseDeflateOffer(std::string_view params, DeflateOffer& offer) {
+    bool seen[4] = {false, false, false, false};
+    while (!params.empty()) {
+        std::size_t semi = params.find(';');
+        std::string_view param = trimView(params.substr(0, semi));
+        params = semi == std::string_view::npos ? std::string_view() : params.substr(semi + 1);
+        if (param.empty()) {
+            continue;
+        }
+        std::string_view name = param;
+        std::string_view value;
+        bool has_value = false;
+        std::size_t eq = param.find('=');
+        if (eq != std::string_view::npos) {
+            name = trimView(param.substr(0, eq));
+            value = trimView(param.substr(eq + 1));
+            has_value = true;
+        }
+
+        int index;
+        if (iequals(name, "server_no_context_takeover")) {
+            if (has_value) return false;
+            offer.server_no_context_takeover = true;
+            index = 0;
+        } else if (iequals(name, "client_no_context_takeover")) {
+            if (has_value) return false;
+            offer.client_no_context_takeover = true;
+            index = 1;
+        } else if (iequals(name, "server_max_window_bits")) {
+            offer.server_max_window_bits = has_value ? parseWindowBits(value) : -1;
+            if (offer.server_max_window_bits < 0) return false;
+            index = 2;
+        } else if (iequals(name, "client_max_window_bits")) {
+            offer.client_max_window_bits = has_value ? parseWindowBits(value) : 15;
+            if (offer.client_max_window_bits < 0) return false;
+            index = 3;
+        } else {
+            return false;
+        }
+        if (seen[index]) return false;
+        seen[index] = true;
+    }
+    return true;
+}
+
+// Approximate zlib allocations (zconf.h): deflate (1 << (windowBits+2)) + (1 << (memLevel+9)),
+// inflate (1 << windowBits), plus the fixed state structs
+constexpr std::size_t kDeflateStateBytes = 6 * 1024;
+constexpr std::size_t kInflateStateBytes = 7 * 1024;
+
+} // namespace
+
+std::size_t WebSocketCodec::deflateMemoryUsage(const WebSocketDeflateParams& params) {
+    return (std::size_t{1} << (params.server_max_window_bits + 2)) + (std::size_t{1} << (params.mem_level + 9)) +
+           kDeflateStateBytes + (std::size_t{1} << params.client_max_window_bits) + kInflateStateBytes;
+}
+
+bool WebSocketCodec::negotiateDeflate(const std::string& extensions, const WebSocketDeflateOptions& options,
+                                      WebSocketDeflateParams& params, std::string& response) {
+    std::string_view rest(extensions);
+    while (!rest.empty()) {
+        std::size_t comma = rest.find(',');
+        std::string_view item = rest.substr(0, comma);
+        rest = comma == std::string_view::npos ? std::string_view() : rest.substr(comma + 1);
+
+        std::size_t semi = item.find(';');
+        if (!iequals(trimView(item.substr(0, semi)), "permessage-deflate")) {
+            continue;
+        }
+        DeflateOffer offer;
+        if (!parseDeflateOffer(semi == std::string_view::npos ? std::string_view() : item.substr(semi + 1), offer)) {
+            continue;
+        }
+
+        WebSocketDeflateParams p;
+        p.server_max_window_bits = std::min(std::max(options.max_window_bits, 9), 15);
+        if (offer.server_max_window_bits > 0) {
+            p.server_max_window_bits = std::min(p.server_max_window_bits, offer.server_max_window_bits);
+        }
+        if (p.server_max_window_bits < 9) {
+            continue;
+        }
+        // Without client_max_window_bits in the offer the client may use any window up to 15
+        const bool client_adjustable = offer.client_max_window_bits > 0;
+        p.client_max_window_bits = client_adjustable ? offer.client_max_window_bits : 15;
+        p.server_no_context_takeover = offer.server_no_context_takeover || !options.context_takeover;
+        p.client_no_context_takeover = offer.client_no_context_takeover || !options.context_takeover;
+
+        // Shrink within what the offer allows until the state fits the per-connection budget
+        bool fits = true;
+        while (options.max_memory > 0 && deflateMemoryUsage(p) > options.max_memory) {
+            if (p.mem_level > 5) {
+                --p.mem_level;
+            } else if (p.server_max_window_bits > 9 &&
+                       (!client_adjustable || p.server_max_window_bits >= p.client_max_window_bits)) {
+                --p.server_max_window_bits;
+            } else if (client_adjustable && p.client_max_window_bits > 9) {
+                --p.client_max_window_bits;
+            } else if (p.mem_level > 1) {
+                --p.mem_level;
+            } else {
+                fits = false;
+                break;
+            }
+        }
+        if (!fits) {
+            continue;
+        }
+
+        params = p;
+        response = "permessage-deflate";
+        if (p.server_no_context_takeover) {
+            response += "; server_no_context_takeover";
+        }
+        if (p.client_no_context_takeover) {
+            response += "; client_no_context_takeover";
+        }
+        if (offer.server_max_window_bits > 0 || p.server_max_window_bits < 15) {
+            response += "; server_max_window_bits=" + std::to_string(p.server_max_window_bits);
+        }
+        if (client_adjustable && p.client_max_window_bits < 15) {
+            response += "; client_max_window_bits=" + std::to_string(p.client_max_window_bits);
+        }
+        return true;
+    }
+    return false;
+}
+
+int WebSocketCodec::parseFrameHeader(const uint8_t* data, size_t len, WebSocketFrameHeader& out_header) {
     if (len < 2) return 0; // Need at least 2 bytes
 
     size_t offset = 0;
     uint8_t byte1 = data[offset++];
     uint8_t byte2 = data[offset++];
 
-    out_frame.fin = (byte1 & 0x80) != 0;
-    out_frame.opcode = static_cast<WebSocketOpcode>(byte1 & 0x0F);
-    out_frame.masked = (byte2 & 0x80) != 0;
+    out_header.fin = (byte1 & 0x80) != 0;
+    out_header.rsv1 = (byte1 & 0x40) != 0;
+    // No negotiated extension defines RSV2/RSV3 (RFC 6455 5.2)
+    if (byte1 & 0x30) return -1;
+    out_header.opcode = static_cast<WebSocketOpcode>(byte1 & 0x0F);
+    out_header.masked = (byte2 & 0x80) != 0;
     uint64_t payload_len = byte2 & 0x7F;
 
     if (payload_len == 126) {
@@ -42,9 +215,7 @@ int WebSocketCodec::parseFrame(uint8_t* data, size_t len, WebSocketFrame& out_fr
         offset += 2;
     } else if (payload_len == 127) {
         if (len < offset + 8) return 0;
-        // ntohll is not standard, manual conversion for big-endian network order
-        // Assuming we are on Little Endian (x86), we need to swap bytes
-        // Or better, read byte by byte
+        // Big-endian 64-bit length, read byte by byte
         uint64_t temp = 0;
         for(int i=0; i<8; ++i) {
              temp = (temp << 8) | data[offset + i];
@@ -52,25 +223,37 @@ int WebSocketCodec::parseFrame(uint8_t* data, size_t len, WebSocketFrame& out_fr
         payload_len = temp;
         offset += 8;
     }
+    out_header.payload_len = payload_len;
 
-    uint8_t masking_key[4];
-    if (out_frame.masked) {
+    if (out_header.masked) {
         if (len < offset + 4) return 0;
-        std::memcpy(masking_key, &data[offset], 4);
+        std::memcpy(out_header.masking_key, &data[offset], 4);
         offset += 4;
     }
+    return static_cast<int>(offset);
+}
+
+int WebSocketCodec::parseFrame(uint8_t* data, size_t len, WebSocketFrame& out_frame) {
+    WebSocketFrameHeader header;
+    int header_len = parseFrameHeader(data, len, header);
+    if (header_len <= 0) return header_len;
+    size_t offset = static_cast<size_t>(header_len);
+    uint64_t payload_len = header.payload_len;
 
-    if (len < offset + payload_len) return 0;
+    out_frame.fin = header.fin;
+    out_frame.rsv1 = header.rsv1;
+    out_frame.opcode = header.opcode;
+    out_frame.masked = header.masked;
+
+    // The consumed size is returned as int; a 64-bit length must also not wrap offset + payload_len
+    if (payload_len > static_cast<uint64_t>(INT32_MAX) - offset) return -1;
+    if (len - offset < payload_len) return 0;
 
     // Zero-copy: point to buffer
-    // Unmask in-place if needed
+    // Unmask in-place if needed (vectorized, see websocket_mask.h)
     uint8_t* payload_ptr = &data[offset];
     if (out_frame.masked && payload_len > 0) {
-        // Need to make sure we don't modify data if it's supposed to be const,
-        // but our API takes uint8_t* which implies mutability.
-        for (size_t i = 0; i < payload_len; ++i) {
-            payload_ptr[i] ^= masking_key[i % 4];
-        }
+        applyWebSocketMask(payload_ptr, payload_len, header.masking_key);
     }
     
     out_frame.payload = std::string_view(reinterpret_cast<const char*>(payload_ptr), payload_len);
@@ -82,7 +265,7 @@ int WebSocketCodec::parseFrame(uint8_t* data, size_t len, WebSocketFrame& out_fr
 std::vector<uint8_t> WebSocketCodec::buildFrame(const WebSocketFrame& frame) {
     std::vector<uint8_t> buffer;
     
-    uint8_t byte1 = (frame.fin ? 0x80 : 0x00) | (static_cast<uint8_t>(frame.opcode) & 0x0F);
+    uint8_t byte1 = (frame.fin ? 0x80 : 0x00) | (frame.rsv1 ? 0x40 : 0x00) | (static_cast<uint8_t>(frame.opcode) & 0x0F);
     buffer.push_back(byte1);
 
     uint8_t byte2 = frame.masked ? 0x80 : 0x00;
@@ -28,6 +28,39 @@ struct WebSocketFrame {
     WebSocketOpcode opcode;         ///< 操作码
     bool masked;                    ///< 是否包含掩码（客户端发往服务端必须包含）
     std::string_view payload;       ///< 负载数据 (Zero-copy view into Buffer)
+    bool rsv1 = false;              ///< RSV1 位；协商 permessage-deflate 后表示消息已压缩
+};
+
+/**
+ * @brief WebSocket帧头
+ */
+struct WebSocketFrameHeader {
+    bool fin = false;
+    bool rsv1 = false;
+    WebSocketOpcode opcode = WebSocketOpcode::UNKNOWN;
+    bool masked = false;
+    uint64_t payload_len = 0;       ///< 帧头声明的负载长度（未校验上限）
+    uint8_t masking_key[4] = {0, 0, 0, 0};
+};
+
+/**
+ * @brief 本端对 permessage-deflate 的接受策略（来自服务端配置）
+ */
+struct WebSocketDeflateOptions {
+    int max_window_bits = 15;        ///< 本端压缩窗口上限 (9-15)
+    bool context_takeover = true;    ///< false 时要求双方每条消息独立压缩
+    std::size_t max_memory = 0;      ///< 每个连接压缩+解压状态的内存上限（字节），0 表示不限制
+};
+
+/**
+ * @brief 协商结果 (RFC 7692 7.1)
+ */
+struct WebSocketDeflateParams {
+    int server_max_window_bits = 15;          ///< 本端压缩使用的窗口
+    int client_max_window_bits = 15;          ///< 对端压缩使用的窗口（本端解压窗口）
+    bool server_no_context_takeover = false;  ///< 本端每条消息后重置压缩器
+    bool client_no_context_takeover = false;  ///< 对端每条消息后重置压缩器
+    int mem_level = 8;                        ///< 本端 deflate memLevel，不参与协商，受内存上限约束
 };
 
 /**
@@ -56,7 +89,35 @@ public:
      */
     static std::string buildHandshakeResponse(const std::string& accept_key);
 
+    /**
+     * @brief 协商 permessage-deflate 扩展
+     *
+     * 按顺序检查 Sec-WebSocket-Extensions 中的每个 permessage-deflate 提议，接受第一个可以满足的：
+     * 参数非法或重复的提议被拒绝；窗口与 memLevel 在提议允许的范围内逐步缩小直到满足内存上限。
+     * zlib 的 raw deflate 不支持 8 位窗口，因此要求 server_max_window_bits=8 的提议会被拒绝。
+     * @param extensions 请求头 Sec-WebSocket-Extensions 的值
+     * @param options 本端策略
+     * @param params [out] 协商结果
+     * @param response [out] 响应头 Sec-WebSocket-Extensions 的值
+     * @return false 表示不启用压缩
+     */
+    static bool negotiateDeflate(const std::string& extensions, const WebSocketDeflateOptions& options,
+                                 WebSocketDeflateParams& params, std::string& response);
+
+    /**
+     * @brief 估算一组压缩参数的 zlib 内存占用（压缩器 + 解压器）
+     */
+    static std::size_t deflateMemoryUsage(const WebSocketDeflateParams& params);
+
     // Frame Parsing
+    /**
+     * @brief 只解析帧头，不要求负载已到达
+     *
+     * 用于在缓冲负载之前按声明的长度拒绝超大帧。
+     * @return int 帧头字节数；0 表示数据不足；-1 表示协议违规
+     */
+    static int parseFrameHeader(const uint8_t* data, size_t len, WebSocketFrameHeader& out_header);
+
     /**
      * @brief 解析WebSocket数据帧 (In-Place Unmasking)
      * @param data 数据指针 (Mutable, will be modified if masked)
@@ -64,7 +125,7 @@ public:
      * @param out_frame [out] 解析出的帧结构
      * @return int 解析消耗的字节数。
      *         0 表示数据不足以解析完整帧；
-     *         -1 表示解析错误（如协议违规）。
+     *         -1 表示解析错误（如协议违规，RSV2/RSV3 置位）。
      */
     static int parseFrame(uint8_t* data, size_t len, WebSocketFrame& out_frame);
     
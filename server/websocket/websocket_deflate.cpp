@@ -0,0 +1,139 @@
+#include "websocket/websocket_deflate.h"
+#include "logger.h"
+
+#include <cstring>
+#include <map>
+#include <memory>
+#include <tuple>
+
+namespace protocols {
+
+namespace {
+// Every message ends with an empty stored block; the sender strips it and the receiver puts it back
+constexpr char kSyncTail[4] = {0x00, 0x00, static_cast<char>(0xff), static_cast<char>(0xff)};
+constexpr std::size_t kInflateChunk = 16 * 1024;
+}
+
+WebSocketDeflate::WebSocketDeflate(const WebSocketDeflateParams& params, int level)
+    : params_(params), level_(level) {
+    std::memset(&deflate_, 0, sizeof(deflate_));
+    std::memset(&inflate_, 0, sizeof(inflate_));
+}
+
+WebSocketDeflate::~WebSocketDeflate() {
+    if (deflate_ready_) {
+        deflateEnd(&deflate_);
+    }
+    if (inflate_ready_) {
+        inflateEnd(&inflate_);
+    }
+}
+
+bool WebSocketDeflate::compress(std::string_view in, std::string& out) {
+    if (!deflate_ready_) {
+        // Negative windowBits: raw deflate without zlib header/trailer
+        if (deflateInit2(&deflate_, level_, Z_DEFLATED, -params_.server_max_window_bits, params_.mem_level,
+                         Z_DEFAULT_STRATEGY) != Z_OK) {
+            LOG_ERROR("WebSocket deflateInit2 failed");
+            return false;
+        }
+        deflate_ready_ = true;
+    }
+
+    deflate_.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in.data()));
+    deflate_.avail_in = static_cast<uInt>(in.size());
+    std::size_t bound = deflateBound(&deflate_, static_cast<uLong>(in.size())) + 16;
+    out.clear();
+    do {
+        std::size_t old_size = out.size();
+        out.resize(old_size + bound);
+        deflate_.next_out = reinterpret_cast<Bytef*>(&out[old_size]);
+        deflate_.avail_out = static_cast<uInt>(bound);
+        int rc = deflate(&deflate_, Z_SYNC_FLUSH);
+        if (rc != Z_OK && rc != Z_BUF_ERROR) {
+            deflateReset(&deflate_);
+            return false;
+        }
+        out.resize(old_size + (bound - deflate_.avail_out));
+    } while (deflate_.avail_out == 0);
+
+    if (out.size() >= 4 && std::memcmp(out.data() + out.size() - 4, kSyncTail, 4) == 0) {
+        out.resize(out.size() - 4);
+    }
+    if (params_.server_no_context_takeover) {
+        deflateReset(&deflate_);
+    }
+    return true;
+}
+
+bool WebSocketDeflate::decompress(std::string_view in, bool fin, std::string& out, std::size_t max_message_bytes) {
+    if (!inflate_ready_) {
+        if (inflateInit2(&inflate_, -params_.client_max_window_bits) != Z_OK) {
+            LOG_ERROR("WebSocket inflateInit2 failed");
+            return false;
+        }
+        inflate_ready_ = true;
+    }
+
+    auto run = [&](std::string_view data) {
+        inflate_.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+        inflate_.avail_in = static_cast<uInt>(data.size());
+        while (true) {
+            std::size_t old_size = out.size();
+            out.resize(old_size + kInflateChunk);
+            inflate_.next_out = reinterpret_cast<Bytef*>(&out[old_size]);
+            inflate_.avail_out = static_cast<uInt>(kInflateChunk);
+            int rc = inflate(&inflate_, Z_SYNC_FLUSH);
+            std::size_t produced = kInflateChunk - inflate_.avail_out;
+            out.resize(old_size + produced);
+            message_bytes_ += produced;
+            if (message_bytes_ > max_message_bytes) {
+                return false;
+            }
+            if (rc == Z_STREAM_END) {
+                // A final block ends the LZ77 context; anything after it in this message is ignored
+                inflateReset(&inflate_);
+                return true;
+            }
+            if (rc != Z_OK && rc != Z_BUF_ERROR) {
+                return false;
+            }
+            if (inflate_.avail_in == 0 && inflate_.avail_out != 0) {
+                return true;
+            }
+            if (rc == Z_BUF_ERROR && produced == 0) {
+                return true;
+            }
+        }
+    };
+
+    bool ok = run(in) && (!fin || run(std::string_view(kSyncTail, sizeof(kSyncTail))));
+    if (!ok) {
+        inflateReset(&inflate_);
+        message_bytes_ = 0;
+        return false;
+    }
+    if (fin) {
+        message_bytes_ = 0;
+        if (params_.client_no_context_takeover) {
+            inflateReset(&inflate_);
+        }
+    }
+    return true;
+}
+
+bool WebSocketDeflate::compressStateless(const WebSocketDeflateParams& params, int level, std::string_view in,
+                                         std::string& out) {
+    using Key = std::tuple<int, int, int>;
+    thread_local std::map<Key, std::unique_ptr<WebSocketDeflate>> cache;
+
+    auto& deflater = cache[Key(params.server_max_window_bits, params.mem_level, level)];
+    if (!deflater) {
+        WebSocketDeflateParams stateless = params;
+        stateless.server_no_context_takeover = true;
+        deflater = std::make_unique<WebSocketDeflate>(stateless, level);
+    }
+    return deflater->compress(in, out);
+}
+
+} // namespace protocols
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <zlib.h>
+#include "websocket/websocket_codec.h"
+
+namespace protocols {
+
+/**
+ * @brief permessage-deflate 统计，由所有IO线程并发更新，供 /metrics 导出
+ */
+struct WebSocketDeflateStats {
+    std::atomic<uint64_t> connections{0};    ///< 协商了压缩的连接数
+    std::atomic<uint64_t> messages_in{0};    ///< 解压的入站消息数
+    std::atomic<uint64_t> messages_out{0};   ///< 以压缩帧发出的消息数（按接收方计）
+    std::atomic<uint64_t> compressions{0};   ///< 实际执行的压缩次数（广播共享时小于 messages_out）
+    std::atomic<uint64_t> bytes_in{0};       ///< 压缩前字节数（按压缩次数计）
+    std::atomic<uint64_t> bytes_out{0};      ///< 压缩后字节数
+};
+
+/**
+ * @brief 单个连接的 permessage-deflate 压缩/解压状态 (RFC 7692)
+ *
+ * 每条消息以 Z_SYNC_FLUSH 结束并去掉末尾的 0x00 0x00 0xff 0xff；
+ * 协商了 no_context_takeover 的一方在每条消息后重置 zlib 流，否则滑动窗口跨消息保留，
+ * 聊天 JSON 中反复出现的键名在后续消息里只需要一个回溯引用。
+ * zlib 流在第一次使用时才分配，只握手不收发大消息的连接不占用窗口内存。
+ * 非线程安全，只能在连接所属IO线程中使用。
+ */
+class WebSocketDeflate {
+public:
+    WebSocketDeflate(const WebSocketDeflateParams& params, int level);
+    ~WebSocketDeflate();
+
+    WebSocketDeflate(const WebSocketDeflate&) = delete;
+    WebSocketDeflate& operator=(const WebSocketDeflate&) = delete;
+
+    /**
+     * @brief 压缩一条完整消息
+     * @param out [out] 压缩后的负载（覆盖写入）
+     */
+    bool compress(std::string_view in, std::string& out);
+
+    /**
+     * @brief 解压一个压缩消息的帧负载
+     *
+     * 分片消息的每一帧依次调用，fin 为 true 的最后一帧补上同步标记并结束本条消息。
+     * @param out [out] 本帧解压出的数据（追加写入，分片依次拼接成完整消息）
+     * @param max_message_bytes 整条消息解压后的大小上限
+     * @return false 表示数据非法或超出上限，连接应关闭
+     */
+    bool decompress(std::string_view in, bool fin, std::string& out, std::size_t max_message_bytes);
+
+    /**
+     * @brief 本端压缩是否与历史消息无关
+     *
+     * 为 true 时同一负载的压缩结果只取决于协商参数，广播时可以在参数相同的连接之间共享。
+     */
+    bool stateless() const { return params_.server_no_context_takeover; }
+
+    const WebSocketDeflateParams& params() const { return params_; }
+    int level() const { return level_; }
+
+    /**
+     * @brief 用当前线程缓存的无状态压缩器压缩一条消息
+     *
+     * 输出与 server_no_context_takeover 的连接各自 compress() 的结果相同。
+     */
+    static bool compressStateless(const WebSocketDeflateParams& params, int level, std::string_view in,
+                                  std::string& out);
+
+private:
+    WebSocketDeflateParams params_;
+    int level_;
+    z_stream deflate_;
+    z_stream inflate_;
+    bool deflate_ready_ = false;
+    bool inflate_ready_ = false;
+    std::size_t message_bytes_ = 0;   ///< 当前消息已解压的字节数
+};
+
+} // namespace protocols
@@ -0,0 +1,144 @@
+#include "websocket/websocket_mask.h"
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CHATROOM_WS_MASK_X86 1
+#endif
+
+namespace protocols {
+
+namespace {
+
+// Key as a little-endian word starting at byte (phase & 3), so word-sized XOR lines up with data[0]
+uint32_t rotatedKey(const uint8_t key[4], std::size_t phase) {
+    uint8_t k[4];
+    for (std::size_t i = 0; i < 4; ++i) {
+        k[i] = key[(phase + i) & 3];
+    }
+    uint32_t k32;
+    std::memcpy(&k32, k, sizeof(k32));
+    return k32;
+}
+
+// The kernels below only ever advance by multiples of 4 bytes, so the rotated key stays valid for the tail
+
+void maskWords(uint8_t* data, std::size_t len, uint32_t k32) {
+    const uint64_t k64 = (static_cast<uint64_t>(k32) << 32) | k32;
+    std::size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t word;
+        std::memcpy(&word, data + i, sizeof(word));
+        word ^= k64;
+        std::memcpy(data + i, &word, sizeof(word));
+    }
+    uint8_t k[4];
+    std::memcpy(k, &k32, sizeof(k));
+    for (; i < len; ++i) {
+        data[i] ^= k[i & 3];
+    }
+}
+
+#ifdef CHATROOM_WS_MASK_X86
+
+void maskSse2(uint8_t* data, std::size_t len, uint32_t k32) {
+    const __m128i mask = _mm_set1_epi32(static_cast<int>(k32));
+    std::size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i* p = reinterpret_cast<__m128i*>(data + i);
+        _mm_storeu_si128(p, _mm_xor_si128(_mm_loadu_si128(p), mask));
+    }
+    maskWords(data + i, len - i, k32);
+}
+
+__attribute__((target("avx2")))
+void maskAvx2(uint8_t* data, std::size_t len, uint32_t k32) {
+    const __m256i mask = _mm256_set1_epi32(static_cast<int>(k32));
+    std::size_t i = 0;
+    // Two independent 32-byte lanes per iteration keep both load ports busy
+    for (; i + 64 <= len; i += 64) {
+        __m256i* p0 = reinterpret_cast<__m256i*>(data + i);
+        __m256i* p1 = reinterpret_cast<__m256i*>(data + i + 32);
+        __m256i a = _mm256_loadu_si256(p0);
+        __m256i b = _mm256_loadu_si256(p1);
+        _mm256_storeu_si256(p0, _mm256_xor_si256(a, mask));
+        _mm256_storeu_si256(p1, _mm256_xor_si256(b, mask));
+    }
+    if (i + 32 <= len) {
+        __m256i* p = reinterpret_cast<__m256i*>(data + i);
+        _mm256_storeu_si256(p, _mm256_xor_si256(_mm256_loadu_si256(p), mask));
+        i += 32;
+    }
+    maskSse2(data + i, len - i, k32);
+}
+
+#endif
+
+using MaskKernel = void (*)(uint8_t*, std::size_t, uint32_t);
+
+struct MaskImpl {
+    MaskKernel kernel;
+    const char* name;
+};
+
+MaskImpl selectImpl() {
+#ifdef CHATROOM_WS_MASK_X86
+    if (webSocketMaskAvx2Supported()) {
+        return {maskAvx2, "avx2"};
+    }
+    return {maskSse2, "sse2"};
+#else
+    return {maskWords, "scalar"};
+#endif
+}
+
+const MaskImpl& impl() {
+    static const MaskImpl selected = selectImpl();
+    return selected;
+}
+
+} // namespace
+
+void webSocketMaskScalar(uint8_t* data, std::size_t len, const uint8_t key[4], std::size_t phase) {
+    maskWords(data, len, rotatedKey(key, phase));
+}
+
+#ifdef CHATROOM_WS_MASK_X86
+
+void webSocketMaskSse2(uint8_t* data, std::size_t len, const uint8_t key[4], std::size_t phase) {
+    maskSse2(data, len, rotatedKey(key, phase));
+}
+
+void webSocketMaskAvx2(uint8_t* data, std::size_t len, const uint8_t key[4], std::size_t phase) {
+    maskAvx2(data, len, rotatedKey(key, phase));
+}
+
+bool webSocketMaskAvx2Supported() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+#else
+
+bool webSocketMaskAvx2Supported() {
+    return false;
+}
+
+#endif
+
+const char* webSocketMaskImpl() {
+    return impl().name;
+}
+
+void applyWebSocketMask(uint8_t* data, std::size_t len, const uint8_t key[4], std::size_t phase) {
+    const uint32_t k32 = rotatedKey(key, phase);
+    // Below one vector the word loop wins; skip the SIMD prologue for short chat frames
+    if (len < 32) {
+        maskWords(data, len, k32);
+        return;
+    }
+    impl().kernel(data, len, k32);
+}
+
+} // namespace protocols
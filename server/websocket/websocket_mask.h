@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace protocols {
+
+/**
+ * @brief WebSocket 掩码异或实现 (RFC 6455 5.3)
+ *
+ * 所有实现都原地修改 data。phase 为 data[0] 在整个负载中的偏移，
+ * 使负载被分段处理时掩码相位保持正确（data[i] ^= key[(phase + i) % 4]）。
+ */
+using WebSocketMaskFn = void (*)(uint8_t* data, std::size_t len, const uint8_t key[4], std::size_t phase);
+
+/**
+ * @brief 64 位整字异或，适用于所有平台
+ */
+void webSocketMaskScalar(uint8_t* data, std::size_t len, const uint8_t key[4], std::size_t phase);
+
+#if defined(__x86_64__) || defined(__i386__)
+/**
+ * @brief SSE2 实现，每次处理 16 字节（x86-64 基线指令集）
+ */
+void webSocketMaskSse2(uint8_t* data, std::size_t len, const uint8_t key[4], std::size_t phase);
+
+/**
+ * @brief AVX2 实现，每次处理 64 字节；只能在 webSocketMaskAvx2Supported() 为 true 时调用
+ */
+void webSocketMaskAvx2(uint8_t* data, std::size_t len, const uint8_t key[4], std::size_t phase);
+#endif
+
+/**
+ * @brief 当前 CPU 是否支持 AVX2
+ */
+bool webSocketMaskAvx2Supported();
+
+/**
+ * @brief 运行时选中的实现名称："avx2"、"sse2" 或 "scalar"
+ */
+const char* webSocketMaskImpl();
+
+/**
+ * @brief 按 CPU 特性选择最快的实现原地去掩码（首次调用时检测一次）
+ */
+void applyWebSocketMask(uint8_t* data, std::size_t len, const uint8_t key[4], std::size_t phase = 0);
+
+} // namespace protocols
@@ -2,11 +2,14 @@
 #include "chatroom/chatroom_server.h"
 #include "chatroom_client.h"
 #include "utils/server_config.h"
+#include "http2/hpack.h"
+#include "http2/http2_session.h"
 #include <thread>
 #include <chrono>
 #include <vector>
 #include <filesystem>
 #include <atomic>
+#include <algorithm>
 #include <sys/socket.h>
 #include <arpa/inet.h>
 
@@ -339,3 +342,184 @@ TEST(IntegrationTest, PrometheusMetrics) {
         server_thread.join();
     }
 }
+
+// 流式导出测试：NDJSON + chunked 编码
+TEST(IntegrationTest, ExportMessagesStreaming) {
+    const int TEST_PORT = 18087;
+    ChatRoomServer server(TEST_PORT);
+    std::thread server_thread([&server]() { server.start(); });
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+
+    {
+        ChatRoomClient client("127.0.0.1", TEST_PORT);
+        client.registerUser("ExportUser", "exportpass");
+        client.login("ExportUser", "exportpass");
+        client.sendMessage("export line 1");
+        client.sendMessage("export line 2");
+    }
+
+    std::string req = "GET /messages/export?since=0 HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    std::string resp = SendRaw(TEST_PORT, req);
+
+    EXPECT_NE(resp.find("Transfer-Encoding: chunked"), std::string::npos);
+    EXPECT_NE(resp.find("Content-Type: application/x-ndjson"), std::string::npos);
+    EXPECT_EQ(resp.find("Content-Length:"), std::string::npos);
+    EXPECT_NE(resp.find("\"content\":\"export line 1\""), std::string::npos);
+    EXPECT_NE(resp.find("\"content\":\"export line 2\""), std::string::npos);
+    // Terminated by the last-chunk marker
+    ASSERT_GE(resp.size(), 5u);
+    EXPECT_EQ(resp.substr(resp.size() - 5), "0\r\n\r\n");
+
+    server.stop();
+    if (server_thread.joinable()) {
+        server_thread.join();
+    }
+}
+
+TEST(IntegrationTest, LongPollMessages) {
+    const int TEST_PORT = 18088;
+    ChatRoomServer server(TEST_PORT);
+    std::thread server_thread([&server]() { server.start(); });
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+
+    ChatRoomClient client("127.0.0.1", TEST_PORT);
+    client.registerUser("PollUser", "pollpass");
+    client.login("PollUser", "pollpass");
+    client.sendMessage("before poll");
+
+    // Start polling after the existing history so the request has to park
+    std::string latest = SendRaw(TEST_PORT, "GET /messages?since=0 HTTP/1.1\r\nHost: localhost\r\n\r\n");
+    auto pos = latest.find("\"next_since\":");
+    ASSERT_NE(pos, std::string::npos);
+    long long since = std::stoll(latest.substr(pos + 13));
+
+    std::thread sender([&client]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(300));
+        client.sendMessage("during poll");
+    });
+
+    auto start = std::chrono::steady_clock::now();
+    std::string resp = SendRaw(TEST_PORT, "GET /messages?since=" + std::to_string(since) +
+                                          "&wait=10 HTTP/1.1\r\nHost: localhost\r\n\r\n");
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    sender.join();
+
+    EXPECT_NE(resp.find("\"content\":\"during poll\""), std::string::npos);
+    EXPECT_EQ(resp.find("\"content\":\"before poll\""), std::string::npos);
+    // Answered on wake-up, well before the 10s wait expires (SendRaw adds a 2s read timeout)
+    EXPECT_LT(elapsed, std::chrono::seconds(5));
+
+    std::string metrics = SendRaw(TEST_PORT, "GET /metrics HTTP/1.1\r\nHost: localhost\r\n\r\n");
+    EXPECT_NE(metrics.find("chatroom_longpoll_woken_total 1"), std::string::npos);
+    EXPECT_NE(metrics.find("chatroom_longpoll_wake_latency_seconds_count 1"), std::string::npos);
+
+    server.stop();
+    if (server_thread.joinable()) {
+        server_thread.join();
+    }
+}
+
+TEST(IntegrationTest, EventStreamResumeAndLive) {
+    const int TEST_PORT = 18089;
+    ChatRoomServer server(TEST_PORT);
+    std::thread server_thread([&server]() { server.start(); });
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+
+    // The database file outlives test runs, so make this run's messages unique
+    std::string tag = std::to_string(std::chrono::steady_clock::now().time_since_epoch().count());
+    ChatRoomClient client("127.0.0.1", TEST_PORT);
+    client.registerUser("SseUser", "ssepass");
+    client.login("SseUser", "ssepass");
+    client.sendMessage("sse before " + tag);
+
+    std::thread publisher([&client, &tag, TEST_PORT]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(300));
+        ChatRoomClient other("127.0.0.1", TEST_PORT);
+        other.registerUser("SseOther", "ssepass");
+        other.login("SseOther", "ssepass");
+        client.sendMessage("sse live " + tag);
+    });
+
+    // The stream never ends; SendRaw returns after 2s without data
+    std::string resp = SendRaw(TEST_PORT, "GET /events HTTP/1.1\r\nHost: localhost\r\nLast-Event-ID: 0\r\n\r\n");
+    publisher.join();
+
+    EXPECT_NE(resp.find("Content-Type: text/event-stream"), std::string::npos);
+    EXPECT_EQ(resp.find("Content-Length:"), std::string::npos);
+    // Backlog from the database, then live events
+    auto before = resp.find("\"content\":\"sse before " + tag + "\"");
+    auto live = resp.find("\"content\":\"sse live " + tag + "\"");
+    EXPECT_NE(before, std::string::npos);
+    EXPECT_NE(live, std::string::npos);
+    EXPECT_LT(before, live);
+    EXPECT_NE(resp.find("event: presence\ndata: {\"status\":\"online\",\"username\":\"SseOther\"}"), std::string::npos);
+
+    server.stop();
+    if (server_thread.joinable()) {
+        server_thread.join();
+    }
+}
+
+// 明文 HTTP/2：先验知识与 Upgrade: h2c 两种建立方式共用同一套路由
+TEST(IntegrationTest, Http2Cleartext) {
+    const int TEST_PORT = 18090;
+    ChatRoomServer server(TEST_PORT);
+    std::thread server_thread([&server]() { server.start(); });
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+
+    auto frame = [](uint8_t type, uint8_t flags, uint32_t stream_id, const std::string& payload) {
+        std::string out;
+        out.push_back(static_cast<char>(payload.size() >> 16));
+        out.push_back(static_cast<char>(payload.size() >> 8));
+        out.push_back(static_cast<char>(payload.size()));
+        out.push_back(static_cast<char>(type));
+        out.push_back(static_cast<char>(flags));
+        for (int shift = 24; shift >= 0; shift -= 8) {
+            out.push_back(static_cast<char>(stream_id >> shift));
+        }
+        return out + payload;
+    };
+    std::string preface(protocols::Http2Session::kPreface);
+    std::string settings = frame(0x4, 0, 0, "");
+
+    // Prior knowledge: two multiplexed requests on one connection
+    protocols::HpackEncoder encoder;
+    std::string users_block;
+    encoder.encode({{":method", "GET"}, {":scheme", "http"}, {":path", "/users"}, {":authority", "localhost"}},
+                   users_block);
+    std::string missing_block;
+    encoder.encode({{":method", "GET"}, {":scheme", "http"}, {":path", "/no-such-route"}, {":authority", "localhost"}},
+                   missing_block);
+    std::string resp = SendRaw(TEST_PORT, preface + settings + frame(0x1, 0x5, 1, users_block) +
+                                          frame(0x1, 0x5, 3, missing_block));
+    EXPECT_NE(resp.find("\"success\":true"), std::string::npos);
+
+    protocols::HpackDecoder decoder;
+    std::vector<std::string> statuses;
+    for (std::size_t off = 0; off + 9 <= resp.size();) {
+        auto byte = [&](std::size_t i) { return static_cast<uint8_t>(resp[i]); };
+        std::size_t len = (byte(off) << 16) | (byte(off + 1) << 8) | byte(off + 2);
+        if (byte(off + 3) == 0x1) {
+            protocols::HpackHeaderList headers;
+            ASSERT_TRUE(decoder.decode(reinterpret_cast<const uint8_t*>(resp.data() + off + 9), len, headers));
+            statuses.push_back(byte(off + 8) == 1 ? "1:" + headers[0].value : "3:" + headers[0].value);
+        }
+        off += 9 + len;
+    }
+    std::sort(statuses.begin(), statuses.end());
+    EXPECT_EQ(statuses, (std::vector<std::string>{"1:200", "3:404"}));
+
+    // Upgrade: the HTTP/1.1 request becomes stream 1
+    std::string upgrade = SendRaw(TEST_PORT,
+                                  "GET /users HTTP/1.1\r\nHost: localhost\r\n"
+                                  "Connection: Upgrade, HTTP2-Settings\r\nUpgrade: h2c\r\n"
+                                  "HTTP2-Settings: AAMAAABkAAQAAP__\r\n\r\n" + preface + settings);
+    EXPECT_EQ(upgrade.rfind("HTTP/1.1 101 Switching Protocols\r\n", 0), 0u);
+    EXPECT_NE(upgrade.find("Upgrade: h2c"), std::string::npos);
+    EXPECT_NE(upgrade.find("\"success\":true"), std::string::npos);
+
+    server.stop();
+    if (server_thread.joinable()) {
+        server_thread.join();
+    }
+}